@@ -269,7 +269,7 @@ M3Result repl_call  (const char* name, int argc, const char* argv[])
             argv[0] = modname_from_fn(argv[0]);
         }
 
-        m3_wasi_context_t* wasi_ctx = m3_GetWasiContext();
+        m3_wasi_context_t* wasi_ctx = m3_GetWasiContext(runtime);
         wasi_ctx->argc = argc;
         wasi_ctx->argv = argv;
 
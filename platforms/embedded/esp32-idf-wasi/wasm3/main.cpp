@@ -51,7 +51,7 @@ static void run_wasm(void)
 
     const char* i_argv[2] = { "test.wasm", NULL };
 
-    m3_wasi_context_t* wasi_ctx = m3_GetWasiContext();
+    m3_wasi_context_t* wasi_ctx = m3_GetWasiContext(runtime);
     wasi_ctx->argc = 1;
     wasi_ctx->argv = i_argv;
 
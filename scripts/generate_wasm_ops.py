@@ -1,5 +1,6 @@
 import re
 import sys
+import argparse
 import os
 from pathlib import Path
 
@@ -13,7 +14,31 @@ def extract_index_if_exists(match_str):
         return int(index_match.group(1))
     return None
 
-def extract_op_names_and_modify(file_path):
+# Espande la lista di operazioni di una riga M3OP nei nomi delle funzioni op_*, per variante
+# (la posizione in M3OpInfo.operations)
+OP_LIST_VARIANTS = {
+    'd_unaryOpList':            ['{0}_{1}_r', '{0}_{1}_s'],
+    'd_binOpList':              ['{0}_{1}_rs', '{0}_{1}_sr', '{0}_{1}_ss'],
+    'd_commutativeBinOpList':   ['{0}_{1}_rs', None, '{0}_{1}_ss'],
+    'd_storeFpOpList':          ['{0}_{1}_rs', '{0}_{1}_sr', '{0}_{1}_ss', '{0}_{1}_rr'],
+    'd_convertOpList':          ['{0}_r_r', '{0}_r_s', '{0}_s_r', '{0}_s_s'],
+    'd_logOp':                  ['{0}'],
+    'd_logOp2':                 ['{0}', '{1}'],
+}
+
+def expand_op_list(line):
+    match = re.search(r'(d_\w+OpList|d_logOp2?)\s*\(([^)]*)\)', line)
+    if not match or match.group(1) not in OP_LIST_VARIANTS:
+        return []
+    args = [a.strip() for a in match.group(2).split(',')]
+    return [('op_' + v.format(*args)) if v else None for v in OP_LIST_VARIANTS[match.group(1)]]
+
+def expand_debug_op(op_name, typed):
+    if typed:
+        return [f'op_{op_name}_{t}' for t in ('i32', 'i64', 'f32', 'f64')]
+    return [f'op_{op_name}']
+
+def extract_op_names_and_modify(file_path, write_output=True):
     try:
         with open(file_path, 'r', encoding='utf-8') as file:
             lines = file.readlines()
@@ -64,7 +89,8 @@ def extract_op_names_and_modify(file_path):
                 m3op_match = re.search(r'(?:M3OP|M3OP_F)\s*\(\s*"([^"]+)"', line)
                 if m3op_match:
                     op_name = m3op_match.group(1)
-                    op_names[op_name] = {'index': current_index, 'enum_name': sanitize_name(op_name)}
+                    op_names[op_name] = {'index': current_index, 'enum_name': sanitize_name(op_name),
+                                         'ops': expand_op_list(line)}
                     
                     parts = line.split(',', 2)
                     if len(parts) >= 2:
@@ -97,7 +123,8 @@ def extract_op_names_and_modify(file_path):
                     else:
                         current_index += 1
                     
-                    op_names[op_name] = {'index': index, 'enum_name': sanitize_name(op_name)}
+                    op_names[op_name] = {'index': index, 'enum_name': sanitize_name(op_name),
+                                         'ops': expand_debug_op(op_name, 'TypedOp' in full_match)}
                     
                     start = match.start()
                     new_parts.append(line[last_end:start])
@@ -119,8 +146,9 @@ def extract_op_names_and_modify(file_path):
         # Salva il file modificato
         base_name, ext = os.path.splitext(file_path)
         output_path = f"{base_name}.modified{ext}"
-        with open(output_path, 'w', encoding='utf-8') as file:
-            file.writelines(modified_lines)
+        if write_output:
+            with open(output_path, 'w', encoding='utf-8') as file:
+                file.writelines(modified_lines)
         
         return op_names, output_path
         
@@ -164,18 +192,205 @@ def generate_header(op_names):
     
     return enum_text + array_text + getter_text
 
-def main():
-    file_path = 'source/operations_reference.h'
+###
+### Superinstruction dai profili (m3_WriteProfilerInfo)
+###
+
+# Famiglie di fusione supportate da Compile_FusedOperator: per ognuna, le istanze possibili
+# (stessi campi delle liste X di m3_fused_ops.h)
+FUSED_SETLOCAL = {
+    'i32.add':   (0x6a, 'i32', 'Add',        'M3_FUNC', 'OP_ADD_32'),
+    'i32.sub':   (0x6b, 'i32', 'Subtract',   'M3_FUNC', 'OP_SUB_32'),
+    'i32.mul':   (0x6c, 'i32', 'Multiply',   'M3_FUNC', 'OP_MUL_32'),
+    'i32.and':   (0x71, 'u32', 'And',        'M3_OPER', '&'),
+    'i32.or':    (0x72, 'u32', 'Or',         'M3_OPER', '|'),
+    'i32.xor':   (0x73, 'u32', 'Xor',        'M3_OPER', '^'),
+    'i32.shl':   (0x74, 'u32', 'ShiftLeft',  'M3_FUNC', 'OP_SHL_32'),
+    'i32.shr_s': (0x75, 'i32', 'ShiftRight', 'M3_FUNC', 'OP_SHR_32'),
+    'i32.shr_u': (0x76, 'u32', 'ShiftRight', 'M3_FUNC', 'OP_SHR_32'),
+    'i64.add':   (0x7c, 'i64', 'Add',        'M3_FUNC', 'OP_ADD_64'),
+    'i64.sub':   (0x7d, 'i64', 'Subtract',   'M3_FUNC', 'OP_SUB_64'),
+    'i64.mul':   (0x7e, 'i64', 'Multiply',   'M3_FUNC', 'OP_MUL_64'),
+    'i64.and':   (0x83, 'u64', 'And',        'M3_OPER', '&'),
+    'i64.or':    (0x84, 'u64', 'Or',         'M3_OPER', '|'),
+    'i64.xor':   (0x85, 'u64', 'Xor',        'M3_OPER', '^'),
+    'i64.shl':   (0x86, 'u64', 'ShiftLeft',  'M3_FUNC', 'OP_SHL_64'),
+    'i64.shr_s': (0x87, 'i64', 'ShiftRight', 'M3_FUNC', 'OP_SHR_64'),
+    'i64.shr_u': (0x88, 'u64', 'ShiftRight', 'M3_FUNC', 'OP_SHR_64'),
+}
+
+FUSED_BRANCHIF = {
+    'i32.eq':   (0x46, 'i32', 'Equal',              '=='),
+    'i32.ne':   (0x47, 'i32', 'NotEqual',           '!='),
+    'i32.lt_s': (0x48, 'i32', 'LessThan',           '< '),
+    'i32.lt_u': (0x49, 'u32', 'LessThan',           '< '),
+    'i32.gt_s': (0x4a, 'i32', 'GreaterThan',        '> '),
+    'i32.gt_u': (0x4b, 'u32', 'GreaterThan',        '> '),
+    'i32.le_s': (0x4c, 'i32', 'LessThanOrEqual',    '<='),
+    'i32.le_u': (0x4d, 'u32', 'LessThanOrEqual',    '<='),
+    'i32.ge_s': (0x4e, 'i32', 'GreaterThanOrEqual', '>='),
+    'i32.ge_u': (0x4f, 'u32', 'GreaterThanOrEqual', '>='),
+    'i64.eq':   (0x51, 'i64', 'Equal',              '=='),
+    'i64.ne':   (0x52, 'i64', 'NotEqual',           '!='),
+    'i64.lt_s': (0x53, 'i64', 'LessThan',           '< '),
+    'i64.lt_u': (0x54, 'u64', 'LessThan',           '< '),
+    'i64.gt_s': (0x55, 'i64', 'GreaterThan',        '> '),
+    'i64.gt_u': (0x56, 'u64', 'GreaterThan',        '> '),
+    'i64.le_s': (0x57, 'i64', 'LessThanOrEqual',    '<='),
+    'i64.le_u': (0x58, 'u64', 'LessThanOrEqual',    '<='),
+    'i64.ge_s': (0x59, 'i64', 'GreaterThanOrEqual', '>='),
+    'i64.ge_u': (0x5a, 'u64', 'GreaterThanOrEqual', '>='),
+}
+
+FUSED_ADDLOAD = {
+    'i32.load':     (0x28, 'i32', 'i32'),
+    'i64.load':     (0x29, 'i64', 'i64'),
+    'i32.load8_s':  (0x2c, 'i32', 'i8'),
+    'i32.load8_u':  (0x2d, 'i32', 'u8'),
+    'i32.load16_s': (0x2e, 'i32', 'i16'),
+    'i32.load16_u': (0x2f, 'i32', 'u16'),
+    'i64.load8_s':  (0x30, 'i64', 'i8'),
+    'i64.load8_u':  (0x31, 'i64', 'u8'),
+    'i64.load16_s': (0x32, 'i64', 'i16'),
+    'i64.load16_u': (0x33, 'i64', 'u16'),
+    'i64.load32_s': (0x34, 'i64', 'i32'),
+    'i64.load32_u': (0x35, 'i64', 'u32'),
+}
+
+# Op che non proseguono con nextOp: una sequenza che le contiene prima dell'ultima posizione
+# non e' codice contiguo (il profiler non vede i salti)
+CONTROL_OPS = {
+    'unreachable', 'loop', 'br', 'br_if', 'br_table', 'return', 'call', 'call_indirect',
+    'Compile', 'Entry', 'End', 'Unsupported', 'CallRawFunction', 'ContinueLoop', 'ContinueLoopIf',
+    'If_s', 'If_r', 'BranchIfPrologue_s', 'BranchIfPrologue_r',
+}
+
+VARIANT_SS = 2      # _ss nelle liste d_binOpList / d_commutativeBinOpList
+VARIANT_R = 0       # _r nelle liste d_unaryOpList
+
+def read_ngram_profile(profile_path, op_names):
+    by_index = {info['index']: (name, info) for name, info in op_names.items()}
+    sequences = []
 
-    if len(sys.argv) > 1:
-        file_path = sys.argv[1]
+    with open(profile_path, 'r', encoding='utf-8') as file:
+        for line in file:
+            line = line.split('#', 1)[0].split()
+            if len(line) < 3:
+                continue
+
+            hits, length, tokens = int(line[0]), int(line[1]), line[2:2 + int(line[1])]
+            ops = []
+            for token in tokens:
+                if token == '?':
+                    ops.append(None)
+                    continue
+                index, variant = (int(x) for x in token.split(':'))
+                name, info = by_index.get(index, (None, None))
+                if name is None or variant >= len(info['ops']):
+                    ops.append(None)
+                else:
+                    ops.append((name, variant, info['ops'][variant]))
+
+            sequences.append((hits, ops))
+
+    return sequences
+
+def is_straight_line(ops):
+    if any(op is None for op in ops):
+        return False
+    return not any(op[0] in CONTROL_OPS for op in ops[:-1])
+
+def match_fusion_family(ops):
+    if len(ops) != 2:
+        return None
+
+    (first, first_variant, _), (second, second_variant, _) = ops
+
+    if first in FUSED_SETLOCAL and first_variant == VARIANT_SS and second in ('SetSlot', 'PreserveSetSlot'):
+        return ('setlocal', first)
+    if first in FUSED_BRANCHIF and first_variant == VARIANT_SS and \
+       ((second == 'br_if' and second_variant == 0) or second == 'ContinueLoopIf'):
+        return ('branchif', first)
+    if first == 'i32.add' and first_variant == VARIANT_SS and second in FUSED_ADDLOAD and second_variant == VARIANT_R:
+        return ('addload', second)
+    return None
 
-    file_path = Path(file_path)
+def generate_fused_ops(sequences, top, profile_path):
+    family_hits = {}
+    unsupported = []
+
+    for hits, ops in sequences:
+        if not is_straight_line(ops):
+            continue
+        family = match_fusion_family(ops)
+        if family:
+            family_hits[family] = family_hits.get(family, 0) + hits
+        elif len(ops) >= 2:
+            unsupported.append((hits, ops))
+
+    chosen = sorted(family_hits.items(), key=lambda x: -x[1])[:top]
+    chosen_keys = {key for key, _ in chosen}
+
+    def x_list(macro, kind, table):
+        text = f"#define {macro}(X)"
+        for name, entry in sorted(table.items(), key=lambda x: x[1][0]):
+            if (kind, name) in chosen_keys:
+                args = ', '.join([f'0x{entry[0]:02x}'] + [str(e).strip() for e in entry[1:]])
+                text += f" \\\n    X ({args})"
+        return text + "\n\n"
+
+    text = "// Auto-generated by scripts/generate_wasm_ops.py --ngrams: do not edit\n"
+    text += f"// profile: {Path(profile_path).name}, top {top} fused sequences\n"
+    text += "#pragma once\n\n"
+
+    for (kind, name), hits in chosen:
+        text += f"// {hits:>13}  {kind:<9} {name}\n"
+    text += "\n"
+
+    text += "// binop ; local.set                X (opcode, TYPE, NAME, MACRO, OP)\n"
+    text += x_list('M3_FUSED_SETLOCAL_OPS', 'setlocal', FUSED_SETLOCAL)
+    text += "// compare ; br_if                  X (opcode, TYPE, NAME, OP)\n"
+    text += x_list('M3_FUSED_BRANCHIF_OPS', 'branchif', FUSED_BRANCHIF)
+    text += "// i32.add ; load                   X (opcode, DEST_TYPE, SRC_TYPE)\n"
+    text += x_list('M3_FUSED_ADDLOAD_OPS', 'addload', FUSED_ADDLOAD)
+
+    # Le sequenze frequenti senza una famiglia di fusione restano da valutare a mano
+    text += "// Frequent sequences without a fusion family:\n"
+    for hits, ops in sorted(unsupported, key=lambda x: -x[0])[:top]:
+        text += f"// {hits:>13}  " + ' ; '.join(op[2] or op[0] for op in ops) + "\n"
+
+    return text, len(chosen)
+
+def main():
+    parser = argparse.ArgumentParser(description='Genera indici e nomi delle operazioni wasm3')
+    parser.add_argument('file_path', nargs='?', default='source/operations_reference.h')
+    parser.add_argument('--ngrams', help='profilo n-gram scritto da m3_WriteProfilerInfo')
+    parser.add_argument('--top', type=int, default=16, help='numero di sequenze fuse da generare')
+    parser.add_argument('--out', help='header generato (default: m3_fused_ops_generated.h accanto al file di riferimento)')
+    args = parser.parse_args()
+
+    file_path = Path(args.file_path)
     
     if not file_path.exists():
         print(f"File not found: {file_path}")
         sys.exit(1)
     
+    if args.ngrams:
+        op_names, _ = extract_op_names_and_modify(file_path, write_output=False)
+        if not op_names:
+            sys.exit(1)
+
+        sequences = read_ngram_profile(args.ngrams, op_names)
+        output, count = generate_fused_ops(sequences, args.top, args.ngrams)
+        out_path = Path(args.out) if args.out else file_path.parent / "m3_fused_ops_generated.h"
+
+        with open(out_path, 'w') as f:
+            f.write(output)
+
+        print(f"File header generato: {out_path}")
+        print(f"Sequenze fuse: {count} (profilo: {len(sequences)} sequenze)")
+        return
+
     try:
         # Estrae i nomi delle operazioni e modifica il file
         op_names, modified_path = extract_op_names_and_modify(file_path)
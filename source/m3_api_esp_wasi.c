@@ -8,6 +8,7 @@
 #define _POSIX_C_SOURCE 200809L
 
 #include "m3_api_esp_wasi.h"
+#include "m3_core.h"
 
 #include "extra/wasi_core.h"
 
@@ -25,8 +26,8 @@ typedef uint32_t __wasi_size_t;
 #include <stdio.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/uio.h>
 
-static m3_wasi_context_t* wasi_context;
 
 typedef struct wasi_iovec_t
 {
@@ -358,25 +359,46 @@ m3ApiRawFunction(m3_wasi_generic_fd_read)
 {
     m3ApiReturnType  (uint32_t)
     m3ApiGetArg      (__wasi_fd_t          , fd)
-    m3ApiGetArgMem   (wasi_iovec_t *       , wasi_iovs)
+    m3ApiGetArg      (mos                  , wasi_iovs)     // translated segment by segment
     m3ApiGetArg      (__wasi_size_t        , iovs_len)
-    m3ApiGetArgMem   (__wasi_size_t *      , nread)
+    m3ApiGetArg      (mos                  , nread)         // resolved after the I/O, which may move it
 
     m3ApiCheckMem(wasi_iovs,    iovs_len * sizeof(wasi_iovec_t));
     m3ApiCheckMem(nread,        sizeof(__wasi_size_t));
 
+    M3Result mem_check = m3_CheckIovecs(_mem, wasi_iovs, iovs_len);
+    if (mem_check != m3Err_none) {
+        return mem_check;
+    }
+
+    M3IovCursor cursor = { .iovs = wasi_iovs, .count = iovs_len };
+    struct iovec iovs[M3_HOST_IOV_MAX];
     ssize_t res = 0;
-    for (__wasi_size_t i = 0; i < iovs_len; i++) {
-        void* addr = m3ApiOffsetToPtr(m3ApiReadMem32(&wasi_iovs[i].buf));
-        size_t len = m3ApiReadMem32(&wasi_iovs[i].buf_len);
-        if (len == 0) continue;
 
-        int ret = read (fd, addr, len);
-        if (ret < 0) m3ApiReturn(errno_to_wasi(errno));
+    // One syscall per batch of M3_HOST_IOV_MAX host iovecs (usually just one)
+    while (cursor.index < cursor.count)
+    {
+        int count; size_t total;
+        mem_check = m3_FillIovecs(_mem, &cursor, iovs, &count, &total);
+
+        ssize_t ret = 0;
+        int err = 0;
+        if (mem_check == m3Err_none && count > 0) {
+            ret = readv(fd, iovs, count);
+            err = errno;
+        }
+        m3_ReleaseIovecs(_mem, &cursor);
+
+        if (mem_check != m3Err_none) {
+            return mem_check;
+        }
+        if (count == 0) break;
+
+        if (ret < 0) { m3ApiReturn(errno_to_wasi(err)); }
         res += ret;
-        if ((size_t)ret < len) break;
+        if ((size_t)ret < total) break;
     }
-    m3ApiWriteMem32(nread, res);
+    m3ApiWriteMem32(m3SegmentedMemAccess(_mem, (m3stack_t)(uintptr_t)nread, sizeof(__wasi_size_t)), res);
     m3ApiReturn(__WASI_ERRNO_SUCCESS);
 }
 
@@ -384,25 +406,46 @@ m3ApiRawFunction(m3_wasi_generic_fd_write)
 {
     m3ApiReturnType  (uint32_t)
     m3ApiGetArg      (__wasi_fd_t          , fd)
-    m3ApiGetArgMem   (wasi_iovec_t *       , wasi_iovs)
+    m3ApiGetArg      (mos                  , wasi_iovs)     // translated segment by segment
     m3ApiGetArg      (__wasi_size_t        , iovs_len)
-    m3ApiGetArgMem   (__wasi_size_t *      , nwritten)
+    m3ApiGetArg      (mos                  , nwritten)      // resolved after the I/O, which may move it
 
     m3ApiCheckMem(wasi_iovs,    iovs_len * sizeof(wasi_iovec_t));
     m3ApiCheckMem(nwritten,     sizeof(__wasi_size_t));
 
+    M3Result mem_check = m3_CheckIovecs(_mem, wasi_iovs, iovs_len);
+    if (mem_check != m3Err_none) {
+        return mem_check;
+    }
+
+    M3IovCursor cursor = { .iovs = wasi_iovs, .count = iovs_len };
+    struct iovec iovs[M3_HOST_IOV_MAX];
     ssize_t res = 0;
-    for (__wasi_size_t i = 0; i < iovs_len; i++) {
-        void* addr = m3ApiOffsetToPtr(m3ApiReadMem32(&wasi_iovs[i].buf));
-        size_t len = m3ApiReadMem32(&wasi_iovs[i].buf_len);
-        if (len == 0) continue;
 
-        int ret = write (fd, addr, len);
-        if (ret < 0) m3ApiReturn(errno_to_wasi(errno));
+    // One syscall per batch of M3_HOST_IOV_MAX host iovecs (usually just one)
+    while (cursor.index < cursor.count)
+    {
+        int count; size_t total;
+        mem_check = m3_FillIovecs(_mem, &cursor, iovs, &count, &total);
+
+        ssize_t ret = 0;
+        int err = 0;
+        if (mem_check == m3Err_none && count > 0) {
+            ret = writev(fd, iovs, count);
+            err = errno;
+        }
+        m3_ReleaseIovecs(_mem, &cursor);
+
+        if (mem_check != m3Err_none) {
+            return mem_check;
+        }
+        if (count == 0) break;
+
+        if (ret < 0) { m3ApiReturn(errno_to_wasi(err)); }
         res += ret;
-        if ((size_t)ret < len) break;
+        if ((size_t)ret < total) break;
     }
-    m3ApiWriteMem32(nwritten, res);
+    m3ApiWriteMem32(m3SegmentedMemAccess(_mem, (m3stack_t)(uintptr_t)nwritten, sizeof(__wasi_size_t)), res);
     m3ApiReturn(__WASI_ERRNO_SUCCESS);
 }
 
@@ -530,9 +573,10 @@ M3Result SuppressLookupFailure(M3Result i_result)
         return i_result;
 }
 
-m3_wasi_context_t* m3_GetWasiContext()
+m3_wasi_context_t* m3_GetWasiContext(IM3Runtime i_runtime)
 {
-    return wasi_context;
+    void ** contextSlot = GetRuntimeWasiContext (i_runtime);
+    return contextSlot ? (m3_wasi_context_t*) * contextSlot : NULL;
 }
 
 
@@ -542,11 +586,17 @@ M3Result  m3_LinkEspWASI  (IM3Module module)
 
     // TODO: Preopen dirs
 
+    void ** contextSlot = GetRuntimeWasiContext (m3_GetModuleRuntime (module));
+    _throwif (m3Err_nullRuntime, !contextSlot);
+
+    m3_wasi_context_t* wasi_context = (m3_wasi_context_t*) * contextSlot;
     if (!wasi_context) {
         wasi_context = (m3_wasi_context_t*)malloc(sizeof(m3_wasi_context_t));
+        _throwifnull (wasi_context);
         wasi_context->exit_code = 0;
         wasi_context->argc = 0;
         wasi_context->argv = 0;
+        * contextSlot = wasi_context;
     }
 
     static const char* namespaces[2] = { "wasi_unstable", "wasi_snapshot_preview1" };
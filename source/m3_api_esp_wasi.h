@@ -41,6 +41,6 @@ M3Result    m3_LinkEspWASI     (IM3Module io_module);
 M3Result m3_LinkEspWASI_Hello(IM3Module module, shell_t *shell, m3_wasi_context_t** ctx);
 #endif
 
-m3_wasi_context_t* m3_GetWasiContext();
+m3_wasi_context_t* m3_GetWasiContext(IM3Runtime i_runtime);
 
 d_m3EndExternC
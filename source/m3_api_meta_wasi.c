@@ -31,7 +31,6 @@
 # error "Missing WASI headers"
 #endif
 
-static m3_wasi_context_t* wasi_context;
 
 typedef size_t __wasi_size_t;
 
@@ -1011,9 +1010,10 @@ M3Result SuppressLookupFailure(M3Result i_result)
         return i_result;
 }
 
-m3_wasi_context_t* m3_GetWasiContext()
+m3_wasi_context_t* m3_GetWasiContext(IM3Runtime i_runtime)
 {
-    return wasi_context;
+    void ** contextSlot = GetRuntimeWasiContext (i_runtime);
+    return contextSlot ? (m3_wasi_context_t*) * contextSlot : NULL;
 }
 
 
@@ -1021,11 +1021,17 @@ M3Result  m3_LinkWASI  (IM3Module module)
 {
     M3Result result = m3Err_none;
 
+    void ** contextSlot = GetRuntimeWasiContext (m3_GetModuleRuntime (module));
+    _throwif (m3Err_nullRuntime, !contextSlot);
+
+    m3_wasi_context_t* wasi_context = (m3_wasi_context_t*) * contextSlot;
     if (!wasi_context) {
         wasi_context = (m3_wasi_context_t*)malloc(sizeof(m3_wasi_context_t));
+        _throwifnull (wasi_context);
         wasi_context->exit_code = 0;
         wasi_context->argc = 0;
         wasi_context->argv = 0;
+        * contextSlot = wasi_context;
     }
 
     static const char* namespaces[2] = { "wasi_unstable", "wasi_snapshot_preview1" };
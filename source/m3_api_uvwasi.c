@@ -24,8 +24,8 @@
 extern char** environ;
 #endif
 
-static m3_wasi_context_t* wasi_context;
-static uvwasi_t uvwasi;
+static uvwasi_t uvwasi;                 // one per process, like the host file system it maps: set up by the first link
+static bool uvwasi_ready;
 
 typedef struct wasi_iovec_t
 {
@@ -1093,9 +1093,10 @@ M3Result SuppressLookupFailure(M3Result i_result)
         return i_result;
 }
 
-m3_wasi_context_t* m3_GetWasiContext()
+m3_wasi_context_t* m3_GetWasiContext(IM3Runtime i_runtime)
 {
-    return wasi_context;
+    void ** contextSlot = GetRuntimeWasiContext (i_runtime);
+    return contextSlot ? (m3_wasi_context_t*) * contextSlot : NULL;
 }
 
 
@@ -1136,17 +1137,27 @@ M3Result  m3_LinkWASIWithOptions  (IM3Module module, uvwasi_options_t init_optio
 {
     M3Result result = m3Err_none;
 
+    void ** contextSlot = GetRuntimeWasiContext (m3_GetModuleRuntime (module));
+    _throwif (m3Err_nullRuntime, !contextSlot);
+
+    m3_wasi_context_t* wasi_context = (m3_wasi_context_t*) * contextSlot;
     if (!wasi_context) {
         wasi_context = (m3_wasi_context_t*)malloc(sizeof(m3_wasi_context_t));
+        _throwifnull (wasi_context);
         wasi_context->exit_code = 0;
         wasi_context->argc = 0;
         wasi_context->argv = 0;
+        * contextSlot = wasi_context;
+    }
 
+    if (!uvwasi_ready) {
         uvwasi_errno_t ret = uvwasi_init(&uvwasi, &init_options);
 
         if (ret != UVWASI_ESUCCESS) {
             return "uvwasi_init failed";
         }
+
+        uvwasi_ready = true;
     }
 
     static const char* namespaces[2] = { "wasi_unstable", "wasi_snapshot_preview1" };
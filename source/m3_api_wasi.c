@@ -59,7 +59,6 @@
 #  define close _close
 #endif
 
-static m3_wasi_context_t* wasi_context;
 
 typedef struct wasi_iovec_t
 {
@@ -183,22 +182,6 @@ __wasi_timestamp_t convert_timespec(const struct timespec *ts) {
     return (__wasi_timestamp_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
 }
 
-#if defined(HAS_IOVEC)
-
-static inline
-const void* copy_iov_to_host(IM3Runtime runtime, void* _mem, struct iovec* host_iov, wasi_iovec_t* wasi_iov, int32_t iovs_len)
-{
-    // Convert wasi memory offsets to host addresses
-    for (int i = 0; i < iovs_len; i++) {
-        host_iov[i].iov_base = m3ApiOffsetToPtr(m3ApiReadMem32(&wasi_iov[i].buf));
-        host_iov[i].iov_len  = m3ApiReadMem32(&wasi_iov[i].buf_len);
-        m3ApiCheckMem(host_iov[i].iov_base,     host_iov[i].iov_len);
-    }
-    m3ApiSuccess();
-}
-
-#endif
-
 /*
  * WASI API implementation
  */
@@ -566,23 +549,55 @@ m3ApiRawFunction(m3_wasi_generic_fd_read)
 {
     m3ApiReturnType  (uint32_t)
     m3ApiGetArg      (__wasi_fd_t          , fd)
+#if defined(HAS_IOVEC)
+    m3ApiGetArg      (mos                  , wasi_iovs)     // translated segment by segment
+#else
     m3ApiGetArgMem   (wasi_iovec_t *       , wasi_iovs)
+#endif
     m3ApiGetArg      (__wasi_size_t        , iovs_len)
+#if defined(HAS_IOVEC)
+    m3ApiGetArg      (mos                  , nread)         // resolved after the I/O, which may move it
+#else
     m3ApiGetArgMem   (__wasi_size_t *      , nread)
+#endif
 
     m3ApiCheckMem(wasi_iovs,    iovs_len * sizeof(wasi_iovec_t));
     m3ApiCheckMem(nread,        sizeof(__wasi_size_t));
 
 #if defined(HAS_IOVEC)
-    struct iovec iovs[iovs_len];
-    const void* mem_check = copy_iov_to_host(runtime, _mem, iovs, wasi_iovs, iovs_len);
+    M3Result mem_check = m3_CheckIovecs(_mem, wasi_iovs, iovs_len);
     if (mem_check != m3Err_none) {
         return mem_check;
     }
 
-    ssize_t ret = readv(fd, iovs, iovs_len);
-    if (ret < 0) { m3ApiReturn(errno_to_wasi(errno)); }
-    m3ApiWriteMem32(nread, ret);
+    M3IovCursor cursor = { .iovs = wasi_iovs, .count = iovs_len };
+    struct iovec iovs[M3_HOST_IOV_MAX];
+    ssize_t res = 0;
+
+    // One syscall per batch of M3_HOST_IOV_MAX host iovecs (usually just one)
+    while (cursor.index < cursor.count)
+    {
+        int count; size_t total;
+        mem_check = m3_FillIovecs(_mem, &cursor, iovs, &count, &total);
+
+        ssize_t ret = 0;
+        int err = 0;
+        if (mem_check == m3Err_none && count > 0) {
+            ret = readv(fd, iovs, count);
+            err = errno;
+        }
+        m3_ReleaseIovecs(_mem, &cursor);
+
+        if (mem_check != m3Err_none) {
+            return mem_check;
+        }
+        if (count == 0) break;
+
+        if (ret < 0) { m3ApiReturn(errno_to_wasi(err)); }
+        res += ret;
+        if ((size_t)ret < total) break;
+    }
+    m3ApiWriteMem32(m3SegmentedMemAccess(_mem, (m3stack_t)(uintptr_t)nread, sizeof(__wasi_size_t)), res);
     m3ApiReturn(__WASI_ERRNO_SUCCESS);
 #else
     ssize_t res = 0;
@@ -605,23 +620,55 @@ m3ApiRawFunction(m3_wasi_generic_fd_write)
 {
     m3ApiReturnType  (uint32_t)
     m3ApiGetArg      (__wasi_fd_t          , fd)
+#if defined(HAS_IOVEC)
+    m3ApiGetArg      (mos                  , wasi_iovs)     // translated segment by segment
+#else
     m3ApiGetArgMem   (wasi_iovec_t *       , wasi_iovs)
+#endif
     m3ApiGetArg      (__wasi_size_t        , iovs_len)
+#if defined(HAS_IOVEC)
+    m3ApiGetArg      (mos                  , nwritten)      // resolved after the I/O, which may move it
+#else
     m3ApiGetArgMem   (__wasi_size_t *      , nwritten)
+#endif
 
     m3ApiCheckMem(wasi_iovs,    iovs_len * sizeof(wasi_iovec_t));
     m3ApiCheckMem(nwritten,     sizeof(__wasi_size_t));
 
 #if defined(HAS_IOVEC)
-    struct iovec iovs[iovs_len];
-    const void* mem_check = copy_iov_to_host(runtime, _mem, iovs, wasi_iovs, iovs_len);
+    M3Result mem_check = m3_CheckIovecs(_mem, wasi_iovs, iovs_len);
     if (mem_check != m3Err_none) {
         return mem_check;
     }
 
-    ssize_t ret = writev(fd, iovs, iovs_len);
-    if (ret < 0) { m3ApiReturn(errno_to_wasi(errno)); }
-    m3ApiWriteMem32(nwritten, ret);
+    M3IovCursor cursor = { .iovs = wasi_iovs, .count = iovs_len };
+    struct iovec iovs[M3_HOST_IOV_MAX];
+    ssize_t res = 0;
+
+    // One syscall per batch of M3_HOST_IOV_MAX host iovecs (usually just one)
+    while (cursor.index < cursor.count)
+    {
+        int count; size_t total;
+        mem_check = m3_FillIovecs(_mem, &cursor, iovs, &count, &total);
+
+        ssize_t ret = 0;
+        int err = 0;
+        if (mem_check == m3Err_none && count > 0) {
+            ret = writev(fd, iovs, count);
+            err = errno;
+        }
+        m3_ReleaseIovecs(_mem, &cursor);
+
+        if (mem_check != m3Err_none) {
+            return mem_check;
+        }
+        if (count == 0) break;
+
+        if (ret < 0) { m3ApiReturn(errno_to_wasi(err)); }
+        res += ret;
+        if ((size_t)ret < total) break;
+    }
+    m3ApiWriteMem32(m3SegmentedMemAccess(_mem, (m3stack_t)(uintptr_t)nwritten, sizeof(__wasi_size_t)), res);
     m3ApiReturn(__WASI_ERRNO_SUCCESS);
 #else
     ssize_t res = 0;
@@ -772,9 +819,10 @@ M3Result SuppressLookupFailure(M3Result i_result)
         return i_result;
 }
 
-m3_wasi_context_t* m3_GetWasiContext()
+m3_wasi_context_t* m3_GetWasiContext(IM3Runtime i_runtime)
 {
-    return wasi_context;
+    void ** contextSlot = GetRuntimeWasiContext (i_runtime);
+    return contextSlot ? (m3_wasi_context_t*) * contextSlot : NULL;
 }
 
 
@@ -794,11 +842,18 @@ M3Result  m3_LinkWASI  (IM3Module module)
     }
 #endif
 
+    void ** contextSlot = GetRuntimeWasiContext (m3_GetModuleRuntime (module));
+    _throwif (m3Err_nullRuntime, !contextSlot);
+
+    // per runtime, not static: guests running on different threads each have their args and exit code
+    m3_wasi_context_t* wasi_context = (m3_wasi_context_t*) * contextSlot;
     if (!wasi_context) {
         wasi_context = (m3_wasi_context_t*)malloc(sizeof(m3_wasi_context_t));
+        _throwifnull (wasi_context);
         wasi_context->exit_code = 0;
         wasi_context->argc = 0;
         wasi_context->argv = 0;
+        * contextSlot = wasi_context;
     }
 
     static const char* namespaces[2] = { "wasi_unstable", "wasi_snapshot_preview1" };
@@ -31,7 +31,8 @@ M3Result    m3_LinkWASIWithOptions  (IM3Module io_module, uvwasi_options_t uvwas
 
 #endif
 
-m3_wasi_context_t* m3_GetWasiContext();
+// the context m3_LinkWASI made for the runtime, NULL before
+m3_wasi_context_t* m3_GetWasiContext(IM3Runtime i_runtime);
 
 d_m3EndExternC
 
@@ -11,7 +11,7 @@
 
 d_m3BeginExternC
 
-typedef struct M3CodePage;
+struct M3CodePage;
 struct M3CodeMappingPage;
 typedef struct M3CodePageHeader
 {
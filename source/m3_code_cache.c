@@ -0,0 +1,918 @@
+//
+//  m3_code_cache.c
+//
+//  Persistent cache of compiled code, see m3_code_cache.h.
+//
+//  File: header, one M3CodeCacheFunction per cached function, then for each of them its
+//  constants, its relocations and its code lines (relocated lines are written as 0).
+//  The file is native (endianness, word size) and only valid for builds like the one that
+//  wrote it: the key mixes the wasm bytes with the operation table, the build configuration
+//  and d_m3CodeCacheBuildTag.
+//
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "m3_code_cache.h"
+#include "m3_env.h"
+#include "wasm3.h"
+
+# if d_m3EnableCodeCache
+
+DEBUG_TYPE WASM_DEBUG_CODE_CACHE = WASM_DEBUG_ALL || (WASM_DEBUG && false);
+
+#define c_m3CodeCacheMagic              0x6363336d      // "m3cc"
+#define c_m3CodeCacheVersion            1
+
+//---------------------------------------------------------------------------------------------------------------------------------
+//  layout, recorded while compiling
+//---------------------------------------------------------------------------------------------------------------------------------
+
+IM3CodeLayout  NewCodeLayout  (void)
+{
+    IM3CodeLayout layout = m3_Def_AllocStruct (M3CodeLayout);
+
+    if (layout)
+        memset (layout, 0x0, sizeof (M3CodeLayout));
+
+    return layout;
+}
+
+
+void  FreeCodeLayout  (IM3CodeLayout i_layout)
+{
+    if (i_layout)
+    {
+        m3_Def_Free (i_layout->segments);
+        m3_Def_Free (i_layout->relocs);
+        m3_Def_Free (i_layout);
+    }
+}
+
+
+static void  CloseSegment  (IM3CodeLayout io_layout)
+{
+    if (io_layout->page)
+    {
+        M3CodeSegment * segment = & io_layout->segments [io_layout->numSegments - 1];
+
+        segment->numLines = (u32) (GetPagePC (io_layout->page) - segment->start);
+        io_layout->numLines += segment->numLines + c_m3SegmentBridgeLines;
+
+        io_layout->page = NULL;
+    }
+}
+
+
+static bool  AddReloc  (IM3CodeLayout io_layout, u32 i_line, u32 i_kind)
+{
+    // grows in steps of 64
+    if ((io_layout->numRelocs & 63) == 0)
+    {
+        u32 * relocs = m3_Def_ReallocArray (u32, io_layout->relocs, io_layout->numRelocs + 64);
+        if (not relocs)
+            return false;
+
+        io_layout->relocs = relocs;
+    }
+
+    io_layout->relocs [io_layout->numRelocs++] = (i_line << 1) | i_kind;
+    return true;
+}
+
+
+void  CodeLayout_AddWord  (IM3CodeLayout io_layout, IM3CodePage i_page, pc_t i_pc, u32 i_kind)
+{
+    if (io_layout->incomplete)
+        return;
+
+    // the compiler moved to another page (bridge, else block, br_table stub): a new segment starts here.
+    // the previous page wasn't written to since, so its current end is where the segment ends
+    if (i_page != io_layout->page)
+    {
+        CloseSegment (io_layout);
+
+        M3CodeSegment * segments = m3_Def_ReallocArray (M3CodeSegment, io_layout->segments, io_layout->numSegments + 1);
+        if (not segments)
+            goto incomplete;
+
+        io_layout->segments = segments;
+        segments [io_layout->numSegments++] = (M3CodeSegment) { .start = i_pc, .numLines = 0, .line = io_layout->numLines };
+        io_layout->page = i_page;
+
+        // back on a page the function left earlier (after an else block or a br_table stub): the
+        // segment that ended here falls through into this one, its bridge branches here. the bridge's
+        // relocs are added when the cache is written, so these stay in line order
+        for (u32 i = 0; i < io_layout->numSegments - 1; ++i)
+        {
+            M3CodeSegment * previous = & segments [i];
+
+            if (previous->start + previous->numLines == i_pc and not previous->next)
+            {
+                previous->next = i_pc;
+                break;
+            }
+        }
+    }
+
+    {
+        M3CodeSegment * segment = & io_layout->segments [io_layout->numSegments - 1];
+        u32 line = io_layout->numLines + (u32) (i_pc - segment->start);
+
+        if (not AddReloc (io_layout, line, i_kind))
+            goto incomplete;
+    }
+    return;
+
+incomplete:
+    ESP_LOGW ("WASM3", "code cache: out of memory recording a function layout, it won't be cached");
+    io_layout->incomplete = true;
+}
+
+
+void  CodeLayout_Rewind  (IM3CodeLayout io_layout, IM3CodePage i_page, pc_t i_pc)
+{
+    if (io_layout->incomplete or i_page != io_layout->page)
+        return;
+
+    M3CodeSegment * segment = & io_layout->segments [io_layout->numSegments - 1];
+    u32 line = io_layout->numLines + (u32) (i_pc - segment->start);
+
+    while (io_layout->numRelocs and (io_layout->relocs [io_layout->numRelocs - 1] >> 1) >= line)
+        io_layout->numRelocs--;
+}
+
+
+void  CodeLayout_Close  (IM3CodeLayout io_layout)
+{
+    CloseSegment (io_layout);
+}
+
+//---------------------------------------------------------------------------------------------------------------------------------
+//  file format
+//---------------------------------------------------------------------------------------------------------------------------------
+
+typedef struct M3CodeCacheHeader
+{
+    u32                     magic;
+    u32                     version;
+    u64                     buildHash;
+    u64                     moduleHash;
+    u32                     numFunctions;
+    u32                     reserved;
+}
+M3CodeCacheHeader;
+
+typedef struct M3CodeCacheFunction
+{
+    u32                     index;              // in module->functions
+    u32                     numLines;
+    u32                     numRelocs;
+
+    u16                     maxStackSlots;
+    u16                     numRetSlots;
+    u16                     numRetAndArgSlots;
+    u16                     numLocalBytes;
+    u16                     numConstantBytes;
+    u16                     reserved;
+}
+M3CodeCacheFunction;
+
+enum
+{
+    c_m3CacheRelocOperation,            // index: in the operation table
+    c_m3CacheRelocNull,
+    c_m3CacheRelocModule,
+    c_m3CacheRelocFuncType,             // index: in module->funcTypes
+    c_m3CacheRelocGlobal,               // index: in module->globals (its value)
+    c_m3CacheRelocFunction,             // index: in module->functions (the M3Function)
+    c_m3CacheRelocFunctionEntry,        // index: function not in the cache (an import): its 'compiled' at load time
+    c_m3CacheRelocCode                  // index: cached function; offset: line in its code
+};
+
+typedef struct M3CodeCacheReloc
+{
+    u32                     line;
+    u8                      kind;
+    u8                      reserved [3];
+    u32                     index;
+    u32                     offset;
+}
+M3CodeCacheReloc;
+
+
+u64  HashBytes  (u64 io_hash, const void * i_bytes, size_t i_size)
+{
+    const u8 * bytes = (const u8 *) i_bytes;
+
+    for (size_t i = 0; i < i_size; ++i)
+    {
+        io_hash ^= bytes [i];
+        io_hash *= 0x100000001b3ULL;                                    // FNV-1a
+    }
+
+    return io_hash;
+}
+
+#define HashValue(HASH, VALUE)          do { u64 v = (u64) (VALUE); HASH = HashBytes (HASH, & v, sizeof (v)); } while (0)
+
+static u64  GetBuildHash  (void)
+{
+    u64 hash = c_m3HashSeed;
+
+    HashValue (hash, c_m3CodeCacheVersion);
+    HashValue (hash, sizeof (code_t));
+    HashValue (hash, sizeof (m3slot_t));
+    HashValue (hash, d_m3ThreadedDispatch);
+    HashValue (hash, d_m3HoistMemoryBoundsChecks);
+    HashValue (hash, d_m3EnableSuperInstructions);
+    HashValue (hash, d_m3FusedOpsGenerated);
+    HashValue (hash, d_m3EnableConstantFolding);
+    HashValue (hash, d_m3EnableTieredCompile);
+    HashValue (hash, d_m3EnableCodePageRefCounting);
+    HashValue (hash, d_m3EnableStacklessCalls);
+    HashValue (hash, d_m3EnableTimeSlicing);
+    HashValue (hash, d_m3SkipStackCheck);
+    HashValue (hash, d_m3SkipMemoryBoundsCheck);
+    HashValue (hash, d_m3HasFloat);
+
+    static const char buildTag [] = d_m3CodeCacheBuildTag;
+    hash = HashBytes (hash, buildTag, sizeof (buildTag));
+
+    // the operation indexes are only stable for the same operation table
+    u32 numOperations = m3_GetNumOperations ();
+    for (u32 i = 0; i < numOperations; ++i)
+    {
+        cstr_t name = m3_GetOperationName (i);
+        hash = HashBytes (hash, name, strlen (name) + 1);
+    }
+
+    return hash;
+}
+
+
+static u64  GetModuleHash  (IM3Module i_module)
+{
+# if d_m3EnableStreamingParse
+    if (not i_module->wasmStart)
+        return i_module->wasmHash;                                      // streamed: same bytes, same hash
+# endif
+
+    return HashBytes (c_m3HashSeed, i_module->wasmStart, i_module->wasmEnd - i_module->wasmStart);
+}
+
+
+static void  GetCachePath  (char * o_path, size_t i_size, const char * i_directory, u64 i_moduleHash)
+{
+    snprintf (o_path, i_size, "%s/%016" PRIx64 ".m3cc", i_directory, i_moduleHash);
+}
+
+
+static bool  IsFunctionCacheable  (IM3Function i_function)
+{
+    IM3CodeLayout layout = i_function->codeLayout;
+    return i_function->wasm and i_function->compiled and layout and not layout->incomplete;
+}
+
+//---------------------------------------------------------------------------------------------------------------------------------
+//  save
+//---------------------------------------------------------------------------------------------------------------------------------
+
+typedef struct M3SegmentRef
+{
+    pc_t                    start;
+    pc_t                    end;
+    u32                     function;
+    u32                     line;               // of 'start' in the function's code
+}
+M3SegmentRef;
+
+
+static int  CompareSegmentRefs  (const void * i_a, const void * i_b)
+{
+    uintptr_t a = (uintptr_t) ((const M3SegmentRef *) i_a)->start;
+    uintptr_t b = (uintptr_t) ((const M3SegmentRef *) i_b)->start;
+
+    return (a > b) - (a < b);
+}
+
+
+// last segment starting at or before i_pc. a pc can also sit just past the end of a segment
+static const M3SegmentRef *  FindSegment  (const M3SegmentRef * i_refs, u32 i_numRefs, pc_t i_pc)
+{
+    u32 low = 0, high = i_numRefs;
+
+    while (low < high)
+    {
+        u32 middle = (low + high) / 2;
+
+        if (i_refs [middle].start <= i_pc)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    if (low and i_pc <= i_refs [low - 1].end)
+        return & i_refs [low - 1];
+
+    return NULL;
+}
+
+
+static M3Result  RelocatePointer  (M3CodeCacheReloc * o_reloc, IM3Module i_module, const void * i_pointer,
+                                   const M3SegmentRef * i_refs, u32 i_numRefs)
+{
+    const u8 * pointer = (const u8 *) i_pointer;
+
+    if (not pointer)
+    {
+        o_reloc->kind = c_m3CacheRelocNull;
+        return m3Err_none;
+    }
+
+    if (pointer == (const u8 *) i_module)
+    {
+        o_reloc->kind = c_m3CacheRelocModule;
+        return m3Err_none;
+    }
+
+    for (u32 i = 0; i < i_module->numFuncTypes; ++i)
+    {
+        if (pointer == (const u8 *) i_module->funcTypes [i])
+        {
+            o_reloc->kind = c_m3CacheRelocFuncType;
+            o_reloc->index = i;
+            return m3Err_none;
+        }
+    }
+
+    const u8 * globals = (const u8 *) i_module->globals;
+    if (globals and pointer >= globals and pointer < globals + i_module->numGlobals * sizeof (M3Global))
+    {
+        size_t offset = pointer - globals;
+
+        if (offset % sizeof (M3Global) == offsetof (M3Global, i64Value))
+        {
+            o_reloc->kind = c_m3CacheRelocGlobal;
+            o_reloc->index = (u32) (offset / sizeof (M3Global));
+            return m3Err_none;
+        }
+    }
+
+    const u8 * functions = (const u8 *) i_module->functions;
+    if (functions and pointer >= functions and pointer < functions + i_module->numFunctions * sizeof (M3Function))
+    {
+        size_t offset = pointer - functions;
+
+        if (offset % sizeof (M3Function) == 0)
+        {
+            o_reloc->kind = c_m3CacheRelocFunction;
+            o_reloc->index = (u32) (offset / sizeof (M3Function));
+            return m3Err_none;
+        }
+    }
+
+    const M3SegmentRef * ref = FindSegment (i_refs, i_numRefs, (pc_t) i_pointer);
+    if (ref)
+    {
+        o_reloc->kind = c_m3CacheRelocCode;
+        o_reloc->index = ref->function;
+        o_reloc->offset = ref->line + (u32) ((pc_t) i_pointer - ref->start);
+        return m3Err_none;
+    }
+
+    // a call into code that isn't cached: an import, a function compiled without a layout, or
+    // the baseline entry of an optimised function (op_CountCall forwards it anyway)
+    for (u32 i = 0; i < i_module->numFunctions; ++i)
+    {
+        IM3Function function = & i_module->functions [i];
+
+        bool isEntry = (i_pointer == (const void *) function->compiled);
+
+#       if d_m3EnableTieredCompile
+        isEntry = isEntry or (function->baselineCompiled and i_pointer == (const void *) function->baselineCompiled);
+#       endif
+
+        if (isEntry)
+        {
+            o_reloc->kind = c_m3CacheRelocFunctionEntry;
+            o_reloc->index = i;
+            return m3Err_none;
+        }
+    }
+
+    return m3Err_codeCacheUnrelocatable;
+}
+
+
+// the compile relocs and two per bridge
+static u32  CountCachedRelocs  (IM3CodeLayout i_layout)
+{
+    u32 numRelocs = i_layout->numRelocs;
+
+    for (u32 i = 0; i < i_layout->numSegments; ++i)
+    {
+        if (i_layout->segments [i].next)
+            numRelocs += c_m3SegmentBridgeLines;
+    }
+
+    return numRelocs;
+}
+
+
+// op_Branch isn't visible outside the unit that compiles the operations: found by name, once per save
+static const void *  GetBranchWord  (void)
+{
+    u32 numOperations = m3_GetNumOperations ();
+    for (u32 i = 0; i < numOperations; ++i)
+    {
+        if (strcmp (m3_GetOperationName (i), "Branch") == 0)
+            return m3_GetOperationWord (m3_GetOperationAtIndex (i));
+    }
+
+    return NULL;
+}
+
+
+static M3Result  WriteCachedFunction  (FILE * io_file, IM3Module i_module, IM3Function i_function,
+                                       const M3SegmentRef * i_refs, u32 i_numRefs, const void * i_branchWord)
+{
+    M3Result result = m3Err_none;
+
+    IM3CodeLayout layout = i_function->codeLayout;
+    u32 numRelocs = CountCachedRelocs (layout);
+
+    code_t * lines = m3_Def_AllocArray (code_t, layout->numLines + 1);
+    M3CodeCacheReloc * relocs = m3_Def_AllocArray (M3CodeCacheReloc, numRelocs + 1);
+    u32 * lineRelocs = m3_Def_AllocArray (u32, numRelocs + 1);       // (line << 1) | c_m3Reloc*, bridges included
+    _throwif (m3Err_mallocFailed, not lines or not relocs or not lineRelocs);
+
+    u32 numLines = layout->numLines;
+    memset (lines, 0x0, numLines * sizeof (code_t));
+
+    // the segments are in line order and so are their relocs: each bridge's go right after its segment's
+    u32 numLineRelocs = 0, nextReloc = 0;
+
+    for (u32 i = 0; i < layout->numSegments; ++i)
+    {
+        M3CodeSegment * segment = & layout->segments [i];
+        u32 end = segment->line + segment->numLines;
+
+        memcpy (lines + segment->line, segment->start, segment->numLines * sizeof (code_t));
+
+        while (nextReloc < layout->numRelocs and (layout->relocs [nextReloc] >> 1) < end)
+            lineRelocs [numLineRelocs++] = layout->relocs [nextReloc++];
+
+        if (segment->next)
+        {
+            lines [end] = (code_t) i_branchWord;
+            lines [end + 1] = (code_t) segment->next;
+
+            lineRelocs [numLineRelocs++] = (end << 1) | c_m3RelocOperation;
+            lineRelocs [numLineRelocs++] = ((end + 1) << 1) | c_m3RelocPointer;
+        }
+    }
+
+    while (nextReloc < layout->numRelocs)
+        lineRelocs [numLineRelocs++] = layout->relocs [nextReloc++];
+
+    for (u32 i = 0; i < numRelocs; ++i)
+    {
+        M3CodeCacheReloc * reloc = & relocs [i];
+        memset (reloc, 0x0, sizeof (M3CodeCacheReloc));
+
+        reloc->line = lineRelocs [i] >> 1;
+        _throwif (m3Err_codeCacheCorrupt, reloc->line >= numLines);
+
+        code_t word = lines [reloc->line];
+        lines [reloc->line] = NULL;
+
+        if ((lineRelocs [i] & 1) == c_m3RelocOperation)
+        {
+            IM3Operation operation = m3_GetWordOperation (word);
+
+            if (operation)
+            {
+                reloc->kind = c_m3CacheRelocOperation;
+                reloc->index = (u32) m3_GetOperationIndex (operation);
+            }
+            else
+            {
+                _throwif (m3Err_codeCacheUnrelocatable, word);
+                reloc->kind = c_m3CacheRelocNull;
+            }
+        }
+        else
+        {
+            result = RelocatePointer (reloc, i_module, word, i_refs, i_numRefs);
+
+            if (result)
+            {
+                ESP_LOGW ("WASM3", "code cache: '%s' line %" PRIu32 ": pointer %p", m3_GetFunctionName (i_function), reloc->line, word);
+                _throw (result);
+            }
+        }
+    }
+
+    if (i_function->numConstantBytes)
+        _throwif ("code cache: write failed", fwrite (i_function->constants, i_function->numConstantBytes, 1, io_file) != 1);
+
+    if (numRelocs)
+        _throwif ("code cache: write failed", fwrite (relocs, sizeof (M3CodeCacheReloc), numRelocs, io_file) != numRelocs);
+
+    if (numLines)
+        _throwif ("code cache: write failed", fwrite (lines, sizeof (code_t), numLines, io_file) != numLines);
+
+    _catch:
+
+    m3_Def_Free (lineRelocs);
+    m3_Def_Free (relocs);
+    m3_Def_Free (lines);
+
+    return result;
+}
+
+
+M3Result  m3_SaveCodeCache  (IM3Module i_module, const char * i_directory)
+{
+    M3Result result = m3Err_none;
+
+    FILE * file = NULL;
+    M3SegmentRef * refs = NULL;
+
+    char path [256];
+    GetCachePath (path, sizeof (path), i_directory, GetModuleHash (i_module));
+
+    // every segment of the cached functions, to turn code pointers into (function, line)
+    u32 numFunctions = 0, numRefs = 0;
+    for (u32 i = 0; i < i_module->numFunctions; ++i)
+    {
+        IM3Function function = & i_module->functions [i];
+
+        if (IsFunctionCacheable (function))
+        {
+            numFunctions++;
+            numRefs += function->codeLayout->numSegments;
+        }
+    }
+
+    refs = m3_Def_AllocArray (M3SegmentRef, numRefs + 1);
+    _throwif (m3Err_mallocFailed, not refs);
+
+    numRefs = 0;
+    for (u32 i = 0; i < i_module->numFunctions; ++i)
+    {
+        IM3Function function = & i_module->functions [i];
+
+        if (IsFunctionCacheable (function))
+        {
+            IM3CodeLayout layout = function->codeLayout;
+
+            for (u32 s = 0; s < layout->numSegments; ++s)
+            {
+                M3CodeSegment * segment = & layout->segments [s];
+
+                refs [numRefs++] = (M3SegmentRef) { .start = segment->start, .end = segment->start + segment->numLines,
+                                                    .function = i, .line = segment->line };
+            }
+        }
+    }
+
+    qsort (refs, numRefs, sizeof (M3SegmentRef), CompareSegmentRefs);
+
+    const void * branchWord = GetBranchWord ();
+    _throwif (m3Err_codeCacheUnrelocatable, not branchWord);
+
+    file = fopen (path, "wb");
+    _throwif ("code cache: unable to open the cache file", not file);
+
+    M3CodeCacheHeader header = { .magic = c_m3CodeCacheMagic, .version = c_m3CodeCacheVersion, .buildHash = GetBuildHash (),
+                                 .moduleHash = GetModuleHash (i_module), .numFunctions = numFunctions };
+
+    _throwif ("code cache: write failed", fwrite (& header, sizeof (header), 1, file) != 1);
+
+    for (u32 i = 0; i < i_module->numFunctions; ++i)
+    {
+        IM3Function function = & i_module->functions [i];
+
+        if (IsFunctionCacheable (function))
+        {
+            M3CodeCacheFunction entry = {
+                .index              = i,
+                .numLines           = function->codeLayout->numLines,
+                .numRelocs          = CountCachedRelocs (function->codeLayout),
+                .maxStackSlots      = function->maxStackSlots,
+                .numRetSlots        = function->numRetSlots,
+                .numRetAndArgSlots  = function->numRetAndArgSlots,
+                .numLocalBytes      = function->numLocalBytes,
+                .numConstantBytes   = function->numConstantBytes
+            };
+
+            _throwif ("code cache: write failed", fwrite (& entry, sizeof (entry), 1, file) != 1);
+        }
+    }
+
+    for (u32 i = 0; i < i_module->numFunctions; ++i)
+    {
+        IM3Function function = & i_module->functions [i];
+
+        if (IsFunctionCacheable (function))
+_           (WriteCachedFunction (file, i_module, function, refs, numRefs, branchWord));
+    }
+
+    if (WASM_DEBUG_CODE_CACHE) ESP_LOGI ("WASM3", "code cache: saved %" PRIu32 " functions to %s", numFunctions, path);
+
+    _catch:
+
+    if (file)
+    {
+        if (fclose (file) != 0 and not result)
+            result = "code cache: write failed";
+
+        if (result)
+            remove (path);
+    }
+
+    m3_Def_Free (refs);
+
+    return result;
+}
+
+//---------------------------------------------------------------------------------------------------------------------------------
+//  load
+//---------------------------------------------------------------------------------------------------------------------------------
+
+typedef struct M3LoadedFunction
+{
+    M3CodeCacheFunction     entry;
+    pc_t                    start;
+    void *                  constants;
+    IM3CodeLayout           layout;
+# if (d_m3EnableCodePageRefCounting)
+    IM3CodePage             page;
+# endif
+}
+M3LoadedFunction;
+
+
+static M3Result  ResolveReloc  (code_t * o_word, IM3Module io_module, const M3CodeCacheReloc * i_reloc,
+                                M3LoadedFunction ** i_placed)
+{
+    M3Result result = m3Err_none;
+
+    u32 index = i_reloc->index;
+
+    switch (i_reloc->kind)
+    {
+        case c_m3CacheRelocOperation:
+        {
+            IM3Operation operation = m3_GetOperationAtIndex (index);
+            _throwif (m3Err_codeCacheCorrupt, not operation);
+
+            * o_word = (code_t) m3OpWord (operation);
+            break;
+        }
+
+        case c_m3CacheRelocNull:
+            * o_word = NULL;
+            break;
+
+        case c_m3CacheRelocModule:
+            * o_word = io_module;
+            break;
+
+        case c_m3CacheRelocFuncType:
+            _throwif (m3Err_codeCacheCorrupt, index >= io_module->numFuncTypes);
+            * o_word = io_module->funcTypes [index];
+            break;
+
+        case c_m3CacheRelocGlobal:
+            _throwif (m3Err_codeCacheCorrupt, index >= io_module->numGlobals);
+            * o_word = & io_module->globals [index].i64Value;
+            break;
+
+        case c_m3CacheRelocFunction:
+            _throwif (m3Err_codeCacheCorrupt, index >= io_module->numFunctions);
+            * o_word = & io_module->functions [index];
+            break;
+
+        case c_m3CacheRelocFunctionEntry:
+        {
+            _throwif (m3Err_codeCacheCorrupt, index >= io_module->numFunctions);
+            IM3Function function = & io_module->functions [index];
+
+            // imports must be linked before the cache is loaded; anything else is compiled now
+            if (not GetFunctionCompiled (function))
+_               (CompileFunction (function));
+
+            * o_word = (code_t) GetFunctionCompiled (function);
+            break;
+        }
+
+        case c_m3CacheRelocCode:
+        {
+            _throwif (m3Err_codeCacheCorrupt, index >= io_module->numFunctions or not i_placed [index]);
+            M3LoadedFunction * target = i_placed [index];
+
+            _throwif (m3Err_codeCacheCorrupt, i_reloc->offset > target->entry.numLines);
+            * o_word = (code_t) (target->start + i_reloc->offset);
+            break;
+        }
+
+        default:
+            _throw (m3Err_codeCacheCorrupt);
+    }
+
+    _catch: return result;
+}
+
+
+static M3Result  ReadCachedFunction  (FILE * i_file, IM3Module io_module, M3LoadedFunction * io_loaded, M3LoadedFunction ** i_placed)
+{
+    M3Result result = m3Err_none;
+
+    M3CodeCacheFunction * entry = & io_loaded->entry;
+    M3CodeCacheReloc * relocs = NULL;
+
+    if (entry->numConstantBytes)
+    {
+        io_loaded->constants = m3_Def_Malloc (entry->numConstantBytes);
+        _throwif (m3Err_mallocFailed, not io_loaded->constants);
+        _throwif (m3Err_codeCacheCorrupt, fread (io_loaded->constants, entry->numConstantBytes, 1, i_file) != 1);
+    }
+
+    relocs = m3_Def_AllocArray (M3CodeCacheReloc, entry->numRelocs + 1);
+    _throwif (m3Err_mallocFailed, not relocs);
+    _throwif (m3Err_codeCacheCorrupt, fread (relocs, sizeof (M3CodeCacheReloc), entry->numRelocs, i_file) != entry->numRelocs);
+
+    code_t * lines = (code_t *) io_loaded->start;
+    _throwif (m3Err_codeCacheCorrupt, fread (lines, sizeof (code_t), entry->numLines, i_file) != entry->numLines);
+
+    // the loaded code is one segment; keeping its layout lets a warm runtime save the cache again
+    IM3CodeLayout layout = io_loaded->layout = NewCodeLayout ();
+    if (layout)
+    {
+        layout->relocs = m3_Def_AllocArray (u32, entry->numRelocs + 1);
+        layout->segments = m3_Def_AllocStruct (M3CodeSegment);
+
+        if (layout->relocs and layout->segments)
+        {
+            layout->segments [0] = (M3CodeSegment) { .start = io_loaded->start, .numLines = entry->numLines };
+            layout->numSegments = 1;
+            layout->numLines = entry->numLines;
+        }
+        else layout->incomplete = true;
+    }
+
+    for (u32 i = 0; i < entry->numRelocs; ++i)
+    {
+        M3CodeCacheReloc * reloc = & relocs [i];
+        _throwif (m3Err_codeCacheCorrupt, reloc->line >= entry->numLines);
+
+_       (ResolveReloc (& lines [reloc->line], io_module, reloc, i_placed));
+
+        if (layout and not layout->incomplete)
+        {
+            u32 kind = (reloc->kind == c_m3CacheRelocOperation) ? c_m3RelocOperation : c_m3RelocPointer;
+            layout->relocs [layout->numRelocs++] = (reloc->line << 1) | kind;
+        }
+    }
+
+    _catch:
+
+    m3_Def_Free (relocs);
+
+    return result;
+}
+
+
+M3Result  m3_LoadCodeCache  (IM3Module io_module, const char * i_directory)
+{
+    M3Result result = m3Err_none;
+
+    IM3Runtime runtime = io_module->runtime;
+    FILE * file = NULL;
+
+    M3LoadedFunction * loaded = NULL;
+    M3LoadedFunction ** placed = NULL;
+    u32 numLoaded = 0;
+
+    _throwif (m3Err_moduleNotLinked, not runtime);
+
+    m3_WaitForBackgroundCompile (runtime);     // the loaded code replaces what the workers would publish
+
+    u64 moduleHash = GetModuleHash (io_module);
+
+    char path [256];
+    GetCachePath (path, sizeof (path), i_directory, moduleHash);
+
+    file = fopen (path, "rb");
+    _throwif (m3Err_codeCacheMiss, not file);
+
+    M3CodeCacheHeader header;
+    _throwif (m3Err_codeCacheMiss, fread (& header, sizeof (header), 1, file) != 1);
+
+    _throwif (m3Err_codeCacheMiss, header.magic != c_m3CodeCacheMagic or header.version != c_m3CodeCacheVersion);
+    _throwif (m3Err_codeCacheMiss, header.moduleHash != moduleHash or header.buildHash != GetBuildHash ());
+    _throwif (m3Err_codeCacheCorrupt, header.numFunctions > io_module->numFunctions);
+
+    loaded = m3_Def_AllocArray (M3LoadedFunction, header.numFunctions + 1);
+    placed = m3_Def_AllocArray (M3LoadedFunction *, io_module->numFunctions + 1);
+    _throwif (m3Err_mallocFailed, not loaded or not placed);
+
+    memset (loaded, 0x0, sizeof (M3LoadedFunction) * header.numFunctions);
+    memset (placed, 0x0, sizeof (M3LoadedFunction *) * io_module->numFunctions);
+
+    // first place every function, so code pointers between them can be resolved while reading
+    for (; numLoaded < header.numFunctions; ++numLoaded)
+    {
+        M3LoadedFunction * function = & loaded [numLoaded];
+        M3CodeCacheFunction * entry = & function->entry;
+
+        _throwif (m3Err_codeCacheCorrupt, fread (entry, sizeof (M3CodeCacheFunction), 1, file) != 1);
+        _throwif (m3Err_codeCacheCorrupt, entry->index >= io_module->numFunctions or placed [entry->index] or not entry->numLines);
+        _throwif (m3Err_codeCacheCorrupt, not io_module->functions [entry->index].wasm);
+
+        IM3CodePage page = AcquireCodePageWithCapacity (runtime, entry->numLines);
+        _throwif (m3Err_mallocFailedCodePage, not page);
+
+        function->start = GetPagePC (page);
+        page->info.lineIndex += entry->numLines;
+# if (d_m3EnableCodePageRefCounting)
+        function->page = page;
+# endif
+
+        ReleaseCodePage (runtime, page);
+
+        placed [entry->index] = function;
+    }
+
+    for (u32 i = 0; i < numLoaded; ++i)
+_       (ReadCachedFunction (file, io_module, & loaded [i], placed));
+
+# if (d_m3EnableCodePageRefCounting)
+    for (u32 i = 0; i < numLoaded; ++i)
+_       (Function_AddCodePage (& io_module->functions [loaded [i].entry.index], loaded [i].page));
+# endif
+
+    // all or nothing: only now the functions point at the loaded code
+    for (u32 i = 0; i < numLoaded; ++i)
+    {
+        M3LoadedFunction * function = & loaded [i];
+        IM3Function target = & io_module->functions [function->entry.index];
+
+        target->maxStackSlots       = function->entry.maxStackSlots;
+        target->numRetSlots         = function->entry.numRetSlots;
+        target->numRetAndArgSlots   = function->entry.numRetAndArgSlots;
+        target->numLocalBytes       = function->entry.numLocalBytes;
+        target->numConstantBytes    = function->entry.numConstantBytes;
+
+        m3_Def_Free (target->constants);
+        target->constants = function->constants;
+        function->constants = NULL;
+
+        FreeCodeLayout (target->codeLayout);
+        target->codeLayout = function->layout;
+        function->layout = NULL;
+
+        SetFunctionCompiled (target, function->start);
+    }
+
+    if (WASM_DEBUG_CODE_CACHE) ESP_LOGI ("WASM3", "code cache: loaded %" PRIu32 " functions from %s", numLoaded, path);
+
+    _catch:
+
+    // on failure the placed lines stay unused in their pages until the runtime goes
+    if (loaded)
+    {
+        for (u32 i = 0; i < numLoaded; ++i)
+        {
+            m3_Def_Free (loaded [i].constants);
+            FreeCodeLayout (loaded [i].layout);
+        }
+    }
+
+    m3_Def_Free (placed);
+    m3_Def_Free (loaded);
+
+    if (file)
+        fclose (file);
+
+    return result;
+}
+
+# else // d_m3EnableCodeCache
+
+M3Result  m3_SaveCodeCache  (IM3Module i_module, const char * i_directory)
+{
+    return m3Err_codeCacheMiss;
+}
+
+M3Result  m3_LoadCodeCache  (IM3Module io_module, const char * i_directory)
+{
+    return m3Err_codeCacheMiss;
+}
+
+# endif // d_m3EnableCodeCache
@@ -0,0 +1,74 @@
+//
+//  m3_code_cache.h
+//
+//  Persistent cache of compiled code (d_m3EnableCodeCache).
+//
+//  While a function compiles, its layout records where its code landed (segments: the code of a
+//  function is spread over pages, else blocks and br_table stubs go to pages of their own) and which
+//  lines hold an operation or a pointer. m3_SaveCodeCache writes the code of a module with those
+//  lines relocated: operations by index (m3_op_table.h), pointers as module objects or as code
+//  positions (function, line). m3_LoadCodeCache copies the code back into pages and patches it,
+//  so the functions never reach CompileFunction.
+//
+
+#pragma once
+
+#include "m3_code.h"
+
+d_m3BeginExternC
+
+# if d_m3EnableCodeCache
+
+typedef struct M3CodeSegment
+{
+    pc_t                    start;
+    u32                     numLines;
+    u32                     line;               // of 'start' in the cached code
+    pc_t                    next;               // code continuing where this segment ends, in a later segment (or NULL)
+}
+M3CodeSegment;
+
+// each segment is followed by room for an op_Branch to 'next': in the cache the segments are laid end to
+// end, so a segment that fell through into code recorded later (the continuation after an else block)
+// has to jump there
+#define c_m3SegmentBridgeLines          2
+
+typedef struct M3CodeLayout
+{
+    M3CodeSegment *         segments;
+    u32                     numSegments;
+
+    u32 *                   relocs;             // (line << 1) | c_m3Reloc*, lines counted across the segments
+    u32                     numRelocs;
+    u32                     numLines;           // in the closed segments and their bridges
+
+    IM3CodePage             page;               // of the open segment, while compiling
+    bool                    incomplete;         // an allocation failed: the function isn't cacheable
+}
+M3CodeLayout;
+
+typedef M3CodeLayout *      IM3CodeLayout;
+
+enum
+{
+    c_m3RelocOperation      = 0,
+    c_m3RelocPointer        = 1
+};
+
+#define c_m3HashSeed                    0xcbf29ce484222325ULL
+
+// FNV-1a; a module is keyed by the hash of its bytes (the streaming parser hashes them as they arrive)
+u64                 HashBytes                   (u64 io_hash, const void * i_bytes, size_t i_size);
+
+IM3CodeLayout       NewCodeLayout               (void);
+void                FreeCodeLayout              (IM3CodeLayout i_layout);               // NULL is valid
+
+// i_pc is where the word is about to be emitted, in i_page
+void                CodeLayout_AddWord          (IM3CodeLayout io_layout, IM3CodePage i_page, pc_t i_pc, u32 i_kind);
+// the compiler took back the words from i_pc on, in the open segment
+void                CodeLayout_Rewind           (IM3CodeLayout io_layout, IM3CodePage i_page, pc_t i_pc);
+void                CodeLayout_Close            (IM3CodeLayout io_layout);
+
+# endif // d_m3EnableCodeCache
+
+d_m3EndExternC
@@ -12,6 +12,7 @@
 
 #include "m3_env.h"
 #include "m3_compile.h"
+#include "m3_compile_pool.h"
 #include "m3_exec.h"
 #include "m3_exception.h"
 #include "m3_info.h"
@@ -23,6 +24,17 @@ WASM3_STATIC_INLINE pc_t GetPC (IM3Compilation o)
     return GetPagePC (o->page);
 }
 
+#if d_m3EnableCodeCache
+// records an operation or a pointer about to be emitted, so m3_SaveCodeCache can relocate it
+WASM3_STATIC_INLINE void  TrackCodeWord  (IM3Compilation o, u32 i_kind)
+{
+    if (o->codeLayout)
+        CodeLayout_AddWord (o->codeLayout, o->page, GetPC (o), i_kind);
+}
+#else
+#   define TrackCodeWord(...)
+#endif
+
 WASM3_STATIC M3_NOINLINE
 M3Result  EnsureCodePageNumLines  (IM3Compilation o, u32 i_numLines)
 {
@@ -39,12 +51,19 @@ M3Result  EnsureCodePageNumLines  (IM3Compilation o, u32 i_numLines)
             m3log (emit, "bridging new code page from: %d %p (free slots: %d) to: %d", o->page->info.sequence, GetPC (o), NumFreeLines (o->page), page->info.sequence);
             d_m3Assert (NumFreeLines (o->page) >= 2);
 
-            EmitWord (o->page, op_Branch);
+            TrackCodeWord (o, c_m3RelocOperation);
+            EmitWord (o->page, m3OpWord (op_Branch));
+            TrackCodeWord (o, c_m3RelocPointer);
             EmitWord (o->page, GetPagePC (page));
 
             ReleaseCodePage (o->runtime, o->page);
 
             o->page = page;
+
+#           if (d_m3EnableCodePageRefCounting)
+            if (o->function)
+                result = Function_AddCodePage (o->function, page);
+#           endif
         }
         else result = m3Err_mallocFailedCodePage;
     }
@@ -90,7 +109,8 @@ WASM3_STATIC M3_NOINLINE M3Result  EmitOp  (IM3Compilation o, IM3Operation i_ope
             # if d_m3RecordBacktraces
                 EmitMappingEntry (o->page, o->lastOpcodeStart - o->module->wasmStart);
             # endif // d_m3RecordBacktraces
-            EmitWord (o->page, i_operation);
+            TrackCodeWord (o, c_m3RelocOperation);
+            EmitWord (o->page, m3OpWord (i_operation));
 
             if(WASM_DEBUG_EmitOp){ 
                 ESP_LOGI("WASM3", "EmitOp: EmitWord completed");
@@ -126,7 +146,10 @@ pc_t  EmitPointer  (IM3Compilation o, const void * const i_pointer)
     pc_t ptr = GetPagePC (o->page);
 
     if (o->page)
+    {
+        TrackCodeWord (o, c_m3RelocPointer);
         EmitWord (o->page, i_pointer);
+    }
 
     return ptr;
 }
@@ -189,17 +212,8 @@ M3Result  AcquireCompilationCodePage  (IM3Compilation o, IM3CodePage * o_codePag
     if (page)
     {
 #       if (d_m3EnableCodePageRefCounting)
-        {
-            if (o->function)
-            {
-                IM3Function func = o->function;
-                page->info.usageCount++;
-
-                u32 index = func->numCodePageRefs++;
-_               (m3ReallocArray (& func->codePageRefs, IM3CodePage, func->numCodePageRefs, index));
-                func->codePageRefs [index] = page;
-            }
-        }
+        if (o->function)
+_           (Function_AddCodePage (o->function, page));
 #       endif
     }
     else _throw (m3Err_mallocFailedCodePage);
@@ -816,6 +830,51 @@ _           (Push (o, i_type, slot));
     _catch: return result;
 }
 
+#if d_m3EnableConstantFolding
+// the value of a stack entry that lives in the constant table (inline op_Const's don't count)
+WASM3_STATIC
+bool  GetStackConstant  (IM3Compilation o, u16 i_stackIndex, u64 * o_value)
+{
+    u16 slot = o->wasmStack [i_stackIndex];
+
+    if (not IsConstantSlot (o, slot))
+        return false;
+
+    if (Is64BitType (o->typeStack [i_stackIndex]))
+    {
+        memcpy (o_value, & o->constants [slot - o->slotFirstConstIndex], sizeof (u64));
+    }
+    else
+    {
+        u32 value;
+        memcpy (& value, & o->constants [slot - o->slotFirstConstIndex], sizeof (value));
+        * o_value = value;
+    }
+
+    return true;
+}
+
+// removes the value under the stack top; the top moves down into its place, keeping its slot or register
+WASM3_STATIC
+M3Result  PopUnderStackTop  (IM3Compilation o)
+{
+    M3Result result = m3Err_none;
+
+    u16 slot = GetStackTopSlotNumber (o);
+    u8 type = GetStackTopType (o);
+
+    o->stackIndex--;
+
+    if (IsRegisterSlotAlias (slot))
+        DeallocateRegister (o, IsFpRegisterSlotAlias (slot));
+
+_   (Pop (o));
+_   (Push (o, type, slot));
+
+    _catch: return result;
+}
+#endif
+
 WASM3_STATIC_INLINE
 M3Result  EmitSlotNumOfStackTopAndPop  (IM3Compilation o)
 {
@@ -1263,7 +1322,7 @@ M3Result  Compile_ExtendedOpcode  (IM3Compilation o, m3opcode_t i_opcode)
 {
 _try {
     u8 opcode;
-_   (Read_u8 (& opcode, & o->wasm, o->wasmEnd));             m3log (compile, d_indent " (FC: %" PRIi32 ")", get_indention_string (o), opcode);
+_   (Read_u8 (&o->runtime->memory, & opcode, & o->wasm, o->wasmEnd));             m3log (compile, d_indent " (FC: %" PRIi32 ")", get_indention_string (o), opcode);
 
     i_opcode = (i_opcode << 8) | opcode;
 
@@ -1354,6 +1413,81 @@ _           (EmitOp (o, op_Return));
 }
 
 
+#if d_m3HoistMemoryBoundsChecks
+
+WASM3_STATIC
+void  ResetBoundsGroup  (IM3Compilation o)
+{
+    o->boundsBaseSlot = c_slotUnused;
+    o->boundsReachPC = NULL;
+}
+
+// a write to the group's base local ends the group
+WASM3_STATIC_INLINE
+void  InvalidateBoundsGroup  (IM3Compilation o, u16 i_slot)
+{
+    if (o->boundsBaseSlot == i_slot)
+        ResetBoundsGroup (o);
+}
+
+// integer div/rem and float->int truncations trap
+WASM3_STATIC_INLINE
+bool  IsTrappingNumericOpcode  (m3opcode_t i_opcode)
+{
+    return ((i_opcode >= 0x6d and i_opcode <= 0x70) or (i_opcode >= 0x7f and i_opcode <= 0x82) or
+            (i_opcode >= 0xa8 and i_opcode <= 0xab) or (i_opcode >= 0xae and i_opcode <= 0xb1));
+}
+
+// Called before each opcode is compiled.
+// Block structure ends the group: code after a label (loop, else, end) can be reached without
+// passing the group's check. Branches, calls, global.set, memory.grow and trapping arithmetic keep
+// it (code after them is only reached by falling through, and wasm memory never shrinks), but the
+// check can't be widened over them anymore: the trap would move ahead of their effects.
+// Loads and stores are handled in Compile_Load_Store.
+WASM3_STATIC
+void  UpdateBoundsGroup  (IM3Compilation o, m3opcode_t i_opcode)
+{
+    bool neutral = (i_opcode == 0x01                                                    // nop
+                    or (i_opcode >= 0x1a and i_opcode <= c_waOp_getGlobal)              // drop, select, local.*, global.get
+                    or (i_opcode >= c_waOp_i32_load and i_opcode <= 0x3f)               // loads, stores, memory.size
+                    or (i_opcode >= c_waOp_i32_const and i_opcode <= 0xc4 and not IsTrappingNumericOpcode (i_opcode))
+                    or (i_opcode >= 0xfc00 and i_opcode <= 0xfc07));                    // saturating truncations
+
+    if (neutral)
+        return;
+
+    if ((i_opcode >= c_waOp_block and i_opcode <= c_waOp_else) or i_opcode == c_waOp_end)
+        ResetBoundsGroup (o);
+    else
+        o->boundsReachPC = NULL;
+}
+
+#endif // d_m3HoistMemoryBoundsChecks
+
+#if d_m3EnableConstantFolding
+// local.set/tee right after a plain copy into the same local: nothing read the copy, and no label can sit between
+// the two (CompileBlockStatements forgets the copy on anything but local.*, consts, nop and drop), so it's taken back
+WASM3_STATIC
+void  RemoveDeadCopy  (IM3Compilation o, u16 i_localSlot)
+{
+    if (o->copyEndPC and o->copySlot == i_localSlot and GetPC (o) == o->copyEndPC and
+        not IsStackPolymorphic (o) and GetStackTopSlotNumber (o) != i_localSlot and not d_m3RecordBacktraces)
+    {
+        o->page->info.lineIndex -= (u32) (o->copyEndPC - o->copyStartPC);
+
+#       if d_m3EnableCodeCache
+        if (o->codeLayout)
+            CodeLayout_Rewind (o->codeLayout, o->page, o->copyStartPC);
+#       endif
+
+        o->numRemovedOps++;
+    }
+
+    o->copyEndPC = NULL;
+}
+#endif
+
+
 WASM3_STATIC
 M3Result  Compile_SetLocal  (IM3Compilation o, m3opcode_t i_opcode)
 {
@@ -1370,10 +1504,36 @@ _   (ReadLEB_ptr (&o->runtime->memory, & localIndex, & o->wasm, o->wasmEnd));
 _       (FindReferencedLocalWithinCurrentBlock (o, & preserveSlot, localSlot));  // preserve will be different than local, if referenced
 
         if (preserveSlot == localSlot)
-_           (CopyStackTopToSlot (o, localSlot))
+        {
+#       if d_m3EnableConstantFolding
+            IM3CodePage page = o->page;
+            pc_t copyStart = NULL;
+
+            if (page and IsOptimizingTier (o))
+            {
+                RemoveDeadCopy (o, localSlot);
+                copyStart = GetPC (o);
+            }
+#       endif
+
+_           (CopyStackTopToSlot (o, localSlot));
+
+#       if d_m3EnableConstantFolding
+            if (copyStart and o->page == page)      // not bridged to a new page
+            {
+                o->copyStartPC = copyStart;
+                o->copyEndPC = GetPC (o);
+                o->copySlot = localSlot;
+            }
+#       endif
+        }
         else
 _           (PreservedCopyTopSlot (o, localSlot, preserveSlot))
 
+#       if d_m3HoistMemoryBoundsChecks
+        InvalidateBoundsGroup (o, localSlot);
+#       endif
+
         if (i_opcode != c_waOp_teeLocal)
 _           (Pop (o));
     }
@@ -1495,6 +1655,22 @@ _   (ReadLEB_ptr (&o->runtime->memory, & depth, & o->wasm, o->wasmEnd));
     IM3CompilationScope scope;
 _   (GetBlockScope (o, & scope, depth));
 
+#   if d_m3EnableConstantFolding
+    // the condition is known: the br_if is either a br or nothing
+    u64 condition;
+    if (i_opcode == c_waOp_branchIf and IsOptimizingTier (o) and o->page and not IsStackPolymorphic (o) and
+        GetNumBlockValuesOnStack (o) >= 1 and GetStackConstant (o, GetStackTopIndex (o), & condition))
+    {
+_       (PopType (o, c_m3Type_i32));
+        o->numRemovedOps++;
+
+        if (not (u32) condition)
+            goto _catch;
+
+        i_opcode = c_waOp_branch;
+    }
+#   endif
+
     // branch target is a loop (continue)
     if (scope->opcode == c_waOp_loop)
     {
@@ -1530,6 +1706,10 @@ _               (EmitOp (o, op_ContinueLoopIf));
         }
         else // is c_waOp_branch
         {
+            // also a br_if folded into a br: the params go where the loop reads them
+            if (GetFuncTypeNumParams (scope->type))
+_               (ResolveBlockResults (o, scope, /* isBranch: */ true));
+
     _       (EmitOp (o, op_ContinueLoop));
             EmitPointer (o, scope->pc);
             o->block.isPolymorphic = true;
@@ -1739,16 +1919,24 @@ _           (CompileCallArgsAndReturn (o, & slotTop, function->funcType, false))
             IM3Operation op;
             const void * operand;
 
-            if (function->compiled)
+#       if (d_m3EnableCodePageRefCounting)
+            // no callee pc in the code: the callee's pages can go (m3_ReleaseColdCode, m3_UnloadModule)
+            op = op_CallFunction;
+            operand = function;
+#       else
+            pc_t compiled = GetFunctionCompiled (function);
+
+            if (compiled)
             {
                 op = op_Call;
-                operand = function->compiled;
+                operand = compiled;
             }
             else
             {
                 op = op_Compile;
                 operand = function;
             }
+#       endif
 
 _           (EmitOp     (o, op));
             EmitPointer (o, operand);
@@ -1798,6 +1986,89 @@ _   (EmitOp         (o, op_CallIndirect));
     return result;
 }
 
+// return_call / return_call_indirect: the arguments are set up as for a call, then op_ReturnCall moves them
+// down into the caller's frame and jumps to the callee, which returns straight to the caller's caller
+WASM3_STATIC
+M3Result  Compile_ReturnCall  (IM3Compilation o, m3opcode_t i_opcode)
+{
+_try {
+
+    IM3Memory mem = &o->runtime->memory;
+
+    bool isIndirect = (i_opcode == c_waOp_returnCallIndirect);
+
+    IM3Function function = NULL;
+    IM3FuncType type;
+
+    if (isIndirect)
+    {
+        u32 typeIndex, tableIndex;
+_       (ReadLEB_u32 (mem, & typeIndex, & o->wasm, o->wasmEnd));
+_       (ReadLEB_u32 (mem, & tableIndex, & o->wasm, o->wasmEnd));
+
+        _throwif ("function call type index out of range", typeIndex >= o->module->numFuncTypes);
+        type = o->module->funcTypes [typeIndex];
+    }
+    else
+    {
+        u32 functionIndex;
+_       (ReadLEB_u32 (mem, & functionIndex, & o->wasm, o->wasmEnd));
+
+        function = Module_GetFunction (o->module, functionIndex);
+        _throwif (m3Err_functionLookupFailed, not function);
+
+        if (not function->module)
+            _throw (ErrorCompile (m3Err_functionImportMissing, o, "'%s.%s'", GetFunctionImportModuleName (function), m3_GetFunctionName (function)));
+
+        type = function->funcType;
+    }
+
+    // the callee leaves its results where the caller's go
+    IM3FuncType callerType = o->function->funcType;
+    u16 numRets = GetFuncTypeNumResults (type);
+
+    _throwif ("tail call result types don't match the caller's", numRets != GetFuncTypeNumResults (callerType));
+    for (u16 i = 0; i < numRets; ++i)
+        _throwif ("tail call result types don't match the caller's", GetFuncTypeResultType (type, i) != GetFuncTypeResultType (callerType, i));
+
+    if (not IsStackPolymorphic (o))     // else unreachable: nothing to emit
+    {
+        u16 tableIndexSlot = 0;
+        if (isIndirect)
+        {
+            if (IsStackTopInRegister (o))
+_               (PreserveRegisterIfOccupied (o, c_m3Type_i32));
+
+            tableIndexSlot = GetStackTopSlotNumber (o);
+        }
+
+        u16 execTop;
+_       (CompileCallArgsAndReturn (o, & execTop, type, isIndirect));
+
+        u32 numSlots = (GetFuncTypeNumParams (type) + numRets) * c_ioSlotCount;
+
+        if (isIndirect)
+        {
+_           (EmitOp         (o, op_ReturnCallIndirect));
+            EmitSlotOffset  (o, tableIndexSlot);
+            EmitPointer     (o, o->module);
+            EmitPointer     (o, type);
+        }
+        else
+        {
+_           (EmitOp         (o, op_ReturnCall));
+            EmitPointer     (o, function);
+        }
+        EmitSlotOffset  (o, execTop);
+        EmitConstant32  (o, numSlots);
+
+_       (SetStackPolymorphic (o));
+    }
+
+} _catch:
+    return result;
+}
+
 WASM3_STATIC
 M3Result  Compile_Memory_Size  (IM3Compilation o, m3opcode_t i_opcode)
 {
@@ -2058,6 +2329,24 @@ M3Result  Compile_Select  (IM3Compilation o, m3opcode_t i_opcode)
 
     IM3Operation op = NULL;
 
+#   if d_m3EnableConstantFolding
+    // the selector is known: the chosen value just stays on the stack
+    u64 selector;
+    if (IsOptimizingTier (o) and o->page and not IsStackPolymorphic (o) and GetNumBlockValuesOnStack (o) >= 3 and
+        GetStackConstant (o, GetStackTopIndex (o), & selector))
+    {
+_       (Pop (o));
+
+        if ((u32) selector)
+_           (Pop (o))
+        else
+_           (PopUnderStackTop (o))
+
+        o->numRemovedOps++;
+        goto _catch;
+    }
+#   endif
+
     if (IsFpType (type))
     {
 #   if d_m3HasFloat
@@ -2155,18 +2444,402 @@ _   (SetStackPolymorphic (o));
 }
 
 
+#if d_m3EnableSuperInstructions
+
+//----- SUPERINSTRUCTIONS -------------------------------------------------------------------------------------------------
+// A binary int operator with both operands in slots looks at the next opcode; if the pair has a fused
+// operation it's emitted instead, and the second opcode is consumed. Fused ops never touch _r0 for
+// their operands (see m3_exec.h), so the register state is the same as the unfused sequence leaves it.
+
+// the sets come from m3_fused_ops.h
+
+// binop ; local.set
+#define d_fusedSetLocalOp(OPCODE, TYPE, NAME, MACRO, OP)    [OPCODE - c_waOp_i32_add] = op_##TYPE##_##NAME##_sss,
+
+static const IM3Operation c_fusedSetLocalOps [c_waOp_i64_shr_u - c_waOp_i32_add + 1] =
+{
+    M3_FUSED_SETLOCAL_OPS (d_fusedSetLocalOp)
+};
+
+// compare ; br_if   { forward branch, loop continue }
+#define d_fusedBranchIfOp(OPCODE, TYPE, NAME, OP)           [OPCODE - c_waOp_i32_eq] = { op_##TYPE##_##NAME##_ss_BranchIf, op_##TYPE##_##NAME##_ss_ContinueLoopIf },
+
+static const IM3Operation c_fusedBranchIfOps [c_waOp_i64_ge_u - c_waOp_i32_eq + 1] [2] =
+{
+    M3_FUSED_BRANCHIF_OPS (d_fusedBranchIfOp)
+};
+
+// i32.add ; load  (fp loads keep the unfused path: their result goes to _fp0)
+#define d_fusedAddLoadOp(OPCODE, DEST_TYPE, SRC_TYPE)       [OPCODE - c_waOp_i32_load] = op_##DEST_TYPE##_Load_##SRC_TYPE##_ss,
+
+static const IM3Operation c_fusedAddLoadOps [c_waOp_i64_load32_u - c_waOp_i32_load + 1] =
+{
+    M3_FUSED_ADDLOAD_OPS (d_fusedAddLoadOp)
+};
+
+WASM3_STATIC
+bool  PeekOpcode  (IM3Compilation o, m3opcode_t * o_opcode, bytes_t * o_next)
+{
+    bytes_t wasm = o->wasm;
+
+    if (o->wasm >= o->wasmEnd or Read_opcode (&o->runtime->memory, o_opcode, & wasm, o->wasmEnd))
+        return false;
+
+    * o_next = wasm;
+    return true;
+}
+
+// same range as FindReferencedLocalWithinCurrentBlock, minus the operands about to be popped
+WASM3_STATIC
+bool  IsLocalReferencedBelowOperands  (IM3Compilation o, u16 i_localSlot, u16 i_numOperands)
+{
+    IM3CompilationScope scope = & o->block;
+    u16 startIndex = scope->blockStackIndex;
+
+    while (scope->opcode == c_waOp_block)
+    {
+        scope = scope->outer;
+        if (not scope)
+            break;
+
+        startIndex = scope->blockStackIndex;
+    }
+
+    for (u32 i = startIndex; i + i_numOperands < o->stackIndex; ++i)
+    {
+        if (o->wasmStack [i] == i_localSlot)
+            return true;
+    }
+
+    return false;
+}
+
+WASM3_STATIC_INLINE
+void  CountFusedOp  (IM3Compilation o, u32 i_numOpcodes)
+{
+    if (o->page)
+    {
+        o->numFusedOps++;
+        o->numFusedOpcodes += i_numOpcodes;
+    }
+}
+
+WASM3_STATIC
+M3Result  EmitFusedOperands  (IM3Compilation o, IM3Operation i_operation)
+{
+    M3Result result;
+
+_   (EmitOp (o, i_operation));
+_   (EmitSlotNumOfStackTopAndPop (o));
+_   (EmitSlotNumOfStackTopAndPop (o));
+
+    _catch: return result;
+}
+
+WASM3_STATIC
+M3Result  Compile_FusedSetLocal  (IM3Compilation o, IM3OpInfo i_opInfo, IM3Operation i_operation, bytes_t i_next, bool * o_fused)
+{
+    M3Result result = m3Err_none;
+
+    bytes_t wasm = i_next;
+    m3slot_t localIndex;
+
+    // malformed input is left to the unfused path to report
+    if (ReadLEB_ptr (&o->runtime->memory, & localIndex, & wasm, o->wasmEnd))
+        return m3Err_none;
+
+    if (localIndex >= GetFunctionNumArgsAndLocals (o->function) or GetStackTypeFromBottom (o, localIndex) != i_opInfo->type)
+        return m3Err_none;
+
+    u16 localSlot = GetSlotForStackIndex (o, localIndex);
+
+    // a pending local.get of the target would need a preserve copy
+    if (IsLocalReferencedBelowOperands (o, localSlot, 2))
+        return m3Err_none;
+
+_   (EmitFusedOperands (o, i_operation));
+    EmitSlotOffset (o, localSlot);
+
+#   if d_m3HoistMemoryBoundsChecks
+    InvalidateBoundsGroup (o, localSlot);
+#   endif
+
+    o->wasm = wasm;
+    * o_fused = true;
+    CountFusedOp (o, 2);
+
+    _catch: return result;
+}
+
+WASM3_STATIC
+M3Result  Compile_FusedBranchIf  (IM3Compilation o, const IM3Operation * i_operations, bytes_t i_next, bool * o_fused)
+{
+    M3Result result = m3Err_none;
+
+    bytes_t wasm = i_next;
+    m3slot_t depth;
+
+    if (ReadLEB_ptr (&o->runtime->memory, & depth, & wasm, o->wasmEnd) or depth > (m3slot_t) o->block.depth)
+        return m3Err_none;
+
+    IM3CompilationScope scope;
+_   (GetBlockScope (o, & scope, depth));
+
+    if (scope->opcode == c_waOp_loop)
+    {
+        if (GetFuncTypeNumParams (scope->type))
+            return m3Err_none;
+
+_       (EmitFusedOperands (o, i_operations [1]));
+        EmitPointer (o, scope->pc);
+    }
+    else
+    {
+        if (scope->depth == 0 or GetFuncTypeNumResults (scope->type))
+            return m3Err_none;
+
+_       (EmitFusedOperands (o, i_operations [0]));
+        EmitPatchingBranchPointer (o, scope);
+    }
+
+#   if d_m3HoistMemoryBoundsChecks
+    o->boundsReachPC = NULL;        // consumed br_if: see UpdateBoundsGroup
+#   endif
+
+    o->wasm = wasm;
+    * o_fused = true;
+    CountFusedOp (o, 2);
+
+    _catch: return result;
+}
+
+WASM3_STATIC
+M3Result  Compile_FusedAddLoad  (IM3Compilation o, m3opcode_t i_loadOpcode, bytes_t i_next, bool * o_fused)
+{
+    M3Result result = m3Err_none;
+
+    IM3Operation op = c_fusedAddLoadOps [i_loadOpcode - c_waOp_i32_load];
+    if (not op)
+        return m3Err_none;
+
+    bytes_t wasm = i_next;
+    m3slot_t alignHint, memoryOffset;
+
+    if (ReadLEB_ptr (&o->runtime->memory, & alignHint, & wasm, o->wasmEnd) or
+        ReadLEB_ptr (&o->runtime->memory, & memoryOffset, & wasm, o->wasmEnd))
+        return m3Err_none;
+
+    IM3OpInfo loadInfo = GetOpInfo (i_loadOpcode);
+    _throwif (m3Err_unknownOpcode, not loadInfo);
+
+_   (PreserveRegisterIfOccupied (o, loadInfo->type));
+_   (EmitFusedOperands (o, op));
+    EmitConstant32 (o, memoryOffset);
+_   (PushRegister (o, loadInfo->type));
+
+    o->wasm = wasm;
+    * o_fused = true;
+    CountFusedOp (o, 2);
+
+    _catch: return result;
+}
+
+// both operands are in slots
+WASM3_STATIC
+M3Result  Compile_FusedOperator  (IM3Compilation o, m3opcode_t i_opcode, IM3OpInfo i_opInfo, bool * o_fused)
+{
+    M3Result result = m3Err_none;
+
+    m3opcode_t next;
+    bytes_t afterNext;
+
+    if (not PeekOpcode (o, & next, & afterNext))
+        return m3Err_none;
+
+    if (next == c_waOp_setLocal and i_opcode >= c_waOp_i32_add and i_opcode <= c_waOp_i64_shr_u)
+    {
+        IM3Operation op = c_fusedSetLocalOps [i_opcode - c_waOp_i32_add];
+        if (op)
+_           (Compile_FusedSetLocal (o, i_opInfo, op, afterNext, o_fused));
+    }
+    else if (next == c_waOp_branchIf and i_opcode >= c_waOp_i32_eq and i_opcode <= c_waOp_i64_ge_u)
+    {
+        const IM3Operation * ops = c_fusedBranchIfOps [i_opcode - c_waOp_i32_eq];
+        if (ops [0])
+_           (Compile_FusedBranchIf (o, ops, afterNext, o_fused));
+    }
+    else if (i_opcode == c_waOp_i32_add and next >= c_waOp_i32_load and next <= c_waOp_i64_load32_u)
+    {
+_       (Compile_FusedAddLoad (o, next, afterNext, o_fused));
+    }
+
+    _catch: return result;
+}
+
+#endif // d_m3EnableSuperInstructions
+
+#if d_m3EnableConstantFolding
+
+WASM3_STATIC_INLINE i64  SignExtend  (u64 i_value, bool i_is64)     { return i_is64 ? (i64) i_value : (i64) (i32) (u32) i_value; }
+WASM3_STATIC_INLINE u64  ZeroExtend  (u64 i_value, bool i_is64)     { return i_is64 ? i_value : (u32) i_value; }
+
+// integer operators only; floats are left to the runtime (rounding modes, NaN payloads).
+// false when the operator would trap: the trap stays where it was
+WASM3_STATIC
+bool  EvaluateIntOperator  (m3opcode_t i_opcode, u64 i_a, u64 i_b, u64 * o_result)
+{
+    u64 r;
+
+    if (i_opcode == 0x45 or i_opcode == 0x50)                                                  // eqz
+    {
+        r = (ZeroExtend (i_a, i_opcode == 0x50) == 0);
+    }
+    else if ((i_opcode >= c_waOp_i32_eq and i_opcode <= 0x4f) or (i_opcode >= 0x51 and i_opcode <= c_waOp_i64_ge_u))
+    {
+        bool is64 = (i_opcode >= 0x51);
+        u64 ua = ZeroExtend (i_a, is64), ub = ZeroExtend (i_b, is64);
+        i64 sa = SignExtend (i_a, is64), sb = SignExtend (i_b, is64);
+
+        switch (i_opcode - (is64 ? 0x51 : c_waOp_i32_eq))
+        {
+            case 0: r = (ua == ub); break;
+            case 1: r = (ua != ub); break;
+            case 2: r = (sa <  sb); break;
+            case 3: r = (ua <  ub); break;
+            case 4: r = (sa >  sb); break;
+            case 5: r = (ua >  ub); break;
+            case 6: r = (sa <= sb); break;
+            case 7: r = (ua <= ub); break;
+            case 8: r = (sa >= sb); break;
+            default: r = (ua >= ub); break;
+        }
+    }
+    else if ((i_opcode >= 0x67 and i_opcode <= 0x69) or (i_opcode >= 0x79 and i_opcode <= 0x7b))  // clz, ctz, popcnt
+    {
+        bool is64 = (i_opcode >= 0x79);
+        u32 bits = is64 ? 64 : 32;
+        u64 ua = ZeroExtend (i_a, is64);
+
+        switch (i_opcode - (is64 ? 0x79 : 0x67))
+        {
+            case 0:  r = ua ? (u64) __builtin_clzll (ua) - (64 - bits) : bits; break;
+            case 1:  r = ua ? (u64) __builtin_ctzll (ua) : bits; break;
+            default: r = (u64) __builtin_popcountll (ua); break;
+        }
+    }
+    else if ((i_opcode >= c_waOp_i32_add and i_opcode <= 0x78) or (i_opcode >= 0x7c and i_opcode <= 0x8a))
+    {
+        bool is64 = (i_opcode >= 0x7c);
+        u32 bits = is64 ? 64 : 32;
+        u64 ua = ZeroExtend (i_a, is64), ub = ZeroExtend (i_b, is64);
+        i64 sa = SignExtend (i_a, is64), sb = SignExtend (i_b, is64);
+        i64 signedMin = is64 ? INT64_MIN : INT32_MIN;
+        u32 shift = (u32) ub & (bits - 1);
+
+        switch (i_opcode - (is64 ? 0x7c : c_waOp_i32_add))
+        {
+            case 0:  r = ua + ub; break;
+            case 1:  r = ua - ub; break;
+            case 2:  r = ua * ub; break;
+            case 3:  if (sb == 0 or (sa == signedMin and sb == -1)) return false;
+                     r = (u64) (sa / sb); break;
+            case 4:  if (ub == 0) return false;
+                     r = ua / ub; break;
+            case 5:  if (sb == 0) return false;
+                     r = (sb == -1) ? 0 : (u64) (sa % sb); break;
+            case 6:  if (ub == 0) return false;
+                     r = ua % ub; break;
+            case 7:  r = ua & ub; break;
+            case 8:  r = ua | ub; break;
+            case 9:  r = ua ^ ub; break;
+            case 10: r = ua << shift; break;
+            case 11: r = (u64) (sa >> shift); break;
+            case 12: r = ua >> shift; break;
+            case 13: r = shift ? (ua << shift) | (ua >> (bits - shift)) : ua; break;
+            default: r = shift ? (ua >> shift) | (ua << (bits - shift)) : ua; break;
+        }
+
+        r = ZeroExtend (r, is64);
+    }
+    else switch (i_opcode)
+    {
+        case 0xa7: r = (u32) i_a; break;                                                        // i32.wrap_i64
+        case 0xac: r = (u64) SignExtend (i_a, false); break;                                    // i64.extend_i32_s
+        case 0xad: r = (u32) i_a; break;                                                        // i64.extend_i32_u
+        case 0xc0: r = (u32) (i32) (i8) i_a; break;                                             // i32.extend8_s
+        case 0xc1: r = (u32) (i32) (i16) i_a; break;                                            // i32.extend16_s
+        case 0xc2: r = (u64) (i64) (i8) i_a; break;                                             // i64.extend8_s
+        case 0xc3: r = (u64) (i64) (i16) i_a; break;                                            // i64.extend16_s
+        case 0xc4: r = (u64) (i64) (i32) i_a; break;                                            // i64.extend32_s
+        default: return false;
+    }
+
+    * o_result = r;
+
+    return true;
+}
+
+// operands in the constant table: the result goes there too, instead of an operation
+WASM3_STATIC
+M3Result  FoldConstantOperator  (IM3Compilation o, m3opcode_t i_opcode, IM3OpInfo i_opInfo, bool * o_folded)
+{
+    M3Result result = m3Err_none;
+
+    u16 numOperands = (i_opInfo->stackOffset == -1) ? 2 : 1;
+
+    if (not o->page or not IsIntType (i_opInfo->type) or i_opInfo->stackOffset < -1 or i_opInfo->stackOffset > 0 or
+        IsStackPolymorphic (o) or GetNumBlockValuesOnStack (o) < numOperands)
+        goto _catch;
+
+    u16 top = GetStackTopIndex (o);
+    u64 a = 0, b = 0;
+
+    if (numOperands == 2)
+    {
+        if (not GetStackConstant (o, top - 1, & a) or not GetStackConstant (o, top, & b))
+            goto _catch;
+    }
+    else if (not GetStackConstant (o, top, & a))
+        goto _catch;
+
+    u64 value;
+    if (EvaluateIntOperator (i_opcode, a, b, & value))
+    {
+        for (u16 i = 0; i < numOperands; ++i)
+_           (Pop (o));
+
+_       (PushConst (o, value, i_opInfo->type));
+
+        o->numFoldedOps++;
+        * o_folded = true;
+    }
+
+    _catch: return result;
+}
+
+#endif // d_m3EnableConstantFolding
+
 // OPTZ: currently all stack slot indices take up a full word, but
 // dual stack source operands could be packed together
 DEBUG_TYPE WASM_DEBUG_Compile_Operator = WASM_DEBUG_ALL || (WASM_DEBUG && false);
-WASM3_STATIC M3Result  Compile_Operator  (IM3Compilation o, m3opcode_t i_opcode)
+// i_operations: opInfo->operations, or an alternative set with the same layout
+WASM3_STATIC M3Result  Compile_OperatorWith  (IM3Compilation o, m3opcode_t i_opcode, IM3OpInfo opInfo, const IM3Operation * i_operations)
 {
     M3Result result;
 
-    IM3OpInfo opInfo = GetOpInfo (i_opcode);
-    _throwif (m3Err_unknownOpcode, not opInfo);
-
     IM3Operation op;
 
+#   if d_m3EnableConstantFolding
+    if (IsOptimizingTier (o))
+    {
+        bool folded = false;
+_       (FoldConstantOperator (o, i_opcode, opInfo, & folded));
+
+        if (folded)
+            goto _catch;
+    }
+#   endif
+
     // This preserve is for for FP compare operations.
     // either need additional slot destination operations or the
     // easy fix, move _r0 out of the way.
@@ -2179,16 +2852,29 @@ _       (PreserveRegisterIfOccupied (o, opInfo->type));
     }
 
     if(WASM_DEBUG_Compile_Operator) ESP_LOGI("WASM3", "Compile_Operator: opInfo->stackOffset = %d", opInfo->stackOffset);
+
+#   if d_m3EnableSuperInstructions
+    if (IsOptimizingTier (o) and not o->runtime->disableFusion and opInfo->stackOffset == -1 and IsIntType (opInfo->type) and
+        not IsStackPolymorphic (o) and GetNumBlockValuesOnStack (o) >= 2 and not IsStackTopInRegister (o) and not IsStackTopMinus1InRegister (o))
+    {
+        bool fused = false;
+_       (Compile_FusedOperator (o, i_opcode, opInfo, & fused));
+
+        if (fused)
+            goto _catch;
+    }
+#   endif
+
     if (opInfo->stackOffset == 0)
     {
         if (IsStackTopInRegister (o))
         {
-            op = opInfo->operations [0]; // _s
+            op = i_operations [0]; // _s
         }
         else
         {
 _           (PreserveRegisterIfOccupied (o, opInfo->type));
-            op = opInfo->operations [1]; // _r
+            op = i_operations [1]; // _r
         }
     }
     else
@@ -2197,28 +2883,28 @@ _           (PreserveRegisterIfOccupied (o, opInfo->type));
         {
             if(WASM_DEBUG_Compile_Operator) ESP_LOGI("WASM3", "Compile_Operator: IsStackTopInRegister");
 
-            op = opInfo->operations [0];  // _rs
+            op = i_operations [0];  // _rs
 
             if (IsStackTopMinus1InRegister (o))
             {                                       d_m3Assert (i_opcode == c_waOp_store_f32 or i_opcode == c_waOp_store_f64);
-                op = opInfo->operations [3]; // _rr for fp.store
+                op = i_operations [3]; // _rr for fp.store
             }
         }
         else if (IsStackTopMinus1InRegister (o))
         {
             if(WASM_DEBUG_Compile_Operator) ESP_LOGI("WASM3", "Compile_Operator: IsStackTopMinus1InRegister");
 
-            op = opInfo->operations [1]; // _sr
+            op = i_operations [1]; // _sr
 
             if (not op)  // must be commutative, then
-                op = opInfo->operations [0];
+                op = i_operations [0];
         }
         else
         {
             if(WASM_DEBUG_Compile_Operator) ESP_LOGI("WASM3", "Compile_Operator: else PreserveRegisterIfOccupied");
 
 _           (PreserveRegisterIfOccupied (o, opInfo->type));     // _ss
-            op = opInfo->operations [2];
+            op = i_operations [2];
         }
     }
 
@@ -2252,6 +2938,15 @@ _           (PushRegister (o, opInfo->type));
     _catch: return result;
 }
 
+WASM3_STATIC M3Result  Compile_Operator  (IM3Compilation o, m3opcode_t i_opcode)
+{
+    IM3OpInfo opInfo = GetOpInfo (i_opcode);
+    if (not opInfo)
+        return m3Err_unknownOpcode;
+
+    return Compile_OperatorWith (o, i_opcode, opInfo, opInfo->operations);
+}
+
 WASM3_STATIC
 M3Result  Compile_Convert  (IM3Compilation o, m3opcode_t i_opcode)
 {
@@ -2276,6 +2971,109 @@ _       (PushRegister (o, opInfo->type))
     _catch: return result;
 }
 
+#if d_m3HoistMemoryBoundsChecks
+
+// Bounds check hoisting
+// Gli accessi sulla stessa base (arg, local o costante, non riscritta) all'interno di un blocco
+// condividono un solo controllo: il primo accesso del gruppo usa la variante _Range, il cui
+// immediate 'reach' copre il massimo offset + size del gruppo; gli altri usano _Unchecked.
+// Quando un accesso successivo va oltre, il reach del primo viene allargato finche' in mezzo ci sono
+// solo load e operazioni pure (UpdateBoundsGroup); altrimenti si apre un nuovo gruppo.
+typedef struct M3HoistedAccess
+{
+    u8                  size;
+    IM3Operation        range       [4];    // same layout as M3OpInfo.operations; address in a slot only
+    IM3Operation        unchecked   [4];
+}
+M3HoistedAccess;
+
+#define d_hoistedLoad(OPCODE, SIZE, TYPE, NAME)     [OPCODE - c_waOp_i32_load] = { SIZE,                                                \
+                                                    { NULL, op_##TYPE##_##NAME##_s_Range, NULL, NULL },                                 \
+                                                    { NULL, op_##TYPE##_##NAME##_s_Unchecked, NULL, NULL } }
+#define d_hoistedStore(OPCODE, SIZE, TYPE, NAME)    [OPCODE - c_waOp_i32_load] = { SIZE,                                                \
+                                                    { op_##TYPE##_##NAME##_rs_Range, NULL, op_##TYPE##_##NAME##_ss_Range, NULL },         \
+                                                    { op_##TYPE##_##NAME##_rs_Unchecked, NULL, op_##TYPE##_##NAME##_ss_Unchecked, NULL } }
+
+static const M3HoistedAccess c_hoistedAccesses [c_waOp_i64_store32 - c_waOp_i32_load + 1] =
+{
+    d_hoistedLoad   (0x28, 4, i32, Load_i32),
+    d_hoistedLoad   (0x29, 8, i64, Load_i64),
+#   if d_m3HasFloat
+    d_hoistedLoad   (0x2a, 4, f32, Load_f32),
+    d_hoistedLoad   (0x2b, 8, f64, Load_f64),
+#   endif
+    d_hoistedLoad   (0x2c, 1, i32, Load_i8),
+    d_hoistedLoad   (0x2d, 1, i32, Load_u8),
+    d_hoistedLoad   (0x2e, 2, i32, Load_i16),
+    d_hoistedLoad   (0x2f, 2, i32, Load_u16),
+    d_hoistedLoad   (0x30, 1, i64, Load_i8),
+    d_hoistedLoad   (0x31, 1, i64, Load_u8),
+    d_hoistedLoad   (0x32, 2, i64, Load_i16),
+    d_hoistedLoad   (0x33, 2, i64, Load_u16),
+    d_hoistedLoad   (0x34, 4, i64, Load_i32),
+    d_hoistedLoad   (0x35, 4, i64, Load_u32),
+
+    d_hoistedStore  (0x36, 4, i32, Store_i32),
+    d_hoistedStore  (0x37, 8, i64, Store_i64),
+#   if d_m3HasFloat
+    d_hoistedStore  (0x38, 4, f32, Store_f32),
+    d_hoistedStore  (0x39, 8, f64, Store_f64),
+#   endif
+    d_hoistedStore  (0x3a, 1, i32, Store_u8),
+    d_hoistedStore  (0x3b, 2, i32, Store_i16),
+    d_hoistedStore  (0x3c, 1, i64, Store_u8),
+    d_hoistedStore  (0x3d, 2, i64, Store_i16),
+    d_hoistedStore  (0x3e, 4, i64, Store_i32),
+};
+
+// picks the operation set for a load/store and updates the group. *o_isHead: the access opens a
+// new group, the caller emits its reach immediate
+WASM3_STATIC
+const IM3Operation *  GetHoistedOperations  (IM3Compilation o, m3opcode_t i_opcode, IM3OpInfo i_opInfo, m3slot_t i_offset, bool * o_isHead)
+{
+    * o_isHead = false;
+
+    const M3HoistedAccess * access = & c_hoistedAccesses [i_opcode - c_waOp_i32_load];
+    u16 numOperands = (i_opInfo->stackOffset < 0) ? 2 : 1;
+
+    if (not IsOptimizingTier (o) or not access->size or not o->function or IsStackPolymorphic (o) or GetNumBlockValuesOnStack (o) < numOperands)
+        return i_opInfo->operations;
+
+    // only slots rewritten by nothing but local.set: args, locals and constants (registers alias far above)
+    u16 base = o->wasmStack [o->stackIndex - numOperands];
+    u64 extent = (u64) i_offset + access->size;
+
+    if (base < o->function->numRetSlots or base >= o->slotFirstDynamicIndex or extent > UINT32_MAX)
+        return i_opInfo->operations;
+
+    if (base == o->boundsBaseSlot and extent <= o->boundsExtent)
+    {
+        o->numUncheckedOps++;
+        return access->unchecked;
+    }
+
+    if (base == o->boundsBaseSlot and o->boundsReachPC)
+    {
+        u32 reach = (u32) extent - o->boundsHeadOffset;
+        memcpy ((void *) o->boundsReachPC, & reach, sizeof (reach));
+
+        o->boundsExtent = (u32) extent;
+        o->numUncheckedOps++;
+        return access->unchecked;
+    }
+
+    o->boundsBaseSlot = base;
+    o->boundsExtent = (u32) extent;
+    o->boundsHeadOffset = (u32) i_offset;
+    o->boundsReachPC = NULL;
+    o->numRangeChecks++;
+
+    * o_isHead = true;
+    return access->range;
+}
+
+#endif // d_m3HoistMemoryBoundsChecks
+
 WASM3_STATIC
 M3Result  Compile_Load_Store  (IM3Compilation o, m3opcode_t i_opcode)
 {
@@ -2293,9 +3091,30 @@ _   (ReadLEB_ptr (mem, & memoryOffset, & o->wasm, o->wasmEnd));
     if (IsFpType (opInfo->type))
 _       (PreserveRegisterIfOccupied (o, c_m3Type_f64));
 
+#   if d_m3HoistMemoryBoundsChecks
+    bool isHead;
+    const IM3Operation * operations = GetHoistedOperations (o, i_opcode, opInfo, memoryOffset, & isHead);
+
+_   (Compile_OperatorWith (o, i_opcode, opInfo, operations));
+
+    EmitConstant32 (o, memoryOffset);
+
+    if (isHead)
+    {
+        if (o->page)
+            o->boundsReachPC = GetPC (o);
+
+        EmitConstant32 (o, o->boundsExtent - o->boundsHeadOffset);
+    }
+
+    // a store is a visible effect: later accesses can't move their trap ahead of it
+    if (opInfo->stackOffset < 0)
+        o->boundsReachPC = NULL;
+#   else
 _   (Compile_Operator (o, i_opcode));
 
     EmitConstant32 (o, memoryOffset);
+#   endif
 }
     _catch: return result;
 }
@@ -2310,11 +3129,20 @@ M3Result  CompileRawFunction  (IM3Module io_module,  IM3Function io_function, co
 
     if (page)
     {
+#       if (d_m3EnableCodePageRefCounting)
+        M3Result result = Function_AddCodePage (io_function, page);
+        if (result)
+        {
+            ReleaseCodePage (io_module->runtime, page);
+            return result;
+        }
+#       endif
+
         io_function->compiled = GetPagePC (page);
         io_function->module = io_module;
 
         if(WASM_DEBUG_CompileRawFunction) ESP_LOGI("WASM3", "CompileRawFunction: EmitWord op_CallRawFunction");
-        EmitWord (page, op_CallRawFunction);
+        EmitWord (page, m3OpWord (op_CallRawFunction));
 
         if(WASM_DEBUG_CompileRawFunction) ESP_LOGI("WASM3", "CompileRawFunction: EmitWord i_function");
         EmitWord (page, i_function);
@@ -2363,8 +3191,8 @@ const M3OpInfo c_operations [] =
     M3OP( "return", 10, 0,  any,    d_logOp (Return),                   Compile_Return ),       // 0x0a
     M3OP( "call", 11, 0,  any,    d_logOp (Call),                     Compile_Call ),         // 0x0b
     M3OP( "call_indirect", 12, 0,  any,    d_logOp (CallIndirect),             Compile_CallIndirect ), // 0x0c
-    M3OP( "return_call", 13, 0,  any,    d_emptyOpList,                      Compile_Call ),         // 0x0d
-    M3OP( "return_call_indirect", 14, 0,  any,    d_emptyOpList,                      Compile_CallIndirect ), // 0x0e
+    M3OP( "return_call", 13, 0,  any,    d_logOp (ReturnCall),               Compile_ReturnCall ),   // 0x0d
+    M3OP( "return_call_indirect", 14, 0,  any,    d_logOp (ReturnCallIndirect),       Compile_ReturnCall ),   // 0x0e
 
     M3OP_RESERVED,  M3OP_RESERVED,                                                                      // 0x14...
     M3OP_RESERVED,  M3OP_RESERVED, M3OP_RESERVED, M3OP_RESERVED,                                        // ...0x19
@@ -2709,6 +3537,17 @@ _       (Read_opcode (&o->runtime->memory, & opcode, & o->wasm, o->wasmEnd));
             _throw (ErrorCompile (m3Err_unknownOpcode, o, "opcode '%x' not available", opcode));
         }
 
+#       if d_m3HoistMemoryBoundsChecks
+        UpdateBoundsGroup (o, opcode);
+#       endif
+
+#       if d_m3EnableConstantFolding
+        if (not (opcode == 0x01 or opcode == 0x1a or                                    // nop, drop
+                 (opcode >= c_waOp_getLocal and opcode <= c_waOp_teeLocal) or
+                 (opcode >= c_waOp_i32_const and opcode <= c_waOp_f64_const)))
+            o->copyEndPC = NULL;
+#       endif
+
         if (opinfo->compiler) {
             if(WASM_DEBUG_CompileBlockStatements) ESP_LOGI("WASM3", "CompileBlockStatements: compiler available (%p)", opinfo->compiler);
 _           ((* opinfo->compiler) (o, opcode))            
@@ -2804,6 +3643,15 @@ M3Result  CompileBlock  (IM3Compilation o, IM3FuncType i_blockType, m3opcode_t i
     */
 
 _try {
+#   if d_m3EnableTieredCompile
+    // first op of every iteration: ContinueLoop jumps back to block->pc
+    if (i_blockOpcode == c_waOp_loop and o->function and not IsOptimizingTier (o))
+    {
+_       (EmitOp (o, op_CountBackEdge));
+        EmitPointer (o, o->function);
+    }
+#   endif
+
     // validate and dealloc params ----------------------------
 
     u16 stackIndex = o->stackIndex;
@@ -2963,6 +3811,29 @@ M3Result  ReserveConstants  (IM3Compilation o)
 }
 
 
+// per-compilation counters, so that concurrent compilations don't race on the runtime's
+WASM3_STATIC
+void  AddCompilationCounters  (IM3Compilation o)
+{
+#   if (d_m3EnableSuperInstructions || d_m3HoistMemoryBoundsChecks || d_m3EnableConstantFolding)
+    LockCompilePool (o->runtime);
+#       if d_m3EnableSuperInstructions
+        o->runtime->numFusedOps        += o->numFusedOps;
+        o->runtime->numFusedOpcodes    += o->numFusedOpcodes;
+#       endif
+#       if d_m3HoistMemoryBoundsChecks
+        o->runtime->numRangeChecks     += o->numRangeChecks;
+        o->runtime->numUncheckedOps    += o->numUncheckedOps;
+#       endif
+#       if d_m3EnableConstantFolding
+        o->module->numFoldedOps        += o->numFoldedOps;
+        o->module->numRemovedOps       += o->numRemovedOps;
+#       endif
+    UnlockCompilePool (o->runtime);
+#   endif
+}
+
+
 const double WASM_DEBUG_CompileFunction = WASM_DEBUG_ALL || (WASM_DEBUG && false);
 M3Result  CompileFunction  (IM3Function io_function)
 {
@@ -2970,11 +3841,58 @@ M3Result  CompileFunction  (IM3Function io_function)
     
     if (!io_function->wasm) return "function body is missing";
 
+    IM3Runtime runtime = io_function->module->runtime;
+
+#   if d_m3EnableParallelCompile
+    if (runtime->compilePool)
+        return CompilePool_CompileFunction (runtime->compilePool, io_function);    // waits for, or steals, a background compile
+#   endif
+
+    return CompileFunctionWith (io_function, & runtime->compilation, c_m3TierFirst);
+}
+
+
+#if d_m3EnableTieredCompile
+DEBUG_TYPE WASM_DEBUG_TierUpFunction = WASM_DEBUG_ALL || (WASM_DEBUG && false);
+// called by op_CountCall and op_CountBackEdge, on the executing thread: runtime->compilation is free.
+// the baseline code isn't released, frames still running it and op_Calls holding its entry need it
+M3Result  TierUpFunction  (IM3Function io_function)
+{
+    M3Result result = m3Err_none;
+
+    pc_t baseline = GetFunctionCompiled (io_function);
+
+    if (io_function->tier == c_m3TierBaseline and baseline)
+    {
+        IM3Runtime runtime = io_function->module->runtime;
+
+        result = CompileFunctionWith (io_function, & runtime->compilation, c_m3TierOptimized);
+
+        if (not result)
+        {
+            io_function->baselineCompiled = baseline;
+            io_function->tier = c_m3TierOptimized;
+
+            LockCompilePool (runtime);
+            runtime->numTierUps++;
+            UnlockCompilePool (runtime);
+
+            if (WASM_DEBUG_TierUpFunction) ESP_LOGI ("WASM3", "TierUpFunction: %s optimised after %u calls, %u iterations", m3_GetFunctionName (io_function), io_function->numCalls, io_function->numBackEdges);
+        }
+        else ESP_LOGW ("WASM3", "TierUpFunction: %s stays in the baseline tier (%s)", m3_GetFunctionName (io_function), result);
+    }
+
+    return result;
+}
+#endif
+
+
+M3Result  CompileFunctionWith  (IM3Function io_function, IM3Compilation o, u8 i_tier)
+{
     IM3FuncType funcType = io_function->funcType;                   m3log (compile, "compiling: [%d] %s %s; wasm-size: %d",
                                                                         io_function->index, m3_GetFunctionName (io_function), SPrintFuncTypeSignature (funcType), (u32) (io_function->wasmEnd - io_function->wasm));
     IM3Runtime runtime = io_function->module->runtime;
-
-    IM3Compilation o = & runtime->compilation;                      d_m3Assert (d_m3MaxFunctionSlots >= d_m3MaxFunctionStackHeight * (d_m3Use32BitSlots + 1))  // need twice as many slots in 32-bit mode
+                                                                    d_m3Assert (d_m3MaxFunctionSlots >= d_m3MaxFunctionStackHeight * (d_m3Use32BitSlots + 1))  // need twice as many slots in 32-bit mode
     memset (o, 0x0, sizeof (M3Compilation));
 
     o->runtime  = runtime;
@@ -2984,6 +3902,14 @@ M3Result  CompileFunction  (IM3Function io_function)
     o->wasmEnd  = io_function->wasmEnd;
     o->block.type = funcType;
 
+#   if d_m3EnableTieredCompile
+    o->tier     = i_tier;
+#   endif
+
+#   if d_m3EnableCodeCache
+    o->codeLayout = NewCodeLayout ();   // without it the function just isn't cacheable
+#   endif
+
 _try {
     // skip over code size. the end was already calculated during parse phase
     u32 size;
@@ -3031,31 +3957,67 @@ _   (ReserveConstants (o));
 
     o->block.blockStackIndex = o->stackFirstDynamicIndex = o->stackIndex;                           m3log (compile, "start stack index: %d",
                                                                                                           (u32) o->stackFirstDynamicIndex);
+#   if d_m3EnableTieredCompile
+    if (not IsOptimizingTier (o))
+    {
+_       (EmitOp (o, op_CountCall));
+        EmitPointer (o, io_function);
+    }
+#   endif
+
 _   (EmitOp (o, op_Entry));
     EmitPointer (o, io_function);
 
+#   if d_m3HoistMemoryBoundsChecks
+    ResetBoundsGroup (o);
+#   endif
+
 _   (CompileBlockStatements (o));
 
     // TODO: validate opcode sequences
     _throwif(m3Err_wasmMalformed, o->previousOpcode != c_waOp_end);
 
-    io_function->compiled = pc;
+    u16 numConstantSlots = o->slotMaxConstIndex - o->slotFirstConstIndex;                           m3log (compile, "unique constant slots: %d; unused slots: %d",
+                                                                                                           numConstantSlots, o->slotFirstDynamicIndex - o->slotMaxConstIndex);
+    void * constants = NULL;
+
+    if (numConstantSlots)
+    {
+        constants = m3_Int_CopyMem (o->constants, numConstantSlots * sizeof (m3slot_t));
+        _throwifnull(constants);
+    }
 
+    // the frame is only set up once nothing can fail: when tiering up, the baseline code still uses the old one
     if(WASM_DEBUG_CompileFunction) ESP_LOGI("WASM3", "Assigning io_function->maxStacksSlots");
     io_function->maxStackSlots = o->maxStackSlots;
 
-    u16 numConstantSlots = o->slotMaxConstIndex - o->slotFirstConstIndex;                           m3log (compile, "unique constant slots: %d; unused slots: %d",
-                                                                                                           numConstantSlots, o->slotFirstDynamicIndex - o->slotMaxConstIndex);
     io_function->numConstantBytes = numConstantSlots * sizeof (m3slot_t);
 
-    if (numConstantSlots)
+    m3_Def_Free (io_function->constants);       // baseline frames copied theirs at op_Entry
+    io_function->constants = constants;
+
+#   if d_m3EnableCodeCache
+    if (o->codeLayout)
     {
-        io_function->constants = m3_Int_CopyMem (o->constants, io_function->numConstantBytes);
-        _throwifnull(io_function->constants);
+        CodeLayout_Close (o->codeLayout);
+
+        FreeCodeLayout (io_function->codeLayout);
+        io_function->codeLayout = o->codeLayout;
+        o->codeLayout = NULL;
     }
+#   endif
+
+    AddCompilationCounters (o);
+
+    SetFunctionCompiled (io_function, pc);      // last: another thread may run it as soon as it's set
 
 } _catch:
 
+#   if d_m3EnableCodeCache
+    FreeCodeLayout (o->codeLayout);
+    o->codeLayout = NULL;
+#   endif
+
     ReleaseCompilationCodePage (o);
 
     return result;
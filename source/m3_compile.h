@@ -11,6 +11,7 @@
 
 #include "wasm3.h"
 #include "m3_code.h"
+#include "m3_code_cache.h"
 #include "m3_exec_defs.h"
 #include "m3_function.h"
 
@@ -41,20 +42,31 @@ enum
     c_waOp_branchTable          = 0x0e,
     c_waOp_branchIf             = 0x0d,
     c_waOp_call                 = 0x10,
+    c_waOp_returnCall           = 0x12,
+    c_waOp_returnCallIndirect   = 0x13,
     c_waOp_getLocal             = 0x20,
     c_waOp_setLocal             = 0x21,
     c_waOp_teeLocal             = 0x22,
 
     c_waOp_getGlobal            = 0x23,
 
+    c_waOp_i32_load             = 0x28,
+    c_waOp_i64_load32_u         = 0x35,
+
     c_waOp_store_f32            = 0x38,
     c_waOp_store_f64            = 0x39,
+    c_waOp_i64_store32          = 0x3e,
 
     c_waOp_i32_const            = 0x41,
     c_waOp_i64_const            = 0x42,
     c_waOp_f32_const            = 0x43,
     c_waOp_f64_const            = 0x44,
 
+    c_waOp_i32_eq               = 0x46,
+    c_waOp_i64_ge_u             = 0x5a,
+    c_waOp_i32_add              = 0x6a,
+    c_waOp_i64_shr_u            = 0x88,
+
     c_waOp_extended             = 0xfc,
 
     c_waOp_memoryCopy           = 0xfc0a,
@@ -131,6 +143,40 @@ typedef struct
     u16                 regStackIndexPlusOne        [2];
 
     m3opcode_t          previousOpcode;
+
+#if d_m3EnableTieredCompile
+    u8                  tier;                       // c_m3Tier*
+#endif
+
+#if d_m3EnableCodeCache
+    IM3CodeLayout       codeLayout;                 // handed to the function when it compiles
+#endif
+
+#if d_m3EnableSuperInstructions
+    u32                 numFusedOps;                // added to the runtime counters when the function compiles
+    u32                 numFusedOpcodes;
+#endif
+
+#if d_m3HoistMemoryBoundsChecks
+    // current group of loads/stores sharing one bounds check (see Compile_Load_Store)
+    u16                 boundsBaseSlot;             // address slot (arg, local or constant); c_slotUnused when there is no group
+    u32                 boundsExtent;               // bytes past the base address already covered by the check
+    u32                 boundsHeadOffset;           // memory offset of the access carrying the check
+    pc_t                boundsReachPC;              // its 'reach' immediate; NULL once widening it could move a trap
+
+    u32                 numRangeChecks;             // added to the runtime counters when the function compiles
+    u32                 numUncheckedOps;
+#endif
+
+#if d_m3EnableConstantFolding
+    // last plain local.set/tee copy (see Compile_SetLocal); it's dead if the same slot is overwritten right after
+    pc_t                copyStartPC;
+    pc_t                copyEndPC;                  // NULL when anything else was compiled since
+    u16                 copySlot;
+
+    u32                 numFoldedOps;               // added to the module counters when the function compiles
+    u32                 numRemovedOps;
+#endif
 }
 M3Compilation;
 
@@ -228,6 +274,16 @@ M3Result    CompileBlock                (IM3Compilation io, IM3FuncType i_blockT
 
 M3Result    CompileBlockStatements      (IM3Compilation io);
 M3Result    CompileFunction             (IM3Function io_function);
+M3Result    CompileFunctionWith         (IM3Function io_function, IM3Compilation o, u8 i_tier);     // o: scratch state of the compiling thread
+
+# if d_m3EnableTieredCompile
+// recompiles a baseline function with the optimising passes; running baseline frames finish in the old code
+M3Result    TierUpFunction              (IM3Function io_function);
+
+#   define IsOptimizingTier(o)          ((o)->tier == c_m3TierOptimized)
+# else
+#   define IsOptimizingTier(o)          true
+# endif
 
 M3Result    CompileRawFunction          (IM3Module io_module, IM3Function io_function, const void * i_function, const void * i_userdata);
 
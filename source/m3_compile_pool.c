@@ -0,0 +1,309 @@
+//
+//  m3_compile_pool.c
+//
+//  Background compilation on worker threads, see m3_compile_pool.h.
+//
+
+#include <string.h>
+
+#include "m3_compile_pool.h"
+#include "m3_compile.h"
+#include "wasm3.h"
+
+# if d_m3EnableParallelCompile
+
+# if d_m3FixedHeap
+#   error "d_m3EnableParallelCompile needs a thread safe allocator: the fixed heap isn't"
+# endif
+
+DEBUG_TYPE WASM_DEBUG_COMPILE_POOL = WASM_DEBUG_ALL || (WASM_DEBUG && false);
+
+
+void  LockCompilePool  (IM3Runtime i_runtime)
+{
+    if (i_runtime and i_runtime->compilePool)
+        pthread_mutex_lock (& i_runtime->compilePool->lock);
+}
+
+
+void  UnlockCompilePool  (IM3Runtime i_runtime)
+{
+    if (i_runtime and i_runtime->compilePool)
+        pthread_mutex_unlock (& i_runtime->compilePool->lock);
+}
+
+
+static void *  CompileWorker  (void * i_pool)
+{
+    IM3CompilePool pool = (IM3CompilePool) i_pool;
+
+    // ~11 KB: it doesn't belong on a worker stack. without it the queue is left to CompileFunction
+    IM3Compilation o = m3_Def_AllocStruct (M3Compilation);
+
+    pthread_mutex_lock (& pool->lock);
+
+    while (o and not pool->stopping and pool->queueNext < pool->queueLength)
+    {
+        IM3Function function = pool->queue [pool->queueNext++];
+
+        if (function->compileState != c_m3CompileQueued)
+            continue;                                               // CompileFunction took it meanwhile
+
+        function->compileState = c_m3CompileRunning;
+        pthread_mutex_unlock (& pool->lock);
+
+        M3Result result = GetFunctionCompiled (function) ? m3Err_none : CompileFunctionWith (function, o, c_m3TierFirst);
+
+        if (WASM_DEBUG_COMPILE_POOL) ESP_LOGI ("WASM3", "CompileWorker: function %d compiled (%s)", (int) (function - function->module->functions), result ? result : "ok");
+
+        pthread_mutex_lock (& pool->lock);
+
+        function->compileState = c_m3CompileIdle;
+
+        if (result and not pool->firstError)
+            pool->firstError = result;
+
+        pthread_cond_broadcast (& pool->changed);
+    }
+
+    pthread_mutex_unlock (& pool->lock);
+
+    m3_Def_Free (o);
+
+    return NULL;
+}
+
+
+// the workers stop when the queue is empty; what's still queued after them goes back to op_Compile
+static void  JoinCompileWorkers  (IM3CompilePool io_pool)
+{
+    for (u32 i = 0; i < io_pool->numThreads; ++i)
+        pthread_join (io_pool->threads [i], NULL);
+
+    m3_Def_Free (io_pool->threads);
+    io_pool->threads = NULL;
+    io_pool->numThreads = 0;
+
+    pthread_mutex_lock (& io_pool->lock);
+
+    for (u32 i = 0; i < io_pool->queueLength; ++i)
+    {
+        IM3Function function = io_pool->queue [i];
+
+        if (function->compileState == c_m3CompileQueued)
+            function->compileState = c_m3CompileIdle;
+    }
+
+    io_pool->queueLength = io_pool->queueNext = 0;
+
+    pthread_mutex_unlock (& io_pool->lock);
+
+    m3_Def_Free (io_pool->queue);
+    io_pool->queue = NULL;
+}
+
+
+M3Result  CompilePool_CompileFunction  (IM3CompilePool io_pool, IM3Function io_function)
+{
+    M3Result result = m3Err_none;
+
+    pthread_mutex_lock (& io_pool->lock);
+
+    while (io_function->compileState == c_m3CompileRunning)
+        pthread_cond_wait (& io_pool->changed, & io_pool->lock);
+
+    bool compiled = GetFunctionCompiled (io_function);
+
+    if (not compiled)
+        io_function->compileState = c_m3CompileRunning;             // queued or not, this thread compiles it
+
+    pthread_mutex_unlock (& io_pool->lock);
+
+    if (not compiled)
+    {
+        result = CompileFunctionWith (io_function, & io_pool->runtime->compilation, c_m3TierFirst);
+
+        pthread_mutex_lock (& io_pool->lock);
+        io_function->compileState = c_m3CompileIdle;
+        pthread_cond_broadcast (& io_pool->changed);
+        pthread_mutex_unlock (& io_pool->lock);
+    }
+
+    return result;
+}
+
+
+static bool  QueueFunction  (IM3CompilePool io_pool, IM3Function io_function)
+{
+    if (io_function->wasm and not GetFunctionCompiled (io_function) and io_function->compileState == c_m3CompileIdle)
+    {
+        io_function->compileState = c_m3CompileQueued;
+        io_pool->queue [io_pool->queueLength++] = io_function;
+
+        return true;
+    }
+
+    return false;
+}
+
+
+static M3Result  NewCompilePool  (IM3CompilePool * o_pool, IM3Runtime i_runtime)
+{
+    M3Result result = m3Err_none;
+
+    IM3CompilePool pool = m3_Def_AllocStruct (M3CompilePool);
+    _throwifnull (pool);
+
+    pool->runtime = i_runtime;
+
+    if (pthread_mutex_init (& pool->lock, NULL))
+    {
+        m3_Def_Free (pool);
+        _throw (m3Err_compileThreadFailed);
+    }
+
+    if (pthread_cond_init (& pool->changed, NULL))
+    {
+        pthread_mutex_destroy (& pool->lock);
+        m3_Def_Free (pool);
+        _throw (m3Err_compileThreadFailed);
+    }
+
+    * o_pool = pool;
+
+    _catch: return result;
+}
+
+
+void  FreeCompilePool  (IM3Runtime io_runtime)
+{
+    IM3CompilePool pool = io_runtime->compilePool;
+
+    if (pool)
+    {
+        pthread_mutex_lock (& pool->lock);
+        pool->stopping = true;
+        pthread_mutex_unlock (& pool->lock);
+
+        JoinCompileWorkers (pool);
+
+        io_runtime->compilePool = NULL;
+
+        pthread_cond_destroy (& pool->changed);
+        pthread_mutex_destroy (& pool->lock);
+        m3_Def_Free (pool);
+    }
+}
+
+
+M3Result  m3_CompileModuleInBackground  (IM3Module io_module, uint32_t i_numThreads, bool i_hotOnly)
+{
+    M3Result result = m3Err_none;
+
+    IM3Runtime runtime = io_module->runtime;
+    _throwif (m3Err_nullRuntime, not runtime);
+
+    if (not i_numThreads)
+        i_numThreads = d_m3CompileThreads;
+
+    IM3CompilePool pool = runtime->compilePool;
+
+    if (pool)
+        JoinCompileWorkers (pool);                                  // one batch at a time
+    else
+    {
+_       (NewCompilePool (& pool, runtime));
+        runtime->compilePool = pool;
+    }
+
+    pool->firstError = m3Err_none;
+    pool->queue = m3_Def_AllocArray (IM3Function, io_module->numFunctions);
+    _throwifnull (pool->queue);
+
+    // likely hot first: the start function is about to run, then what the host can call
+    if (io_module->startFunction >= 0)
+        QueueFunction (pool, & io_module->functions [io_module->startFunction]);
+
+    for (u32 i = 0; i < io_module->numFunctions; ++i)
+    {
+        IM3Function function = & io_module->functions [i];
+
+        if (function->export_name)
+            QueueFunction (pool, function);
+    }
+
+    if (not i_hotOnly)
+    {
+        for (u32 i = 0; i < io_module->numFunctions; ++i)
+            QueueFunction (pool, & io_module->functions [i]);
+    }
+
+    if (WASM_DEBUG_COMPILE_POOL) ESP_LOGI ("WASM3", "m3_CompileModuleInBackground: %d functions queued for %d threads", pool->queueLength, i_numThreads);
+
+    if (not pool->queueLength)
+        goto _catch;
+
+#   if d_m3HasOperationTable
+    m3_GetNumOperations ();                                         // the table is built lazily and not thread safe: build it now
+#   endif
+
+    pool->threads = m3_Def_AllocArray (pthread_t, i_numThreads);
+    _throwifnull (pool->threads);
+
+    pthread_attr_t attributes;
+    pthread_attr_init (& attributes);
+    pthread_attr_setstacksize (& attributes, d_m3CompileThreadStackSize);
+
+    for (u32 i = 0; i < i_numThreads; ++i)
+    {
+        if (pthread_create (& pool->threads [pool->numThreads], & attributes, CompileWorker, pool))
+            break;
+
+        pool->numThreads++;
+    }
+
+    pthread_attr_destroy (& attributes);
+
+    // whatever no worker takes is compiled lazily, as usual
+    if (not pool->numThreads)
+    {
+        ESP_LOGW ("WASM3", "m3_CompileModuleInBackground: no compile thread started");
+        _throw (m3Err_compileThreadFailed);
+    }
+
+    _catch: return result;
+}
+
+
+M3Result  m3_WaitForBackgroundCompile  (IM3Runtime i_runtime)
+{
+    M3Result result = m3Err_none;
+
+    IM3CompilePool pool = i_runtime->compilePool;
+
+    if (pool)
+    {
+        JoinCompileWorkers (pool);
+
+        result = pool->firstError;
+        pool->firstError = m3Err_none;
+    }
+
+    return result;
+}
+
+# else
+
+// without worker threads the module is simply compiled by the caller
+M3Result  m3_CompileModuleInBackground  (IM3Module io_module, uint32_t i_numThreads, bool i_hotOnly)
+{
+    return i_hotOnly ? m3Err_none : m3_CompileModule (io_module);
+}
+
+
+M3Result  m3_WaitForBackgroundCompile  (IM3Runtime i_runtime)
+{
+    return m3Err_none;
+}
+
+# endif // d_m3EnableParallelCompile
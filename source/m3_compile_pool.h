@@ -0,0 +1,70 @@
+//
+//  m3_compile_pool.h
+//
+//  Background compilation (d_m3EnableParallelCompile).
+//
+//  m3_CompileModuleInBackground queues the functions of a module (the start function and the
+//  exports first) and compiles them on worker threads, each with its own M3Compilation, while
+//  the caller goes on and runs the start function. A function being compiled by a worker is
+//  'running'; CompileFunction, on the executing thread, waits for it, or takes it off the queue
+//  and compiles it itself when no worker got to it yet. op_Compile stays the fallback for every
+//  function the pool didn't reach.
+//
+//  The pool's lock also guards what compilations share in the runtime: the code page lists,
+//  the counters and the error info.
+//
+
+#pragma once
+
+#include "m3_env.h"
+
+d_m3BeginExternC
+
+# if d_m3EnableParallelCompile
+
+#include <pthread.h>
+
+enum
+{
+    c_m3CompileIdle         = 0,        // not queued; compiled or not, see 'compiled'
+    c_m3CompileQueued       = 1,
+    c_m3CompileRunning      = 2
+};
+
+typedef struct M3CompilePool
+{
+    IM3Runtime              runtime;
+
+    pthread_mutex_t         lock;
+    pthread_cond_t          changed;            // a function left the running state
+
+    pthread_t *             threads;
+    u32                     numThreads;
+
+    IM3Function *           queue;
+    u32                     queueLength;
+    u32                     queueNext;          // next function a worker takes
+
+    M3Result                firstError;         // of a worker compile; the function is left to op_Compile
+    bool                    stopping;
+}
+M3CompilePool;
+
+typedef M3CompilePool *     IM3CompilePool;
+
+void            LockCompilePool                 (IM3Runtime i_runtime);         // no-op until a pool exists
+void            UnlockCompilePool               (IM3Runtime i_runtime);
+
+M3Result        CompilePool_CompileFunction     (IM3CompilePool io_pool, IM3Function io_function);
+
+// stops taking queued functions, joins the workers and frees the pool
+void            FreeCompilePool                 (IM3Runtime io_runtime);
+
+# else
+
+#   define LockCompilePool(RUNTIME)
+#   define UnlockCompilePool(RUNTIME)
+
+# endif // d_m3EnableParallelCompile
+
+d_m3EndExternC
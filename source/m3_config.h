@@ -58,8 +58,7 @@
 # endif
 
 # ifndef d_m3ProfilerSlotMask
-// was 0xFFFF
-#   define d_m3ProfilerSlotMask                 1024
+#   define d_m3ProfilerSlotMask                 1023    // distinct ops counted by the profiler, less one; 2^n - 1
 # endif
 
 # ifndef d_m3RecordBacktraces
@@ -77,6 +76,18 @@
 #   define d_m3EnableOpProfiling                0       // opcode usage counters
 # endif
 
+# ifndef d_m3ProfilerNGramMax
+#   define d_m3ProfilerNGramMax                 3       // longest op sequence counted by the profiler
+# endif
+
+# ifndef d_m3ProfilerNGramSlots
+#   define d_m3ProfilerNGramSlots               1024    // distinct sequences kept
+# endif
+
+# ifndef d_m3ProfilerOutputPath
+#   define d_m3ProfilerOutputPath               NULL    // m3_FreeRuntime writes the n-gram profile here when set
+# endif
+
 # ifndef d_m3EnableOpTracing
 #   define d_m3EnableOpTracing                  0       // only works with DEBUG
 # endif
@@ -152,5 +163,105 @@
 #   define d_m3SkipMemoryBoundsCheck            0       // skip memory bounds checks
 # endif
 
-#define d_m3EnableCodePageRefCounting           0       // not supported currently
+# ifndef d_m3HoistMemoryBoundsChecks
+#   define d_m3HoistMemoryBoundsChecks          (! d_m3SkipMemoryBoundsCheck)   // one bounds check per group of accesses on the same base local
+# endif
+
+# ifndef d_m3ThreadedDispatch
+#   define d_m3ThreadedDispatch                 0       // computed-goto dispatch in a single function (m3_exec_threaded.h), for toolchains without guaranteed tail calls
+# endif
+
+# ifndef d_m3EnableStreamingParse
+#   define d_m3EnableStreamingParse             1       // m3_ParseModuleBegin / Feed / Finish: parse a module as it arrives, without the whole image in memory
+# endif
+
+# ifndef d_m3MaxStreamedSectionBytes
+#   define d_m3MaxStreamedSectionBytes          (256*1024)  // largest section or function body the streaming parser will buffer (sizes come from the module)
+# endif
+
+# ifndef d_m3EnableCodeCache
+#   define d_m3EnableCodeCache                  0       // m3_SaveCodeCache / m3_LoadCodeCache; compiled functions keep their relocation records
+# endif
+
+# ifndef d_m3CodeCacheBuildTag
+#   define d_m3CodeCacheBuildTag                M3_VERSION  // part of the cache key with the configuration and the operation table; set it to the firmware version
+# endif
+
+# ifndef d_m3EnableParallelCompile
+#   define d_m3EnableParallelCompile            0       // m3_CompileModuleInBackground compiles on worker threads (pthreads); needs a thread safe allocator
+# endif
+
+# ifndef d_m3CompileThreads
+#   define d_m3CompileThreads                   2       // workers when m3_CompileModuleInBackground is asked for 0
+# endif
+
+# ifndef d_m3CompileThreadStackSize
+#   define d_m3CompileThreadStackSize           (16*1024)   // CompileBlock recurses once per nested block
+# endif
+
+# ifndef d_m3EnableSuperInstructions
+#   define d_m3EnableSuperInstructions          1       // compile frequent opcode sequences into single fused operations
+# endif
+
+# ifndef d_m3FusedOpsGenerated
+#   define d_m3FusedOpsGenerated                0       // take the fused op sets from m3_fused_ops_generated.h (scripts/generate_wasm_ops.py)
+# endif
+
+# ifndef d_m3EnableConstantFolding
+#   define d_m3EnableConstantFolding            1       // evaluate integer operators on constants; drop selects, br_ifs and overwritten copies decided at compile time
+# endif
+
+# ifndef d_m3EnableTieredCompile
+#   define d_m3EnableTieredCompile              0       // cheap first compile that counts calls and loop iterations; hot functions are recompiled with the passes above
+# endif
+
+# ifndef d_m3TierUpCalls
+#   define d_m3TierUpCalls                      1000    // calls before a function is recompiled
+# endif
+
+# ifndef d_m3TierUpBackEdges
+#   define d_m3TierUpBackEdges                  10000   // loop iterations, in any of its loops, before a function is recompiled
+# endif
+
+# ifndef d_m3EnableCodePageRefCounting
+#   define d_m3EnableCodePageRefCounting        0       // pages count the functions with code in them: m3_UnloadModule and m3_ReleaseColdCode free code
+# endif                                                 // calls then go through the callee, not straight to its code
+
+# ifndef d_m3EnableStacklessCalls
+#   define d_m3EnableStacklessCalls             0       // wasm calls, returns and loops jump instead of nesting C calls: the runtime keeps the return frames
+# endif
+
+# ifndef d_m3MaxCallDepth
+#   define d_m3MaxCallDepth                     65536   // return frames kept by d_m3EnableStacklessCalls before a call traps (stack overflow)
+# endif
+
+# ifndef d_m3EnableAsyncImports
+#   define d_m3EnableAsyncImports               0       // a raw import can park the call (m3ApiSuspend) until the host resumes it with m3_Resume
+# endif
+
+# ifndef d_m3EnableTimeSlicing
+#   define d_m3EnableTimeSlicing                0       // function entries and loop iterations spend the runtime's slice (m3_SetTimeSlice): a spent call is parked
+# endif
+
+#if d_m3EnableTimeSlicing && !d_m3EnableAsyncImports
+#   undef  d_m3EnableAsyncImports
+#   define d_m3EnableAsyncImports               1       // a call out of slice is parked like one waiting for an import
+#endif
+
+#if d_m3EnableAsyncImports && !d_m3EnableStacklessCalls
+#   undef  d_m3EnableStacklessCalls
+#   define d_m3EnableStacklessCalls             1       // a parked call is only its return frames and its stack
+#endif
+
+# ifndef d_m3EnableExecutor
+#   define d_m3EnableExecutor                   0       // m3_NewExecutor runs jobs on a thread per prepared runtime (pthreads); needs a thread safe allocator
+# endif
+
+# ifndef d_m3ExecutorThreadStackSize
+#   define d_m3ExecutorThreadStackSize          (256*1024)  // unless d_m3EnableStacklessCalls, every wasm call nests a native frame on the worker
+# endif
+
+# ifndef d_m3ExecutorQueueLength
+#   define d_m3ExecutorQueueLength              64      // initial jobs of a worker's deque; a full one doubles
+# endif
 
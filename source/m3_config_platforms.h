@@ -137,10 +137,12 @@ static void* preallocate_wasm_memory(size_t size) {
 #  define M3_WEAK //__declspec(selectany)
 #  define M3_NO_UBSAN
 #  define M3_NOINLINE
+#  define M3_THREAD_LOCAL   __declspec(thread)
 # elif defined(__MINGW32__) || defined(__CYGWIN__)
 #  define M3_WEAK //__attribute__((selectany))
 #  define M3_NO_UBSAN
 #  define M3_NOINLINE   __attribute__((noinline))
+#  define M3_THREAD_LOCAL   __thread
 # else
 #  define M3_WEAK       __attribute__((weak))
 #  define M3_NO_UBSAN   //__attribute__((no_sanitize("undefined")))
@@ -150,6 +152,7 @@ static void* preallocate_wasm_memory(size_t size) {
 #  else
 #    define M3_NOINLINE   __attribute__((noinline))
 #  endif
+#  define M3_THREAD_LOCAL   __thread
 # endif
 
 # if !defined(M3_HAS_TAIL_CALL)
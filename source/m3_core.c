@@ -5,13 +5,13 @@
 //  Copyright © 2019 Steven Massey. All rights reserved.
 //
 
+#define M3_IMPLEMENT_ERROR_STRINGS
+
 #include "m3_esp_try.h"
 #include "m3_exec_defs.h"
 #include "wasm3.h"
 #include "wasm3_defs.h"
 
-#define M3_IMPLEMENT_ERROR_STRINGS
-
 #include "m3_core.h"
 #include "m3_env.h"
 
@@ -168,7 +168,7 @@ bool check_memory_available_bySize(size_t required_size) {
     #endif
 }
 
-static u32 call_default_alloc_cycle =  0;
+static M3_THREAD_LOCAL u32 call_default_alloc_cycle =  0;     // the watchdog is fed per task
 void call_default_alloc(){
     if(call_default_alloc_cycle++ % 5 == 0) { CALL_WATCHDOG }
 }
@@ -354,17 +354,13 @@ void* default_realloc(void* ptr, size_t new_size) {
     END_TRY;
 }
 
-void m3_SetMemoryAllocator(MemoryAllocator* allocator) {
-    current_allocator = allocator ? allocator : &default_allocator;
-}
-
 DEBUG_TYPE WASM_DEBUG_MALLOC_IMPL_BACKTRACE = WASM_DEBUG_ALL || (WASM_DEBUG && false);
 void* m3_Malloc_Impl(size_t i_size) {
     if(WASM_DEBUG_MALLOC_IMPL_BACKTRACE) esp_backtrace_print(100);
 
     if (WASM_DEBUG_MEMORY) ESP_LOGI("WASM3", "Calling m3_Malloc_Impl of size %zu", i_size);
 
-    M3Memory* memory = (M3Memory*)current_allocator->malloc(sizeof(M3Memory));
+    M3Memory* memory = (M3Memory*)default_allocator.malloc(sizeof(M3Memory));
     if (!memory) {
         ESP_LOGE("WASM3", "Null M3Memory pointer");
         return NULL;
@@ -378,12 +374,12 @@ void* m3_Malloc_Impl(size_t i_size) {
     ESP_LOGI("WASM3", "m3_Malloc_Imp memory->segment_size = %zu", memory->segment_size);
 
     // Alloca array di strutture MemorySegment
-    memory->segments = (MemorySegment*)current_allocator->malloc(
+    memory->segments = (MemorySegment*)default_allocator.malloc(
         memory->num_segments * sizeof(MemorySegment)
     );
     
     if (!memory->segments) {
-        current_allocator->free(memory);
+        default_allocator.free(memory);
         return NULL;
     }
 
@@ -413,21 +409,21 @@ void m3_Free_Impl(void* io_ptr, bool isMemory) {
             for (size_t i = 0; i < memory->num_segments; i++) {
                 if (memory->segments[i]->is_allocated && memory->segments[i]->data) {
                     if(is_ptr_freeable(&memory->segments[i]->data))
-                        current_allocator->free(memory->segments[i]->data);
+                        default_allocator.free(memory->segments[i]->data);
                 }
             }
 
             if(is_ptr_freeable(&memory->segments))
-                current_allocator->free(memory->segments);
+                default_allocator.free(memory->segments);
         }
         
         if(!is_ptr_freeable(&memory)){
             ESP_LOGI("WASM3", "m3_Free_Impl: not safe to free memory");
         }
 
-        //current_allocator->free(memory); // DON'T do it (why?)
+        //default_allocator.free(memory); // DON'T do it (why?)
     } else {
-        current_allocator->free(io_ptr);
+        default_allocator.free(io_ptr);
     }
 }
 
@@ -443,7 +439,7 @@ void* m3_Realloc_Impl(void* i_ptr, size_t i_newSize, size_t i_oldSize) {
 
             // Riallocare l'array dei segmenti se necessario
             if (new_num_segments != memory->num_segments) {
-                MemorySegment** new_segments = current_allocator->realloc(
+                MemorySegment** new_segments = default_allocator.realloc(
                     memory->segments,
                     new_num_segments * sizeof(MemorySegment*)
                 );
@@ -460,7 +456,7 @@ void* m3_Realloc_Impl(void* i_ptr, size_t i_newSize, size_t i_oldSize) {
                 // Libera i segmenti in eccesso se stiamo riducendo
                 for (size_t i = new_num_segments; i < memory->num_segments; i++) {
                     if (new_segments[i]->is_allocated && new_segments[i]->data) {
-                        current_allocator->free(new_segments[i]->data);
+                        default_allocator.free(new_segments[i]->data);
                     }
                 }
 
@@ -472,8 +468,8 @@ void* m3_Realloc_Impl(void* i_ptr, size_t i_newSize, size_t i_oldSize) {
             return i_ptr;
         }
         else {
-            if(is_ptr_freeable(i_ptr)) current_allocator->free(i_ptr);
-            return current_allocator->realloc(i_ptr, i_newSize);
+            if(is_ptr_freeable(i_ptr)) default_allocator.free(i_ptr);
+            return default_allocator.realloc(i_ptr, i_newSize);
         }        
     }
 
@@ -517,8 +513,8 @@ void* m3_CopyMem(const void* i_from, size_t i_size) {
 
 #if d_m3LogNativeStack
 
-static size_t stack_start;
-static size_t stack_end;
+static M3_THREAD_LOCAL size_t stack_start;
+static M3_THREAD_LOCAL size_t stack_end;
 
 void        m3StackCheckInit ()
 {
@@ -645,7 +641,7 @@ M3Result Read_u64(IM3Memory memory, u64* o_value, bytes_t* io_bytes, cbytes_t i_
         source_ptr = MEMACCESS(const u64*, memory, io_bytes);
         dest_ptr = MEMPOINT(bytes_t, memory, o_value);
 
-        if (!source_ptr || source_ptr == ERROR_POINTER || !dest_ptr) 
+        if (!source_ptr || (const void*)source_ptr == ERROR_POINTER || !dest_ptr) 
             return m3Err_malformedData;
     } else {
         if (!*io_bytes) 
@@ -683,7 +679,7 @@ M3Result Read_u32(IM3Memory memory, u32* o_value, bytes_t* io_bytes, cbytes_t i_
     if (memory) {
         source_ptr = MEMACCESS(const u32*, memory, io_bytes);
         dest_ptr = MEMPOINT(bytes_t, memory, o_value);
-        if (!source_ptr || source_ptr == ERROR_POINTER || !dest_ptr) 
+        if (!source_ptr || (const void*)source_ptr == ERROR_POINTER || !dest_ptr) 
             return m3Err_malformedData;
     } else {
         if (!*io_bytes) 
@@ -724,7 +720,7 @@ M3Result Read_f64(IM3Memory memory, f64* o_value, bytes_t* io_bytes, cbytes_t i_
     if (memory) {
         source_ptr = MEMACCESS(const f64*, memory, io_bytes);
         dest_ptr = MEMPOINT(bytes_t, memory, o_value);
-        if (!source_ptr || source_ptr == ERROR_POINTER || !dest_ptr) 
+        if (!source_ptr || (const void*)source_ptr == ERROR_POINTER || !dest_ptr) 
             return m3Err_malformedData;
     } else {
         if (!*io_bytes) 
@@ -761,7 +757,7 @@ M3Result Read_f32(IM3Memory memory, f32* o_value, bytes_t* io_bytes, cbytes_t i_
     if (memory) {
         source_ptr = MEMACCESS(const f32*, memory, io_bytes);
         dest_ptr = MEMPOINT(bytes_t, memory, o_value);
-        if (!source_ptr || source_ptr == ERROR_POINTER || !dest_ptr) 
+        if (!source_ptr || (const void*)source_ptr == ERROR_POINTER || !dest_ptr) 
             return m3Err_malformedData;
     } else {
         if (!*io_bytes) 
@@ -799,7 +795,7 @@ M3Result Read_u8(IM3Memory memory, u8* o_value, bytes_t* io_bytes, cbytes_t i_en
     if (memory) {
         source_ptr = MEMACCESS(const u8*, memory, io_bytes);
         dest_ptr = MEMPOINT(bytes_t, memory, o_value);
-        if (!source_ptr || source_ptr == ERROR_POINTER || !dest_ptr) 
+        if (!source_ptr || (const void*)source_ptr == ERROR_POINTER || !dest_ptr) 
             return m3Err_malformedData;
     } else {
         if (!*io_bytes) 
@@ -835,7 +831,7 @@ M3Result Read_opcode(IM3Memory memory, m3opcode_t* o_value, bytes_t* io_bytes, c
     if (memory) {
         source_ptr = MEMACCESS(u8*, memory, io_bytes);
         dest_ptr = MEMPOINT(bytes_t, memory, o_value);
-        if (!source_ptr || source_ptr == ERROR_POINTER || !dest_ptr) 
+        if (!source_ptr || (const void*)source_ptr == ERROR_POINTER || !dest_ptr) 
             return m3Err_malformedData;
     } else {
         if (!*io_bytes) 
@@ -886,7 +882,7 @@ M3Result ReadLebUnsigned(IM3Memory memory, u64* o_value, u32 i_maxNumBits, bytes
     if (memory) {
         source_ptr = MEMACCESS(const u8*, memory, io_bytes);
         dest_ptr = MEMPOINT(bytes_t, memory, o_value);
-        if (!source_ptr || source_ptr == ERROR_POINTER || !dest_ptr) 
+        if (!source_ptr || (const void*)source_ptr == ERROR_POINTER || !dest_ptr) 
             return m3Err_malformedData;
     } else {
         if (!*io_bytes) 
@@ -947,7 +943,7 @@ M3Result ReadLebSigned(IM3Memory memory, i64* o_value, u32 i_maxNumBits, bytes_t
     if (memory) {
         source_ptr = MEMACCESS(const u8*, memory, io_bytes);
         dest_ptr = MEMPOINT(bytes_t, memory, o_value);
-        if (!source_ptr || source_ptr == ERROR_POINTER || !dest_ptr) 
+        if (!source_ptr || (const void*)source_ptr == ERROR_POINTER || !dest_ptr) 
             return m3Err_malformedData;
     } else {
         if (!*io_bytes) 
@@ -29,7 +29,7 @@ M3MemoryHeader;
 typedef void *                              code_t; // was const void *
 typedef code_t const *                      pc_t; // was const * /*__restrict__*/
 
-#define d_m3CodePageFreeLinesThreshold      4+2       // max is: select _sss & CallIndirect + 2 for bridge
+#define d_m3CodePageFreeLinesThreshold      5+2       // max is: store _ss_Range (op, 2 slots, offset, reach) + 2 for bridge
 
 #define d_m3DefaultMemPageSize              65536
 
@@ -171,6 +171,9 @@ void        FillBacktraceFunctionInfo  (IM3Runtime io_runtime, IM3Function i_fun
 void        ClearBacktrace             (IM3Runtime io_runtime);
 # endif
 
+// where the runtime keeps the m3_wasi_context_t of m3_LinkWASI, for the WASI sources that don't see M3Runtime; NULL without a runtime
+void **     GetRuntimeWasiContext      (IM3Runtime i_runtime);
+
 void *  m3_Int_CopyMem  (const void * i_from, size_t i_size);
 
 void* default_malloc(size_t size);
@@ -184,12 +187,11 @@ typedef struct {
     void* (*realloc)(void* ptr, size_t new_size);
 } MemoryAllocator;
 
-static MemoryAllocator default_allocator = {
+// read only, shared by the runtimes of every thread
+static const MemoryAllocator default_allocator = {
     .malloc = default_malloc,
     .free = default_free,
     .realloc = default_realloc
 };
 
-static MemoryAllocator* current_allocator = &default_allocator;
-
 d_m3EndExternC
@@ -19,7 +19,8 @@ typedef struct {
     const char* func_name;
 } trace_entry_t;
 
-static struct {
+// per thread: it follows the op nesting of the code running on this thread, whichever runtime it belongs to
+static M3_THREAD_LOCAL struct {
     trace_entry_t entries[TRACE_STACK_DEPTH_MAX];
     int current_stack_depth;
     const char* TAG;
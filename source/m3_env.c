@@ -9,6 +9,7 @@
 #include <limits.h>
 
 #include "m3_env.h"
+#include "m3_compile_pool.h"
 #include "m3_segmented_memory.h"
 #include "wasm3.h"
 #include "wasm3_defs.h"
@@ -33,6 +34,14 @@ IM3Environment  m3_NewEnvironment  ()
     {                
         _try
         {
+#           if d_m3EnableExecutor
+            if (pthread_mutex_init (& env->lock, NULL))
+            {
+                m3_Def_Free (env);
+                return NULL;
+            }
+#           endif
+
             // create FuncTypes for all simple block return ValueTypes
             for (u8 t = c_m3Type_none; t <= c_m3Type_f64; t++)
             {
@@ -87,6 +96,9 @@ void  m3_FreeEnvironment  (IM3Environment i_environment)
     if (i_environment)
     {
         Environment_Release (i_environment);
+#       if d_m3EnableExecutor
+        pthread_mutex_destroy (& i_environment->lock);
+#       endif
         m3_Def_Free (i_environment);
     }
 }
@@ -105,6 +117,8 @@ void  Environment_AddFuncType  (IM3Environment i_environment, IM3FuncType * io_f
     if(WASM_DEBUG_ADDFUNC) ESP_LOGI("WASM3", "Called Environment_AddFuncType");
 
     IM3FuncType addType = * io_funcType;
+
+    LockEnvironment (i_environment);
     IM3FuncType newType = i_environment->funcTypes;
 
     while (newType)
@@ -117,12 +131,14 @@ void  Environment_AddFuncType  (IM3Environment i_environment, IM3FuncType * io_f
         else {
             if(!ultra_safe_ptr_valid(addType)){
                 ESP_LOGE("WASM3", "Invalid addType pointer in Environment_AddFuncType");
+                UnlockEnvironment (i_environment);
                 return;
             }
 
             if(!ultra_safe_ptr_valid(newType)){
                 ESP_LOGE("WASM3", "Invalid newType pointer in Environment_AddFuncType");
                 m3_Def_Free (addType);
+                UnlockEnvironment (i_environment);
                 return;
             }
         }
@@ -137,6 +153,8 @@ void  Environment_AddFuncType  (IM3Environment i_environment, IM3FuncType * io_f
         i_environment->funcTypes = newType;
     }
 
+    UnlockEnvironment (i_environment);
+
     * io_funcType = newType;
 
     if(WASM_DEBUG_ADDFUNC) ESP_LOGI("WASM3", "End of Environment_AddFuncType call");
@@ -167,7 +185,7 @@ IM3CodePage RemoveCodePageOfCapacity(M3CodePage ** io_list, u32 i_minimumLineCou
         if (NumFreeLines(page) >= i_minimumLineCount)
         {
              if(WASM_DEBUG_RemoveCodePageOfCapacity) ESP_LOGI("WASM3", "RemoveCodePageOfCapacity: page->info.usageCount = %d", page->info.usageCount);
-            d_m3Assert(page->info.usageCount == 0);
+            d_m3Assert(d_m3EnableCodePageRefCounting or page->info.usageCount == 0);   // counted: pages shared by functions
             
             // Verifica se è sicuro deallocare
             if (M3CodePage_RemoveCodePageOfCapacity_FreePage && IsCodePageSafeToFree(page))
@@ -218,7 +236,7 @@ IM3CodePage RemoveCodePageOfCapacity (M3CodePage ** io_list, u32 i_minimumLineCo
     while (page)
     {
         if (NumFreeLines (page) >= i_minimumLineCount)
-        {                                                           d_m3Assert (page->info.usageCount == 0);
+        {                                                           d_m3Assert (d_m3EnableCodePageRefCounting or page->info.usageCount == 0);
             IM3CodePage next = page->info.next;
             if (prev)
                 prev->info.next = next; // mid-list
@@ -238,7 +256,11 @@ IM3CodePage RemoveCodePageOfCapacity (M3CodePage ** io_list, u32 i_minimumLineCo
 
 IM3CodePage  Environment_AcquireCodePage (IM3Environment i_environment, u32 i_minimumLineCount)
 {
-    return RemoveCodePageOfCapacity (& i_environment->pagesReleased, i_minimumLineCount);
+    LockEnvironment (i_environment);
+    IM3CodePage page = RemoveCodePageOfCapacity (& i_environment->pagesReleased, i_minimumLineCount);
+    UnlockEnvironment (i_environment);
+
+    return page;
 }
 
 
@@ -263,8 +285,10 @@ void  Environment_ReleaseCodePages  (IM3Environment i_environment, IM3CodePage i
     if (end)
     {
         // push list to front
+        LockEnvironment (i_environment);
         end->info.next = i_environment->pagesReleased;
         i_environment->pagesReleased = i_codePageList;
+        UnlockEnvironment (i_environment);
     }
 }
 
@@ -285,7 +309,12 @@ IM3Memory m3_NewStack(){
 DEBUG_TYPE WASM_DEBUG_NEW_RUNTIME = WASM_DEBUG_ALL || (WASM_DEBUG && false);
 IM3Runtime  m3_NewRuntime  (IM3Environment i_environment, u32 i_stackSizeInBytes, void * i_userdata)
 {
-    if(WASM_DEBUG_NEW_RUNTIME) ESP_LOGI("WASM3", "m3_NewRuntime called");
+    return m3_NewRuntimeWithMemoryBackend (i_environment, i_stackSizeInBytes, i_userdata, c_m3MemoryBackend_Segmented);
+}
+
+IM3Runtime  m3_NewRuntimeWithMemoryBackend  (IM3Environment i_environment, u32 i_stackSizeInBytes, void * i_userdata, M3MemoryBackend i_memoryBackend)
+{
+    if(WASM_DEBUG_NEW_RUNTIME) ESP_LOGI("WASM3", "m3_NewRuntime called (backend: %d)", i_memoryBackend);
 
     IM3Runtime runtime = m3_Def_AllocStruct (M3Runtime);
     if(WASM_DEBUG_NEW_RUNTIME) ESP_LOGI("WASM3", "m3_NewRuntime: m3_Def_AllocStruct done (%d bytes)", sizeof(M3Runtime));
@@ -300,7 +329,12 @@ IM3Runtime  m3_NewRuntime  (IM3Environment i_environment, u32 i_stackSizeInBytes
             ESP_LOGI("WASM3", "m3_NewRuntime: &runtime->memory ptr: %p", &runtime->memory);
         }
 
-        IM3Memory memory = m3_InitMemory(&runtime->memory);
+        IM3Memory memory = m3_InitMemoryWithBackend(&runtime->memory, i_memoryBackend);
+        if (memory == NULL) {
+            ESP_LOGE("WASM3", "m3_NewRuntime: memory init failed (%s)", m3Err_mallocFailed);
+            m3_Def_Free (runtime);
+            return NULL;
+        }
         memory->runtime = runtime;
 
         m3_ResetErrorInfo(runtime);
@@ -339,6 +373,7 @@ IM3Runtime  m3_NewRuntime  (IM3Environment i_environment, u32 i_stackSizeInBytes
             runtime->stack = runtime->originStack;
             runtime->maxStackSize = i_stackSizeInBytes; 
             runtime->numStackSlots = i_stackSizeInBytes / sizeof (m3slot_t);         
+            memory->maxStack = (m3slot_t *) runtime->originStack + runtime->numStackSlots;
             m3log (runtime, "new stack: %p", runtime->originStack);
         }
         else { 
@@ -363,6 +398,11 @@ void *  m3_GetUserData  (IM3Runtime i_runtime)
     return i_runtime ? i_runtime->userdata : NULL;
 }
 
+void **  GetRuntimeWasiContext  (IM3Runtime i_runtime)
+{
+    return i_runtime ? & i_runtime->wasiContext : NULL;
+}
+
 void *  ForEachModule  (IM3Runtime i_runtime, ModuleVisitor i_visitor, void * i_info)
 {
     void * r = NULL;
@@ -390,6 +430,10 @@ void *  _FreeModule  (IM3Module i_module, void * i_info)
 
 void  Runtime_Release  (IM3Runtime i_runtime)
 {
+#   if d_m3EnableParallelCompile
+    FreeCompilePool (i_runtime);        // before the modules: the workers compile their functions
+#   endif
+
     ForEachModule (i_runtime, _FreeModule, NULL);                   d_m3Assert (i_runtime->numActiveCodePages == 0);
 
     Environment_ReleaseCodePages (i_runtime->environment, i_runtime->pagesOpen);
@@ -406,6 +450,12 @@ void  Runtime_Release  (IM3Runtime i_runtime)
     }
     
     FreeMemory (memory);
+
+#   if d_m3EnableStacklessCalls
+    m3_Def_Free (i_runtime->callFrames);
+#   endif
+
+    free (i_runtime->wasiContext);
 }
 
 void  m3_FreeRuntime  (IM3Runtime i_runtime)
@@ -414,10 +464,157 @@ void  m3_FreeRuntime  (IM3Runtime i_runtime)
     {
         m3_PrintProfilerInfo ();
 
+        if (d_m3ProfilerOutputPath)
+            m3_WriteProfilerInfo (d_m3ProfilerOutputPath);
+
         Runtime_Release (i_runtime);        
     }
 }
 
+#if d_m3EnableStacklessCalls
+
+M3Result  Runtime_GrowCallFrames  (IM3Runtime io_runtime)
+{
+    u32 maxCallFrames = io_runtime->maxCallFrames ? io_runtime->maxCallFrames * 2 : 64;
+    maxCallFrames = M3_MIN (maxCallFrames, d_m3MaxCallDepth);
+
+    if (maxCallFrames <= io_runtime->maxCallFrames)
+        return m3Err_trapStackOverflow;
+
+    M3CallFrame * frames = m3_Def_ReallocArray (M3CallFrame, io_runtime->callFrames, maxCallFrames);
+    if (not frames)
+        return m3Err_mallocFailed;
+
+    io_runtime->callFrames = frames;
+    io_runtime->maxCallFrames = maxCallFrames;
+
+    return m3Err_none;
+}
+
+#endif
+
+
+#if d_m3EnableStacklessCalls
+// back in the host: drops the frames the run left above i_base, or keeps them all when an import parked the call
+static M3Result  EndRunFromHost  (IM3Runtime io_runtime, M3Result i_result, u32 i_base, IM3Function i_function)
+{
+#   if d_m3EnableAsyncImports
+    if (i_result == m3Err_suspended)
+    {
+        // a host function that called in is still on the native stack: it can't be parked
+        if (i_base == 0)
+            return i_result;
+
+        io_runtime->suspendedImport = NULL;
+        i_result = m3Err_suspendUnderHostCall;
+    }
+#   endif
+
+#   if d_m3RecordBacktraces
+    if (i_result)
+    {
+        // a trap comes straight back here: the frames left above the base are its backtrace, innermost first
+        FillBacktraceFunctionInfo (io_runtime, io_runtime->function);
+
+        for (u32 i = io_runtime->numCallFrames - 1; i > i_base; --i)
+        {
+            PushBacktraceFrame (io_runtime, io_runtime->callFrames [i].pc - 1);
+            FillBacktraceFunctionInfo (io_runtime, io_runtime->callFrames [i].function);
+        }
+    }
+
+    io_runtime->function = i_function;
+#   endif
+
+    io_runtime->numCallFrames = i_base;
+
+    return i_result;
+}
+#endif
+
+
+#if d_m3EnableTimeSlicing
+static inline i32  NewSlice  (IM3Runtime i_runtime)
+{
+    u32 slice = i_runtime->timeSlice;
+    return (slice and slice < INT32_MAX) ? (i32) slice : INT32_MAX;
+}
+
+
+bool  Runtime_ParkSpentCall  (IM3Runtime io_runtime, pc_t i_pc, m3stack_t i_sp)
+{
+    // without a slice the budget only ran out after 2^31 entries; a run under a host function has native frames in the way
+    if (io_runtime->timeSlice == 0 or io_runtime->numNestedRuns)
+    {
+        io_runtime->budget = NewSlice (io_runtime);
+        return false;
+    }
+
+    io_runtime->resumePC = i_pc;
+    io_runtime->resumeSP = i_sp;
+
+    return true;
+}
+#endif
+
+
+// code run from the host: a call, the start function, an init expression. with d_m3EnableStacklessCalls
+// the return frames of its wasm calls pile up over a frame without pc, where op_Return hands back here
+static M3Result  RunCodeFromHost  (pc_t i_pc, m3stack_t i_sp, IM3Memory i_memory)
+{
+    M3Result result = m3Err_none;
+
+#   if d_m3EnableStacklessCalls
+    IM3Runtime runtime = i_memory->runtime;
+    u32 base = runtime->numCallFrames;
+    IM3Function function = NULL;
+#       if d_m3RecordBacktraces
+    function = runtime->function;
+#       endif
+
+_   (Runtime_PushCallFrame (runtime, NULL, NULL));
+#   endif
+
+#   if d_m3EnableTimeSlicing
+    if (base == 0)
+        runtime->budget = NewSlice (runtime);
+    else
+        runtime->numNestedRuns++;
+#   endif
+
+#   if (d_m3EnableOpProfiling || d_m3EnableOpTracing)
+    result = (M3Result) RunCode (i_pc, i_sp, i_memory, d_m3OpDefaultArgs, d_m3BaseCstr);
+#   else
+    result = (M3Result) RunCode (i_pc, i_sp, i_memory, d_m3OpDefaultArgs);
+#   endif
+
+#   if d_m3EnableTimeSlicing
+    if (base)
+        runtime->numNestedRuns--;
+#   endif
+
+#   if d_m3EnableStacklessCalls
+    result = EndRunFromHost (runtime, result, base, function);
+
+    _catch:
+#   endif
+    return result;
+}
+
+
+#if d_m3EnableAsyncImports
+// waiting for an import, or (d_m3EnableTimeSlicing) out of slice: the runtime's stack belongs to the parked call
+static inline bool  HasParkedCall  (IM3Runtime i_runtime)
+{
+#   if d_m3EnableTimeSlicing
+    if (i_runtime->resumePC)
+        return true;
+#   endif
+    return i_runtime->suspendedImport != NULL;
+}
+#endif
+
+
 DEBUG_TYPE WASM_DEBUG_EvaluateExpression = WASM_DEBUG_ALL || (WASM_DEBUG && false);
 M3Result  EvaluateExpression  (IM3Module i_module, void * o_expressed, u8 i_type, bytes_t * io_bytes, cbytes_t i_end)
 {
@@ -428,12 +625,16 @@ M3Result  EvaluateExpression  (IM3Module i_module, void * o_expressed, u8 i_type
 
     // OPTZ: use a simplified interpreter for expressions
 
-    // create a temporary runtime context
+    // create a temporary runtime context. d_m3PreferStaticAlloc keeps it off the stack, on the heap: a static
+    // one would be shared by the modules loading on different threads
 
     #if defined(d_m3PreferStaticAlloc)
-        static M3Runtime runtime = { 0 };
+        IM3Runtime scratch = m3_Def_AllocStruct (M3Runtime);
+        if (not scratch)
+            return m3Err_mallocFailed;
     #else
-        M3Runtime runtime = { 0 };
+        M3Runtime scratchRuntime = { 0 };
+        IM3Runtime scratch = & scratchRuntime;
     #endif    
 
     //M3_INIT (runtime);    
@@ -442,18 +643,18 @@ M3Result  EvaluateExpression  (IM3Module i_module, void * o_expressed, u8 i_type
 
     IM3Runtime savedRuntime = i_module->runtime;
 
-    runtime.environment = savedRuntime->environment;
-    runtime.numStackSlots = savedRuntime->numStackSlots; 
-    runtime.stack = savedRuntime->stack;
-    runtime.memory = savedRuntime->memory;
+    scratch->environment = savedRuntime->environment;
+    scratch->numStackSlots = savedRuntime->numStackSlots; 
+    scratch->stack = savedRuntime->stack;
+    scratch->memory = savedRuntime->memory;
 
-    m3stack_t stack = runtime.stack;
+    m3stack_t stack = scratch->stack;
 
     ESP_LOGI("WASM3", "Stack pointer at: %p", stack);
 
-    i_module->runtime = & runtime;
+    i_module->runtime = scratch;
 
-    IM3Compilation o = & runtime.compilation;
+    IM3Compilation o = & scratch->compilation;
     o->runtime = i_module->runtime;
     o->module =  i_module;
     o->wasm =    * io_bytes;
@@ -464,11 +665,11 @@ M3Result  EvaluateExpression  (IM3Module i_module, void * o_expressed, u8 i_type
 
     //  OPTZ: this code page could be erased after use.  maybe have 'empty' list in addition to full and open?
     if(WASM_DEBUG_EvaluateExpression) ESP_LOGI("WASM3", "EvaluateExpression: AcquireCodePage");
-    o->page = AcquireCodePage (& runtime);  // AcquireUnusedCodePage (...)
+    o->page = AcquireCodePage (scratch);  // AcquireUnusedCodePage (...)
 
     if (o->page)
     {
-        IM3FuncType ftype = runtime.environment->retFuncTypes[i_type];
+        IM3FuncType ftype = scratch->environment->retFuncTypes[i_type];
 
         if(WASM_DEBUG_EvaluateExpression) ESP_LOGI("WASM3", "EvaluateExpression: GetPagePC");
 
@@ -477,7 +678,7 @@ M3Result  EvaluateExpression  (IM3Module i_module, void * o_expressed, u8 i_type
         if(WASM_DEBUG_EvaluateExpression) ESP_LOGI("WASM3", "EvaluateExpression: CompileBlock");
         result = CompileBlock (o, ftype, c_waOp_block);
 
-        if (not result && o->maxStackSlots >= runtime.numStackSlots) {
+        if (not result && o->maxStackSlots >= scratch->numStackSlots) {
             result = error_details(m3Err_trapStackOverflow, "in EvaluateExpression");
         }
 
@@ -489,11 +690,7 @@ M3Result  EvaluateExpression  (IM3Module i_module, void * o_expressed, u8 i_type
                 waitForIt();
             }
 
-            # if (d_m3EnableOpProfiling || d_m3EnableOpTracing)
-            m3ret_t r = RunCode (m3code, stack, memory , d_m3OpDefaultArgs, d_m3BaseCstr); // NULL or &o->runtime ?
-            # else
-            m3ret_t r = RunCode (m3code, stack, memory , d_m3OpDefaultArgs); 
-            # endif
+            m3ret_t r = RunCodeFromHost (m3code, stack, memory);
             
             if(WASM_DEBUG_EvaluateExpression) {
                 ESP_LOGI("WASM3", "EvaluateExpression: RunCode r: %p", r);
@@ -532,7 +729,7 @@ M3Result  EvaluateExpression  (IM3Module i_module, void * o_expressed, u8 i_type
 
         // TODO: EraseCodePage (...) see OPTZ above
         if(WASM_DEBUG_EvaluateExpression) ESP_LOGI("WASM3", "EvaluateExpression: ReleaseCodePage");
-        //ReleaseCodePage (& runtime, o->page);
+        //ReleaseCodePage (scratch, o->page);
     }
     else result = m3Err_mallocFailedCodePage;
 
@@ -541,6 +738,10 @@ M3Result  EvaluateExpression  (IM3Module i_module, void * o_expressed, u8 i_type
     i_module->runtime = savedRuntime;
     * io_bytes = o->wasm;
 
+    #if defined(d_m3PreferStaticAlloc)
+        m3_Def_Free (scratch);
+    #endif
+
     if(WASM_DEBUG_EvaluateExpression){
         if(result != NULL){
             ESP_LOGI("WASM3", "EvaluateExpression: return %s", result);
@@ -574,9 +775,15 @@ M3Result ResizeMemory(IM3Runtime io_runtime, u32 i_numPages) {
     }
 
     // Calcola la nuova dimensione totale richiesta
-    size_t new_total_size = i_numPages * memory->pageSize;
+    size_t new_total_size = (size_t)i_numPages * memory->pageSize;
 
-    return GrowMemory(memory, new_total_size);
+    // Every offset below memory.size needs its segment (the data is still allocated on first touch)
+    if (new_total_size > memory->total_size)
+        result = GrowMemory(memory, new_total_size - memory->total_size);
+    if (result == m3Err_none)
+        memory->numPages = i_numPages;
+
+    return result;
 
 #if d_m3MaxLinearMemoryPages > 0
     _throwif("linear memory limitation exceeded", i_numPages > d_m3MaxLinearMemoryPages);
@@ -639,6 +846,12 @@ M3Result InitMemory(IM3Runtime io_runtime, IM3Module i_module) // todo: add to .
         // Calcola dimensioni totali
         io_runtime->memory.max_size = 0;
         io_runtime->memory.segment_size = WASM_SEGMENT_SIZE;
+
+        // memory.size starts at the declared minimum; op_MemGrow and the load/store bounds checks read it
+        if (i_module->memoryInfo.pageSize)
+            io_runtime->memory.pageSize = i_module->memoryInfo.pageSize;
+        io_runtime->memory.numPages = M3_MAX(io_runtime->memory.numPages, i_module->memoryInfo.initPages);
+_       (ResizeMemory (io_runtime, io_runtime->memory.numPages));
         
         // Calcola numero iniziale di segmenti necessari
         if(WASM_INIT_MEMORY_PREALLOC_SEGMENTS){
@@ -652,7 +865,7 @@ M3Result InitMemory(IM3Runtime io_runtime, IM3Module i_module) // todo: add to .
         }
     }
 
-    return result;
+    _catch: return result;
 }
 
 
@@ -730,7 +943,7 @@ _       (EvaluateExpression(io_module, &segmentOffset, c_m3Type_i32, &start,
               i, segment->size, segmentOffset);
 
         // Verifica limiti
-        if (segmentOffset >= 0 && (size_t)(segmentOffset) + segment->size <= io_memory->total_size)
+        if (segmentOffset >= 0 && (u64)(segmentOffset) + segment->size <= m3_LinearMemorySize (io_memory))
         {
             // Calcola i segmenti interessati
             size_t start_segment = segmentOffset / io_memory->segment_size;
@@ -757,16 +970,16 @@ _       (EvaluateExpression(io_module, &segmentOffset, c_m3Type_i32, &start,
                 );
 
                 if(!io_memory->segments[current_segment]->is_allocated){
-                    if((result = InitSegment(io_memory, io_memory->segments[current_segment], true))){
-                        _throw(result);
+                    if(InitSegment(io_memory, io_memory->segments[current_segment], true) == NULL){
+                        _throw(m3Err_mallocFailed);
                     }
                 }
                 
                 u8* dest = ((u8*)io_memory->segments[current_segment]->data) + segment_offset;
-                //memcpy(dest, segment->data + src_offset, bytes_to_copy);
 
-                if(WASM_DEBUG_INIT_DATA_SEGMENTS) ESP_LOGI("WASM3", "InitDataSegments: m3_memcpy");
-                m3_memcpy(io_memory, dest, segment->data + src_offset, bytes_to_copy);
+                // both are host pointers: m3_memcpy would take their low 32 bits for guest offsets on a 64-bit host
+                if(WASM_DEBUG_INIT_DATA_SEGMENTS) ESP_LOGI("WASM3", "InitDataSegments: memcpy");
+                memcpy(dest, segment->data + src_offset, bytes_to_copy);
                 
                 remaining -= bytes_to_copy;
                 src_offset += bytes_to_copy;
@@ -845,7 +1058,7 @@ M3Result  m3_CompileModule  (IM3Module io_module)
     for (u32 i = 0; i < io_module->numFunctions; ++i)
     {
         IM3Function f = & io_module->functions [i];
-        if (f->wasm and not f->compiled)
+        if (f->wasm and not GetFunctionCompiled (f))
         {
 _           (CompileFunction (f));
         }
@@ -868,7 +1081,7 @@ M3Result  m3_RunStart  (IM3Module io_module)
     {
         IM3Function function = & io_module->functions [io_module->startFunction];
 
-        if (not function->compiled)
+        if (not GetFunctionCompiled (function))
         {
 _           (CompileFunction (function));
         }
@@ -880,15 +1093,22 @@ _           (CompileFunction (function));
         IM3Module module = function->module;
         IM3Runtime runtime = module->runtime;
 
+#if d_m3EnableAsyncImports
+        _throwif (m3Err_callSuspended, HasParkedCall (runtime));
+#endif
+
         startFunctionTmp = io_module->startFunction;
         io_module->startFunction = -1;
 
-# if (d_m3EnableOpProfiling || d_m3EnableOpTracing)
-        result = (M3Result) RunCode (function->compiled,  runtime->stack, &runtime->memory, d_m3OpDefaultArgs, d_m3BaseCstr);
-# else
-        result = (M3Result) RunCode (function->compiled,  runtime->stack, &runtime->memory, d_m3OpDefaultArgs);
-# endif
+        result = RunCodeFromHost (function->compiled, runtime->stack, &runtime->memory);
 
+#if d_m3EnableAsyncImports
+        if (result == m3Err_suspended)
+        {
+            runtime->suspendedCall = function;      // under way: m3_Resume ends it
+            goto _catch;
+        }
+#endif
         if (result)
         {
             io_module->startFunction = startFunctionTmp;
@@ -962,6 +1182,134 @@ _catch:
     return result;
 }
 
+
+#if d_m3EnableCodePageRefCounting
+
+DEBUG_TYPE WASM_DEBUG_RELEASE_CODE = WASM_DEBUG_ALL || (WASM_DEBUG && false);
+
+// frees the open and full pages no function has code in anymore
+u32  Runtime_ReleaseCodePages  (IM3Runtime io_runtime)
+{
+    u32 numFreed = 0;
+
+    LockCompilePool (io_runtime);
+
+    IM3CodePage * lists [] = { & io_runtime->pagesOpen, & io_runtime->pagesFull };
+
+    for (u32 i = 0; i < 2; ++i)
+    {
+        IM3CodePage * link = lists [i];
+
+        while (* link)
+        {
+            IM3CodePage page = * link;
+
+            if (page->info.usageCount == 0)
+            {
+                * link = page->info.next;
+                page->info.next = NULL;
+
+                FreeCodePages (& page);
+
+                io_runtime->numCodePages--;
+                numFreed++;
+            }
+            else link = & page->info.next;
+        }
+    }
+
+    UnlockCompilePool (io_runtime);
+
+    return numFreed;
+}
+
+
+M3Result  m3_UnloadModule  (IM3Module i_module)
+{
+    M3Result result = m3Err_none;
+
+    IM3Runtime runtime = i_module->runtime;
+    _throwif ("module is not loaded", not runtime);
+
+#if d_m3EnableAsyncImports
+    _throwif (m3Err_callSuspended, HasParkedCall (runtime));     // the parked frames may return into this module's code
+#endif
+
+    m3_WaitForBackgroundCompile (runtime);      // its functions may be in the queue; their errors don't matter anymore
+
+    IM3Module * link = & runtime->modules;
+    while (* link and * link != i_module)
+        link = & (* link)->next;
+
+    _throwif ("module is not loaded", not * link);
+
+    * link = i_module->next;
+
+    if (runtime->lastCalled and runtime->lastCalled->module == i_module)
+        runtime->lastCalled = NULL;
+
+    m3_FreeModule (i_module);
+
+    u32 numFreed = Runtime_ReleaseCodePages (runtime);
+
+    if (WASM_DEBUG_RELEASE_CODE) ESP_LOGI ("WASM3", "m3_UnloadModule: %" PRIu32 " code pages freed, %" PRIu32 " left", numFreed, runtime->numCodePages);
+
+    _catch: return result;
+}
+
+
+// second chance: a function is released when it wasn't entered since the previous pass
+M3Result  m3_ReleaseColdCode  (IM3Runtime io_runtime, uint32_t i_maxCodePages, uint32_t * o_numPagesFreed)
+{
+    u32 numFreed = 0;
+
+#if d_m3EnableAsyncImports
+    if (HasParkedCall (io_runtime))
+        return m3Err_callSuspended;             // 'called' says nothing about the functions on the parked call's stack
+#endif
+
+    if (io_runtime->numCodePages > i_maxCodePages)
+    {
+        m3_WaitForBackgroundCompile (io_runtime);
+
+        u32 numReleased = 0;
+
+        for (IM3Module module = io_runtime->modules; module; module = module->next)
+        {
+            for (u32 i = 0; i < module->numFunctions; ++i)
+            {
+                IM3Function function = & module->functions [i];
+
+                // imports keep their stubs
+                if (not function->wasm or not function->numCodePageRefs)
+                    continue;
+
+                if (function->called)
+                {
+                    function->called = false;
+                }
+                else
+                {
+                    Function_FreeCompiledCode (function);
+                    numReleased++;
+                }
+            }
+        }
+
+        numFreed = Runtime_ReleaseCodePages (io_runtime);
+
+        if (WASM_DEBUG_RELEASE_CODE) ESP_LOGI ("WASM3", "m3_ReleaseColdCode: %" PRIu32 " functions released, %" PRIu32 " code pages freed, %" PRIu32 " left",
+                                               numReleased, numFreed, io_runtime->numCodePages);
+    }
+
+    if (o_numPagesFreed)
+        * o_numPagesFreed = numFreed;
+
+    return m3Err_none;
+}
+
+#endif // d_m3EnableCodePageRefCounting
+
 IM3Global  m3_FindGlobal  (IM3Module               io_module, const char * const      i_globalName)
 {
     // Search exports
@@ -1094,7 +1442,7 @@ M3Result  m3_FindFunction  (IM3Function * o_function, IM3Runtime i_runtime, cons
 
     if (function)
     {
-        if (not function->compiled)
+        if (not GetFunctionCompiled (function))
         {
 _           (CompileFunction (function))
         }
@@ -1123,7 +1471,7 @@ _try {
 
     if (function)
     {
-        if (not function->compiled)
+        if (not GetFunctionCompiled (function))
         {
 _           (CompileFunction (function))
         }
@@ -1216,11 +1564,31 @@ M3Result  m3_CallV  (IM3Function i_function, ...)
 }
 
 static
-void  ReportNativeStackUsage  ()
+void  ReportNativeStackUsage  (IM3Runtime i_runtime)
 {
 #   if d_m3LogNativeStack
         int stackUsed =  m3StackGetMax();
+#       if d_m3EnableStacklessCalls
+        // the native stack stays the same however deep the wasm calls went
+        fprintf (stderr, "Native stack used: %d, wasm return frames: %u\n", stackUsed, (unsigned) i_runtime->peakCallFrames);
+        i_runtime->peakCallFrames = 0;
+#       else
         fprintf (stderr, "Native stack used: %d\n", stackUsed);
+#       endif
+#   endif
+}
+
+
+// the embedder's call has returned, or an import parked it
+static
+void  CallReturned  (IM3Runtime io_runtime, IM3Function i_function, M3Result i_result)
+{
+    ReportNativeStackUsage (io_runtime);
+
+    io_runtime->lastCalled = i_result ? NULL : i_function;
+#   if d_m3EnableAsyncImports
+    if (i_result == m3Err_suspended)
+        io_runtime->suspendedCall = i_function;
 #   endif
 }
 
@@ -1232,9 +1600,18 @@ M3Result m3_CallVL(IM3Function i_function, va_list i_args)
     M3Result result = m3Err_none;
     u8* s = NULL;
 
-    if (!i_function->compiled) {
+#if d_m3EnableCodePageRefCounting
+    if (!GetFunctionCompiled (i_function) && i_function->wasm)
+_       (CompileFunction (i_function));         // its code was released by m3_ReleaseColdCode
+#endif
+    if (!GetFunctionCompiled (i_function)) {
         return m3Err_missingCompiledCode;
     }
+#if d_m3EnableAsyncImports
+    if (HasParkedCall (runtime)) {
+        return m3Err_callSuspended;                 // its frames use the stack the arguments go to
+    }
+#endif
 
 # if d_m3RecordBacktraces
     ClearBacktrace(runtime);
@@ -1260,14 +1637,9 @@ _   (checkStartFunction(i_function->module))
     }
 
 // Here's born _mem
-# if (d_m3EnableOpProfiling || d_m3EnableOpTracing)
-    result = (M3Result) RunCode(i_function->compiled, (ptr)(runtime->stack), &runtime->memory, d_m3OpDefaultArgs, d_m3BaseCstr);
-# else
-    result = (M3Result) RunCode(i_function->compiled, (ptr)(runtime->stack), &runtime->memory, d_m3OpDefaultArgs);
-# endif
-    ReportNativeStackUsage();
+    result = RunCodeFromHost (i_function->compiled, runtime->stack, &runtime->memory);
 
-    runtime->lastCalled = result ? NULL : i_function;
+    CallReturned (runtime, i_function, result);
 
     _catch: return result;
 }
@@ -1284,9 +1656,18 @@ M3Result m3_Call(IM3Function i_function, uint32_t i_argc, const void* i_argptrs[
     if (i_argc != ftype->numArgs) {
         return m3Err_argumentCountMismatch;
     }
-    if (!i_function->compiled) {
+#if d_m3EnableCodePageRefCounting
+    if (!GetFunctionCompiled (i_function) && i_function->wasm)
+_       (CompileFunction (i_function));         // its code was released by m3_ReleaseColdCode
+#endif
+    if (!GetFunctionCompiled (i_function)) {
         return m3Err_missingCompiledCode;
     }
+#if d_m3EnableAsyncImports
+    if (HasParkedCall (runtime)) {
+        return m3Err_callSuspended;
+    }
+#endif
 
 # if d_m3RecordBacktraces
     ClearBacktrace(runtime);
@@ -1311,15 +1692,9 @@ _   (checkStartFunction(i_function->module))
         }
     }
 
-# if (d_m3EnableOpProfiling || d_m3EnableOpTracing)
-    result = (M3Result) RunCode(i_function->compiled, (runtime->stack), &runtime->memory, d_m3OpDefaultArgs, d_m3BaseCstr);
-# else
-    result = (M3Result) RunCode(i_function->compiled, (runtime->stack), &runtime->memory, d_m3OpDefaultArgs);
-# endif
-
-    ReportNativeStackUsage();
+    result = RunCodeFromHost (i_function->compiled, runtime->stack, &runtime->memory);
 
-    runtime->lastCalled = result ? NULL : i_function;
+    CallReturned (runtime, i_function, result);
 
     _catch: return result;
 }
@@ -1334,9 +1709,18 @@ M3Result m3_CallArgv(IM3Function i_function, uint32_t i_argc, const char* i_argv
     if (i_argc != ftype->numArgs) {
         return m3Err_argumentCountMismatch;
     }
-    if (!i_function->compiled) {
+#if d_m3EnableCodePageRefCounting
+    if (!GetFunctionCompiled (i_function) && i_function->wasm)
+_       (CompileFunction (i_function));         // its code was released by m3_ReleaseColdCode
+#endif
+    if (!GetFunctionCompiled (i_function)) {
         return m3Err_missingCompiledCode;
     }
+#if d_m3EnableAsyncImports
+    if (HasParkedCall (runtime)) {
+        return m3Err_callSuspended;
+    }
+#endif
 
 # if d_m3RecordBacktraces
     ClearBacktrace(runtime);
@@ -1361,15 +1745,9 @@ _   (checkStartFunction(i_function->module))
         }
     }
 
-# if (d_m3EnableOpProfiling || d_m3EnableOpTracing)
-    result = (M3Result) RunCode(i_function->compiled, (runtime->stack), &runtime->memory, d_m3OpDefaultArgs, d_m3BaseCstr);
-# else
-    result = (M3Result) RunCode(i_function->compiled, (runtime->stack), &runtime->memory, d_m3OpDefaultArgs);
-# endif
-    
-    ReportNativeStackUsage();
+    result = RunCodeFromHost (i_function->compiled, runtime->stack, &runtime->memory);
 
-    runtime->lastCalled = result ? NULL : i_function;
+    CallReturned (runtime, i_function, result);
 
     _catch: return result;
 }
@@ -1445,6 +1823,152 @@ M3Result  m3_GetResultsVL  (IM3Function i_function, va_list o_rets)
     return m3Err_none;
 }
 
+
+#if d_m3EnableAsyncImports
+
+IM3Function  m3_GetSuspendedImport  (IM3Runtime i_runtime)
+{
+    return i_runtime->suspendedImport;
+}
+
+
+M3Result  m3_Resume  (IM3Runtime io_runtime, uint32_t i_retc, const void * i_retptrs[])
+{
+    CALL_WATCHDOG
+
+    M3Result result = m3Err_none;
+    pc_t pc = NULL;
+    m3stack_t sp = NULL;
+
+    IM3Function import = io_runtime->suspendedImport;
+    if (import)
+    {
+        IM3FuncType ftype = import->funcType;
+        _throwif (m3Err_argumentCountMismatch, i_retc != ftype->numRets);
+
+        u8* s = (u8*) io_runtime->suspendedSP;
+
+        for (u32 i = 0; i < ftype->numRets; ++i)
+        {
+            switch (d_FuncRetType(ftype, i)) {
+            case c_m3Type_i32:  *(i32*)(s) = *(i32*)i_retptrs[i];  s += 8; break;
+            case c_m3Type_i64:  *(i64*)(s) = *(i64*)i_retptrs[i];  s += 8; break;
+# if d_m3HasFloat
+            case c_m3Type_f32:  *(f32*)(s) = *(f32*)i_retptrs[i];  s += 8; break;
+            case c_m3Type_f64:  *(f64*)(s) = *(f64*)i_retptrs[i];  s += 8; break;
+# endif
+            default: _throw ("unknown return type");
+            }
+        }
+
+        io_runtime->suspendedImport = NULL;
+
+        // the import returns as op_CallRawFunction would have: to the caller on top of the parked frames
+        M3CallFrame * caller = & io_runtime->callFrames [io_runtime->numCallFrames - 1];
+
+        if (caller->pc)
+        {
+            io_runtime->numCallFrames--;
+#   if d_m3RecordBacktraces
+            io_runtime->function = caller->function;
+#   endif
+            pc = caller->pc;
+            sp = caller->sp;
+        }
+        else io_runtime->numCallFrames = 0;         // the embedder called the import itself: nothing left to run
+    }
+    else
+    {
+#   if d_m3EnableTimeSlicing
+        // out of slice: the call goes on from the op that parked it
+        _throwif (m3Err_noSuspendedCall, not io_runtime->resumePC);
+        _throwif (m3Err_argumentCountMismatch, i_retc != 0);
+
+        pc = io_runtime->resumePC;
+        sp = io_runtime->resumeSP;
+        io_runtime->resumePC = NULL;
+#   else
+        _throw (m3Err_noSuspendedCall);
+#   endif
+    }
+
+# if d_m3RecordBacktraces
+    ClearBacktrace (io_runtime);
+# endif
+
+    m3StackCheckInit ();
+
+    if (pc)
+    {
+#   if d_m3EnableTimeSlicing
+        io_runtime->budget = NewSlice (io_runtime);
+#   endif
+
+#   if (d_m3EnableOpProfiling || d_m3EnableOpTracing)
+        result = (M3Result) RunCode (pc, sp, & io_runtime->memory, d_m3OpDefaultArgs, d_m3BaseCstr);
+#   else
+        result = (M3Result) RunCode (pc, sp, & io_runtime->memory, d_m3OpDefaultArgs);
+#   endif
+
+        result = EndRunFromHost (io_runtime, result, 0, NULL);
+    }
+
+    CallReturned (io_runtime, io_runtime->suspendedCall, result);
+
+    _catch: return result;
+}
+
+
+void  m3_CancelSuspended  (IM3Runtime io_runtime)
+{
+    if (HasParkedCall (io_runtime))
+    {
+        io_runtime->suspendedImport = NULL;
+#   if d_m3EnableTimeSlicing
+        io_runtime->resumePC = NULL;
+#   endif
+        io_runtime->suspendedCall = NULL;
+
+        EndRunFromHost (io_runtime, m3Err_none, 0, NULL);
+    }
+}
+
+#else
+
+IM3Function  m3_GetSuspendedImport  (IM3Runtime i_runtime)
+{
+    return NULL;
+}
+
+
+M3Result  m3_Resume  (IM3Runtime io_runtime, uint32_t i_retc, const void * i_retptrs[])
+{
+    return m3Err_noSuspendedCall;
+}
+
+
+void  m3_CancelSuspended  (IM3Runtime io_runtime)
+{
+}
+
+#endif
+
+
+#if d_m3EnableTimeSlicing
+
+void  m3_SetTimeSlice  (IM3Runtime io_runtime, uint32_t i_budget)
+{
+    io_runtime->timeSlice = i_budget;
+}
+
+#else
+
+void  m3_SetTimeSlice  (IM3Runtime io_runtime, uint32_t i_budget)
+{
+}
+
+#endif
+
 void  ReleaseCodePageNoTrack (IM3Runtime i_runtime, IM3CodePage i_codePage)
 {
     if (i_codePage)
@@ -1465,6 +1989,8 @@ void  ReleaseCodePageNoTrack (IM3Runtime i_runtime, IM3CodePage i_codePage)
 DEBUG_TYPE WASM_DEBUG_AcquireCodePageWithCapacity = WASM_DEBUG_ALL || (WASM_DEBUG && false);
 IM3CodePage  AcquireCodePageWithCapacity  (IM3Runtime i_runtime, u32 i_minLineCount)
 {
+    LockCompilePool (i_runtime);    // the page lists are shared with the background compiles
+
     if(WASM_DEBUG_AcquireCodePageWithCapacity) ESP_LOGI("WASM3", "AcquireCodePageWithCapacity: RemoveCodePageOfCapacity");
     IM3CodePage page = RemoveCodePageOfCapacity (& i_runtime->pagesOpen, i_minLineCount);
 
@@ -1487,6 +2013,8 @@ IM3CodePage  AcquireCodePageWithCapacity  (IM3Runtime i_runtime, u32 i_minLineCo
         i_runtime->numActiveCodePages++;
     }
 
+    UnlockCompilePool (i_runtime);
+
     return page;
 }
 
@@ -1501,6 +2029,8 @@ void  ReleaseCodePage  (IM3Runtime i_runtime, IM3CodePage i_codePage)
 {
     if (i_codePage)
     {
+        LockCompilePool (i_runtime);
+
         ReleaseCodePageNoTrack (i_runtime, i_codePage);
         i_runtime->numActiveCodePages--;
 
@@ -1518,6 +2048,8 @@ void  ReleaseCodePage  (IM3Runtime i_runtime, IM3CodePage i_codePage)
                 #endif
 #           endif
 #       endif
+
+        UnlockCompilePool (i_runtime);
     }
 }
 
@@ -1528,6 +2060,8 @@ M3Result  m3Error  (M3Result i_result, IM3Runtime i_runtime, IM3Module i_module,
 {
     if (i_runtime)
     {
+        LockCompilePool (i_runtime);    // a background compile can fail at the same time
+
         i_runtime->error = (M3ErrorInfo){ .result = i_result, .runtime = i_runtime, .module = i_module,
                                           .function = i_function, .file = i_file, .line = i_lineNum };
         i_runtime->error.message = i_runtime->error_message;
@@ -1536,6 +2070,8 @@ M3Result  m3Error  (M3Result i_result, IM3Runtime i_runtime, IM3Module i_module,
         va_start (args, i_errorMessage);
         vsnprintf (i_runtime->error_message, sizeof(i_runtime->error_message), i_errorMessage, args);
         va_end (args);
+
+        UnlockCompilePool (i_runtime);
     }
 
     return i_result;
@@ -1574,10 +2110,16 @@ uint8_t* m3_GetMemory(IM3Runtime i_runtime, uint32_t* o_memorySizeInBytes, uint3
         if (o_memorySizeInBytes)
             *o_memorySizeInBytes = size;
 
+#if WASM_SEGMENTED_MEM_ENABLE_FLAT
+        // Flat backend: the linear memory is already contiguous, no copy needed
+        if (m3_IsFlatMemory(&i_runtime->memory))
+            return i_runtime->memory.flat_base;
+#endif
+
         if (size)
         {
             // Alloca un blocco contiguo di memoria
-            memory = (uint8_t*)current_allocator->malloc(size);
+            memory = (uint8_t*)default_allocator.malloc(size);
             
             if (memory)
             {
@@ -1590,14 +2132,14 @@ uint8_t* m3_GetMemory(IM3Runtime i_runtime, uint32_t* o_memorySizeInBytes, uint3
                         //size_t seg_size = (i == i_runtime->memory.num_segments - 1) ? (size - (i * i_runtime->memory.segment_size)) :  i_runtime->memory.segment_size;
                         size_t seg_size = i_runtime->memory.segment_size;
 
-                        i_runtime->memory.segments[i]->data = current_allocator->malloc(seg_size);
+                        i_runtime->memory.segments[i]->data = default_allocator.malloc(seg_size);
                         if (!i_runtime->memory.segments[i]->data)
                         {
                             // Fallimento: libera tutto e ritorna NULL
                             for (size_t j = 0; j < i; j++) {
-                                current_allocator->free(i_runtime->memory.segments[j]->data);
+                                default_allocator.free(i_runtime->memory.segments[j]->data);
                             }
-                            current_allocator->free(memory);
+                            default_allocator.free(memory);
                             return NULL;
                         }
                         i_runtime->memory.segments[i]->is_allocated = true;
@@ -13,6 +13,10 @@
 #include "m3_function.h"
 #include "m3_pointers.h"
 
+#if d_m3EnableExecutor
+#   include <pthread.h>
+#endif
+
 d_m3BeginExternC
 
 // forced pre-declaration (m3_compile.h)
@@ -71,6 +75,16 @@ M3Global;
 
 
 //---------------------------------------------------------------------------------------------------------------------------------
+
+#if d_m3EnableStreamingParse
+typedef struct M3ModuleBytes
+{
+    struct M3ModuleBytes *  next;
+    u8                      bytes [];
+}
+M3ModuleBytes;
+#endif
+
 typedef struct M3Module
 {
     struct M3Runtime *      runtime;
@@ -113,6 +127,19 @@ typedef struct M3Module
 
     //bool                    hasWasmCodeCopy;
 
+#if d_m3EnableStreamingParse
+    M3ModuleBytes *         keptBytes;              // sections copied by the streaming parser (globals, elements, data): their pointers lead here
+#endif
+
+#if d_m3EnableCodeCache
+    u64                     wasmHash;               // a streamed module has no wasmStart; the parser hashed the bytes as they went by
+#endif
+
+#if d_m3EnableConstantFolding
+    u32                     numFoldedOps;           // operators evaluated at compile time
+    u32                     numRemovedOps;          // selects, br_ifs and copies dropped by the peephole
+#endif
+
     struct M3Module *       next;
 }
 M3Module;
@@ -140,9 +167,21 @@ typedef struct M3Environment
     M3CodePage *            pagesReleased;
 
     M3SectionHandler        customSectionHandler;
+
+#if d_m3EnableExecutor
+    pthread_mutex_t         lock;                               // funcTypes and pagesReleased: the runtimes of an executor load and compile on their own threads
+#endif
 }
 M3Environment;
 
+#if d_m3EnableExecutor
+#   define LockEnvironment(ENV)         pthread_mutex_lock (& (ENV)->lock)
+#   define UnlockEnvironment(ENV)       pthread_mutex_unlock (& (ENV)->lock)
+#else
+#   define LockEnvironment(ENV)
+#   define UnlockEnvironment(ENV)
+#endif
+
 void                        Environment_Release         (IM3Environment i_environment);
 
 // takes ownership of io_funcType and returns a pointer to the persistent version (could be same or different)
@@ -150,6 +189,21 @@ void                        Environment_AddFuncType     (IM3Environment i_enviro
 
 //---------------------------------------------------------------------------------------------------------------------------------
 
+#if d_m3EnableStacklessCalls
+
+// return frame of a wasm call in progress (d_m3EnableStacklessCalls): op_Call pushes it, op_Return pops it
+typedef struct M3CallFrame
+{
+    pc_t                    pc;             // where the caller resumes; NULL: the host called in here
+    m3stack_t               sp;             // the caller's frame
+#   if d_m3RecordBacktraces
+    IM3Function             function;       // the caller
+#   endif
+}
+M3CallFrame;
+
+#endif
+
 typedef struct M3Runtime
 {
     M3Compilation           compilation;
@@ -175,6 +229,7 @@ typedef struct M3Runtime
     IM3Function             lastCalled;     // last function that successfully executed
 
     void *                  userdata;
+    void *                  wasiContext;    // m3_wasi_context_t of m3_LinkWASI (malloc), its args and exit code
 
     M3Memory                memory;
     u32                     memoryLimit;
@@ -193,6 +248,49 @@ typedef struct M3Runtime
 #endif
 
 	u32						newCodePageSequence;
+
+#if d_m3EnableSuperInstructions
+    u32                     numFusedOps;        // superinstructions emitted
+    u32                     numFusedOpcodes;    // wasm opcodes they replaced
+    bool                    disableFusion;      // compile without them, to measure what they save
+#endif
+
+#if d_m3HoistMemoryBoundsChecks
+    u32                     numRangeChecks;     // load/store ops carrying a group's hoisted bounds check
+    u32                     numUncheckedOps;    // load/store ops covered by it
+#endif
+
+#if d_m3EnableTieredCompile
+    u32                     numTierUps;         // functions recompiled with the optimising passes
+#endif
+
+#if d_m3EnableStacklessCalls
+    M3CallFrame *           callFrames;         // grows by doubling, up to d_m3MaxCallDepth
+    u32                     numCallFrames;
+    u32                     maxCallFrames;
+    u32                     peakCallFrames;     // deepest since the last ReportNativeStackUsage (d_m3LogNativeStack)
+#   if d_m3RecordBacktraces
+    IM3Function             function;           // executing, for the backtrace of a trap
+#   endif
+#endif
+
+#if d_m3EnableAsyncImports
+    IM3Function             suspendedImport;    // parked the call: NULL when none is parked
+    m3stack_t               suspendedSP;        // the import's slots, where m3_Resume stores its results
+    IM3Function             suspendedCall;      // called by the embedder, m3_GetResults reads it once resumed
+#endif
+
+#if d_m3EnableTimeSlicing
+    i32                     budget;             // function entries and loop iterations left in the slice
+    u32                     timeSlice;          // 0: no limit
+    u32                     numNestedRuns;      // host functions calling back in: their runs aren't parked
+    pc_t                    resumePC;           // a call parked out of slice goes on from here; NULL when none is
+    m3stack_t               resumeSP;
+#endif
+
+#if d_m3EnableParallelCompile
+    struct M3CompilePool *  compilePool;        // background compilation (m3_compile_pool.h); NULL until it's first started
+#endif
 }
 M3Runtime;
 
@@ -204,6 +302,40 @@ void *                      v_FindFunction              (IM3Module i_module, con
 IM3CodePage                 AcquireCodePage             (IM3Runtime io_runtime);
 IM3CodePage                 AcquireCodePageWithCapacity (IM3Runtime io_runtime, u32 i_lineCount);
 void                        ReleaseCodePage             (IM3Runtime io_runtime, IM3CodePage i_codePage);
+#if d_m3EnableCodePageRefCounting
+u32                         Runtime_ReleaseCodePages    (IM3Runtime io_runtime);
+#endif
+
+#if d_m3EnableStacklessCalls
+M3Result                    Runtime_GrowCallFrames      (IM3Runtime io_runtime);
+
+static inline M3Result  Runtime_PushCallFrame  (IM3Runtime io_runtime, pc_t i_pc, m3stack_t i_sp)
+{
+    if (M3_UNLIKELY (io_runtime->numCallFrames == io_runtime->maxCallFrames))
+    {
+        M3Result result = Runtime_GrowCallFrames (io_runtime);
+        if (result)
+            return result;
+    }
+
+    M3CallFrame * frame = & io_runtime->callFrames [io_runtime->numCallFrames++];
+    frame->pc = i_pc;
+    frame->sp = i_sp;
+#   if d_m3RecordBacktraces
+    frame->function = io_runtime->function;
+#   endif
+#   if d_m3LogNativeStack
+    io_runtime->peakCallFrames = M3_MAX (io_runtime->peakCallFrames, io_runtime->numCallFrames);
+#   endif
+
+    return m3Err_none;
+}
+#endif
+
+#if d_m3EnableTimeSlicing
+// the slice is spent: parks the call at i_pc, or starts a new slice when it can't be parked
+bool                        Runtime_ParkSpentCall       (IM3Runtime io_runtime, pc_t i_pc, m3stack_t i_sp);
+#endif
 
 // IM3Runtime memory
 void                        InitRuntime                 (IM3Runtime io_runtime, u32 i_stackSizeInBytes);
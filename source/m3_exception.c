@@ -1,3 +1,4 @@
+#include <inttypes.h>
 #include "esp_log.h"
 #include "esp_debug_helpers.h"
 
@@ -5,7 +6,7 @@
 
 
 char* error_details(const char* base_error, const char* format, ...) {
-    static char buffer[512];  // Buffer statico per il risultato
+    static __thread char buffer[512];  // Buffer statico per il risultato, uno per thread: il messaggio resta del chiamante
     char temp_buffer[256];    // Buffer temporaneo per la parte formattata
     va_list args;
     
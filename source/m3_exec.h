@@ -4,7 +4,12 @@
 //  Created by Steven Massey on 4/17/19.
 //  Copyright © 2019 Steven Massey. All rights reserved.
 
-#pragma once
+// m3_exec_threaded.h and m3_op_table.h expand the operations a second time with d_m3OpBodiesPass defined:
+// everything else in this file is skipped then
+#if !defined (M3_EXEC_H) || defined (d_m3OpBodiesPass)
+
+#ifndef d_m3OpBodiesPass
+#define M3_EXEC_H
 
 #include "m3_math_utils.h"
 #include "m3_env.h"
@@ -47,20 +52,27 @@
 d_m3BeginExternC
 
 // Riscrive l'operazione precedente con un nuovo operatore
-#define rewrite_op(OP)              *((void**)(_pc-1)) = (void*)(OP)
+#define rewrite_op(OP)              *((void**)(_pc-1)) = (void*)(m3OpWord (OP))
 
 // Salta un valore immediato nel program counter
 #define skip_immediate(TYPE)        (_pc++)
 
 // Legge un valore immediato dal program counter e lo incrementa
-#define immediate_ptr(TYPE)             (TYPE*)m3SegmentedMemAccess(_mem, _pc++, sizeof(TYPE))
+// (le code page sono nell'heap nativo: nessuna risoluzione)
+#define immediate_ptr(TYPE)             ((TYPE*)(_pc++))
 #define immediate(TYPE)                 *immediate_ptr(TYPE)
 
+#if M3Runtime_Stack_Segmented
 // Accede al valore nello slot dello stack usando un offset immediato
 #define slot(TYPE)                  *(TYPE*)m3SegmentedMemAccess(_mem, _sp + immediate(i32), sizeof(TYPE))
 
 // Ottiene il puntatore allo slot dello stack usando un offset immediato
 #define slot_ptr(TYPE)             (TYPE*)m3SegmentedMemAccess(_mem, _sp + immediate(i32), sizeof(TYPE))
+#else
+// Stack nativo: validato una volta in op_Entry, poi accesso diretto
+#define slot(TYPE)                  (* (TYPE *) (_sp + immediate (i32)))
+#define slot_ptr(TYPE)              ((TYPE *) (_sp + immediate (i32)))
+#endif
 
 # if d_m3EnableOpProfiling || d_m3EnableOpTracing // originally only d_m3EnableOpProfiling
    # if M3_FUNCTIONS_ENUM
@@ -75,6 +87,24 @@ d_m3BeginExternC
 
 #define jumpOp(PC)                  jumpOpDirect(PC)
 
+// time slicing: function entries, tail calls and loop iterations spend the runtime's slice. once it's spent
+// the call is parked at PC, an op with no live register, and m3_Resume dispatches it again
+#if d_m3EnableTimeSlicing
+#   define spendSlice(PC)               if (M3_UNLIKELY (--m3MemRuntime (_mem)->budget < 0) and \
+                                            Runtime_ParkSpentCall (m3MemRuntime (_mem), (pc_t) (PC), _sp)) return m3Err_suspended
+#else
+#   define spendSlice(PC)
+#endif
+
+// back to the top of a loop body: op_Loop calls the body again, or (stackless) the body is jumped to
+#if d_m3EnableTimeSlicing
+#   define continueLoop(LOOP)           { spendSlice (LOOP); jumpOp (LOOP); }
+#elif d_m3EnableStacklessCalls
+#   define continueLoop(LOOP)           jumpOp (LOOP)
+#else
+#   define continueLoop(LOOP)           return (LOOP)
+#endif
+
 #if d_m3RecordBacktraces
     #define pushBacktraceFrame()            (PushBacktraceFrame (_mem->runtime, _pc - 1))
     #define fillBacktraceFrame(FUNCTION)    (FillBacktraceFunctionInfo (_mem->runtime, function))
@@ -116,12 +146,12 @@ d_m3BeginExternC
                         _mem->runtime, "Null pointer"))
 
   #define d_outOfBounds newTrap (ErrorRuntime (m3Err_trapOutOfBoundsMemoryAccess,   \
-                        _mem->runtime, "memory size: %zu; access offset: %zu",      \
-                        _mem->total_size, operand))
+                        _mem->runtime, "memory size: %" PRIu64 "; access offset: %" PRIu64, \
+                        m3_LinearMemorySize (_mem), operand))
 
   #define d_outOfBoundsMemOp(OFFSET, SIZE) newTrap (ErrorRuntime (m3Err_trapOutOfBoundsMemoryAccess,   \
-                      _mem->runtime, "memory size: %zu; access offset: %zu; size: %u",     \
-                      _mem->total_size, OFFSET, SIZE))
+                      _mem->runtime, "memory size: %" PRIu64 "; access offset: %" PRIu64 "; size: %u", \
+                      m3_LinearMemorySize (_mem), (u64) (OFFSET), SIZE))
 #else
   #define d_nullPointer newTrap (m3Err_nullPointer)
 
@@ -147,6 +177,35 @@ d_m3RetSig  Call  (d_m3OpSig)
     nextOpDirect();
 }
 
+#if d_m3EnableStacklessCalls
+// Call without the nested call: the caller's return frame is kept by the runtime, op_Return jumps back to it
+static inline m3ret_t  PushCall  (IM3Memory i_memory, pc_t i_pc, m3stack_t i_sp)
+{
+    m3ret_t possible_trap = m3_Yield ();
+    if (M3_UNLIKELY(possible_trap)) return possible_trap;
+
+    return Runtime_PushCallFrame (i_memory->runtime, i_pc, i_sp);
+}
+
+// the caller's frame, just popped; NULL when the host called in (RunCodeFromHost pops that one)
+static inline M3CallFrame *  PopCall  (IM3Runtime io_runtime)
+{
+    M3CallFrame * frame = & io_runtime->callFrames [io_runtime->numCallFrames - 1];
+
+    if (not frame->pc)
+        return NULL;
+
+    io_runtime->numCallFrames--;
+#   if d_m3RecordBacktraces
+    io_runtime->function = frame->function;
+#   endif
+
+    return frame;
+}
+#endif
+
+#endif // d_m3OpBodiesPass
+
 // TODO: OK, this needs some explanation here ;0
 
 #define d_m3CommutativeOpMacro(RES, REG, TYPE, NAME, OP, ...) \
@@ -576,7 +635,16 @@ d_m3Op (Call)
     i32 stackOffset            = immediate (i32);
     IM3Memory memory           = _mem; //  m3MemInfo (_mem);
 
-    pc_t sp = _sp + stackOffset;
+#if d_m3EnableStacklessCalls
+    m3ret_t r = PushCall (memory, _pc, _sp);
+
+    if (M3_UNLIKELY(r))
+        newTrap (r);
+
+    _sp += stackOffset;
+    jumpOp (callPC);
+#else
+    m3stack_t sp = _sp + stackOffset;
 
     # if (d_m3EnableOpProfiling || d_m3EnableOpTracing)
     m3ret_t r = Call(callPC, sp, memory, d_m3OpDefaultArgs, d_m3BaseCstr);
@@ -593,6 +661,7 @@ d_m3Op (Call)
         pushBacktraceFrame();
         forwardTrap(r);
     }
+#endif
 }
 
 d_m3Op (CallIndirect)
@@ -603,8 +672,6 @@ d_m3Op (CallIndirect)
     i32 stackOffset            = immediate (i32);
     IM3Memory memory          =_mem; //  m3MemInfo (_mem);
 
-    pc_t sp = _sp + stackOffset;
-
     m3ret_t r = m3Err_none;
 
     if (M3_LIKELY(tableIndex < module->table0Size))
@@ -615,15 +682,27 @@ d_m3Op (CallIndirect)
         {
             if (M3_LIKELY(type == function->funcType))
             {
-                if (M3_UNLIKELY(not function->compiled))
+                if (M3_UNLIKELY(not GetFunctionCompiled(function)))
                     r = CompileFunction(function);
 
+#if d_m3EnableStacklessCalls
+                if (M3_LIKELY(not r))
+                    r = PushCall (memory, _pc, _sp);
+
                 if (M3_LIKELY(not r))
                 {
+                    _sp += stackOffset;
+                    jumpOp (GetFunctionCompiled(function));
+                }
+#else
+                if (M3_LIKELY(not r))
+                {
+                    m3stack_t sp = _sp + stackOffset;
+
                     # if (d_m3EnableOpProfiling || d_m3EnableOpTracing)
-                    r = Call(function->compiled, sp, memory, d_m3OpDefaultArgs, d_m3BaseCstr);
+                    r = Call(GetFunctionCompiled(function), sp, memory, d_m3OpDefaultArgs, d_m3BaseCstr);
                     # else
-                    r = Call(function->compiled, sp, memory, d_m3OpDefaultArgs);
+                    r = Call(GetFunctionCompiled(function), sp, memory, d_m3OpDefaultArgs);
                     # endif
 
                     // Non serve più refreshare _mem
@@ -637,6 +716,7 @@ d_m3Op (CallIndirect)
                         forwardTrap(r);
                     }
                 }
+#endif
             }
             else r = m3Err_trapIndirectCallTypeMismatch;
         }
@@ -649,6 +729,7 @@ d_m3Op (CallIndirect)
     else forwardTrap(r);
 }
 
+
 DEBUG_TYPE WASM_DEBUG_CallRawFunction = WASM_DEBUG_ALL || (WASM_DEBUG && false);
 d_m3Op (CallRawFunction)
 {
@@ -660,7 +741,7 @@ d_m3Op (CallRawFunction)
 
     M3ImportContext ctx;
 
-    M3RawCall call = (M3RawCall) (MEMACCESS(M3RawCall, _mem, (ptr)_pc++)); // *MEMACCESS..
+    M3RawCall call = immediate (M3RawCall);
     if(WASM_DEBUG_CallRawFunction) ESP_LOGI("WASM3", "CallRawFunction: call address %p", call);
 
     ctx.function = immediate (IM3Function);
@@ -696,9 +777,31 @@ d_m3Op (CallRawFunction)
         runtime->stack = stack_backup;
     }
 
+#if d_m3EnableAsyncImports
+    if (possible_trap == m3Err_suspended)
+    {
+        // parked: the caller's return frame stays on top, m3_Resume pops it once the results are in these slots
+        runtime->suspendedImport = ctx.function;
+        runtime->suspendedSP = _sp;
+        forwardTrap (possible_trap);
+    }
+#endif
+
     if (M3_UNLIKELY(possible_trap)) {
         pushBacktraceFrame();
     }
+#if d_m3EnableStacklessCalls
+    else
+    {
+        // called (or tail called) like a wasm function: it returns the way op_Return does
+        M3CallFrame * caller = PopCall (runtime);
+        if (caller)
+        {
+            _sp = caller->sp;
+            jumpOp (caller->pc);
+        }
+    }
+#endif
     forwardTrap(possible_trap);
 }
 
@@ -707,7 +810,7 @@ d_m3Op  (MemSize)
 {
     IM3Memory memory            =_mem; //  m3MemInfo (_mem);
 
-    _r0 = memory->total_size; // istead of memory->numPages
+    _r0 = memory->numPages;
 
     nextOp ();
 }
@@ -746,7 +849,9 @@ d_m3Op (MemGrow) //todo: convert it to new memory model
 
 // Memory Copy operation
 DEBUG_TYPE WASM_DEBUG_MemCopy = WASM_DEBUG_ALL || (WASM_DEBUG && false);
+#ifndef d_m3OpBodiesPass     // a local would be jumped over uninitialized
 const bool WASM_MemCopy_DisableCheck = true;
+#endif
 d_m3Op (MemCopy)
 {
     if(WASM_DEBUG_MemCopy) ESP_LOGI("WASM3", "MemCopy called");
@@ -775,7 +880,9 @@ d_m3Op (MemCopy)
 }
 
 DEBUG_TYPE WASM_DEBUG_MemFill = WASM_DEBUG_ALL || (WASM_DEBUG && false);
+#ifndef d_m3OpBodiesPass     // a local would be jumped over uninitialized
 const bool WASM_MemFill_DisableCheck = true;
+#endif
 d_m3Op (MemFill)
 {
     if(WASM_DEBUG_MemFill) ESP_LOGI("WASM3", "MemFill called");
@@ -785,7 +892,7 @@ d_m3Op (MemFill)
     u64 destination = slot (u32);
     
     if(!WASM_MemFill_DisableCheck){
-        if (M3_UNLIKELY(destination + size > _mem->total_size))
+        if (M3_UNLIKELY(destination + size > m3_LinearMemorySize (_mem)))
         {
             d_outOfBoundsMemOp (destination, size);
             return;
@@ -816,13 +923,13 @@ d_m3Op  (Compile)
 
     m3ret_t result = m3Err_none;
 
-    if (M3_UNLIKELY(not function->compiled)) // check to see if function was compiled since this operation was emitted.
+    if (M3_UNLIKELY(not GetFunctionCompiled (function))) // check to see if function was compiled since this operation was emitted (maybe by a worker thread)
         result = CompileFunction (function);
 
     if (not result)
     {
         // patch up compiled pc and call rewritten op_Call
-        * ((void**) --_pc) = (void*) (function->compiled);
+        * ((void**) --_pc) = (void*) GetFunctionCompiled (function);
         --_pc;
         nextOpDirect ();
     }
@@ -830,46 +937,151 @@ d_m3Op  (Compile)
     newTrap (result);
 }
 
+
+#if d_m3EnableCodePageRefCounting
+
+// op_Call through the function: its code can be released between calls (m3_ReleaseColdCode) and compiled again here
+d_m3Op  (CallFunction)
+{
+    IM3Function function        = immediate (IM3Function);
+    i32 stackOffset             = immediate (i32);
+    IM3Memory memory            = _mem;
+
+    m3ret_t r = m3Err_none;
+
+    if (M3_UNLIKELY (not GetFunctionCompiled (function)))
+        r = CompileFunction (function);
+
+#if d_m3EnableStacklessCalls
+    if (M3_LIKELY (not r))
+        r = PushCall (memory, _pc, _sp);
+
+    if (M3_LIKELY (not r))
+    {
+        _sp += stackOffset;
+        jumpOp (GetFunctionCompiled (function));
+    }
+#else
+    if (M3_LIKELY (not r))
+    {
+        pc_t sp = _sp + stackOffset;
+
+        # if (d_m3EnableOpProfiling || d_m3EnableOpTracing)
+        r = Call (GetFunctionCompiled (function), sp, memory, d_m3OpDefaultArgs, d_m3BaseCstr);
+        # else
+        r = Call (GetFunctionCompiled (function), sp, memory, d_m3OpDefaultArgs);
+        # endif
+
+        if (M3_LIKELY (not r))
+            nextOp ();
+        else
+        {
+            pushBacktraceFrame ();
+            forwardTrap (r);
+        }
+    }
+#endif
+
+    newTrap (r);
+}
+
+#endif // d_m3EnableCodePageRefCounting
+
+
+#if d_m3EnableTieredCompile
+
+// baseline code starts with op_CountCall (see TierUpFunction). once the function is optimised its
+// 'compiled' moves: callers still holding the baseline entry land here and are sent on
+d_m3Op  (CountCall)
+{
+    IM3Function function        = immediate (IM3Function);
+
+    if (M3_UNLIKELY (++function->numCalls == d_m3TierUpCalls))
+        TierUpFunction (function);                      // on failure it just stays in the baseline tier
+
+    if (M3_UNLIKELY (function->tier != c_m3TierBaseline))
+        jumpOp (GetFunctionCompiled (function));
+
+    nextOp ();
+}
+
+
+// first op of a loop body in baseline code. no on-stack replacement: the running call finishes
+// in the baseline code, the next one doesn't
+d_m3Op  (CountBackEdge)
+{
+    IM3Function function        = immediate (IM3Function);
+
+    if (M3_UNLIKELY (++function->numBackEdges == d_m3TierUpBackEdges))
+        TierUpFunction (function);
+
+    nextOp ();
+}
+
+#endif // d_m3EnableTieredCompile
+
 ////////////////////////////////
 
 d_m3Op  (Entry)
 {
+    spendSlice (_pc - 1);
+
     d_m3ClearRegisters
 
     d_m3TracePrepare
 
     IM3Function function = immediate (IM3Function);
+#if ! d_m3EnableStacklessCalls
     IM3Memory memory = m3MemInfo (_mem);
+#endif
 
-#define d_m3SkipStackCheck 1
 #if d_m3SkipStackCheck
     if (true)
 #else
+    // the whole frame is checked here once, so slot() can dereference without checks
     if (M3_LIKELY ((void *) (_sp + function->maxStackSlots) < _mem->maxStack))
 #endif
     {
 #if defined(DEBUG)
         function->hits++;
+#endif
+#if d_m3EnableCodePageRefCounting
+        function->called = true;
 #endif
         u8 * stack = (u8 *) ((m3slot_t *) _sp + function->numRetAndArgSlots);
 
+#if M3Runtime_Stack_Segmented
         m3_memset (_mem, stack, 0x0, function->numLocalBytes);
+#else
+        memset (stack, 0x0, function->numLocalBytes);
+#endif
         stack += function->numLocalBytes;
 
         if (function->constants)
         {
+#if M3Runtime_Stack_Segmented
             m3_memcpy (_mem, stack, function->constants, function->numConstantBytes);
+#else
+            memcpy (stack, function->constants, function->numConstantBytes);
+#endif
         }
 
         #if d_m3EnableStrace >= 2
             const char* funName = m3_GetFunctionName(function);
-            m3stack_t __sp = MEMPOINT(m3stack_t, _mem, _sp);
+            m3stack_t __sp = STACKPOINT(m3stack_t, _mem, _sp);
             const char* printFunArgs = SPrintFunctionArgList (function, __sp + function->numRetSlots);
             d_m3TracePrint("%s %s {", funName, printFunArgs);
 
             trace_rt->callDepth++;
         #endif
 
+#if d_m3EnableStacklessCalls
+        // the body runs in this native frame's place; op_Return goes back to the caller through the runtime
+#   if d_m3RecordBacktraces
+        m3MemRuntime (_mem)->function = function;
+#   endif
+        nextOp ();
+#else
         m3ret_t r = nextOpImpl ();
 
 #if d_m3EnableStrace >= 2
@@ -882,7 +1094,7 @@ d_m3Op  (Entry)
             if (rettype != c_m3Type_none) {
                 int size = 256;
                 char* str = malloc(size*sizeof(char));
-                m3stack_t __sp = MEMPOINT(m3stack_t, _mem, _sp);
+                m3stack_t __sp = STACKPOINT(m3stack_t, _mem, _sp);
                 SPrintArg (str, size, __sp, rettype);
                 d_m3TracePrint("} = %s", str);
                 free(str);
@@ -897,10 +1109,154 @@ d_m3Op  (Entry)
             fillBacktraceFrame ();
         }
         forwardTrap (r);
+#endif
     }
     else newTrap (m3Err_trapStackOverflow);
 }
 
+
+#ifndef d_m3OpBodiesPass
+
+// return_call: the callee's return and argument slots, set up above the frame as for a call, move down
+// to the start of the frame
+static inline void  MoveTailCallSlots  (m3stack_t io_sp, i32 i_stackOffset, u32 i_numSlots, IM3Memory i_memory)
+{
+#if M3Runtime_Stack_Segmented
+    for (u32 i = 0; i < i_numSlots; ++i)
+        * (m3slot_t *) m3SegmentedMemAccess (i_memory, io_sp + i, sizeof (m3slot_t)) =
+            * (m3slot_t *) m3SegmentedMemAccess (i_memory, io_sp + i_stackOffset + i, sizeof (m3slot_t));
+#else
+    memmove (io_sp, io_sp + i_stackOffset, i_numSlots * sizeof (m3slot_t));
+#endif
+}
+
+// then the callee takes over the frame: what its op_CountCall and op_Entry do is done here, without the
+// native frame op_Entry keeps while the function runs. returns the pc to go on from, NULL on stack overflow
+static inline pc_t  EnterTailCall  (IM3Function io_function, m3stack_t i_sp, IM3Memory i_memory)
+{
+    pc_t pc = GetFunctionCompiled (io_function);
+
+#if d_m3EnableTieredCompile
+    if (* pc == (code_t) m3OpWord (op_CountCall))
+    {
+        if (M3_UNLIKELY (++io_function->numCalls == d_m3TierUpCalls))
+            TierUpFunction (io_function);
+
+        pc = GetFunctionCompiled (io_function);
+        if (* pc == (code_t) m3OpWord (op_CountCall))
+            pc += 2;
+    }
+#endif
+
+    // imports have no op_Entry: their code runs and returns as is
+    if (* pc == (code_t) m3OpWord (op_Entry))
+    {
+#if !d_m3SkipStackCheck
+        if (M3_UNLIKELY ((void *) (i_sp + io_function->maxStackSlots) >= i_memory->maxStack))
+            return NULL;
+#endif
+#if d_m3EnableCodePageRefCounting
+        io_function->called = true;
+#endif
+#if d_m3EnableStacklessCalls && d_m3RecordBacktraces
+        i_memory->runtime->function = io_function;
+#endif
+        u8 * stack = (u8 *) (i_sp + io_function->numRetAndArgSlots);
+
+#if M3Runtime_Stack_Segmented
+        m3_memset (i_memory, stack, 0x0, io_function->numLocalBytes);
+        if (io_function->constants)
+            m3_memcpy (i_memory, stack + io_function->numLocalBytes, io_function->constants, io_function->numConstantBytes);
+#else
+        memset (stack, 0x0, io_function->numLocalBytes);
+        if (io_function->constants)
+            memcpy (stack + io_function->numLocalBytes, io_function->constants, io_function->numConstantBytes);
+#endif
+        pc += 2;
+    }
+
+    return pc;
+}
+
+#endif // d_m3OpBodiesPass
+
+
+// no native frame and no wasm frame of its own: the callee returns straight to the caller's caller.
+// m3_Yield is checked as in Call, a tail recursive loop never goes through it otherwise
+d_m3Op  (ReturnCall)
+{
+    spendSlice (_pc - 1);
+
+    IM3Function function        = immediate (IM3Function);
+    i32 stackOffset             = immediate (i32);
+    u32 numSlots                = immediate (u32);
+
+    m3ret_t r = m3_Yield ();
+
+    if (M3_LIKELY (not r) and M3_UNLIKELY (not GetFunctionCompiled (function)))
+        r = CompileFunction (function);
+
+    if (M3_UNLIKELY (r))
+        newTrap (r);
+
+    MoveTailCallSlots (_sp, stackOffset, numSlots, _mem);
+
+    pc_t pc = EnterTailCall (function, _sp, _mem);
+
+    if (M3_UNLIKELY (not pc))
+        newTrap (m3Err_trapStackOverflow);
+
+    jumpOp (pc);
+}
+
+
+d_m3Op  (ReturnCallIndirect)
+{
+    spendSlice (_pc - 1);
+
+    u32 tableIndex              = slot (u32);
+    IM3Module module            = immediate (IM3Module);
+    IM3FuncType type            = immediate (IM3FuncType);
+    i32 stackOffset             = immediate (i32);
+    u32 numSlots                = immediate (u32);
+
+    m3ret_t r = m3_Yield ();
+    IM3Function function = NULL;
+
+    if (M3_LIKELY (not r))
+    {
+        if (M3_LIKELY (tableIndex < module->table0Size))
+        {
+            function = module->table0 [tableIndex];
+
+            if (M3_LIKELY (function))
+            {
+                if (M3_LIKELY (type == function->funcType))
+                {
+                    if (M3_UNLIKELY (not GetFunctionCompiled (function)))
+                        r = CompileFunction (function);
+                }
+                else r = m3Err_trapIndirectCallTypeMismatch;
+            }
+            else r = m3Err_trapTableElementIsNull;
+        }
+        else r = m3Err_trapTableIndexOutOfRange;
+    }
+
+    if (M3_UNLIKELY (r))
+        newTrap (r);
+
+    MoveTailCallSlots (_sp, stackOffset, numSlots, _mem);
+
+    pc_t pc = EnterTailCall (function, _sp, _mem);
+
+    if (M3_UNLIKELY (not pc))
+        newTrap (m3Err_trapStackOverflow);
+
+    jumpOp (pc);
+}
+
+
 DEBUG_TYPE WASM_DEBUG_Loop = WASM_DEBUG_ALL || (WASM_DEBUG && false);
 d_m3Op  (Loop)
 {
@@ -912,6 +1268,11 @@ d_m3Op  (Loop)
     // this reduces code size & stack usage
     d_m3ClearRegisters
 
+#if d_m3EnableStacklessCalls
+    // no native frame per loop either: op_ContinueLoop jumps back to the body, a return from inside
+    // it can't go through here
+    nextOp ();
+#else
     m3ret_t r;
     
     IM3Memory memory =_mem; //  m3MemInfo (_mem);
@@ -951,12 +1312,13 @@ d_m3Op  (Loop)
     if(WASM_DEBUG_Loop) ESP_LOGI("WASM3", "Loop ending.");
     
     forwardTrap (r);
+#endif
 }
 
 
 d_m3Op  (Branch)
 {
-    jumpOp (_pc);
+    jumpOp (* _pc);
 }
 
 
@@ -1093,7 +1455,7 @@ d_m3Op  (DumpStack)
 #if d_m3HasFloat
     printf ("                                    fp0: %" PRIf64 "\n", _fp0);
 #endif
-    pc_t sp = MEMPOINT(pc_t, _mem, _sp);
+    pc_t sp = STACKPOINT(pc_t, _mem, _sp);
 
     for (u32 i = 0; i < stackHeight; ++i)
     {
@@ -1211,6 +1573,24 @@ d_m3Select_f (f64, _fp0, s, slot (i32))
 
 d_m3Op  (Return){
     m3StackCheck();
+
+#if d_m3EnableStacklessCalls
+    #if d_m3EnableStrace >= 2
+        d_m3TracePrepare
+        if (trace_rt->callDepth) {          // an init expression returns without an op_Entry
+            trace_rt->callDepth--;
+            d_m3TracePrint("}");
+        }
+    #endif
+
+    M3CallFrame * caller = PopCall (m3MemRuntime (_mem));
+    if (caller)
+    {
+        _sp = caller->sp;
+        jumpOp (caller->pc);
+    }
+#endif
+
     return m3Err_none;
 }
 
@@ -1284,12 +1664,10 @@ d_m3Op  (ContinueLoop)
 
     m3StackCheck();
 
-    // TODO: this is where execution can "escape" the M3 code and callback to the client / fiber switch
-    // OR it can go in the Loop operation. I think it's best to do here. adding code to the loop operation
-    // has the potential to increase its native-stack usage. (don't forget ContinueLoopIf too.)
+    // with d_m3EnableTimeSlicing this is where the call leaves for the scheduler (continueLoop), as in ContinueLoopIf
 
     void * loopId = immediate (void *);
-    return loopId;
+    continueLoop (loopId);
 }
 
 
@@ -1306,7 +1684,7 @@ d_m3Op  (ContinueLoopIf)
     if (condition)
     {
         if(WASM_DEBUG_ContinueLoopIf) ESP_LOGI("WASM3", "ContinueLoopIf: return loopId: %p", loopId);
-        return loopId;
+        continueLoop (loopId);
     }
     else {
         if(WASM_DEBUG_ContinueLoopIf) ESP_LOGI("WASM3", "ContinueLoopIf: else nextOp()");
@@ -1330,7 +1708,9 @@ d_m3Op  (ContinueLoopIf)
     })
 
 DEBUG_TYPE WASM_DEBUG_Const = WASM_DEBUG_ALL || (WASM_DEBUG && false); // Const32 and Const64
+#ifndef d_m3OpBodiesPass     // a local would be jumped over uninitialized
 bool WASM_ConstUseComplexAssing = false;
+#endif
 
 d_m3Op (Const32) {
     /* Simply Also Known As
@@ -1343,7 +1723,7 @@ d_m3Op (Const32) {
         waitForIt();
     }
 
-    u32 value = MEMACCESS(u32, _mem, _pc++);
+    u32 value = immediate(u32);
 
     if(WASM_ConstUseComplexAssing){
         i32 imm = immediate(i32);    
@@ -1351,8 +1731,8 @@ d_m3Op (Const32) {
         if(WASM_DEBUG_Const) ESP_LOGW("WASM3", "Const32: _sp = %p, dest_offset = %p, imm = %d", _sp, dest_offset, imm);
         u32* dest = m3SegmentedMemAccess(_mem, CAST_PTR dest_offset, sizeof(u32));
         
-        bool isErr = (dest == ERROR_POINTER);
-        if (isErr != NULL) {
+        bool isErr = ((void*)dest == ERROR_POINTER);
+        if (isErr) {
             ESP_LOGW("WASM3", "Destination memory failed at sp=%u, immediate=%d, dest=%p, _pc=%p", _sp, imm, dest, _pc);
             waitForIt();
             if(isErr) return m3Err_pointerOverflow;
@@ -1385,19 +1765,9 @@ d_m3Op (Const64) {
     */
     if(WASM_DEBUG_Const) ESP_LOGI("WASM3", "Const64 called");
 
-    // Prima verifica la validità dell'accesso alla memoria sorgente
-    void* src_ptr = m3SegmentedMemAccess(_mem, _pc, sizeof(u64));
-
     // Leggi il valore usando memcpy per evitare problemi di allineamento
     u64 value = 0;
-
-    bool isErr = (value == ERROR_POINTER);
-    if (WASM_DEBUG_Const || isErr) {
-        ESP_LOGI("WASM3", "Source memory access failed at pc=%u", (unsigned)_pc);
-        if(isErr) return m3Err_mallocFailed;
-    }
-    
-    m3_memcpy(_mem, &value, src_ptr, sizeof(u64));     
+    memcpy(&value, _pc, sizeof(u64));
 
         // aka immediate(i32);
     _pc += (M3_SIZEOF_PTR == 4) ? 2 : 1;  // Su ESP32 sempre 2 perché M3_SIZEOF_PTR == 4
@@ -1487,49 +1857,36 @@ d_m3Op  (SetGlobal_f64)
 #endif
 
 
-#define d_m3SkipMemoryBoundsCheck 1
 #if d_m3SkipMemoryBoundsCheck
 #  define m3MemCheck(x) true
 #else
 #  define m3MemCheck(x) M3_LIKELY(x)
 #endif
 
-#define d_m3Load(REG,DEST_TYPE,SRC_TYPE)                \
-d_m3Op(DEST_TYPE##_Load_##SRC_TYPE##_r)                 \
+// Varianti di controllo per load/store, applicate all'indirizzo finale (base + offset):
+//  Checked   - controllo sul singolo accesso
+//  Range     - primo accesso di un gruppo: l'immediate 'reach' copre anche gli accessi
+//              successivi sulla stessa base (d_m3HoistMemoryBoundsChecks, vedi Compile_Load_Store)
+//  Unchecked - accesso coperto dal Range che lo precede nello stesso blocco
+// Il Range legge sempre il suo immediate, anche con d_m3SkipMemoryBoundsCheck.
+#define d_m3MemChecked(OPERAND, SIZE)       m3MemCheck ((OPERAND) + (SIZE) <= m3_LinearMemorySize (_mem))
+#define d_m3MemRange(OPERAND, SIZE)         M3_LIKELY ((OPERAND) + immediate (u32) <= m3_LinearMemorySize (_mem))
+#define d_m3MemUnchecked(OPERAND, SIZE)     true
+
+#define d_m3LoadOp(NAME, CHECK, ADDRESS, REG, DEST_TYPE, SRC_TYPE) \
+d_m3Op(NAME)                                            \
 {                                                       \
     d_m3TracePrepare                                    \
+    u64 operand = ADDRESS;                              \
     u32 offset = immediate (u32);                       \
-    u64 operand = (u32) _r0;                            \
     operand += offset;                                  \
                                                         \
-    if (m3MemCheck(                                     \
-        operand + sizeof (SRC_TYPE) <= _mem->length     \
-    )) {                                                \
+    if (CHECK (operand, sizeof (SRC_TYPE))) {           \
         {                                               \
             u8* src8 = m3MemData(_mem) + operand;       \
             SRC_TYPE value;                             \
-            m3_memcpy(_mem, &value, src8, sizeof(SRC_TYPE));\
-            M3_BSWAP_##SRC_TYPE(value);                 \
-            REG = (DEST_TYPE)value;                     \
-            d_m3TraceLoad(DEST_TYPE, operand, REG);     \
-        }                                               \
-        nextOp ();                                      \
-    } else d_outOfBounds;                               \
-}                                                       \
-d_m3Op(DEST_TYPE##_Load_##SRC_TYPE##_s)                 \
-{                                                       \
-    d_m3TracePrepare                                    \
-    u64 operand = slot (u32);                           \
-    u32 offset = immediate (u32);                       \
-    operand += offset;                                  \
-                                                        \
-    if (m3MemCheck(                                     \
-        operand + sizeof (SRC_TYPE) <= _mem->length     \
-    )) {                                                \
-        {                                               \
-            u8* src8 = m3MemData(_mem) + operand;       \
-            SRC_TYPE value;                             \
-            m3_memcpy(_mem, &value, src8, sizeof(SRC_TYPE));\
+            if (M3_UNLIKELY(m3_memcpy(_mem, &value, src8, sizeof(SRC_TYPE)))) \
+                newTrap (m3Err_mallocFailed);           \
             M3_BSWAP_##SRC_TYPE(value);                 \
             REG = (DEST_TYPE)value;                     \
             d_m3TraceLoad(DEST_TYPE, operand, REG);     \
@@ -1538,6 +1895,19 @@ d_m3Op(DEST_TYPE##_Load_##SRC_TYPE##_s)                 \
     } else d_outOfBounds;                               \
 }
 
+#if d_m3HoistMemoryBoundsChecks
+#define d_m3LoadHoisted(REG,DEST_TYPE,SRC_TYPE)                                                                 \
+d_m3LoadOp (DEST_TYPE##_Load_##SRC_TYPE##_s_Range,      d_m3MemRange,       slot (u32), REG, DEST_TYPE, SRC_TYPE) \
+d_m3LoadOp (DEST_TYPE##_Load_##SRC_TYPE##_s_Unchecked,  d_m3MemUnchecked,   slot (u32), REG, DEST_TYPE, SRC_TYPE)
+#else
+#define d_m3LoadHoisted(REG,DEST_TYPE,SRC_TYPE)
+#endif
+
+#define d_m3Load(REG,DEST_TYPE,SRC_TYPE)                                                                        \
+d_m3LoadOp (DEST_TYPE##_Load_##SRC_TYPE##_r,            d_m3MemChecked,     (u32) _r0,  REG, DEST_TYPE, SRC_TYPE) \
+d_m3LoadOp (DEST_TYPE##_Load_##SRC_TYPE##_s,            d_m3MemChecked,     slot (u32), REG, DEST_TYPE, SRC_TYPE) \
+d_m3LoadHoisted (REG, DEST_TYPE, SRC_TYPE)
+
 #define d_m3Load_i(DEST_TYPE, SRC_TYPE) d_m3Load(_r0, DEST_TYPE, SRC_TYPE)
 #define d_m3Load_f(DEST_TYPE, SRC_TYPE) d_m3Load(_fp0, DEST_TYPE, SRC_TYPE)
 
@@ -1565,92 +1935,48 @@ d_m3Load_i (i64, i64);
 /// Segmented memory store
 ///
 
-#define d_m3Store(REG, SRC_TYPE, DEST_TYPE)             \
-d_m3Op  (SRC_TYPE##_Store_##DEST_TYPE##_rs)             \
-{                                                       \
-    d_m3TracePrepare                                    \
-    u64 operand = slot (u32);                           \
-    u32 offset = immediate (u32);                       \
-    operand += offset;                                  \
-                                                        \
-    if (m3MemCheck(                                     \
-        operand + sizeof (DEST_TYPE) <= _mem->length    \
-    )) {                                                \
-        {                                               \
-            d_m3TraceStore(SRC_TYPE, operand, REG);     \
-            u8* mem8 = m3MemData(_mem) + operand;       \
-            DEST_TYPE val = (DEST_TYPE) REG;            \
-            M3_BSWAP_##DEST_TYPE(val);                  \
-            m3_memcpy(_mem, mem8, &val, sizeof(val));   \
-        }                                               \
-        nextOp ();                                      \
-    } else d_outOfBounds;                               \
-}                                                       \
-d_m3Op  (SRC_TYPE##_Store_##DEST_TYPE##_sr)             \
-{                                                       \
-    d_m3TracePrepare                                    \
-    const SRC_TYPE value = slot (SRC_TYPE);             \
-    u64 operand = (u32) _r0;                            \
-    u32 offset = immediate (u32);                       \
-    operand += offset;                                  \
-                                                        \
-    if (m3MemCheck(                                     \
-        operand + sizeof (DEST_TYPE) <= _mem->length    \
-    )) {                                                \
-        {                                               \
-            d_m3TraceStore(SRC_TYPE, operand, value);   \
-            u8* mem8 = m3MemData(_mem) + operand;       \
-            DEST_TYPE val = (DEST_TYPE) value;          \
-            M3_BSWAP_##DEST_TYPE(val);                  \
-            m3_memcpy(_mem, mem8, &val, sizeof(val));   \
-        }                                               \
-        nextOp ();                                      \
-    } else d_outOfBounds;                               \
-}                                                       \
-d_m3Op  (SRC_TYPE##_Store_##DEST_TYPE##_ss)             \
+// VALUE e' letto prima di ADDRESS: stesso ordine degli slot emessi dal compilatore
+#define d_m3StoreOp(NAME, CHECK, VALUE, ADDRESS, SRC_TYPE, DEST_TYPE) \
+d_m3Op  (NAME)                                          \
 {                                                       \
     d_m3TracePrepare                                    \
-    const SRC_TYPE value = slot (SRC_TYPE);             \
-    u64 operand = slot (u32);                           \
+    const SRC_TYPE value = VALUE;                       \
+    u64 operand = ADDRESS;                              \
     u32 offset = immediate (u32);                       \
     operand += offset;                                  \
                                                         \
-    if (m3MemCheck(                                     \
-        operand + sizeof (DEST_TYPE) <= _mem->length    \
-    )) {                                                \
+    if (CHECK (operand, sizeof (DEST_TYPE))) {          \
         {                                               \
             d_m3TraceStore(SRC_TYPE, operand, value);   \
             u8* mem8 = m3MemData(_mem) + operand;       \
             DEST_TYPE val = (DEST_TYPE) value;          \
             M3_BSWAP_##DEST_TYPE(val);                  \
-            m3_memcpy(_mem, mem8, &val, sizeof(val));   \
+            if (M3_UNLIKELY(m3_memcpy(_mem, mem8, &val, sizeof(val)))) \
+                newTrap (m3Err_mallocFailed);           \
         }                                               \
         nextOp ();                                      \
     } else d_outOfBounds;                               \
 }
 
+#if d_m3HoistMemoryBoundsChecks
+#define d_m3StoreHoisted(REG, SRC_TYPE, DEST_TYPE)                                                                          \
+d_m3StoreOp (SRC_TYPE##_Store_##DEST_TYPE##_rs_Range,       d_m3MemRange,       REG,             slot (u32), SRC_TYPE, DEST_TYPE) \
+d_m3StoreOp (SRC_TYPE##_Store_##DEST_TYPE##_ss_Range,       d_m3MemRange,       slot (SRC_TYPE), slot (u32), SRC_TYPE, DEST_TYPE) \
+d_m3StoreOp (SRC_TYPE##_Store_##DEST_TYPE##_rs_Unchecked,   d_m3MemUnchecked,   REG,             slot (u32), SRC_TYPE, DEST_TYPE) \
+d_m3StoreOp (SRC_TYPE##_Store_##DEST_TYPE##_ss_Unchecked,   d_m3MemUnchecked,   slot (SRC_TYPE), slot (u32), SRC_TYPE, DEST_TYPE)
+#else
+#define d_m3StoreHoisted(REG, SRC_TYPE, DEST_TYPE)
+#endif
+
+#define d_m3Store(REG, SRC_TYPE, DEST_TYPE)                                                                                 \
+d_m3StoreOp (SRC_TYPE##_Store_##DEST_TYPE##_rs,             d_m3MemChecked,     REG,             slot (u32), SRC_TYPE, DEST_TYPE) \
+d_m3StoreOp (SRC_TYPE##_Store_##DEST_TYPE##_sr,             d_m3MemChecked,     slot (SRC_TYPE), (u32) _r0,  SRC_TYPE, DEST_TYPE) \
+d_m3StoreOp (SRC_TYPE##_Store_##DEST_TYPE##_ss,             d_m3MemChecked,     slot (SRC_TYPE), slot (u32), SRC_TYPE, DEST_TYPE) \
+d_m3StoreHoisted (REG, SRC_TYPE, DEST_TYPE)
+
 // both operands can be in regs when storing a float
-#define d_m3StoreFp(REG, TYPE)                          \
-d_m3Op  (TYPE##_Store_##TYPE##_rr)                      \
-{                                                       \
-    d_m3TracePrepare                                    \
-    u64 operand = (u32) _r0;                            \
-    u32 offset = immediate (u32);                       \
-    operand += offset;                                  \
-                                                        \
-    if (m3MemCheck(                                     \
-        operand + sizeof (TYPE) <= _mem->length         \
-    )) {                                                \
-        {                                               \
-            d_m3TraceStore(TYPE, operand, REG);         \
-            u8* mem8 = m3MemData(_mem) + operand;       \
-            TYPE val = (TYPE) REG;                      \
-            M3_BSWAP_##TYPE(val);                       \
-            m3_memcpy(_mem, mem8, &val, sizeof(val));   \
-        }                                               \
-        nextOp ();                                      \
-    } else d_outOfBounds;                               \
-}
+#define d_m3StoreFp(REG, TYPE)                                                                                              \
+d_m3StoreOp (TYPE##_Store_##TYPE##_rr,                      d_m3MemChecked,     REG,             (u32) _r0,  TYPE, TYPE)
 
 #define d_m3Store_i(SRC_TYPE, DEST_TYPE) d_m3Store(_r0, SRC_TYPE, DEST_TYPE)
 #define d_m3Store_f(SRC_TYPE, DEST_TYPE) d_m3Store(_fp0, SRC_TYPE, DEST_TYPE) d_m3StoreFp (_fp0, SRC_TYPE);
@@ -1669,8 +1995,97 @@ d_m3Store_i (i64, i16)
 d_m3Store_i (i64, i32)
 d_m3Store_i (i64, i64)
 
+
+//---------------------------------------------------------------------------------------------------------------------
+// superinstructions
+//---------------------------------------------------------------------------------------------------------------------
+// Sequenze frequenti di opcode wasm compilate in un'unica operazione (vedi Compile_Operator).
+// Gli operandi sono sempre in slot: nessun passaggio per _r0, un solo dispatch.
+// Gli insiemi istanziati sono in m3_fused_ops.h.
+#if d_m3EnableSuperInstructions
+
+#include "m3_fused_ops.h"
+
+// TYPE.NAME ; local.set
+#define d_m3SetLocalOpMacro(TYPE, NAME, OP, ...)         \
+d_m3Op(TYPE##_##NAME##_sss)                             \
+{                                                       \
+    TYPE operand2 = slot (TYPE);                        \
+    TYPE operand1 = slot (TYPE);                        \
+    TYPE * dest = slot_ptr (TYPE);                      \
+    OP((* dest), operand1, operand2, ##__VA_ARGS__);    \
+    nextOp ();                                          \
+}
+
+#define d_m3SetLocalOp(OPCODE, TYPE, NAME, MACRO, OP)   d_m3SetLocalOpMacro (TYPE, NAME, MACRO, OP)
+M3_FUSED_SETLOCAL_OPS (d_m3SetLocalOp)
+
+// TYPE.compare ; br_if  (forward branch without results, or loop continue without params)
+#define d_m3CompareBranchMacro(TYPE, NAME, OP)          \
+d_m3Op(TYPE##_##NAME##_ss_BranchIf)                     \
+{                                                       \
+    TYPE operand2 = slot (TYPE);                        \
+    TYPE operand1 = slot (TYPE);                        \
+    pc_t branch = immediate (pc_t);                     \
+                                                        \
+    if (operand1 OP operand2)                           \
+    {                                                   \
+        jumpOp (branch);                                \
+    }                                                   \
+    else nextOp ();                                     \
+}                                                       \
+d_m3Op(TYPE##_##NAME##_ss_ContinueLoopIf)               \
+{                                                       \
+    TYPE operand2 = slot (TYPE);                        \
+    TYPE operand1 = slot (TYPE);                        \
+    void * loopId = immediate (void *);                 \
+                                                        \
+    if (operand1 OP operand2)                           \
+    {                                                   \
+        continueLoop (loopId);                          \
+    }                                                   \
+    else nextOp ();                                     \
+}
+
+#define d_m3CompareBranchOp(OPCODE, TYPE, NAME, OP)     d_m3CompareBranchMacro (TYPE, NAME, OP)
+M3_FUSED_BRANCHIF_OPS (d_m3CompareBranchOp)
+
+// i32.add ; load: l'indirizzo e' (u32)(base + index), poi l'offset come in d_m3Load.
+// La somma resta a 32 bit: piegare la costante nell'offset cambierebbe il wrap-around.
+#define d_m3AddLoad(REG,DEST_TYPE,SRC_TYPE)             \
+d_m3Op(DEST_TYPE##_Load_##SRC_TYPE##_ss)                \
+{                                                       \
+    d_m3TracePrepare                                    \
+    u32 address2 = slot (u32);                          \
+    u32 address1 = slot (u32);                          \
+    u32 offset = immediate (u32);                       \
+    u64 operand = (u32) (address1 + address2);          \
+    operand += offset;                                  \
+                                                        \
+    if (m3MemCheck(                                     \
+        operand + sizeof (SRC_TYPE) <= m3_LinearMemorySize (_mem) \
+    )) {                                                \
+        {                                               \
+            u8* src8 = m3MemData(_mem) + operand;       \
+            SRC_TYPE value;                             \
+            if (M3_UNLIKELY(m3_memcpy(_mem, &value, src8, sizeof(SRC_TYPE)))) \
+                newTrap (m3Err_mallocFailed);           \
+            M3_BSWAP_##SRC_TYPE(value);                 \
+            REG = (DEST_TYPE)value;                     \
+            d_m3TraceLoad(DEST_TYPE, operand, REG);     \
+        }                                               \
+        nextOp ();                                      \
+    } else d_outOfBounds;                               \
+}
+
+#define d_m3AddLoadOp(OPCODE, DEST_TYPE, SRC_TYPE)       d_m3AddLoad (_r0, DEST_TYPE, SRC_TYPE)
+M3_FUSED_ADDLOAD_OPS (d_m3AddLoadOp)
+
+#endif // d_m3EnableSuperInstructions
+
 #undef m3MemCheck
 
+#ifndef d_m3OpBodiesPass
 
 //---------------------------------------------------------------------------------------------------------------------
 // debug/profiling
@@ -1691,7 +2106,8 @@ d_m3RetSig  debugOp  (d_m3OpSig, OP_TRACE_TYPE i_operationName)
 # if d_m3EnableOpProfiling
 d_m3RetSig  profileOp  (d_m3OpSig, OP_TRACE_TYPE i_operationName)
 {
-    ProfileHit (i_operationName);
+    ProfileHit ((IM3Operation) * _pc);
+    ProfileSequenceHit ((IM3Operation) * _pc);
 
     nextOpDirect();
 }
@@ -1709,5 +2125,18 @@ d_m3RetSig traceOp(d_m3OpSig, OP_TRACE_TYPE opName){
 }
 #endif
 
+#if defined (M3_COMPILE_OPCODES)
+#   if d_m3HasOperationTable
+#       include "m3_op_table.h"
+#   endif
+#   if d_m3ThreadedDispatch
+#       include "m3_exec_threaded.h"
+#   endif
+#endif
+
 d_m3EndExternC
 
+#endif // d_m3OpBodiesPass
+
+#endif // M3_EXEC_H
+
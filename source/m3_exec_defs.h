@@ -55,6 +55,13 @@ d_m3BeginExternC
     (type)m3SegmentedMemAccess(mem, pc, sizeof(type))
 #endif
 
+// Value stack pointers: resolved only when the stack lives in segmented memory
+#if M3Runtime_Stack_Segmented
+#define STACKPOINT(type, mem, sp)   MEMPOINT(type, mem, sp)
+#else
+#define STACKPOINT(type, mem, sp)   ((type)(sp))
+#endif
+
 ///
 ///
 ///
@@ -127,41 +134,77 @@ d_m3BeginExternC
     #define TRACE_NAME __FUNCTION__
 #endif
 
-#if M3Runtime_Stack_Segmented
-    #if WASM_ENABLE_OP_TRACE
-        #define nextOpImpl() ({ \
-            M3Result result; \
-            if (trace_context.current_stack_depth >= TRACE_STACK_DEPTH_MAX) { \
-                result = m3Err_trapStackOverflow; \
-            } else { \
-                IM3Operation op = (MEMACCESS(IM3Operation, _mem, _pc)); \
-                trace_enter(op, trace_context.current_stack_depth, TRACE_NAME); \
-                trace_context.current_stack_depth++; \
-                result = op(_pc + 1, d_m3OpArgs TRACE_FUNC_NAME); \
-                trace_context.current_stack_depth--; \
-                trace_exit(op, trace_context.current_stack_depth, TRACE_NAME); \
-            } \
-            result; \
-        })
-
-        #define jumpOpImpl(PC) ({ \
-            M3Result result; \
-            if (trace_context.current_stack_depth >= TRACE_STACK_DEPTH_MAX) { \
-                result = m3Err_trapStackOverflow; \
-            } else { \
-                IM3Operation op = (MEMACCESS(IM3Operation, _mem, PC)); \
-                trace_enter(op, trace_context.current_stack_depth, TRACE_NAME); \
-                trace_context.current_stack_depth++; \
-                result = op(PC + 1, d_m3OpArgs TRACE_FUNC_NAME); \
-                trace_context.current_stack_depth--; \
-                trace_exit(op, trace_context.current_stack_depth, TRACE_NAME); \
-            } \
-            result; \
-        })
-    #else
-        #define nextOpImpl() ((MEMACCESS(IM3Operation, _mem, _pc))(_pc + 1, d_m3OpArgs TRACE_FUNC_NAME))
-        #define jumpOpImpl(PC) ((MEMACCESS(IM3Operation, _mem, PC))(PC + 1, d_m3OpArgs TRACE_FUNC_NAME))
-    #endif
+#if d_m3ThreadedDispatch
+#   if (d_m3EnableOpProfiling || d_m3EnableOpTracing || WASM_ENABLE_OP_TRACE)
+#       error "d_m3ThreadedDispatch: op tracing and profiling hook the tail-call dispatch"
+#   endif
+
+    // Le op eseguite vivono in m3_ThreadedDispatch () (m3_exec_threaded.h). Qui op_NAME resta solo
+    // come identita' per il compilatore; il corpo va in op_NAME_body, mai referenziata quindi mai emessa.
+    // Il valore di ritorno distinto evita che il linker fonda gli stub (ICF).
+    #undef  d_m3Op
+    #define d_m3Op(NAME)                                                                                        \
+        M3_NO_UBSAN d_m3RetSig op_##NAME (d_m3OpSig) { return (m3ret_t) #NAME; }                                \
+        M3_NO_UBSAN d_m3RetSig op_##NAME##_body (d_m3OpSig)
+
+    m3ret_t vectorcall      m3_ThreadedDispatch         (d_m3OpSig);
+#endif
+
+#define d_m3HasOperationTable           (d_m3ThreadedDispatch || d_m3EnableCodeCache)
+
+#if d_m3HasOperationTable
+    // every operation of m3_exec.h, indexed in definition order (m3_op_table.h)
+    u32                     m3_GetNumOperations         (void);
+    i32                     m3_GetOperationIndex        (IM3Operation i_operation);     // -1 if unknown
+    IM3Operation            m3_GetOperationAtIndex      (u32 i_index);
+    cstr_t                  m3_GetOperationName         (u32 i_index);
+
+    // word emitted in the code stream for an operation, and back (NULL if unknown)
+    const void *            m3_GetOperationWord         (IM3Operation i_operation);
+    IM3Operation            m3_GetWordOperation         (const void * i_word);
+#endif
+
+#if d_m3ThreadedDispatch
+#   define m3OpWord(OP)                 m3_GetOperationWord (OP)
+#else
+#   define m3OpWord(OP)                 (OP)
+#endif
+
+// Code pages are always native: the next operation is read straight from _pc
+#if WASM_ENABLE_OP_TRACE
+    #define nextOpImpl() ({ \
+        M3Result result; \
+        if (trace_context.current_stack_depth >= TRACE_STACK_DEPTH_MAX) { \
+            result = m3Err_trapStackOverflow; \
+        } else { \
+            IM3Operation op = (IM3Operation)(* _pc); \
+            trace_enter(op, trace_context.current_stack_depth, TRACE_NAME); \
+            trace_context.current_stack_depth++; \
+            result = op(_pc + 1, d_m3OpArgs TRACE_FUNC_NAME); \
+            trace_context.current_stack_depth--; \
+            trace_exit(op, trace_context.current_stack_depth, TRACE_NAME); \
+        } \
+        result; \
+    })
+
+    #define jumpOpImpl(PC) ({ \
+        M3Result result; \
+        if (trace_context.current_stack_depth >= TRACE_STACK_DEPTH_MAX) { \
+            result = m3Err_trapStackOverflow; \
+        } else { \
+            IM3Operation op = (IM3Operation)(* PC); \
+            trace_enter(op, trace_context.current_stack_depth, TRACE_NAME); \
+            trace_context.current_stack_depth++; \
+            result = op(PC + 1, d_m3OpArgs TRACE_FUNC_NAME); \
+            trace_context.current_stack_depth--; \
+            trace_exit(op, trace_context.current_stack_depth, TRACE_NAME); \
+        } \
+        result; \
+    })
+#elif d_m3ThreadedDispatch
+    // non-tail invocations (Call, Entry, Loop) re-enter the dispatch function
+    #define nextOpImpl() m3_ThreadedDispatch (_pc, d_m3OpArgs)
+    #define jumpOpImpl(PC) m3_ThreadedDispatch ((pc_t) (PC), d_m3OpArgs)
 #else
     #define nextOpImpl() ((IM3Operation)(* _pc))(_pc + 1, d_m3OpArgs TRACE_FUNC_NAME)
     #define jumpOpImpl(PC) ((IM3Operation)(*  PC))( PC + 1, d_m3OpArgs TRACE_FUNC_NAME)
@@ -0,0 +1,61 @@
+//
+//  m3_exec_threaded.h
+//
+//  Computed-goto dispatch (d_m3ThreadedDispatch).
+//
+//  Le op di m3_exec.h vengono espanse una seconda volta dentro m3_ThreadedDispatch () come blocchi
+//  etichettati: nextOp () diventa un goto all'indirizzo della label letto dal codice, invece di una
+//  tail call. Serve dove M3_MUSTTAIL non e' garantito (GCC per Xtensa, -O0/-Os): senza tail call
+//  ogni op eseguita aggiunge un frame sullo stack C.
+//
+//  Le funzioni op_* a livello di file restano come identita' per il compilatore; EmitOp scrive nel
+//  codice la label corrispondente (m3OpWord). Lo stack C cresce solo dove cresceva anche prima:
+//  Call, Entry e Loop rientrano in m3_ThreadedDispatch () tramite nextOpImpl (). Con
+//  d_m3EnableStacklessCalls nemmeno loro: saltano, e lo stack C resta costante.
+//
+//  Incluso solo da m3_exec.h, nell'unita' che compila le op (M3_COMPILE_OPCODES), dopo m3_op_table.h.
+//
+
+#pragma once
+
+#if !defined (__GNUC__)
+#   error "d_m3ThreadedDispatch needs labels as values (GCC or Clang)"
+#endif
+
+M3_NO_UBSAN m3ret_t vectorcall  m3_ThreadedDispatch  (d_m3OpSig)
+{
+#   pragma push_macro ("d_m3Op")
+#   pragma push_macro ("nextOpDirect")
+#   pragma push_macro ("jumpOpDirect")
+
+#   undef  nextOpDirect
+#   define nextOpDirect()               goto * (* _pc++)
+#   undef  jumpOpDirect
+#   define jumpOpDirect(PC)             do { _pc = (pc_t) (PC); goto * (* _pc++); } while (0)
+
+#   define d_m3OpBodiesPass
+
+    // a NULL pc fills the operation table with the labels (EnsureOperationTable): the bodies are dead code in this pass
+    if (M3_UNLIKELY (not _pc))
+    {
+#       undef  d_m3Op
+#       define d_m3Op(NAME)             RegisterOperation (op_##NAME, && L_op_##NAME, #NAME); if (0)
+#       include "m3_exec.h"
+
+        return m3Err_none;
+    }
+
+    nextOpDirect ();
+
+#   undef  d_m3Op
+#   define d_m3Op(NAME)                 L_op_##NAME:
+#   include "m3_exec.h"
+
+    return m3Err_none;  // not reached: every operation ends in a jump or a return
+
+#   undef  d_m3OpBodiesPass
+
+#   pragma pop_macro ("jumpOpDirect")
+#   pragma pop_macro ("nextOpDirect")
+#   pragma pop_macro ("d_m3Op")
+}
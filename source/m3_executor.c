@@ -0,0 +1,373 @@
+//
+//  m3_executor.c
+//
+//  Jobs on a thread per runtime, with work stealing, see m3_executor.h.
+//
+
+#include <string.h>
+
+#include "m3_executor.h"
+#include "wasm3.h"
+
+
+static M3Result  CheckRuntimes  (IM3Runtime * i_runtimes, u32 i_numRuntimes)
+{
+    M3Result result = m3Err_none;
+
+    _throwif (m3Err_nullRuntime, not i_runtimes or not i_numRuntimes);
+
+    for (u32 i = 0; i < i_numRuntimes; ++i)
+        _throwif (m3Err_nullRuntime, not i_runtimes [i]);
+
+    _catch: return result;
+}
+
+
+# if d_m3EnableExecutor
+
+# if d_m3FixedHeap
+#   error "d_m3EnableExecutor needs a thread safe allocator: the fixed heap isn't"
+# endif
+
+DEBUG_TYPE WASM_DEBUG_EXECUTOR = WASM_DEBUG_ALL || (WASM_DEBUG && false);
+
+static M3_THREAD_LOCAL IM3ExecutorWorker    s_currentWorker;        // the worker of this thread, NULL outside the pools
+
+
+static M3Result  PushJob  (IM3ExecutorWorker io_worker, M3ExecutorJobEntry i_entry)
+{
+    M3Result result = m3Err_none;
+
+    pthread_mutex_lock (& io_worker->lock);
+
+    u32 numJobs = io_worker->bottom - io_worker->top;
+
+    if (numJobs == io_worker->jobsCapacity)
+    {
+        M3ExecutorJobEntry * jobs = m3_Def_AllocArray (M3ExecutorJobEntry, io_worker->jobsCapacity * 2);
+        _throwifnull (jobs);
+
+        for (u32 i = 0; i < numJobs; ++i)
+            jobs [i] = io_worker->jobs [(io_worker->top + i) & (io_worker->jobsCapacity - 1)];
+
+        m3_Def_Free (io_worker->jobs);
+
+        io_worker->jobs = jobs;
+        io_worker->jobsCapacity *= 2;
+        io_worker->top = 0;
+        io_worker->bottom = numJobs;
+    }
+
+    io_worker->jobs [io_worker->bottom & (io_worker->jobsCapacity - 1)] = i_entry;
+    io_worker->bottom++;
+
+    _catch:
+    pthread_mutex_unlock (& io_worker->lock);
+
+    return result;
+}
+
+
+// the owner takes the newest job, a thief the oldest
+static bool  TakeJob  (IM3ExecutorWorker io_worker, bool i_owner, M3ExecutorJobEntry * o_entry)
+{
+    bool taken = false;
+
+    pthread_mutex_lock (& io_worker->lock);
+
+    if (io_worker->top != io_worker->bottom)
+    {
+        u32 index = i_owner ? --io_worker->bottom : io_worker->top++;
+
+        * o_entry = io_worker->jobs [index & (io_worker->jobsCapacity - 1)];
+        taken = true;
+    }
+
+    pthread_mutex_unlock (& io_worker->lock);
+
+    return taken;
+}
+
+
+static bool  FindJob  (IM3ExecutorWorker i_worker, M3ExecutorJobEntry * o_entry)
+{
+    IM3Executor executor = i_worker->executor;
+
+    if (not __atomic_load_n (& executor->numQueued, __ATOMIC_SEQ_CST))
+        return false;
+
+    bool found = TakeJob (i_worker, true, o_entry);
+
+    u32 self = (u32) (i_worker - executor->workers);
+
+    for (u32 i = 1; not found and i < executor->numWorkers; ++i)
+        found = TakeJob (& executor->workers [(self + i) % executor->numWorkers], false, o_entry);
+
+    if (found)
+        __atomic_sub_fetch (& executor->numQueued, 1, __ATOMIC_SEQ_CST);
+
+    return found;
+}
+
+
+static void  JobDone  (IM3Executor io_executor)
+{
+    if (__atomic_sub_fetch (& io_executor->numPending, 1, __ATOMIC_SEQ_CST) == 0)
+    {
+        pthread_mutex_lock (& io_executor->sleepLock);
+        pthread_cond_broadcast (& io_executor->idle);
+        pthread_mutex_unlock (& io_executor->sleepLock);
+    }
+}
+
+
+static void *  ExecutorWorker  (void * i_worker)
+{
+    IM3ExecutorWorker worker = (IM3ExecutorWorker) i_worker;
+    IM3Executor executor = worker->executor;
+
+    s_currentWorker = worker;
+
+    while (true)
+    {
+        M3ExecutorJobEntry entry;
+
+        if (FindJob (worker, & entry))
+        {
+            entry.job (worker->runtime, entry.userdata);
+            JobDone (executor);
+
+            continue;
+        }
+
+        // m3_SubmitJob counts the job queued before it looks for sleepers: one of the two sees the other
+        pthread_mutex_lock (& executor->sleepLock);
+        __atomic_add_fetch (& executor->numSleeping, 1, __ATOMIC_SEQ_CST);
+
+        while (not executor->stopping and not __atomic_load_n (& executor->numQueued, __ATOMIC_SEQ_CST))
+            pthread_cond_wait (& executor->wake, & executor->sleepLock);
+
+        __atomic_sub_fetch (& executor->numSleeping, 1, __ATOMIC_SEQ_CST);
+        bool stop = executor->stopping and not __atomic_load_n (& executor->numQueued, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock (& executor->sleepLock);
+
+        if (stop)
+            break;
+    }
+
+    s_currentWorker = NULL;
+
+    return NULL;
+}
+
+
+// stops and joins the threads started, then frees what was set up
+static void  ReleaseExecutor  (IM3Executor io_executor)
+{
+    pthread_mutex_lock (& io_executor->sleepLock);
+    io_executor->stopping = true;
+    pthread_cond_broadcast (& io_executor->wake);
+    pthread_mutex_unlock (& io_executor->sleepLock);
+
+    for (u32 i = 0; i < io_executor->numStarted; ++i)
+        pthread_join (io_executor->workers [i].thread, NULL);
+
+    for (u32 i = 0; i < io_executor->numWorkers; ++i)
+    {
+        pthread_mutex_destroy (& io_executor->workers [i].lock);
+        m3_Def_Free (io_executor->workers [i].jobs);
+    }
+
+    m3_Def_Free (io_executor->workers);
+
+    pthread_cond_destroy (& io_executor->idle);
+    pthread_cond_destroy (& io_executor->wake);
+    pthread_mutex_destroy (& io_executor->sleepLock);
+
+    m3_Def_Free (io_executor);
+}
+
+
+M3Result  m3_NewExecutor  (IM3Executor * o_executor, IM3Runtime * i_runtimes, uint32_t i_numRuntimes)
+{
+    M3Result result = m3Err_none;
+
+    * o_executor = NULL;
+
+_   (CheckRuntimes (i_runtimes, i_numRuntimes));
+
+    IM3Executor executor = m3_Def_AllocStruct (M3Executor);
+    _throwifnull (executor);
+
+    if (pthread_mutex_init (& executor->sleepLock, NULL))
+    {
+        m3_Def_Free (executor);
+        _throw (m3Err_executorThreadFailed);
+    }
+
+    if (pthread_cond_init (& executor->wake, NULL))
+    {
+        pthread_mutex_destroy (& executor->sleepLock);
+        m3_Def_Free (executor);
+        _throw (m3Err_executorThreadFailed);
+    }
+
+    if (pthread_cond_init (& executor->idle, NULL))
+    {
+        pthread_cond_destroy (& executor->wake);
+        pthread_mutex_destroy (& executor->sleepLock);
+        m3_Def_Free (executor);
+        _throw (m3Err_executorThreadFailed);
+    }
+
+    // from here on ReleaseExecutor undoes what's done
+    * o_executor = executor;
+
+    executor->workers = m3_Def_AllocArray (M3ExecutorWorker, i_numRuntimes);
+    _throwifnull (executor->workers);
+
+    for (u32 i = 0; i < i_numRuntimes; ++i)
+    {
+        IM3ExecutorWorker worker = & executor->workers [i];
+
+        worker->executor = executor;
+        worker->runtime = i_runtimes [i];
+
+        _throwif (m3Err_executorThreadFailed, pthread_mutex_init (& worker->lock, NULL));
+        executor->numWorkers++;
+
+        worker->jobs = m3_Def_AllocArray (M3ExecutorJobEntry, d_m3ExecutorQueueLength);
+        _throwifnull (worker->jobs);
+        worker->jobsCapacity = d_m3ExecutorQueueLength;
+    }
+
+#   if d_m3HasOperationTable
+    m3_GetNumOperations ();                                         // the table is built lazily and not thread safe: build it now
+#   endif
+
+    pthread_attr_t attributes;
+    pthread_attr_init (& attributes);
+    pthread_attr_setstacksize (& attributes, d_m3ExecutorThreadStackSize);
+
+    for (u32 i = 0; i < executor->numWorkers; ++i)
+    {
+        if (pthread_create (& executor->workers [i].thread, & attributes, ExecutorWorker, & executor->workers [i]))
+            break;
+
+        executor->numStarted++;
+    }
+
+    pthread_attr_destroy (& attributes);
+
+    // a runtime without its thread would be left out: all or nothing
+    _throwif (m3Err_executorThreadFailed, executor->numStarted < executor->numWorkers);
+
+    if (WASM_DEBUG_EXECUTOR) ESP_LOGI ("WASM3", "m3_NewExecutor: %d threads started", executor->numStarted);
+
+    _catch:
+    if (result and * o_executor)
+    {
+        ReleaseExecutor (* o_executor);
+        * o_executor = NULL;
+    }
+
+    return result;
+}
+
+
+void  m3_FreeExecutor  (IM3Executor i_executor)
+{
+    if (i_executor)
+    {
+        m3_WaitForJobs (i_executor);
+        ReleaseExecutor (i_executor);
+    }
+}
+
+
+M3Result  m3_SubmitJob  (IM3Executor io_executor, M3ExecutorJob i_job, void * i_userdata)
+{
+    M3Result result = m3Err_none;
+
+    IM3ExecutorWorker worker = s_currentWorker;
+
+    if (not worker or worker->executor != io_executor)
+    {
+        u32 next = __atomic_fetch_add (& io_executor->nextWorker, 1, __ATOMIC_RELAXED);
+        worker = & io_executor->workers [next % io_executor->numWorkers];
+    }
+
+    // pending before it can be taken: a fast worker would otherwise count it done first
+    __atomic_add_fetch (& io_executor->numPending, 1, __ATOMIC_SEQ_CST);
+
+    result = PushJob (worker, (M3ExecutorJobEntry) { i_job, i_userdata });
+
+    if (result)
+    {
+        JobDone (io_executor);
+        _throw (result);
+    }
+
+    __atomic_add_fetch (& io_executor->numQueued, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n (& io_executor->numSleeping, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock (& io_executor->sleepLock);
+        pthread_cond_signal (& io_executor->wake);
+        pthread_mutex_unlock (& io_executor->sleepLock);
+    }
+
+    _catch: return result;
+}
+
+
+void  m3_WaitForJobs  (IM3Executor io_executor)
+{
+    pthread_mutex_lock (& io_executor->sleepLock);
+
+    while (__atomic_load_n (& io_executor->numPending, __ATOMIC_SEQ_CST))
+        pthread_cond_wait (& io_executor->idle, & io_executor->sleepLock);
+
+    pthread_mutex_unlock (& io_executor->sleepLock);
+}
+
+# else
+
+// without threads a job runs as it's submitted, on the first runtime
+M3Result  m3_NewExecutor  (IM3Executor * o_executor, IM3Runtime * i_runtimes, uint32_t i_numRuntimes)
+{
+    M3Result result = m3Err_none;
+
+    * o_executor = NULL;
+
+_   (CheckRuntimes (i_runtimes, i_numRuntimes));
+
+    IM3Executor executor = m3_Def_AllocStruct (M3Executor);
+    _throwifnull (executor);
+
+    executor->runtime = i_runtimes [0];
+    * o_executor = executor;
+
+    _catch: return result;
+}
+
+
+void  m3_FreeExecutor  (IM3Executor i_executor)
+{
+    m3_Def_Free (i_executor);
+}
+
+
+M3Result  m3_SubmitJob  (IM3Executor io_executor, M3ExecutorJob i_job, void * i_userdata)
+{
+    i_job (io_executor->runtime, i_userdata);
+
+    return m3Err_none;
+}
+
+
+void  m3_WaitForJobs  (IM3Executor io_executor)
+{
+}
+
+# endif // d_m3EnableExecutor
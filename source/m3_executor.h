@@ -0,0 +1,79 @@
+//
+//  m3_executor.h
+//
+//  Thread pool over prepared runtimes (d_m3EnableExecutor).
+//
+//  Each runtime gets a worker thread, and each worker a deque of jobs. The owner takes from the
+//  bottom, newest first, while the data it touched is still in cache; an idle worker steals from
+//  the top of the others, oldest first. Jobs submitted from outside the pool are dealt to the
+//  deques in turn, jobs submitted by a job go to its own worker's deque.
+//
+//  A deque is a ring buffer under its own lock: submissions come from any thread, not only the
+//  owner, and a job is one whole guest call, long next to a lock that's almost never contended.
+//  The counters that decide whether to sleep, to wake a worker or to wake m3_WaitForJobs are
+//  atomics, so submitting to a busy pool touches no shared lock but the deque's.
+//
+
+#pragma once
+
+#include "m3_env.h"
+
+d_m3BeginExternC
+
+# if d_m3EnableExecutor
+
+#include <pthread.h>
+
+typedef struct M3ExecutorJobEntry
+{
+    M3ExecutorJob           job;
+    void *                  userdata;
+}
+M3ExecutorJobEntry;
+
+typedef struct M3ExecutorWorker
+{
+    struct M3Executor *     executor;
+    IM3Runtime              runtime;
+    pthread_t               thread;
+
+    pthread_mutex_t         lock;               // the deque
+    M3ExecutorJobEntry *    jobs;               // ring buffer of jobsCapacity, a power of two
+    u32                     jobsCapacity;
+    u32                     top;                // oldest job, where thieves take
+    u32                     bottom;             // one past the newest, where the owner pushes and takes
+}
+M3ExecutorWorker;
+
+typedef M3ExecutorWorker *  IM3ExecutorWorker;
+
+typedef struct M3Executor
+{
+    IM3ExecutorWorker       workers;
+    u32                     numWorkers;
+    u32                     numStarted;
+
+    u32                     nextWorker;         // of the next outside submission (atomic)
+    u32                     numQueued;          // in the deques (atomic)
+    u32                     numPending;         // submitted and not done (atomic)
+    u32                     numSleeping;        // workers waiting on 'wake' (atomic)
+
+    pthread_mutex_t         sleepLock;
+    pthread_cond_t          wake;               // a job was queued, or stopping
+    pthread_cond_t          idle;               // numPending reached 0
+
+    bool                    stopping;
+}
+M3Executor;
+
+# else
+
+typedef struct M3Executor
+{
+    IM3Runtime              runtime;            // the jobs run on it, on the submitting thread
+}
+M3Executor;
+
+# endif // d_m3EnableExecutor
+
+d_m3EndExternC
@@ -9,6 +9,7 @@
 #include <string.h>
 
 #include "m3_function.h"
+#include "m3_code_cache.h"
 //#include "m3_env.h"
 #include "m3_bind.h" 
 #include "wasm3.h"
@@ -131,6 +132,7 @@ void  Function_Release  (IM3Function i_function)
     #else
     m3_Def_Free(i_function->constants);
     #endif 
+    i_function->constants = NULL;
 
     for (int i = 0; i < i_function->numNames; i++)
     {
@@ -158,20 +160,11 @@ void  Function_Release  (IM3Function i_function)
         #endif
     }
 
-    // Function_FreeCompiledCode (func);
+    Function_FreeCompiledCode (i_function);     // the pages it leaves unused go with Runtime_ReleaseCodePages
 
-#   if (d_m3EnableCodePageRefCounting)
-    {
-        #if FUNCTIONS_ON_SEGMENTED_MEM
-        m3_Dyn_Free(i_function->module->runtime->memory, i_function->codePageRefs);
-        #else
-        m3_Def_Free(i_function->codePageRefs);
-        #endif
-
-        i_function->numCodePageRefs = 0;
-    }
-
-   
+#   if d_m3EnableCodeCache
+    FreeCodeLayout (i_function->codeLayout);
+    i_function->codeLayout = NULL;
 #   endif
 
     // This is redundant, functions are allocated in groups of functions
@@ -183,25 +176,64 @@ void  Function_Release  (IM3Function i_function)
 }
 
 
+# if (d_m3EnableCodePageRefCounting)
+// the function has code in i_page: the page stays until the function lets it go (Function_FreeCompiledCode)
+M3Result  Function_AddCodePage  (IM3Function io_function, IM3CodePage i_page)
+{
+    M3Result result = m3Err_none;
+
+    for (u32 i = 0; i < io_function->numCodePageRefs; ++i)
+    {
+        if (io_function->codePageRefs [i] == i_page)
+            return result;
+    }
+
+    IM3CodePage * refs = m3_Def_ReallocArray (IM3CodePage, io_function->codePageRefs, io_function->numCodePageRefs + 1);
+    _throwifnull (refs);
+
+    refs [io_function->numCodePageRefs++] = i_page;
+    io_function->codePageRefs = refs;
+
+    i_page->info.usageCount++;
+
+    _catch: return result;
+}
+# endif
+
+
+// back to the state before the first call: it compiles again if called. the caller makes sure no frame still runs
+// the code and frees the pages left unused (Runtime_ReleaseCodePages)
 void  Function_FreeCompiledCode (IM3Function i_function)
 {
 #   if (d_m3EnableCodePageRefCounting)
     {
-        i_function->compiled = NULL;
+        SetFunctionCompiled (i_function, NULL);
 
-        while (i_function->numCodePageRefs--)
+        while (i_function->numCodePageRefs)
         {
-            IM3CodePage page = i_function->codePageRefs [i_function->numCodePageRefs];
-
-            if (--(page->info.usageCount) == 0)
-            {
-//                printf ("free %p\n", page);
-            }
+            IM3CodePage page = i_function->codePageRefs [--i_function->numCodePageRefs];
+                                                                        d_m3Assert (page->info.usageCount > 0);
+            page->info.usageCount--;
         }
 
         m3_Def_Free (i_function->codePageRefs);
-
-        Runtime_ReleaseCodePages (i_function->module->runtime);
+        i_function->codePageRefs = NULL;
+
+        m3_Def_Free (i_function->constants);
+        i_function->constants = NULL;
+        i_function->numConstantBytes = 0;
+
+#       if d_m3EnableCodeCache
+        FreeCodeLayout (i_function->codeLayout);
+        i_function->codeLayout = NULL;
+#       endif
+
+#       if d_m3EnableTieredCompile
+        i_function->tier = c_m3TierFirst;
+        i_function->numCalls = 0;
+        i_function->numBackEdges = 0;
+        i_function->baselineCompiled = NULL;
+#       endif
     }
 #   endif
 }
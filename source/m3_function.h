@@ -9,6 +9,7 @@
 
 #include "m3_exception.h"
 #include "m3_core.h"
+#include "m3_code.h"
 
 #if PASSTHROUGH_HELLOESP
 #include "m3_api_esp_wasi.h"
@@ -62,6 +63,22 @@ typedef struct M3Function
 # if (d_m3EnableCodePageRefCounting)
     IM3CodePage *           codePageRefs;                           // array of all pages used
     u32                     numCodePageRefs;
+    bool                    called;                                 // entered since the last m3_ReleaseColdCode
+# endif
+
+# if d_m3EnableCodeCache
+    struct M3CodeLayout *   codeLayout;                             // where 'compiled' landed (m3_code_cache.h)
+# endif
+
+# if d_m3EnableParallelCompile
+    u8                      compileState;                           // c_m3Compile*, guarded by the runtime's compile pool (m3_compile_pool.h)
+# endif
+
+# if d_m3EnableTieredCompile
+    u8                      tier;                                   // c_m3Tier*
+    u32                     numCalls;                               // counted by the baseline code only
+    u32                     numBackEdges;
+    pc_t                    baselineCompiled;                       // once optimised: the old entry, that stale op_Calls still hold
 # endif
 
 # if defined (DEBUG)
@@ -86,8 +103,33 @@ M3Function;
 
 typedef M3Function *        IM3Function;
 
+// 'compiled' is published last, after the code and the fields above: a worker thread may be the one writing it
+# if d_m3EnableParallelCompile
+#   define GetFunctionCompiled(FUNC)            __atomic_load_n (& (FUNC)->compiled, __ATOMIC_ACQUIRE)
+#   define SetFunctionCompiled(FUNC, PC)        __atomic_store_n (& (FUNC)->compiled, (PC), __ATOMIC_RELEASE)
+# else
+#   define GetFunctionCompiled(FUNC)            ((FUNC)->compiled)
+#   define SetFunctionCompiled(FUNC, PC)        ((FUNC)->compiled = (PC))
+# endif
+
+enum
+{
+    c_m3TierBaseline        = 0,        // no superinstructions nor hoisted checks; counts calls and loop iterations
+    c_m3TierOptimized       = 1
+};
+
+// d_m3EnableTieredCompile: functions start in the baseline tier, TierUpFunction recompiles the hot ones
+# if d_m3EnableTieredCompile
+#   define c_m3TierFirst                        c_m3TierBaseline
+# else
+#   define c_m3TierFirst                        c_m3TierOptimized
+# endif
+
 void        Function_Release            (IM3Function i_function);
 void        Function_FreeCompiledCode   (IM3Function i_function);
+# if (d_m3EnableCodePageRefCounting)
+M3Result    Function_AddCodePage        (IM3Function io_function, IM3CodePage i_page);
+# endif
 
 cstr_t      GetFunctionImportModuleName (IM3Function i_function);
 cstr_t *    GetFunctionNames            (IM3Function i_function, u16 * o_numNames);
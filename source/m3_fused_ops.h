@@ -0,0 +1,76 @@
+//
+//  m3_fused_ops.h
+//
+//  Superinstruction sets: which opcode pairs Compile_FusedOperator fuses.
+//  m3_exec.h instantiates the operations, m3_compile.c the match tables.
+//
+//  scripts/generate_wasm_ops.py --ngrams <profile> writes m3_fused_ops_generated.h
+//  with the same lists, chosen from a d_m3EnableOpProfiling run; d_m3FusedOpsGenerated selects it.
+//
+
+#pragma once
+
+#if d_m3FusedOpsGenerated
+#   include "m3_fused_ops_generated.h"
+#else
+
+// binop ; local.set                X (opcode, TYPE, NAME, MACRO, OP)
+#define M3_FUSED_SETLOCAL_OPS(X)                        \
+    X (0x6a, i32, Add,          M3_FUNC, OP_ADD_32)     \
+    X (0x6b, i32, Subtract,     M3_FUNC, OP_SUB_32)     \
+    X (0x6c, i32, Multiply,     M3_FUNC, OP_MUL_32)     \
+    X (0x71, u32, And,          M3_OPER, &)             \
+    X (0x72, u32, Or,           M3_OPER, |)             \
+    X (0x73, u32, Xor,          M3_OPER, ^)             \
+    X (0x74, u32, ShiftLeft,    M3_FUNC, OP_SHL_32)     \
+    X (0x75, i32, ShiftRight,   M3_FUNC, OP_SHR_32)     \
+    X (0x76, u32, ShiftRight,   M3_FUNC, OP_SHR_32)     \
+    X (0x7c, i64, Add,          M3_FUNC, OP_ADD_64)     \
+    X (0x7d, i64, Subtract,     M3_FUNC, OP_SUB_64)     \
+    X (0x7e, i64, Multiply,     M3_FUNC, OP_MUL_64)     \
+    X (0x83, u64, And,          M3_OPER, &)             \
+    X (0x84, u64, Or,           M3_OPER, |)             \
+    X (0x85, u64, Xor,          M3_OPER, ^)             \
+    X (0x86, u64, ShiftLeft,    M3_FUNC, OP_SHL_64)     \
+    X (0x87, i64, ShiftRight,   M3_FUNC, OP_SHR_64)     \
+    X (0x88, u64, ShiftRight,   M3_FUNC, OP_SHR_64)
+
+// compare ; br_if                  X (opcode, TYPE, NAME, OP)
+#define M3_FUSED_BRANCHIF_OPS(X)                        \
+    X (0x46, i32, Equal,                ==)             \
+    X (0x47, i32, NotEqual,             !=)             \
+    X (0x48, i32, LessThan,             < )             \
+    X (0x49, u32, LessThan,             < )             \
+    X (0x4a, i32, GreaterThan,          > )             \
+    X (0x4b, u32, GreaterThan,          > )             \
+    X (0x4c, i32, LessThanOrEqual,      <=)             \
+    X (0x4d, u32, LessThanOrEqual,      <=)             \
+    X (0x4e, i32, GreaterThanOrEqual,   >=)             \
+    X (0x4f, u32, GreaterThanOrEqual,   >=)             \
+    X (0x51, i64, Equal,                ==)             \
+    X (0x52, i64, NotEqual,             !=)             \
+    X (0x53, i64, LessThan,             < )             \
+    X (0x54, u64, LessThan,             < )             \
+    X (0x55, i64, GreaterThan,          > )             \
+    X (0x56, u64, GreaterThan,          > )             \
+    X (0x57, i64, LessThanOrEqual,      <=)             \
+    X (0x58, u64, LessThanOrEqual,      <=)             \
+    X (0x59, i64, GreaterThanOrEqual,   >=)             \
+    X (0x5a, u64, GreaterThanOrEqual,   >=)
+
+// i32.add ; load                   X (opcode, DEST_TYPE, SRC_TYPE)
+#define M3_FUSED_ADDLOAD_OPS(X)                         \
+    X (0x28, i32, i32)                                  \
+    X (0x29, i64, i64)                                  \
+    X (0x2c, i32, i8)                                   \
+    X (0x2d, i32, u8)                                   \
+    X (0x2e, i32, i16)                                  \
+    X (0x2f, i32, u16)                                  \
+    X (0x30, i64, i8)                                   \
+    X (0x31, i64, u8)                                   \
+    X (0x32, i64, i16)                                  \
+    X (0x33, i64, u16)                                  \
+    X (0x34, i64, i32)                                  \
+    X (0x35, i64, u32)
+
+#endif // d_m3FusedOpsGenerated
@@ -108,6 +108,10 @@ void *  v_PrintEnvModuleInfo  (IM3Module i_module, u32 * io_index)
 {
     printf (" module [%u]  name: '%s'; funcs: %d  \n", * io_index++, i_module->name, i_module->numFunctions);
 
+#if d_m3EnableConstantFolding
+    printf ("   folded ops: %u; removed ops: %u\n", i_module->numFoldedOps, i_module->numRemovedOps);
+#endif
+
     return NULL;
 }
 
@@ -118,6 +122,18 @@ void  m3_PrintRuntimeInfo  (IM3Runtime i_runtime)
 
     printf (" stack-size: %zu   \n\n", i_runtime->numStackSlots * sizeof (m3slot_t));
 
+#if d_m3EnableSuperInstructions
+    printf (" fused ops: %u (from %u wasm opcodes)\n\n", i_runtime->numFusedOps, i_runtime->numFusedOpcodes);
+#endif
+
+#if d_m3HoistMemoryBoundsChecks
+    printf (" bounds checks: %u range checks cover %u unchecked accesses\n\n", i_runtime->numRangeChecks, i_runtime->numUncheckedOps);
+#endif
+
+#if d_m3EnableTieredCompile
+    printf (" tiered up: %u functions\n\n", i_runtime->numTierUps);
+#endif
+
     u32 moduleIndex = 0;
     ForEachModule (i_runtime, (ModuleVisitor) v_PrintEnvModuleInfo, & moduleIndex);
 
@@ -171,7 +187,7 @@ cstr_t  SPrintValue  (void * i_value, u8 i_type)
     #if M3Runtime_Stack_Segmented
     snprintf (string, 100, "i_offset: %d, i_type: %d\n", (mos)i_value, i_type);
     #else    
-    SPrintArg (string, 100, m3stack_t i_value, i_type); // mos instead of m3stack_t    
+    SPrintArg (string, 100, (voidptr_t) i_value, i_type);
     #endif
     return string;
 }
@@ -309,7 +325,11 @@ void  dump_code_page  (IM3CodePage i_codePage, pc_t i_startPC)
         while (pc < end)
         {
             pc_t operationPC = pc;
+#           if d_m3ThreadedDispatch
+            IM3Operation op = m3_GetWordOperation (* pc++);
+#           else
             IM3Operation op = (IM3Operation) (* pc++);
+#           endif
 
                 OpInfo i = find_operation_info (op);
 
@@ -527,70 +547,268 @@ void  log_emit  (IM3Compilation o, IM3Operation i_operation)
 
 typedef struct M3ProfilerSlot
 {
-    OP_TRACE_TYPE      opName;
-    u64         hitCount;
+    IM3Operation        operation;
+    u64                 hitCount;
 }
 M3ProfilerSlot;
 
 // you can't  __attribute__((section(".rodata"))) because you have to edit it
 static M3ProfilerSlot s_opProfilerCounts [d_m3ProfilerSlotMask + 1] = {};
 
-void  ProfileHit  (OP_TRACE_TYPE i_operationName)
+// keyed by the op about to run: the name threaded through the op signature is only the caller's
+void  ProfileHit  (IM3Operation i_operation)
 {
-    u64 ptr = (u64) i_operationName;
-
-    M3ProfilerSlot * slot = & s_opProfilerCounts [ptr & d_m3ProfilerSlotMask];
+    u32 hash = (u32) ((uintptr_t) i_operation >> 2) * 2654435761u;
 
-    if (slot->opName)
+    for (u32 probe = 0; probe <= d_m3ProfilerSlotMask; ++probe)
     {
-        if (slot->opName != i_operationName)
+        M3ProfilerSlot * slot = & s_opProfilerCounts [(hash + probe) & d_m3ProfilerSlotMask];
+
+        if (not slot->operation)
+            slot->operation = i_operation;
+
+        if (slot->operation == i_operation)
         {
-            m3_Abort ("profiler slot collision; increase d_m3ProfilerSlotMask");
+            slot->hitCount++;
+            return;
         }
     }
 
-    slot->opName = i_operationName;
-    slot->hitCount++;
+    m3_Abort ("profiler slots full; increase d_m3ProfilerSlotMask");
 }
 
 
-void  m3_PrintProfilerInfo  ()
+// every op dispatched through nextOp since the process started
+u64  GetProfiledDispatches  (void)
+{
+    u64 total = 0;
+    for (u32 i = 0; i <= d_m3ProfilerSlotMask; ++i)
+        total += s_opProfilerCounts [i].hitCount;
+
+    return total;
+}
+
+
+// op n-grams: sequences of consecutively dispatched operations, keyed by the op pointers.
+// Only nextOp dispatches pass through the profiler, so a sequence can jump over a branch
+// target, a loop entry or a call; generate_wasm_ops.py drops those with a control op before the
+// last position. Fusion candidates are clearer with d_m3EnableSuperInstructions off.
+
+typedef struct M3ProfilerNGram
 {
-    M3ProfilerSlot dummy;
-    M3ProfilerSlot * maxSlot = & dummy;
+    IM3Operation        ops [d_m3ProfilerNGramMax];
+    u32                 length;
+    u64                 hitCount;
+}
+M3ProfilerNGram;
+
+static M3ProfilerNGram  s_opProfilerNGrams      [d_m3ProfilerNGramSlots];
+static IM3Operation     s_opProfilerHistory     [d_m3ProfilerNGramMax];     // most recent last
+static u32              s_opProfilerHistoryLength;
+static u64              s_opProfilerNGramDrops;
+
+static
+void  ProfileNGram  (IM3Operation * i_ops, u32 i_length)
+{
+    u32 hash = 2166136261u;
+    for (u32 i = 0; i < i_length; ++i)
+        hash = (hash ^ (u32) ((uintptr_t) i_ops [i] >> 2)) * 16777619u;
+
+    // open addressing, a short probe; a full neighbourhood drops the hit
+    for (u32 probe = 0; probe < 16; ++probe)
+    {
+        M3ProfilerNGram * slot = & s_opProfilerNGrams [(hash + probe) % d_m3ProfilerNGramSlots];
+
+        if (not slot->length)
+        {
+            memcpy (slot->ops, i_ops, i_length * sizeof (IM3Operation));
+            slot->length = i_length;
+        }
 
-    do
+        if (slot->length == i_length and memcmp (slot->ops, i_ops, i_length * sizeof (IM3Operation)) == 0)
+        {
+            slot->hitCount++;
+            return;
+        }
+    }
+
+    s_opProfilerNGramDrops++;
+}
+
+
+void  ProfileSequenceHit  (IM3Operation i_operation)
+{
+    if (s_opProfilerHistoryLength == d_m3ProfilerNGramMax)
     {
-        maxSlot->hitCount = 0;
+        memmove (s_opProfilerHistory, s_opProfilerHistory + 1, (d_m3ProfilerNGramMax - 1) * sizeof (IM3Operation));
+        s_opProfilerHistoryLength--;
+    }
+
+    s_opProfilerHistory [s_opProfilerHistoryLength++] = i_operation;
+
+    for (u32 length = 2; length <= s_opProfilerHistoryLength; ++length)
+        ProfileNGram (s_opProfilerHistory + s_opProfilerHistoryLength - length, length);
+}
+
 
-        for (u32 i = 0; i <= d_m3ProfilerSlotMask; ++i)
+// operations are written as <op index>:<variant>, the index assigned by generate_wasm_ops.py and the
+// variant the position in M3OpInfo.operations; ops outside the op tables (fused ops too) as '?'
+static
+bool  FindProfiledOperation  (IM3Operation i_operation, IM3OpInfo * o_info, u32 * o_variant)
+{
+    for (u32 table = 0; table < 2; ++table)
+    {
+        for (u32 i = 0; i <= 0xff; ++i)
         {
-            M3ProfilerSlot * slot = & s_opProfilerCounts [i];
+            IM3OpInfo info = GetOpInfo (table ? (c_waOp_extended << 8) | i : i);
+            if (not info)
+                break;
 
-            if (slot->opName)
+            for (u32 v = 0; v < 4; ++v)
             {
-                if (slot->hitCount > maxSlot->hitCount)
-                    maxSlot = slot;
+                if (i_operation and info->operations [v] == i_operation)
+                {
+                    * o_info = info;
+                    * o_variant = v;
+                    return true;
+                }
             }
         }
+    }
+
+    return false;
+}
+
+
+static
+int  CompareNGramHits  (const void * i_a, const void * i_b)
+{
+    u64 a = (* (M3ProfilerNGram * const *) i_a)->hitCount;
+    u64 b = (* (M3ProfilerNGram * const *) i_b)->hitCount;
+
+    return (a < b) - (a > b);
+}
+
+
+static
+int  CompareSlotHits  (const void * i_a, const void * i_b)
+{
+    u64 a = (* (M3ProfilerSlot * const *) i_a)->hitCount;
+    u64 b = (* (M3ProfilerSlot * const *) i_b)->hitCount;
+
+    return (a < b) - (a > b);
+}
+
+
+void  m3_PrintProfilerInfo  ()
+{
+    static M3ProfilerSlot * sorted [d_m3ProfilerSlotMask + 1];
+
+    u32 count = 0;
+    for (u32 i = 0; i <= d_m3ProfilerSlotMask; ++i)
+    {
+        if (s_opProfilerCounts [i].operation)
+            sorted [count++] = & s_opProfilerCounts [i];
+    }
+
+    qsort (sorted, count, sizeof (M3ProfilerSlot *), CompareSlotHits);
+
+    for (u32 i = 0; i < count; ++i)
+    {
+        IM3OpInfo info; u32 variant;
+
+        if (FindProfiledOperation (sorted [i]->operation, & info, & variant))
+        {
+#           if DEBUG && M3_FUNCTIONS_ENUM
+            ESP_LOGI ("WASM3", "%13" PRIu64 "  %s/%" PRIu32, sorted [i]->hitCount, getOpName (info->idx), variant);
+#           elif DEBUG
+            ESP_LOGI ("WASM3", "%13" PRIu64 "  %s/%" PRIu32, sorted [i]->hitCount, info->name, variant);
+#           else
+            ESP_LOGI ("WASM3", "%13" PRIu64 "  %d/%" PRIu32, sorted [i]->hitCount, info->idx, variant);
+#           endif
+        }
+        else ESP_LOGI ("WASM3", "%13" PRIu64 "  %p", sorted [i]->hitCount, sorted [i]->operation);
+    }
+}
+
+
+M3Result  m3_WriteProfilerInfo  (const char * i_path)
+{
+    M3Result result = m3Err_none;
+
+    M3ProfilerNGram ** sorted = NULL;
+    FILE * file = fopen (i_path, "w");
+    _throwif ("unable to open the profiler output", not file);
+
+    sorted = malloc (d_m3ProfilerNGramSlots * sizeof (M3ProfilerNGram *));
+    _throwif (m3Err_mallocFailed, not sorted);
+
+    u32 count = 0;
+    for (u32 i = 0; i < d_m3ProfilerNGramSlots; ++i)
+    {
+        if (s_opProfilerNGrams [i].length)
+            sorted [count++] = & s_opProfilerNGrams [i];
+    }
+
+    qsort (sorted, count, sizeof (M3ProfilerNGram *), CompareNGramHits);
+
+    fprintf (file, "# wasm3 op n-grams: <hits> <length> <op index>:<variant>...  # names\n");
+    fprintf (file, "# dropped %" PRIu64 "\n", s_opProfilerNGramDrops);
+
+    for (u32 i = 0; i < count; ++i)
+    {
+        M3ProfilerNGram * ngram = sorted [i];
+
+        fprintf (file, "%" PRIu64 " %" PRIu32, ngram->hitCount, ngram->length);
+
+        for (u32 n = 0; n < ngram->length; ++n)
+        {
+            IM3OpInfo info; u32 variant;
+
+            if (FindProfiledOperation (ngram->ops [n], & info, & variant))
+                fprintf (file, " %d:%" PRIu32, info->idx, variant);
+            else
+                fprintf (file, " ?");
+        }
+
+        fprintf (file, "  #");
 
-        if (maxSlot->opName)
+        for (u32 n = 0; n < ngram->length; ++n)
         {
-            #if M3_FUNCTIONS_ENUM
-            ESP_LOGE ("WASM3", "%13llu  %s\n", maxSlot->hitCount, getOpName(maxSlot->opName));
-            maxSlot->opName = -10;
-            #else 
-            ESP_LOGE ("WASM3", "%13llu  %s\n", maxSlot->hitCount, maxSlot->opName);
-            maxSlot->opName = NULL;
-            #endif
+            IM3OpInfo info; u32 variant;
+
+            if (FindProfiledOperation (ngram->ops [n], & info, & variant))
+            {
+#               if DEBUG && M3_FUNCTIONS_ENUM
+                fprintf (file, " %s/%" PRIu32, getOpName (info->idx), variant);
+#               elif DEBUG
+                fprintf (file, " %s/%" PRIu32, info->name, variant);
+#               else
+                fprintf (file, " %d/%" PRIu32, info->idx, variant);
+#               endif
+            }
+            else fprintf (file, " %p", ngram->ops [n]);
         }
+
+        fprintf (file, "\n");
     }
-    while (maxSlot->hitCount);
+
+    _catch:
+    free (sorted);
+    if (file)
+        fclose (file);
+
+    return result;
 }
 
 # else
 
 void  m3_PrintProfilerInfo  () {}
 
+M3Result  m3_WriteProfilerInfo  (const char * i_path)
+{
+    return m3Err_none;
+}
+
 # endif
 
@@ -12,7 +12,9 @@
 
 d_m3BeginExternC
 
-void            ProfileHit              (OP_TRACE_TYPE i_operationName);
+void            ProfileHit              (IM3Operation i_operation);
+void            ProfileSequenceHit      (IM3Operation i_operation);
+u64             GetProfiledDispatches   (void);
 
 #if DEBUG
 
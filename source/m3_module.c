@@ -46,6 +46,15 @@ void  m3_FreeModule  (IM3Module i_module)
 
         FreeImportInfo(&i_module->memoryImport);
 
+#if d_m3EnableStreamingParse
+        while (i_module->keptBytes)
+        {
+            M3ModuleBytes * next = i_module->keptBytes->next;
+            m3_Def_Free (i_module->keptBytes);
+            i_module->keptBytes = next;
+        }
+#endif
+
         m3_Def_Free (i_module);
     }
 }
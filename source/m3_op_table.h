@@ -0,0 +1,178 @@
+//
+//  m3_op_table.h
+//
+//  Tabella di tutte le operazioni di m3_exec.h, nell'ordine in cui sono definite: l'indice e'
+//  stabile per una stessa build e serve a rilocare i puntatori alle op (m3_code_cache.c).
+//  Con d_m3ThreadedDispatch la tabella associa anche l'op alla label in m3_ThreadedDispatch ().
+//
+//  La tabella si costruisce espandendo una seconda volta i corpi delle op (d_m3OpBodiesPass) come
+//  codice morto: d_m3Op (NAME) registra op_NAME prima del proprio corpo.
+//
+//  Incluso solo da m3_exec.h, nell'unita' che compila le op (M3_COMPILE_OPCODES).
+//
+
+#pragma once
+
+#include <stdlib.h>
+
+#define d_m3MaxOperations               1024        // more than the operations m3_exec.h defines
+
+typedef struct M3OperationEntry
+{
+    IM3Operation            operation;
+    const void *            word;           // what the code stream holds: the operation or its label
+    cstr_t                  name;
+}
+M3OperationEntry;
+
+static M3OperationEntry     s_operations            [d_m3MaxOperations];
+static u16                  s_operationsByAddress   [d_m3MaxOperations];
+static u16                  s_operationsByWord      [d_m3MaxOperations];
+static u32                  s_numOperations;
+
+
+static void  RegisterOperation  (IM3Operation i_operation, const void * i_word, cstr_t i_name)
+{
+    d_m3Assert (s_numOperations < d_m3MaxOperations);
+
+    if (s_numOperations < d_m3MaxOperations)
+    {
+        u16 index = (u16) s_numOperations++;
+
+        M3OperationEntry * entry = & s_operations [index];
+        entry->operation = i_operation;
+        entry->word = i_word;
+        entry->name = i_name;
+
+        s_operationsByAddress [index] = s_operationsByWord [index] = index;
+    }
+}
+
+
+#if (d_m3EnableOpProfiling || d_m3EnableOpTracing)
+#   define d_m3OpTableSig               d_m3OpSig, OP_TRACE_TYPE i_operationName
+#else
+#   define d_m3OpTableSig               d_m3OpSig
+#endif
+
+#if ! d_m3ThreadedDispatch
+// same signature as the operations: the dead bodies still contain their tail calls
+static M3_NO_UBSAN m3ret_t vectorcall  RegisterOperations  (d_m3OpTableSig)
+{
+#   pragma push_macro ("d_m3Op")
+#   define d_m3OpBodiesPass
+
+#   undef  d_m3Op
+#   define d_m3Op(NAME)                 RegisterOperation (op_##NAME, (const void *) op_##NAME, #NAME); if (0)
+#   include "m3_exec.h"
+
+#   undef  d_m3OpBodiesPass
+#   pragma pop_macro ("d_m3Op")
+
+    return m3Err_none;
+}
+#endif
+
+
+static int  CompareOperationAddresses  (const void * i_a, const void * i_b)
+{
+    uintptr_t a = (uintptr_t) s_operations [* (const u16 *) i_a].operation;
+    uintptr_t b = (uintptr_t) s_operations [* (const u16 *) i_b].operation;
+
+    return (a > b) - (a < b);
+}
+
+
+static int  CompareOperationWords  (const void * i_a, const void * i_b)
+{
+    uintptr_t a = (uintptr_t) s_operations [* (const u16 *) i_a].word;
+    uintptr_t b = (uintptr_t) s_operations [* (const u16 *) i_b].word;
+
+    return (a > b) - (a < b);
+}
+
+
+static void  EnsureOperationTable  (void)
+{
+    if (M3_LIKELY (s_numOperations))
+        return;
+
+#   if d_m3ThreadedDispatch
+        m3_ThreadedDispatch (NULL, NULL, NULL, d_m3OpDefaultArgs);
+#   elif (d_m3EnableOpProfiling || d_m3EnableOpTracing)
+        RegisterOperations (NULL, NULL, NULL, d_m3OpDefaultArgs, d_m3BaseCstr);
+#   else
+        RegisterOperations (NULL, NULL, NULL, d_m3OpDefaultArgs);
+#   endif
+
+    qsort (s_operationsByAddress, s_numOperations, sizeof (u16), CompareOperationAddresses);
+    qsort (s_operationsByWord, s_numOperations, sizeof (u16), CompareOperationWords);
+}
+
+
+// binary search of one of the sorted index arrays; the key is matched against the operation or the word
+static i32  FindOperation  (const u16 * i_sorted, const void * i_key, bool i_byWord)
+{
+    u32 low = 0, high = s_numOperations;
+
+    while (low < high)
+    {
+        u32 middle = (low + high) / 2;
+        const M3OperationEntry * entry = & s_operations [i_sorted [middle]];
+        uintptr_t value = (uintptr_t) (i_byWord ? entry->word : (const void *) entry->operation);
+
+        if (value == (uintptr_t) i_key)
+            return i_sorted [middle];
+        else if (value < (uintptr_t) i_key)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    return -1;
+}
+
+
+u32  m3_GetNumOperations  (void)
+{
+    EnsureOperationTable ();
+    return s_numOperations;
+}
+
+
+i32  m3_GetOperationIndex  (IM3Operation i_operation)
+{
+    EnsureOperationTable ();
+    return FindOperation (s_operationsByAddress, (const void *) i_operation, false);
+}
+
+
+IM3Operation  m3_GetOperationAtIndex  (u32 i_index)
+{
+    EnsureOperationTable ();
+    return (i_index < s_numOperations) ? s_operations [i_index].operation : NULL;
+}
+
+
+cstr_t  m3_GetOperationName  (u32 i_index)
+{
+    EnsureOperationTable ();
+    return (i_index < s_numOperations) ? s_operations [i_index].name : NULL;
+}
+
+
+const void *  m3_GetOperationWord  (IM3Operation i_operation)
+{
+    i32 index = m3_GetOperationIndex (i_operation);
+                                                                        d_m3Assert (index >= 0 or not i_operation);
+    return (index >= 0) ? s_operations [index].word : NULL;
+}
+
+
+IM3Operation  m3_GetWordOperation  (const void * i_word)
+{
+    EnsureOperationTable ();
+
+    i32 index = FindOperation (s_operationsByWord, i_word, true);
+    return (index >= 0) ? s_operations [index].operation : NULL;
+}
@@ -0,0 +1,515 @@
+#include "m3_pager.h"
+#include "esp_log.h"
+#include "m3_pointers.h"
+#include "wasm3.h"
+
+#include <string.h>
+#include <time.h>
+
+DEBUG_TYPE WASM_DEBUG_PAGER = WASM_DEBUG_ALL || (WASM_DEBUG && false);
+
+esp_err_t paging_init(paging_stats_t** o_paging, segment_handlers_t* handlers, size_t segment_size) {
+    paging_stats_t* paging = m3_Def_Malloc(sizeof(paging_stats_t));
+    if (!paging) {
+        ESP_LOGE("WASM3", "paging_init: allocation failed");
+        *o_paging = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+
+    memset(paging, 0, sizeof(paging_stats_t));
+    if (handlers) paging->handlers = *handlers;
+    paging->segment_size = segment_size;
+    paging->resident_budget = WASM_PAGER_RESIDENT_BUDGET;
+
+    *o_paging = paging;
+    #if WASM_PAGER_COMPRESSED_STORE
+    return paging_use_compressed_store(paging);
+    #else
+    return paging_open_store(paging, WASM_PAGER_STORE_PATH);
+    #endif
+}
+
+void paging_deinit(paging_stats_t* paging) {
+    if (!paging) return;
+
+    if (WASM_DEBUG_PAGER) paging_print_stats(paging);
+
+    // Segment data belongs to the owner (already released by FreeMemory)
+    for (size_t i = 0; i < paging->num_pages; i++) {
+        m3_Def_Free(paging->pages[i]->blob);
+        m3_Def_Free(paging->pages[i]);
+    }
+    m3_Def_Free(paging->pages);
+    m3_Def_Free(paging->scratch);
+
+    if (paging->store) fclose(paging->store);
+    m3_Def_Free(paging);
+}
+
+static bool has_evicted_pages(paging_stats_t* paging) {
+    for (size_t i = 0; i < paging->num_pages; i++) {
+        if (paging->pages[i]->state == c_pagerState_Evicted) return true;
+    }
+    return false;
+}
+
+esp_err_t paging_open_store(paging_stats_t* paging, const char* path) {
+    if (!paging) return ESP_ERR_INVALID_ARG;
+
+    if (has_evicted_pages(paging)) {
+        ESP_LOGW("WASM3", "paging_open_store: segments are evicted to the current store");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    FILE* store = path ? fopen(path, "w+b") : tmpfile();
+    if (!store) {
+        ESP_LOGW("WASM3", "paging_open_store: can't open the store (%s), eviction disabled", path ? path : "tmpfile");
+        return ESP_FAIL;
+    }
+
+    if (paging->store) fclose(paging->store);
+    paging->store = store;
+    paging->store_kind = c_pagerStore_File;
+    return ESP_OK;
+}
+
+esp_err_t paging_use_compressed_store(paging_stats_t* paging) {
+    if (!paging) return ESP_ERR_INVALID_ARG;
+
+    if (has_evicted_pages(paging)) {
+        ESP_LOGW("WASM3", "paging_use_compressed_store: segments are evicted to the current store");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (!paging->scratch) {
+        paging->scratch = m3_Def_Malloc(paging->segment_size);
+        if (!paging->scratch) return ESP_ERR_NO_MEM;
+    }
+
+    paging->store_kind = c_pagerStore_Compressed;
+    return ESP_OK;
+}
+
+///
+/// LZ codec (LZ4-style sequences: token, literals, 16-bit offset, match)
+///
+/// token: high nibble literal count, low nibble match length - 4; 15 continues in
+/// 255-terminated extension bytes. The last sequence carries literals only.
+
+#define LZ_MIN_MATCH 4
+
+static inline uint32_t lz_read32(const uint8_t* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t lz_hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - WASM_PAGER_LZ_HASH_BITS);
+}
+
+static bool lz_put_length(uint8_t* dst, size_t cap, size_t* op, size_t length) {
+    while (length >= 255) {
+        if (*op >= cap) return false;
+        dst[(*op)++] = 255;
+        length -= 255;
+    }
+    if (*op >= cap) return false;
+    dst[(*op)++] = (uint8_t)length;
+    return true;
+}
+
+static bool lz_emit(uint8_t* dst, size_t cap, size_t* op, const uint8_t* literals, size_t literal_length, size_t match_length, size_t offset) {
+    size_t match_code = match_length ? match_length - LZ_MIN_MATCH : 0;
+
+    if (*op >= cap) return false;
+    dst[(*op)++] = (uint8_t)((M3_MIN(literal_length, 15) << 4) | M3_MIN(match_code, 15));
+
+    if (literal_length >= 15 && !lz_put_length(dst, cap, op, literal_length - 15)) return false;
+    if (*op + literal_length > cap) return false;
+    memcpy(dst + *op, literals, literal_length);
+    *op += literal_length;
+
+    if (!match_length) return true;
+
+    if (*op + 2 > cap) return false;
+    dst[(*op)++] = (uint8_t)offset;
+    dst[(*op)++] = (uint8_t)(offset >> 8);
+
+    if (match_code >= 15 && !lz_put_length(dst, cap, op, match_code - 15)) return false;
+    return true;
+}
+
+// Compressed size, or 0 if the output would reach cap
+static size_t lz_compress(const uint8_t* src, size_t length, uint8_t* dst, size_t cap, uint16_t* table) {
+    memset(table, 0, sizeof(uint16_t) << WASM_PAGER_LZ_HASH_BITS);
+
+    size_t ip = 1, anchor = 0, op = 0;
+    while (ip + LZ_MIN_MATCH <= length) {
+        uint32_t sequence = lz_read32(src + ip);
+        uint32_t hash = lz_hash(sequence);
+        size_t ref = table[hash];
+        table[hash] = (uint16_t)ip;
+
+        if (ip - ref > UINT16_MAX || lz_read32(src + ref) != sequence) {
+            ip++;
+            continue;
+        }
+
+        size_t match_length = LZ_MIN_MATCH;
+        while (ip + match_length < length && src[ref + match_length] == src[ip + match_length]) {
+            match_length++;
+        }
+
+        if (!lz_emit(dst, cap, &op, src + anchor, ip - anchor, match_length, ip - ref)) return 0;
+        ip += match_length;
+        anchor = ip;
+    }
+
+    if (anchor < length && !lz_emit(dst, cap, &op, src + anchor, length - anchor, 0, 0)) return 0;
+    return op < cap ? op : 0;
+}
+
+static bool lz_get_length(const uint8_t* src, size_t length, size_t* ip, size_t* value) {
+    uint8_t byte;
+    do {
+        if (*ip >= length) return false;
+        byte = src[(*ip)++];
+        *value += byte;
+    } while (byte == 255);
+    return true;
+}
+
+static bool lz_decompress(const uint8_t* src, size_t length, uint8_t* dst, size_t size) {
+    size_t ip = 0, op = 0;
+    while (ip < length) {
+        uint8_t token = src[ip++];
+
+        size_t literal_length = token >> 4;
+        if (literal_length == 15 && !lz_get_length(src, length, &ip, &literal_length)) return false;
+        if (ip + literal_length > length || op + literal_length > size) return false;
+        memcpy(dst + op, src + ip, literal_length);
+        ip += literal_length;
+        op += literal_length;
+
+        if (ip >= length) break;
+
+        if (ip + 2 > length) return false;
+        size_t offset = src[ip] | ((size_t)src[ip + 1] << 8);
+        ip += 2;
+
+        size_t match_length = token & 15;
+        if (match_length == 15 && !lz_get_length(src, length, &ip, &match_length)) return false;
+        match_length += LZ_MIN_MATCH;
+
+        if (offset == 0 || offset > op || op + match_length > size) return false;
+
+        // Byte by byte: the match may overlap its own output
+        const uint8_t* match = dst + op - offset;
+        for (size_t i = 0; i < match_length; i++) {
+            dst[op + i] = match[i];
+        }
+        op += match_length;
+    }
+
+    return op == size;
+}
+
+///
+/// Backing store
+///
+
+static int64_t pager_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Compressed RAM: fill word if the segment is uniform, LZ otherwise
+static bool store_compress(paging_stats_t* paging, segment_info_t* page) {
+    const uint8_t* data = *page->data;
+    size_t words = paging->segment_size / sizeof(uint32_t);
+    uint32_t fill = lz_read32(data);
+
+    size_t word = 1;
+    while (word < words && lz_read32(data + word * sizeof(uint32_t)) == fill) word++;
+
+    if (word == words) {
+        page->encoding = c_pagerEncoding_Fill;
+        page->fill = fill;
+        page->blob_size = sizeof(uint32_t);
+        paging->fill_pages++;
+    }
+    else {
+        size_t size = lz_compress(data, paging->segment_size, paging->scratch, paging->segment_size, paging->lz_table);
+        if (!size) {
+            paging->incompressible++;
+            return false;
+        }
+
+        uint8_t* blob = m3_Def_Malloc(size);
+        if (!blob) return false;
+        memcpy(blob, paging->scratch, size);
+
+        page->encoding = c_pagerEncoding_LZ;
+        page->blob = blob;
+        page->blob_size = (uint16_t)size;
+        paging->lz_pages++;
+    }
+
+    paging->raw_bytes += paging->segment_size;
+    paging->compressed_bytes += page->blob_size;
+    return true;
+}
+
+static bool store_decompress(paging_stats_t* paging, segment_info_t* page, void* data) {
+    int64_t start = pager_now_ns();
+
+    if (page->encoding == c_pagerEncoding_Fill) {
+        uint8_t* bytes = data;
+        if (page->fill == 0) {
+            memset(bytes, 0, paging->segment_size);
+        } else {
+            for (size_t i = 0; i < paging->segment_size; i += sizeof(uint32_t)) {
+                memcpy(bytes + i, &page->fill, sizeof(uint32_t));
+            }
+        }
+        paging->fill_pages--;
+    }
+    else {
+        if (!lz_decompress(page->blob, page->blob_size, data, paging->segment_size)) return false;
+        m3_Def_Free(page->blob);
+        page->blob = NULL;
+        paging->lz_pages--;
+    }
+
+    paging->raw_bytes -= paging->segment_size;
+    paging->compressed_bytes -= page->blob_size;
+    page->blob_size = 0;
+
+    int64_t elapsed = pager_now_ns() - start;
+    paging->decompressions++;
+    paging->decompress_ns += elapsed;
+    if (elapsed > paging->decompress_max_ns) paging->decompress_max_ns = elapsed;
+    return true;
+}
+
+// File: segment N lives at N * segment_size
+static bool store_write(paging_stats_t* paging, segment_info_t* page) {
+    if (paging->store_kind == c_pagerStore_Compressed) {
+        if (!store_compress(paging, page)) return false;
+        paging->store_writes++;
+        return true;
+    }
+
+    if (!paging->store) return false;
+
+    long position = (long)page->segment_id * (long)paging->segment_size;
+    if (fseek(paging->store, position, SEEK_SET) != 0) return false;
+    if (fwrite(*page->data, 1, paging->segment_size, paging->store) != paging->segment_size) return false;
+
+    page->encoding = c_pagerEncoding_File;
+    paging->store_writes++;
+    return true;
+}
+
+static bool store_read(paging_stats_t* paging, segment_info_t* page, void* data) {
+    if (page->encoding != c_pagerEncoding_File) {
+        if (!store_decompress(paging, page, data)) return false;
+        paging->store_reads++;
+        return true;
+    }
+
+    long position = (long)page->segment_id * (long)paging->segment_size;
+    if (fseek(paging->store, position, SEEK_SET) != 0) return false;
+    if (fread(data, 1, paging->segment_size, paging->store) != paging->segment_size) return false;
+
+    paging->store_reads++;
+    return true;
+}
+
+///
+/// Clock
+///
+
+// Evicts one cold, unpinned resident segment other than keep. Two sweeps at most: the
+// first one clears the reference bits it passes over.
+static bool evict_one(paging_stats_t* paging, segment_info_t* keep) {
+    for (size_t steps = 0; steps < 2 * paging->num_pages; steps++) {
+        if (paging->clock_hand >= paging->num_pages) paging->clock_hand = 0;
+        segment_info_t* page = paging->pages[paging->clock_hand++];
+
+        if (page == keep || page->state != c_pagerState_Resident || !*page->data || page->pins) continue;
+
+        if (page->referenced) {
+            page->referenced = false;
+            if (paging->handlers.on_age) paging->handlers.on_age(paging->handlers.user, page);
+            continue;
+        }
+
+        if (!store_write(paging, page)) {
+            // Incompressible segments stay resident until they are cold again
+            if (paging->store_kind == c_pagerStore_Compressed) {
+                page->referenced = true;
+                continue;
+            }
+            paging->failed_evictions++;
+            return false;
+        }
+
+        void* data = *page->data;
+        *page->data = NULL;
+        m3_Def_Free(data);
+
+        page->state = c_pagerState_Evicted;
+        paging->resident--;
+        paging->evictions++;
+
+        if (WASM_DEBUG_PAGER) ESP_LOGI("WASM3", "pager: evicted segment %u", page->segment_id);
+
+        if (paging->handlers.on_evict) paging->handlers.on_evict(paging->handlers.user, page);
+        return true;
+    }
+
+    return false;
+}
+
+static void enforce_budget(paging_stats_t* paging, segment_info_t* keep) {
+    while (paging->resident > paging->resident_budget) {
+        if (!evict_one(paging, keep)) break;
+    }
+}
+
+void paging_set_resident_budget(paging_stats_t* paging, size_t segments) {
+    if (!paging) return;
+
+    paging->resident_budget = segments < WASM_PAGER_MIN_RESIDENT ? WASM_PAGER_MIN_RESIDENT : segments;
+    enforce_budget(paging, NULL);
+}
+
+///
+/// Hooks
+///
+
+esp_err_t paging_notify_segment_creation(paging_stats_t* paging, segment_info_t** o_page) {
+    if (!paging) return ESP_ERR_INVALID_ARG;
+
+    if (paging->num_pages == paging->capacity) {
+        size_t capacity = paging->capacity ? paging->capacity * 2 : 64;
+        segment_info_t** pages = m3_Def_Realloc(paging->pages, capacity * sizeof(segment_info_t*));
+        if (!pages) return ESP_ERR_NO_MEM;
+
+        paging->pages = pages;
+        paging->capacity = capacity;
+    }
+
+    segment_info_t* page = m3_Def_Malloc(sizeof(segment_info_t));
+    if (!page) return ESP_ERR_NO_MEM;
+
+    memset(page, 0, sizeof(segment_info_t));
+    page->segment_id = (uint32_t)paging->num_pages;
+    paging->pages[paging->num_pages++] = page;
+
+    *o_page = page;
+    return ESP_OK;
+}
+
+esp_err_t paging_notify_segment_access(paging_stats_t* paging, uint32_t segment_id) {
+    if (!paging || segment_id >= paging->num_pages) return ESP_ERR_INVALID_ARG;
+
+    segment_info_t* page = paging->pages[segment_id];
+    page->referenced = true;
+
+    if (page->state != c_pagerState_Evicted) return ESP_OK;
+
+    // Fault in: make room first, so the budget holds while we allocate
+    if (paging->resident >= paging->resident_budget) evict_one(paging, page);
+
+    void* data = m3_Def_Malloc(paging->segment_size);
+    if (!data) {
+        ESP_LOGE("WASM3", "pager: no memory to fault in segment %u", segment_id);
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (!store_read(paging, page, data)) {
+        ESP_LOGE("WASM3", "pager: store read failed for segment %u", segment_id);
+        m3_Def_Free(data);
+        return ESP_FAIL;
+    }
+
+    *page->data = data;
+    page->state = c_pagerState_Resident;
+    paging->resident++;
+    paging->faults++;
+
+    if (WASM_DEBUG_PAGER) ESP_LOGI("WASM3", "pager: faulted in segment %u", segment_id);
+
+    if (paging->handlers.on_load) paging->handlers.on_load(paging->handlers.user, page);
+
+    enforce_budget(paging, page);
+    return ESP_OK;
+}
+
+esp_err_t paging_notify_segment_allocation(paging_stats_t* paging, segment_info_t* page, void** data) {
+    if (!paging || !page) return ESP_ERR_INVALID_ARG;
+
+    page->data = data;
+    page->referenced = true;
+    if (page->state != c_pagerState_Resident) {
+        page->state = c_pagerState_Resident;
+        paging->resident++;
+    }
+
+    enforce_budget(paging, page);
+    return ESP_OK;
+}
+
+esp_err_t paging_notify_segment_deallocation(paging_stats_t* paging, uint32_t segment_id) {
+    if (!paging || segment_id >= paging->num_pages) return ESP_ERR_INVALID_ARG;
+
+    segment_info_t* page = paging->pages[segment_id];
+    if (page->state == c_pagerState_Resident) paging->resident--;
+    page->state = c_pagerState_Absent;
+    page->referenced = false;
+
+    return ESP_OK;
+}
+
+esp_err_t paging_pin(paging_stats_t* paging, uint32_t segment_id) {
+    if (!paging || segment_id >= paging->num_pages) return ESP_ERR_INVALID_ARG;
+
+    segment_info_t* page = paging->pages[segment_id];
+    if (page->pins == UINT16_MAX) return ESP_ERR_INVALID_STATE;
+
+    page->pins++;
+    return ESP_OK;
+}
+
+esp_err_t paging_unpin(paging_stats_t* paging, uint32_t segment_id) {
+    if (!paging || segment_id >= paging->num_pages) return ESP_ERR_INVALID_ARG;
+
+    segment_info_t* page = paging->pages[segment_id];
+    if (!page->pins) return ESP_ERR_INVALID_STATE;
+
+    if (--page->pins == 0) enforce_budget(paging, NULL);
+    return ESP_OK;
+}
+
+void paging_print_stats(paging_stats_t* paging) {
+    if (!paging) return;
+
+    ESP_LOGI("WASM3", "pager: %zu/%zu resident of %zu segments", paging->resident, paging->resident_budget, paging->num_pages);
+    ESP_LOGI("WASM3", "pager: %zu faults, %zu evictions (%zu failed), %zu store writes, %zu store reads",
+             paging->faults, paging->evictions, paging->failed_evictions, paging->store_writes, paging->store_reads);
+
+    if (paging->store_kind == c_pagerStore_Compressed) {
+        ESP_LOGI("WASM3", "pager: compressed %zu -> %zu bytes (ratio %zu.%02zu), %zu fill + %zu LZ segments, %zu incompressible",
+                 paging->raw_bytes, paging->compressed_bytes,
+                 paging->compressed_bytes ? paging->raw_bytes / paging->compressed_bytes : 0,
+                 paging->compressed_bytes ? (paging->raw_bytes * 100 / paging->compressed_bytes) % 100 : 0,
+                 paging->fill_pages, paging->lz_pages, paging->incompressible);
+        ESP_LOGI("WASM3", "pager: %zu decompressions, avg %lld ns, max %lld ns", paging->decompressions,
+                 (long long)(paging->decompressions ? paging->decompress_ns / (int64_t)paging->decompressions : 0),
+                 (long long)paging->decompress_max_ns);
+    }
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+// Built-in segment pager: the paging_* hooks of he_memory.h, implemented in-tree.
+// Tracks segment recency with a clock (second chance) and evicts cold segments to a
+// backing store under a resident budget: either compressed in RAM (same-filled pages are
+// kept as their fill word, the rest go through a small LZ codec) or a plain file, standing
+// in for PSRAM / SPI flash. Evicted segments fault back in on the next paging_notify_segment_access.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+
+#define WASM_PAGER_RESIDENT_BUDGET 64   // resident segments (64 * 4 KB)
+#define WASM_PAGER_MIN_RESIDENT 8       // host calls may hold this many unpinned segment pointers at once
+#define WASM_PAGER_STORE_PATH NULL      // NULL: anonymous tmpfile()
+#define WASM_PAGER_COMPRESSED_STORE 1   // evict into compressed RAM instead of the file store
+#define WASM_PAGER_LZ_HASH_BITS 10
+
+typedef enum {
+    c_pagerState_Absent = 0,    // no data
+    c_pagerState_Resident,
+    c_pagerState_Evicted        // data lives in the store only
+} pager_state_t;
+
+typedef enum {
+    c_pagerStore_File = 0,
+    c_pagerStore_Compressed
+} pager_store_t;
+
+typedef enum {
+    c_pagerEncoding_File = 0,   // at segment_id * segment_size in the file store
+    c_pagerEncoding_Fill,       // every word equals fill (zero pages included)
+    c_pagerEncoding_LZ
+} pager_encoding_t;
+
+typedef struct segment_info_t {
+    uint32_t segment_id;
+    void** data;                // owner's data pointer: swapped by eviction and fault-in
+    void* owner;
+    uint8_t state;              // pager_state_t
+    bool referenced;            // clock bit
+    uint16_t pins;              // host pointers into data in use: never evicted while > 0
+
+    // Evicted content
+    uint8_t encoding;           // pager_encoding_t
+    uint16_t blob_size;
+    uint32_t fill;
+    uint8_t* blob;
+} segment_info_t;
+
+// Called after the pager changed *page->data, and when the clock clears a reference bit
+// (accesses that don't go through paging_notify_segment_access must set it again)
+typedef struct segment_handlers_t {
+    void (*on_evict)(void* user, segment_info_t* page);
+    void (*on_load)(void* user, segment_info_t* page);
+    void (*on_age)(void* user, segment_info_t* page);
+    void* user;
+} segment_handlers_t;
+
+typedef struct paging_stats_t {
+    segment_handlers_t handlers;
+    size_t segment_size;
+
+    segment_info_t** pages;     // by segment_id
+    size_t num_pages;
+    size_t capacity;
+    size_t clock_hand;
+
+    size_t resident;
+    size_t resident_budget;
+    uint8_t store_kind;         // pager_store_t
+    FILE* store;
+
+    uint8_t* scratch;           // compression output, one segment
+    uint16_t lz_table[1 << WASM_PAGER_LZ_HASH_BITS];
+
+    // Counters
+    size_t faults;
+    size_t evictions;
+    size_t failed_evictions;
+    size_t store_writes;
+    size_t store_reads;
+
+    // Compressed store
+    size_t fill_pages;
+    size_t lz_pages;
+    size_t incompressible;      // evictions refused: LZ output not smaller than the segment
+    size_t raw_bytes;           // segment bytes held compressed
+    size_t compressed_bytes;
+    size_t decompressions;
+    int64_t decompress_ns;
+    int64_t decompress_max_ns;
+} paging_stats_t;
+
+esp_err_t paging_init(paging_stats_t** o_paging, segment_handlers_t* handlers, size_t segment_size);
+void paging_deinit(paging_stats_t* paging);
+
+esp_err_t paging_notify_segment_creation(paging_stats_t* paging, segment_info_t** o_page);
+esp_err_t paging_notify_segment_access(paging_stats_t* paging, uint32_t segment_id);
+esp_err_t paging_notify_segment_allocation(paging_stats_t* paging, segment_info_t* page, void** data);
+esp_err_t paging_notify_segment_deallocation(paging_stats_t* paging, uint32_t segment_id);
+
+// Pinned segments stay resident (the budget may be exceeded meanwhile); the last unpin
+// brings the pager back under budget
+esp_err_t paging_pin(paging_stats_t* paging, uint32_t segment_id);
+esp_err_t paging_unpin(paging_stats_t* paging, uint32_t segment_id);
+
+// Budget in segments (clamped to WASM_PAGER_MIN_RESIDENT); evicts right away if over it
+void paging_set_resident_budget(paging_stats_t* paging, size_t segments);
+// Switches to a file store (NULL: anonymous tmpfile). Only while nothing is evicted.
+esp_err_t paging_open_store(paging_stats_t* paging, const char* path);
+// Switches to the compressed RAM store. Only while nothing is evicted.
+esp_err_t paging_use_compressed_store(paging_stats_t* paging);
+void paging_print_stats(paging_stats_t* paging);
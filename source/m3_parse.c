@@ -336,15 +336,23 @@ M3Result  Parse_InitExpr  (M3Module * io_module, bytes_t * io_bytes, cbytes_t i_
     // this doesn't generate code pages. just walks the wasm bytecode to find the end
 
 #if defined(d_m3PreferStaticAlloc)
-    static M3Compilation compilation;
+    // on the heap, not static: modules can be parsed on several threads at once
+    IM3Compilation o = m3_Def_AllocStruct (M3Compilation);
+    if (not o)
+        return m3Err_mallocFailed;
 #else
     M3Compilation compilation;
+    IM3Compilation o = & compilation;
 #endif
-    compilation = (M3Compilation){ .runtime = io_module->runtime, .module = io_module, .wasm = * io_bytes, .wasmEnd = i_end };
+    * o = (M3Compilation){ .runtime = io_module->runtime, .module = io_module, .wasm = * io_bytes, .wasmEnd = i_end };
 
-    result = CompileBlockStatements (& compilation);
+    result = CompileBlockStatements (o);
 
-    * io_bytes = compilation.wasm;
+    * io_bytes = o->wasm;
+
+#if defined(d_m3PreferStaticAlloc)
+    m3_Def_Free (o);
+#endif
 
     return result;
 }
@@ -673,6 +681,61 @@ M3Result  ParseModuleSection  (M3Module * o_module, u8 i_sectionType, bytes_t i_
 DEBUG_TYPE WASM_DEBUG_PARSE_MODULE = WASM_DEBUG_ALL || (WASM_DEBUG && false);
 static const bool WASM_PARSE_MODULE_IGNORE_SECTION_ORDER = false;
 DEBUG_TYPE WASM_DEBUG_PARSE_MODULE_EXCEPTED_SECTION = WASM_DEBUG_ALL || (WASM_DEBUG && false);
+
+// sections appear only once and in order. a misplaced one ends the module there (o_forcedEnd), unless
+// WASM_ParseModule_EndWithExceptedSection is off
+M3Result  CheckSectionOrder  (u8 i_section, u8 * io_expectedSection, bool * o_forcedEnd)
+{
+    static const u8 sectionsOrder[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 12, 10, 11, 0 }; // 0 is a placeholder
+
+    M3Result result = m3Err_none;
+
+    * o_forcedEnd = false;
+
+    if (i_section != 0 && !WASM_PARSE_MODULE_IGNORE_SECTION_ORDER) {
+        while (sectionsOrder[(* io_expectedSection)++] != i_section) {
+            if(WASM_DEBUG_PARSE_MODULE) ESP_LOGD("WASM3", "Expected section order: %d, found: %d", sectionsOrder[* io_expectedSection-1], i_section);
+
+            if(* io_expectedSection >= 12){
+                if(WASM_ParseModule_EndWithExceptedSection){
+                    ESP_LOGW("WASM3", "m3_ParseModule: forced end cycle");
+                    * o_forcedEnd = true;
+                    break;
+                }
+                else {
+                    ESP_LOGE("WASM3", "m3_ParseModule: WASM section (%d) not found on not in order", i_section);
+
+                    if(WASM_DEBUG_PARSE_MODULE_EXCEPTED_SECTION){
+                        LOG_FLUSH;
+                        backtrace();
+                    }
+
+                    _throwif(m3Err_misorderedWasmSection, * io_expectedSection >= 12);
+                }
+            }
+        }
+    }
+
+    _catch: return result;
+}
+
+
+void  AddModuleMemoryRequest  (IM3Module i_module)
+{
+    IM3Memory mem = & i_module->runtime->memory;
+
+    if(mem->firm == INIT_FIRM){
+        u32 pages = i_module->memoryInfo.maxPages;
+        if(pages < i_module->memoryInfo.initPages) pages = i_module->memoryInfo.initPages;
+        u32 req_size =  pages * i_module->memoryInfo.pageSize;
+
+        if(WASM_DEBUG_PARSE_MODULE) ESP_LOGW("WASM3", "m3_ParseModule: module requested size: %d", req_size);
+
+        mem->total_requested_size += req_size;
+    }
+}
+
+
 M3Result  m3_ParseModule  (IM3Environment i_environment, IM3Module * o_module, cbytes_t i_bytes, u32 i_numBytes, IM3Runtime o_runtime)
 {
     IM3Module module;          
@@ -733,7 +796,6 @@ _   (Read_u32 (mem, & version, & pos, end));
     _throwif (m3Err_wasmMalformed, magic != 0x6d736100);
     _throwif (m3Err_incompatibleWasmVersion, version != 1);
 
-    static const u8 sectionsOrder[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 12, 10, 11, 0 }; // 0 is a placeholder
     u8 expectedSection = 0;
 
     if(WASM_DEBUG_PARSE_MODULE) ESP_LOGI("WASM3", "m3_ParseModule: cycling");
@@ -752,36 +814,14 @@ _       (ReadLEB_u7 (mem, & section, & pos, end));
             //ESP_LOGI("WASM3", "Section header bytes: %02x %02x %02x %02x", i_bytes[0], i_bytes[1], i_bytes[2], i_bytes[3]);
         }
 
-        if (section != 0 && !WASM_PARSE_MODULE_IGNORE_SECTION_ORDER) {
-            // Ensure sections appear only once and in order
-            bool forcedEnd = false;
-            while (sectionsOrder[expectedSection++] != section) {
-                if(WASM_DEBUG_PARSE_MODULE) ESP_LOGD("WASM3", "Expected section order: %d, found: %d", sectionsOrder[expectedSection-1], section);
-
-                if(expectedSection >= 12){
-                    if(WASM_ParseModule_EndWithExceptedSection){
-                        ESP_LOGW("WASM3", "m3_ParseModule: forced end cycle");
-                        forcedEnd = true;
-                        break;
-                    }
-                    else {
-                        ESP_LOGE("WASM3", "m3_ParseModule: WASM section (%d) not found on not in order", section);   
-
-                        if(WASM_DEBUG_PARSE_MODULE_EXCEPTED_SECTION){    
-                            LOG_FLUSH;
-                            backtrace();             
-                        }
-
-                        _throwif(m3Err_misorderedWasmSection, expectedSection >= 12);
-                    }
-                }               
-            }
+        // Ensure sections appear only once and in order
+        bool forcedEnd;
+_       (CheckSectionOrder (section, & expectedSection, & forcedEnd));
 
-            if(forcedEnd){
-                end = cyclePos;
-                module->wasmEnd = cyclePos;
-                break;
-            }
+        if(forcedEnd){
+            end = cyclePos;
+            module->wasmEnd = cyclePos;
+            break;
         }
 
         if(WASM_DEBUG_PARSE_MODULE) ESP_LOGI("WASM3", "m3_ParseModule: cycle: ReadLEB_u32");
@@ -795,15 +835,8 @@ _       (ParseModuleSection (module, section, pos, sectionLength));
         pos += sectionLength;
     }
 
-    if(mem != NULL && mem->firm == INIT_FIRM){
-        u32 pages = module->memoryInfo.maxPages;
-        if(pages < module->memoryInfo.initPages) pages = module->memoryInfo.initPages;
-        u32 req_size =  pages * module->memoryInfo.pageSize;
-
-        if(WASM_DEBUG_PARSE_MODULE) ESP_LOGW("WASM3", "m3_ParseModule: module requested size: %d", req_size);
-
-        mem->total_requested_size += req_size;
-    }
+    if(mem != NULL)
+        AddModuleMemoryRequest (module);
 
 } _catch:
 
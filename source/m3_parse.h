@@ -2,4 +2,8 @@
 
 #include "m3_env.h"
 
+// shared by m3_ParseModule and the streaming parser (m3_parse_stream.c)
+M3Result    ParseModuleSection          (M3Module * o_module, u8 i_sectionType, bytes_t i_bytes, u32 i_numBytes);
+M3Result    CheckSectionOrder           (u8 i_section, u8 * io_expectedSection, bool * o_forcedEnd);
+void        AddModuleMemoryRequest      (IM3Module i_module);
 
@@ -0,0 +1,518 @@
+//
+//  m3_parse_stream.c
+//
+//  Streaming module parser (d_m3EnableStreamingParse), see m3_ParseModuleBegin in wasm3.h.
+//
+//  The bytes go through a small state machine: header, section id, section size, section. A section is collected
+//  into one transient buffer, reused from section to section, and given to ParseModuleSection as m3_ParseModule
+//  would. The sections the module keeps pointers into (globals, elements, data) are collected into a block the
+//  module owns instead. The code section is never held whole: each body goes straight to the allocation its
+//  function keeps, and can be compiled as soon as it is complete.
+//
+
+#include <string.h>
+
+#include "m3_parse.h"
+#include "m3_compile.h"
+#include "m3_code_cache.h"
+#include "wasm3.h"
+
+# if d_m3EnableStreamingParse
+
+DEBUG_TYPE WASM_DEBUG_PARSE_STREAM = WASM_DEBUG_ALL || (WASM_DEBUG && false);
+
+enum
+{
+    c_m3StreamHeader,               // magic and version
+    c_m3StreamSectionId,
+    c_m3StreamSectionSize,
+
+    // within a section: sectionLeft bounds these
+    c_m3StreamSection,              // a whole section, into the buffer or a kept block; target NULL skips it
+    c_m3StreamCustomName,           // the start of a custom section: is it worth buffering?
+    c_m3StreamCodeCount,
+    c_m3StreamBodySize,
+    c_m3StreamBody,
+
+    c_m3StreamIgnore                // after a forced end (CheckSectionOrder) nothing more is parsed
+};
+
+typedef struct M3ParseStream
+{
+    IM3Module               module;
+    M3Result                result;                 // sticky
+
+    u8                      state;                  // c_m3Stream*
+
+    u8 *                    target;                 // the bytes the state waits for go here
+    u8 *                    sectionBytes;           // start of the collected section
+    u32                     filled;
+    u32                     needed;
+
+    u8                      section;
+    u8                      expectedSection;
+    u32                     sectionLength;
+    u32                     sectionLeft;            // not arrived yet
+
+    u8                      small [8];              // header, LEBs, the start of a custom section
+
+    u8 *                    buffer;                 // transient: the current section
+    u32                     bufferSize;
+
+    u32                     numBodies;
+    u32                     nextBody;
+
+    M3LinkImports           linkImports;
+    void *                  userdata;
+
+# if d_m3EnableCodeCache
+    u64                     hash;                   // of the bytes m3_ParseModule would have seen
+# endif
+
+    M3ParseStats            stats;
+}
+M3ParseStream;
+
+
+static void  Expect  (IM3ParseStream io_stream, u8 i_state, u8 * i_target, u32 i_numBytes)
+{
+    io_stream->state    = i_state;
+    io_stream->target   = i_target;
+    io_stream->filled   = 0;
+    io_stream->needed   = i_numBytes;
+}
+
+
+// Section and body sizes come from the module: a few bytes of header must not get a large allocation.
+// Checked before anything is allocated for them, which also keeps 'header + size' from wrapping.
+static M3Result  ReserveBytes  (IM3ParseStream io_stream, u32 i_numBytes)
+{
+    M3Result result = m3Err_none;
+
+    _throwif ("streamed section larger than d_m3MaxStreamedSectionBytes", i_numBytes > d_m3MaxStreamedSectionBytes);
+
+    // the transient buffer stays allocated while a kept section or a body is collected
+    u32 bytes = sizeof (M3ParseStream) + io_stream->bufferSize + i_numBytes;
+    if (bytes > io_stream->stats.peakBytes)
+        io_stream->stats.peakBytes = bytes;
+
+    _catch: return result;
+}
+
+
+static M3Result  GrowBuffer  (IM3ParseStream io_stream, u32 i_size)
+{
+    M3Result result = m3Err_none;
+
+    if (i_size == 0)
+        i_size = 1;                                                     // an empty section still needs a valid pointer
+
+    if (i_size > io_stream->bufferSize)
+    {
+_       (ReserveBytes (io_stream, i_size - io_stream->bufferSize));
+
+        u8 * buffer = (u8 *) m3_Def_Realloc (io_stream->buffer, i_size);
+        _throwifnull (buffer);
+
+        io_stream->buffer = buffer;
+        io_stream->bufferSize = i_size;
+    }
+
+    _catch: return result;
+}
+
+
+// LEBs arrive one byte at a time into 'small'
+static M3Result  ReadStreamLEB  (IM3ParseStream io_stream, u32 * o_value, bool * o_complete)
+{
+    M3Result result = m3Err_none;
+
+    * o_complete = false;
+
+    u8 last = io_stream->small [io_stream->filled - 1];
+
+    if ((last & 0x80) and io_stream->filled < 5)
+    {
+        io_stream->needed++;
+    }
+    else
+    {
+        bytes_t pos = io_stream->small;
+_       (ReadLEB_u32 (io_stream->module->memoryInfo.mem, o_value, & pos, io_stream->small + io_stream->filled));
+        * o_complete = true;
+    }
+
+    _catch: return result;
+}
+
+
+static M3Result  BeginSection  (IM3ParseStream io_stream)
+{
+    M3Result result = m3Err_none;
+    IM3Module module = io_stream->module;
+
+    u32 length = io_stream->sectionLength;
+    u8 section = io_stream->section;
+
+    if (section == 10)
+    {
+        if (io_stream->linkImports)
+_           (io_stream->linkImports (module, io_stream->userdata));
+
+        Expect (io_stream, c_m3StreamCodeCount, io_stream->small, 1);
+    }
+    else if (section == 0)
+    {
+        Expect (io_stream, c_m3StreamCustomName, io_stream->small, M3_MIN (length, 5));
+    }
+    else if (section == 6 or section == 9 or section == 11)
+    {
+        // ParseSection_Global, _Element and _Data keep pointers into the section
+_       (ReserveBytes (io_stream, length));
+        M3ModuleBytes * kept = (M3ModuleBytes *) m3_Def_Malloc (sizeof (M3ModuleBytes) + length);
+        _throwifnull (kept);
+
+        kept->next = module->keptBytes;
+        module->keptBytes = kept;
+        io_stream->stats.keptBytes += length;
+
+        Expect (io_stream, c_m3StreamSection, kept->bytes, length);
+    }
+    else
+    {
+_       (GrowBuffer (io_stream, length));
+        Expect (io_stream, c_m3StreamSection, io_stream->buffer, length);
+    }
+
+    io_stream->sectionBytes = io_stream->target;
+
+    _catch: return result;
+}
+
+
+static void  NextBody  (IM3ParseStream io_stream)
+{
+    if (io_stream->nextBody < io_stream->numBodies)
+        Expect (io_stream, c_m3StreamBodySize, io_stream->small, 1);
+    else
+        Expect (io_stream, c_m3StreamSectionId, io_stream->small, 1);
+}
+
+
+// the state got the bytes it waited for
+static M3Result  Advance  (IM3ParseStream io_stream)
+{
+    M3Result result = m3Err_none;
+    IM3Module module = io_stream->module;
+
+    u32 value;
+    bool complete;
+
+    switch (io_stream->state)
+    {
+        case c_m3StreamHeader:
+        {
+            u32 magic, version;
+            memcpy (& magic, io_stream->small, sizeof (magic));
+            memcpy (& version, io_stream->small + 4, sizeof (version));
+
+            _throwif ("malformed Wasm binary", magic != 0x6d736100);
+            _throwif ("incompatible Wasm binary version", version != 1);
+
+            Expect (io_stream, c_m3StreamSectionId, io_stream->small, 1);
+            break;
+        }
+
+        case c_m3StreamSectionId:
+        {
+            u8 section = io_stream->small [0];
+
+            bool forcedEnd;
+_           (CheckSectionOrder (section, & io_stream->expectedSection, & forcedEnd));
+
+            if (forcedEnd)
+            {
+                Expect (io_stream, c_m3StreamIgnore, NULL, 0);
+                break;
+            }
+
+# if d_m3EnableCodeCache
+            io_stream->hash = HashBytes (io_stream->hash, & section, 1);   // m3_ParseModule stops before a refused id
+# endif
+            io_stream->section = section;
+            Expect (io_stream, c_m3StreamSectionSize, io_stream->small, 1);
+            break;
+        }
+
+        case c_m3StreamSectionSize:
+        {
+_           (ReadStreamLEB (io_stream, & value, & complete));
+            if (not complete)
+                break;
+
+            if (WASM_DEBUG_PARSE_STREAM) ESP_LOGI ("WASM3", "m3_ParseModuleFeed: section %d, %u bytes", io_stream->section, value);
+
+            io_stream->sectionLength = value;
+            io_stream->sectionLeft = value;
+_           (BeginSection (io_stream));
+            break;
+        }
+
+        case c_m3StreamSection:
+        {
+            if (io_stream->sectionBytes)
+_               (ParseModuleSection (module, io_stream->section, io_stream->sectionBytes, io_stream->sectionLength));
+
+            Expect (io_stream, c_m3StreamSectionId, io_stream->small, 1);
+            break;
+        }
+
+        case c_m3StreamCustomName:
+        {
+            // only the name section and a custom section handler read custom sections: the rest goes by unbuffered
+            u32 filled = io_stream->filled;
+            bool wanted = module->environment->customSectionHandler or (filled == 5 and memcmp (io_stream->small, "\x04name", 5) == 0);
+
+            u8 * target = NULL;
+            if (wanted)
+            {
+_               (GrowBuffer (io_stream, io_stream->sectionLength));
+                target = io_stream->buffer;
+                memcpy (target, io_stream->small, filled);
+            }
+
+            Expect (io_stream, c_m3StreamSection, target, io_stream->sectionLength);
+            io_stream->filled = filled;
+            io_stream->sectionBytes = target;
+            break;
+        }
+
+        case c_m3StreamCodeCount:
+        {
+_           (ReadStreamLEB (io_stream, & value, & complete));
+            if (not complete)
+                break;
+
+            _throwif ("mismatched function count in code section", value != module->numFunctions - module->numFuncImports);
+
+            io_stream->numBodies = value;
+            io_stream->nextBody = 0;
+            NextBody (io_stream);
+            break;
+        }
+
+        case c_m3StreamBodySize:
+        {
+_           (ReadStreamLEB (io_stream, & value, & complete));
+            if (not complete)
+                break;
+
+            if (value == 0)
+            {
+                io_stream->nextBody++;                                  // as ParseSection_Code: no body, no function code
+                NextBody (io_stream);
+                break;
+            }
+
+            _throwif ("section overrun while parsing Wasm binary", value > io_stream->sectionLeft);
+_           (ReserveBytes (io_stream, io_stream->filled + value));
+
+            // the function keeps its body with the size in front, as it would point into the whole module
+            u32 lebLength = io_stream->filled;
+            u8 * body = (u8 *) m3_Def_Malloc (lebLength + value);
+            _throwifnull (body);
+
+            memcpy (body, io_stream->small, lebLength);
+            io_stream->stats.keptBytes += lebLength + value;
+
+            IM3Function func = Module_GetFunction (module, io_stream->nextBody + module->numFuncImports);
+
+            func->module = module;
+            func->wasm = body;
+            func->wasmEnd = body + lebLength + value;
+            func->ownsWasmCode = true;
+
+            Expect (io_stream, c_m3StreamBody, body + lebLength, value);
+            break;
+        }
+
+        case c_m3StreamBody:
+        {
+            IM3Function func = Module_GetFunction (module, io_stream->nextBody + module->numFuncImports);
+
+            // the imports are linked: compile now, while the rest of the module is on its way
+            if (io_stream->linkImports)
+            {
+                M3Result compiled = CompileFunction (func);
+
+                if (not compiled)
+                    io_stream->stats.numCompiled++;
+                else if (WASM_DEBUG_PARSE_STREAM)
+                    ESP_LOGW ("WASM3", "m3_ParseModuleFeed: %s left to lazy compile (%s)", m3_GetFunctionName (func), compiled);
+            }
+
+            io_stream->nextBody++;
+            NextBody (io_stream);
+            break;
+        }
+    }
+
+    // the code section can't end with bytes left over
+    if (io_stream->state == c_m3StreamSectionId and io_stream->section == 10 and io_stream->sectionLeft)
+        _throw ("section underrun while parsing Wasm binary");
+
+    _catch: return result;
+}
+
+
+static M3Result  Consume  (IM3ParseStream io_stream, bytes_t * io_bytes, u32 * io_numBytes)
+{
+    M3Result result = m3Err_none;
+
+    bool inSection = (io_stream->state >= c_m3StreamSection and io_stream->state < c_m3StreamIgnore);
+
+    u32 take = io_stream->needed - io_stream->filled;
+    if (take > * io_numBytes)
+        take = * io_numBytes;
+
+    if (inSection)
+    {
+        _throwif ("section overrun while parsing Wasm binary", io_stream->sectionLeft == 0);
+
+        if (take > io_stream->sectionLeft)
+            take = io_stream->sectionLeft;
+        io_stream->sectionLeft -= take;
+    }
+
+    if (io_stream->target)
+        memcpy (io_stream->target + io_stream->filled, * io_bytes, take);
+
+# if d_m3EnableCodeCache
+    if (io_stream->state != c_m3StreamSectionId)                        // hashed once accepted, in Advance
+        io_stream->hash = HashBytes (io_stream->hash, * io_bytes, take);
+# endif
+
+    io_stream->filled += take;
+    * io_bytes += take;
+    * io_numBytes -= take;
+
+    _catch: return result;
+}
+
+
+M3Result  m3_ParseModuleBegin  (IM3Environment i_environment, IM3Runtime i_runtime, M3LinkImports i_linkImports,
+                                void * i_userdata, IM3ParseStream * o_stream)
+{
+    M3Result result = m3Err_none;
+
+    IM3ParseStream stream = NULL;
+    IM3Module module = NULL;
+
+    * o_stream = NULL;
+
+    // unlike m3_ParseModule there's no fallback runtime: the functions may be compiled while parsing
+    _throwif ("streaming parse: the runtime memory is not initialized", not i_runtime or i_runtime->memory.firm != INIT_FIRM);
+
+    stream = m3_Def_AllocStruct (M3ParseStream);
+    _throwifnull (stream);
+
+    module = m3_Def_AllocStruct (M3Module);
+    _throwifnull (module);
+
+    module->name = ".unnamed";
+    module->startFunction = -1;
+    module->environment = i_environment;
+    module->runtime = i_runtime;
+    module->memoryInfo.mem = & i_runtime->memory;
+
+    stream->module = module;
+    stream->linkImports = i_linkImports;
+    stream->userdata = i_userdata;
+    stream->stats.peakBytes = sizeof (M3ParseStream);
+# if d_m3EnableCodeCache
+    stream->hash = c_m3HashSeed;
+# endif
+
+    Expect (stream, c_m3StreamHeader, stream->small, 8);
+
+    * o_stream = stream;
+    stream = NULL;
+    module = NULL;
+
+    _catch:
+
+    m3_FreeModule (module);
+    m3_Def_Free (stream);
+
+    return result;
+}
+
+
+M3Result  m3_ParseModuleFeed  (IM3ParseStream io_stream, cbytes_t i_bytes, u32 i_numBytes)
+{
+    M3Result result = io_stream->result;
+
+    bytes_t pos = i_bytes;
+
+    while (not result)
+    {
+        if (io_stream->state == c_m3StreamIgnore)
+            break;                                                      // dropped, as m3_ParseModule drops it
+
+        if (io_stream->filled == io_stream->needed)
+            result = Advance (io_stream);
+        else if (i_numBytes)
+            result = Consume (io_stream, & pos, & i_numBytes);
+        else
+            break;
+    }
+
+    if (result)
+        ESP_LOGE ("WASM3", "m3_ParseModuleFeed: %s", result);
+
+    io_stream->result = result;
+
+    return result;
+}
+
+
+M3Result  m3_ParseModuleFinish  (IM3ParseStream i_stream, IM3Module * o_module, M3ParseStats * o_stats)
+{
+    M3Result result = i_stream->result;
+    IM3Module module = i_stream->module;
+
+    // a module can only end between two sections (Feed advances every state that got its bytes)
+    if (not result)
+    {
+        bool complete = (i_stream->state == c_m3StreamSectionId and i_stream->filled == 0) or i_stream->state == c_m3StreamIgnore;
+        if (not complete)
+            result = "underrun while parsing Wasm binary";
+    }
+
+    if (not result)
+    {
+# if d_m3EnableCodeCache
+        module->wasmHash = i_stream->hash;
+# endif
+        AddModuleMemoryRequest (module);
+    }
+    else
+    {
+        m3_FreeModule (module);
+        module = NULL;
+    }
+
+    if (WASM_DEBUG_PARSE_STREAM) ESP_LOGI ("WASM3", "m3_ParseModuleFinish: peak %u bytes, kept %u bytes, %u functions compiled",
+                                           i_stream->stats.peakBytes, i_stream->stats.keptBytes, i_stream->stats.numCompiled);
+    if (o_stats)
+        * o_stats = i_stream->stats;
+
+    m3_Def_Free (i_stream->buffer);
+    m3_Def_Free (i_stream);
+
+    * o_module = module;
+
+    return result;
+}
+
+# endif // d_m3EnableStreamingParse
@@ -3,7 +3,6 @@
 #include "esp_log.h"
 #include "esp_system.h"
 #include "esp_memory_utils.h"
-#include <setjmp.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -29,12 +28,14 @@ ptr_check_result_t validate_pointer(const void* ptr, size_t expected_size) {
 
     // 3. Verifica che il puntatore sia in un range di memoria valido
     // Questi valori vanno adattati in base alla configurazione della memoria dell'ESP32
+#if defined(ESP_PLATFORM)
     extern uint32_t _heap_start, _heap_end;
     if ((uintptr_t)ptr < (uintptr_t)&_heap_start || 
         (uintptr_t)ptr + expected_size > (uintptr_t)&_heap_end) {
         if(WASM_DEBUG_POINTERS) ESP_LOGE("WASM3", "Pointer out of valid memory range: %p", ptr);
         return PTR_CHECK_OUT_OF_BOUNDS;
     }
+#endif
 
     return PTR_CHECK_OK;
 }
@@ -196,8 +197,6 @@ bool safe_free_with_check(void** ptr) {
     return true;
 }
 
-static jmp_buf g_jmpBuf;
-
 // Wrapper sicuro per m3_Def_Free specifica per WASM3
 bool safe_m3_free(void** ptr) {
     if (!ptr || !(*ptr)) {
@@ -207,17 +206,11 @@ bool safe_m3_free(void** ptr) {
     // Salva il valore originale per il logging
     void* original_ptr = *ptr;
     
-    // Setup error handler
-    if (setjmp(g_jmpBuf) == 0) {
-        // Tenta l'operazione in un contesto protetto
-        if (is_ptr_valid(*ptr)) {
-            m3_Def_Free(*ptr);
-            *ptr = NULL;
-            ESP_LOGD("WASM3", "Successfully freed WASM3 memory at %p", original_ptr);
-            return true;
-        }
-    } else {
-        ESP_LOGE("WASM3", "Exception during WASM3 free operation at %p", original_ptr);
+    if (is_ptr_valid(*ptr)) {
+        m3_Def_Free(*ptr);
+        *ptr = NULL;
+        ESP_LOGD("WASM3", "Successfully freed WASM3 memory at %p", original_ptr);
+        return true;
     }
     
     return false;
@@ -229,11 +222,17 @@ bool safe_m3_free(void** ptr) {
 
 static inline bool is_address_in_range(uintptr_t ptr) {
     // Verifica range DRAM per ESP32
+#if defined(ESP_PLATFORM)
     const uint32_t VALID_HEAP_START = 0x3FFAE000; // Inizio dell'heap (DRAM)
     const uint32_t VALID_HEAP_END = 0x40000000;   // Fine dell'heap
 
     uint32_t addr = (uint32_t)ptr;
     return addr >= VALID_HEAP_START && addr < VALID_HEAP_END;
+#else
+    // Build host (test/internal/host): nessuna finestra DRAM fissa
+    (void) ptr;
+    return true;
+#endif
 }
 
 bool ultra_safe_ptr_valid(const void* ptr) {
@@ -286,14 +285,8 @@ bool ultra_safe_ptr_valid(const void* ptr) {
 #define SAFE_TAG "SafeFree"
 DEBUG_TYPE WASM_DEBUG_SAFE_TAG = WASM_DEBUG_ALL || (WASM_DEBUG && false);
 
-// Struttura per memorizzare informazioni sui blocchi liberati
-#define MAX_TRACKED_PTRS 64
-static struct {
-    void* ptrs[MAX_TRACKED_PTRS];
-    int count;
-} freed_ptrs = {0};
-
 static inline bool is_in_dram_range(const void* ptr) {
+#if defined(ESP_PLATFORM)
     // Uso uint32_t come nel file originale
     extern uint32_t _heap_start, _heap_end;
     
@@ -302,19 +295,10 @@ static inline bool is_in_dram_range(const void* ptr) {
     uintptr_t end = (uintptr_t)&_heap_end;
     
     return (addr >= start && addr < end);
-}
-
-static bool was_previously_freed(const void* ptr) {
-    for (int i = 0; i < freed_ptrs.count; i++) {
-        if (freed_ptrs.ptrs[i] == ptr) return true;
-    }
-    return false;
-}
-
-static void track_freed_ptr(const void* ptr) {
-    if (freed_ptrs.count < MAX_TRACKED_PTRS) {
-        freed_ptrs.ptrs[freed_ptrs.count++] = (void*)ptr;
-    }
+#else
+    (void) ptr;
+    return true;
+#endif
 }
 
 ptr_status_t validate_ptr_for_free(const void* ptr) {
@@ -334,11 +318,8 @@ ptr_status_t validate_ptr_for_free(const void* ptr) {
         return PTR_OUT_OF_BOUNDS;
     }
 
-    // Verifica se già liberato
-    if (was_previously_freed(ptr)) {
-        if(WASM_DEBUG_SAFE_TAG) ESP_LOGW(SAFE_TAG, "Pointer already freed: %p", ptr);
-        return PTR_ALREADY_FREED;
-    }
+    // Niente elenco dei blocchi gia' liberati: l'heap riusa gli indirizzi (un blocco nuovo sembrava gia' liberato)
+    // e la lista era condivisa da tutti i thread. Resta il controllo d'integrita' dell'heap qui sotto.
 
     // Verifica integrità del blocco heap
     if (!heap_caps_check_integrity_addr(ptr, true)) {
@@ -363,9 +344,7 @@ bool ultra_safe_free(void** ptr) {
         return false;
     }
 
-    // Free sicura con tracking
     heap_caps_free(original);
-    track_freed_ptr(original);
     *ptr = NULL;
     
     return true;
@@ -0,0 +1,226 @@
+//
+//  m3_scheduler.c
+//
+//  Cooperative time slicing of calls on many runtimes, see m3_scheduler.h.
+//
+
+#include <string.h>
+
+#include "m3_scheduler.h"
+#include "wasm3.h"
+
+DEBUG_TYPE WASM_DEBUG_SCHEDULER = WASM_DEBUG_ALL || (WASM_DEBUG && false);
+
+
+// i32 and f32 take the first 4 bytes of their value: a pointer to it is then what m3_Call and m3_Resume expect
+static M3Result  CopyValues  (IM3ScheduledCall io_call, IM3Function i_function, bool i_rets, u32 i_count, const void * i_ptrs[])
+{
+    M3Result result = m3Err_none;
+
+    _throwif (m3Err_tooManyArgsRets, i_count > c_m3ScheduledMaxValues);
+
+    for (u32 i = 0; i < i_count; ++i)
+    {
+        M3ValueType type = i_rets ? m3_GetRetType (i_function, i) : m3_GetArgType (i_function, i);
+        _throwif (m3Err_argumentCountMismatch, type == c_m3Type_none);
+
+        io_call->values [i] = 0;
+        memcpy (& io_call->values [i], i_ptrs [i], (type == c_m3Type_i64 or type == c_m3Type_f64) ? 8 : 4);
+    }
+
+    io_call->numValues = i_count;
+
+    _catch: return result;
+}
+
+
+static void  Unlink  (IM3Scheduler io_scheduler, IM3ScheduledCall i_call)
+{
+    IM3ScheduledCall * link = & io_scheduler->calls;
+
+    while (* link != i_call)
+        link = & (* link)->next;
+
+    * link = i_call->next;
+    i_call->next = NULL;
+
+    io_scheduler->numCalls--;
+}
+
+
+static void  Append  (IM3Scheduler io_scheduler, IM3ScheduledCall i_call)
+{
+    IM3ScheduledCall * link = & io_scheduler->calls;
+
+    while (* link)
+        link = & (* link)->next;
+
+    * link = i_call;
+
+    io_scheduler->numCalls++;
+}
+
+
+static IM3ScheduledCall  FindCall  (IM3Scheduler i_scheduler, IM3Runtime i_runtime)
+{
+    IM3ScheduledCall call = i_scheduler->calls;
+
+    while (call and call->runtime != i_runtime)
+        call = call->next;
+
+    return call;
+}
+
+
+// the first ready call of the highest priority: the list is in turn order
+static IM3ScheduledCall  NextCall  (IM3Scheduler i_scheduler)
+{
+    IM3ScheduledCall next = NULL;
+
+    for (IM3ScheduledCall call = i_scheduler->calls; call; call = call->next)
+    {
+        if (call->state == c_m3CallWaiting)
+            continue;
+
+        if (not next or call->priority > next->priority)
+            next = call;
+    }
+
+    return next;
+}
+
+
+static void  RunSlice  (IM3Scheduler io_scheduler, IM3ScheduledCall io_call)
+{
+    M3Result result;
+
+    const void * ptrs [c_m3ScheduledMaxValues];
+    for (u32 i = 0; i < io_call->numValues; ++i)
+        ptrs [i] = & io_call->values [i];
+
+    m3_SetTimeSlice (io_call->runtime, io_call->timeSlice);
+
+    if (io_call->state == c_m3CallStarting)
+        result = m3_Call (io_call->function, io_call->numValues, ptrs);
+    else
+        result = m3_Resume (io_call->runtime, io_call->numValues, ptrs);
+
+    io_call->numValues = 0;
+
+    Unlink (io_scheduler, io_call);
+
+    if (result == m3Err_suspended)
+    {
+        io_call->state = m3_GetSuspendedImport (io_call->runtime) ? c_m3CallWaiting : c_m3CallReady;
+        Append (io_scheduler, io_call);                         // behind the calls of its priority
+    }
+    else
+    {
+        if (WASM_DEBUG_SCHEDULER) ESP_LOGI ("WASM3", "RunSlice: %s ended: %s", m3_GetFunctionName (io_call->function), result ? result : "ok");
+
+        if (io_call->ended)
+            io_call->ended (io_call->function, result, io_call->userdata);
+
+        m3_Def_Free (io_call);
+    }
+}
+
+
+IM3Scheduler  m3_NewScheduler  (void)
+{
+    IM3Scheduler scheduler = m3_Def_AllocStruct (M3Scheduler);
+
+    if (scheduler)
+        memset (scheduler, 0, sizeof (M3Scheduler));
+
+    return scheduler;
+}
+
+
+void  m3_FreeScheduler  (IM3Scheduler i_scheduler)
+{
+    if (not i_scheduler)
+        return;
+
+    while (i_scheduler->calls)
+    {
+        IM3ScheduledCall call = i_scheduler->calls;
+        Unlink (i_scheduler, call);
+
+        if (call->state != c_m3CallStarting)
+            m3_CancelSuspended (call->runtime);
+
+        m3_Def_Free (call);
+    }
+
+    m3_Def_Free (i_scheduler);
+}
+
+
+M3Result  m3_ScheduleCall  (IM3Scheduler io_scheduler, IM3Function i_function, uint32_t i_priority, uint32_t i_timeSlice,
+                            uint32_t i_argc, const void * i_argptrs[], M3ScheduledCallEnded i_ended, void * i_userdata)
+{
+    M3Result result = m3Err_none;
+    IM3ScheduledCall call = NULL;
+
+    IM3Runtime runtime = i_function->module->runtime;
+    _throwif (m3Err_nullRuntime, not runtime);
+    _throwif (m3Err_runtimeScheduled, FindCall (io_scheduler, runtime));
+    _throwif (m3Err_argumentCountMismatch, i_argc != m3_GetArgCount (i_function));
+
+    call = m3_Def_AllocStruct (M3ScheduledCall);
+    _throwifnull (call);
+    memset (call, 0, sizeof (M3ScheduledCall));
+
+_   (CopyValues (call, i_function, false, i_argc, i_argptrs));
+
+    call->function = i_function;
+    call->runtime = runtime;
+    call->ended = i_ended;
+    call->userdata = i_userdata;
+    call->priority = i_priority;
+    call->timeSlice = i_timeSlice;
+    call->state = c_m3CallStarting;
+
+    Append (io_scheduler, call);
+    call = NULL;
+
+    _catch:
+    if (call)
+        m3_Def_Free (call);
+
+    return result;
+}
+
+
+M3Result  m3_WakeScheduledCall  (IM3Scheduler io_scheduler, IM3Runtime i_runtime, uint32_t i_retc, const void * i_retptrs[])
+{
+    M3Result result = m3Err_none;
+
+    IM3ScheduledCall call = FindCall (io_scheduler, i_runtime);
+    _throwif (m3Err_noSuspendedCall, not call or call->state != c_m3CallWaiting);
+
+    IM3Function import = m3_GetSuspendedImport (i_runtime);
+    _throwif (m3Err_argumentCountMismatch, i_retc != m3_GetRetCount (import));
+
+_   (CopyValues (call, import, true, i_retc, i_retptrs));
+
+    call->state = c_m3CallReady;
+
+    _catch: return result;
+}
+
+
+uint32_t  m3_RunScheduler  (IM3Scheduler io_scheduler, uint32_t i_maxSlices)
+{
+    for (u32 slices = 0; not i_maxSlices or slices < i_maxSlices; ++slices)
+    {
+        IM3ScheduledCall call = NextCall (io_scheduler);
+        if (not call)
+            break;
+
+        RunSlice (io_scheduler, call);
+    }
+
+    return io_scheduler->numCalls;
+}
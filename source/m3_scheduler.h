@@ -0,0 +1,60 @@
+//
+//  m3_scheduler.h
+//
+//  Cooperative scheduling of calls on many runtimes from one thread.
+//
+//  Each scheduled call owns its runtime until it ends. The scheduler gives the CPU away one time
+//  slice at a time (d_m3EnableTimeSlicing): the first slice starts the call with m3_Call, the
+//  next ones continue it with m3_Resume, and a slice ends whenever the runtime parks the call.
+//  A call parked by an async import isn't ready again until the host wakes it with the import's
+//  results. Calls are kept in one list in the order they take turns: the slice goes to the first
+//  ready call of the highest priority, which then moves to the end of the list.
+//
+
+#pragma once
+
+#include "m3_env.h"
+
+d_m3BeginExternC
+
+enum
+{
+    c_m3ScheduledMaxValues  = 16        // arguments of a call, results of the import it waits for
+};
+
+enum
+{
+    c_m3CallStarting        = 0,        // not called yet
+    c_m3CallReady           = 1,        // out of slice
+    c_m3CallWaiting         = 2         // on an async import
+};
+
+typedef struct M3ScheduledCall
+{
+    struct M3ScheduledCall *    next;
+
+    IM3Function                 function;
+    IM3Runtime                  runtime;
+
+    M3ScheduledCallEnded        ended;
+    void *                      userdata;
+
+    u32                         priority;
+    u32                         timeSlice;
+    u8                          state;
+
+    u32                         numValues;
+    u64                         values [c_m3ScheduledMaxValues];    // one per argument or result, whatever its type
+}
+M3ScheduledCall;
+
+typedef M3ScheduledCall *       IM3ScheduledCall;
+
+typedef struct M3Scheduler
+{
+    IM3ScheduledCall            calls;
+    u32                         numCalls;
+}
+M3Scheduler;
+
+d_m3EndExternC
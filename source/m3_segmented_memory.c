@@ -4,6 +4,13 @@
 #include "wasm3.h"
 #include <stdint.h>
 
+#if WASM_SEGMENTED_MEM_ENABLE_FLAT
+#include <sys/mman.h>
+#endif
+#if !defined(_WIN32)
+#include <sys/uio.h>
+#endif
+
 #define WASM_SEGMENTED_MEM_LAZY_ALLOC true
 
 DEBUG_TYPE WASM_DEBUG_GET_OFFSET_POINTER = WASM_DEBUG_ALL || (WASM_DEBUG && false);
@@ -14,7 +21,7 @@ DEBUG_TYPE WASM_DEBUG_M3_INIT_MEMORY = WASM_DEBUG_ALL || (WASM_DEBUG && false);
 
 #if ENABLE_WDT
 static mos check_wdt_trigger_every = 5;
-static mos check_wdt_trigger_cycle = 0;
+static M3_THREAD_LOCAL mos check_wdt_trigger_cycle = 0;
 
 DEBUG_TYPE WASM_DEBUG_check_wdt_reset = false;
 void check_wdt_reset(){
@@ -34,7 +41,7 @@ const bool DEBUG_WASM_INIT_MEMORY = false;
 // Utility functions
 static bool is_address_in_segment(MemorySegment* seg, void* ptr) {
     if (!seg || !seg->data || !ptr) return false;
-    return (ptr >= seg->data && ptr < (char*)seg->data + seg->size);
+    return ((char*)ptr >= (char*)seg->data && (char*)ptr < (char*)seg->data + seg->size);
 }
 
 static size_t get_segment_index(M3Memory* memory, void* ptr) {
@@ -90,6 +97,15 @@ mos get_offset_pointer(IM3Memory memory, void* ptr) {
         return (mos)ptr;
     }
 
+    #if WASM_SEGMENTED_MEM_ENABLE_FLAT
+    if (m3_IsFlatMemory(memory)) {
+        if ((u8*)ptr >= memory->flat_base && (u8*)ptr < memory->flat_base + memory->total_size) {
+            return (mos)((u8*)ptr - memory->flat_base);
+        }
+        return (mos)(uintptr_t)ptr;
+    }
+    #endif
+
     // Search through all segments to find which one contains this pointer
     for (size_t i = 0; i < memory->num_segments; i++) {
         MemorySegment* segment = memory->segments[i];
@@ -124,16 +140,105 @@ mos get_offset_pointer(IM3Memory memory, void* ptr) {
     return (mos)ptr;
 }
 
+////////////////////////////////////////////////////////////////
+/// Flat backend
+
+#if WASM_SEGMENTED_MEM_ENABLE_FLAT
+DEBUG_TYPE WASM_DEBUG_FLAT_MEMORY = WASM_DEBUG_ALL || (WASM_DEBUG && false);
+
+static M3Result flat_reserve(IM3Memory memory) {
+    size_t reserve = (size_t)memory->maxPages * memory->pageSize;
+
+    void* base = mmap(NULL, reserve + WASM_FLAT_MEM_GUARD_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        ESP_LOGW("WASM3", "flat_reserve: mmap of %zu bytes failed", reserve);
+        return m3Err_mallocFailed;
+    }
+
+    memory->flat_base = (u8*)base;
+    memory->flat_reserved = reserve;
+    memory->flat_committed = 0;
+
+    if(WASM_DEBUG_FLAT_MEMORY) ESP_LOGI("WASM3", "flat_reserve: %zu bytes at %p", reserve, base);
+    return m3Err_none;
+}
+
+// Make [0, size) readable/writable. Pages are demand-zero, so committing costs no RSS until touched.
+static M3Result flat_commit(IM3Memory memory, size_t size) {
+    if (size <= memory->flat_committed) return m3Err_none;
+    if (size > memory->flat_reserved) return m3Err_memoryLimit;
+
+    u8* from = memory->flat_base + memory->flat_committed;
+    if (mprotect(from, size - memory->flat_committed, PROT_READ | PROT_WRITE) != 0) {
+        ESP_LOGE("WASM3", "flat_commit: mprotect failed (%zu -> %zu)", memory->flat_committed, size);
+        return m3Err_mallocFailed;
+    }
+
+    memory->flat_committed = size;
+    return m3Err_none;
+}
+
+static void flat_release(IM3Memory memory) {
+    if (!memory->flat_base) return;
+
+    munmap(memory->flat_base, memory->flat_reserved + WASM_FLAT_MEM_GUARD_SIZE);
+    memory->flat_base = NULL;
+    memory->flat_reserved = 0;
+    memory->flat_committed = 0;
+}
+#endif
+
+////////////////////////////////////////////////////////////////
+/// Translation cache
+
+void m3_TlbFlush(IM3Memory memory) {
+    #if WASM_SEGMENTED_MEM_ENABLE_TLB
+    if (!memory) return;
+    for (size_t i = 0; i < WASM_SEGMENTED_MEM_TLB_ENTRIES; i++) {
+        memory->tlb[i].segment_index = WASM_SEGMENTED_MEM_TLB_INVALID;
+        memory->tlb[i].base = NULL;
+    }
+    #endif
+}
+
+void m3_TlbInvalidateSegment(IM3Memory memory, size_t segment_index) {
+    #if WASM_SEGMENTED_MEM_ENABLE_TLB
+    if (!memory) return;
+    M3MemoryTlbEntry* entry = &memory->tlb[segment_index & (WASM_SEGMENTED_MEM_TLB_ENTRIES - 1)];
+    if (entry->segment_index == segment_index) {
+        entry->segment_index = WASM_SEGMENTED_MEM_TLB_INVALID;
+        entry->base = NULL;
+    }
+    #endif
+}
+
+static inline void tlb_fill(IM3Memory memory, size_t segment_index, u8* base) {
+    #if WASM_SEGMENTED_MEM_ENABLE_TLB
+    M3MemoryTlbEntry* entry = &memory->tlb[segment_index & (WASM_SEGMENTED_MEM_TLB_ENTRIES - 1)];
+    entry->segment_index = segment_index;
+    entry->base = base;
+    memory->tlb_misses++;
+    #endif
+}
+
 void notify_memory_segment_access(IM3Memory memory, MemorySegment* segment){
     #if WASM_SEGMENTED_MEM_ENABLE_HE_PAGES
+    if(m3_IsFlatMemory(memory)) return;
+
     if(segment->segment_page == NULL){
         ESP_LOGW("WASM3", "notify_memory_segment_access: memory segment page is NULL");
         //backtrace();
         return;
     }
 
+    void* data_before = segment->data;
     paging_notify_segment_access(memory->paging, segment->segment_page->segment_id);
 
+    // the pager moved the segment (eviction / reload): cached translation is stale
+    if(segment->data != data_before){
+        m3_TlbInvalidateSegment(memory, segment->index);
+    }
+
     if(segment->data == NULL){
         ESP_LOGE("WASM3", "notify_memory_segment_access: segment data is NULL after notify_memory_segment_access");
         //todo: init now?
@@ -142,6 +247,57 @@ void notify_memory_segment_access(IM3Memory memory, MemorySegment* segment){
     #endif
 }
 
+#if WASM_SEGMENTED_MEM_ENABLE_HE_PAGES && WASM_SEGMENTED_MEM_BUILTIN_PAGER
+// The pager swapped a segment's data. Eviction can hit any segment, and a redirected
+// translation may point into it, so the whole translation cache goes.
+static void pager_on_evict(void* user, segment_info_t* page) {
+    M3Memory* memory = user;
+    MemorySegment* seg = page->owner;
+
+    m3_TlbFlush(memory);
+    if (seg->kind == c_m3SegKind_Pool) memory->collect_stats.empty_segments--;
+}
+
+static void pager_on_load(void* user, segment_info_t* page) {
+    M3Memory* memory = user;
+    MemorySegment* seg = page->owner;
+
+    m3_TlbInvalidateSegment(memory, seg->index);
+    if (seg->kind == c_m3SegKind_Pool) memory->collect_stats.empty_segments++;
+}
+
+// Translation cache hits don't reach the pager: drop the segment's entry so that its next
+// access misses and sets the reference bit again
+static void pager_on_age(void* user, segment_info_t* page) {
+    M3Memory* memory = user;
+    MemorySegment* seg = page->owner;
+
+    m3_TlbInvalidateSegment(memory, seg->index);
+}
+#endif
+
+void m3_PinSegment(IM3Memory memory, mos offset) {
+    #if WASM_SEGMENTED_MEM_ENABLE_HE_PAGES && WASM_SEGMENTED_MEM_BUILTIN_PAGER
+    if (!IsValidMemory(memory) || m3_IsFlatMemory(memory)) return;
+
+    size_t index = offset / memory->segment_size;
+    if (index >= memory->num_segments || !memory->segments[index]->segment_page) return;
+
+    paging_pin(memory->paging, memory->segments[index]->segment_page->segment_id);
+    #endif
+}
+
+void m3_UnpinSegment(IM3Memory memory, mos offset) {
+    #if WASM_SEGMENTED_MEM_ENABLE_HE_PAGES && WASM_SEGMENTED_MEM_BUILTIN_PAGER
+    if (!IsValidMemory(memory) || m3_IsFlatMemory(memory)) return;
+
+    size_t index = offset / memory->segment_size;
+    if (index >= memory->num_segments || !memory->segments[index]->segment_page) return;
+
+    paging_unpin(memory->paging, memory->segments[index]->segment_page->segment_id);
+    #endif
+}
+
 // Core pointer resolution functions
 bool WASM_DEBUG_get_offset_pointer = WASM_DEBUG_ALL || (WASM_DEBUG && false);
 ptr get_segment_pointer(IM3Memory memory, mos offset) {
@@ -184,50 +340,19 @@ ptr get_segment_pointer(IM3Memory memory, mos offset) {
         return (ptr)&ERROR_POINTER;
     }
     
-    // Initialize segment if needed
-    if (m3_alloc_on_segment_data && !seg->data) {
-        if(seg->is_allocated){
-            notify_memory_segment_access(memory, seg);
-        }
-        else {
-            if(WASM_DEBUG_get_offset_pointer) ESP_LOGI("WASM3", "get_segment_pointer: requested data allocation of segment %lu", segment_index);
-            seg = InitSegment(memory, seg, true);
-
-            if(seg == NULL){
-                ESP_LOGE("WASM3", "get_segment_pointer: failed init segment data");
-                return (ptr)&ERROR_POINTER;
-            }
-        }
-    }
-    
     mos seg_offset = segment_offset;
 
-    // Handle multi-segment chunks
-    MemoryChunk* chunk = seg->first_chunk;
-    while (chunk) {
-        if (chunk->num_segments > 1) {
-            size_t chunk_start = chunk->start_segment * memory->segment_size;
-            size_t chunk_end = chunk_start;
-            for (size_t i = 0; i < chunk->num_segments; i++) {
-                chunk_end += chunk->segment_sizes[i];
-            }
-            
-            if (offset >= chunk_start && offset < chunk_end) {
-                // Calculate which segment of the chunk we're in
-                size_t relative_offset = offset - chunk_start;
-                size_t current_size = 0;
-                for (size_t i = 0; i < chunk->num_segments; i++) {
-                    if (relative_offset < current_size + chunk->segment_sizes[i]) {
-                        seg = memory->segments[chunk->start_segment + i];
-                        seg_offset = (relative_offset - current_size);
-
-                        goto resolve;
-                    }
-                    current_size += chunk->segment_sizes[i];
-                }
-            }
+    // Handle multi-segment chunks: O(1) through the segment's redirect entry
+    MemoryChunk* chunk = seg->span_chunk;
+    if (chunk && chunk->segment_offsets) {
+        size_t chunk_start = chunk->start_segment * memory->segment_size;
+        size_t relative_offset = offset - chunk_start;
+        size_t part = seg->span_index;
+
+        if (relative_offset >= chunk->segment_offsets[part] && relative_offset < chunk->segment_offsets[part + 1]) {
+            seg = memory->segments[chunk->start_segment + part];
+            seg_offset = relative_offset - chunk->segment_offsets[part];
         }
-        chunk = chunk->next;
     }
 
     resolve: {
@@ -247,6 +372,14 @@ ptr get_segment_pointer(IM3Memory memory, mos offset) {
             ESP_LOGI("WASM3", "get_segment_pointer: (after notify) seg->is_allocated=%d, seg->data=%p", seg->is_allocated, seg->data);
         }
 
+        if(seg->data == NULL){
+            ESP_LOGE("WASM3", "get_segment_pointer: segment %u has no data", seg->index);
+            return (ptr)&ERROR_POINTER;
+        }
+
+        // the whole requested segment translates with the same displacement
+        tlb_fill(memory, segment_index, (u8*)seg->data + seg_offset - segment_offset);
+
         if(WASM_DEBUG_get_offset_pointer) {
             ESP_LOGI("WASM3", "get_segment_pointer: pointer resolved with seg_offset: %lld", seg_offset);
             ESP_LOGI("WASM3", "get_segment_pointer: requested segment %d", seg->index);
@@ -266,28 +399,30 @@ ptr m3_ResolvePointer(M3Memory* memory, mos offset) {
 
     if(WASM_DEBUG_m3_ResolvePointer) ESP_LOGI("WASM3", "m3_ResolvePointer (mem: %p) called for ptr: %p", memory, offset);
 
-    ptr resolved = (ptr)offset;
-    if (is_ptr_valid((void*)offset)) {
-        if(WASM_DEBUG_m3_ResolvePointer) ESP_LOGI("WASM3", "m3_ResolvePointer %p considered valid", offset);
-        goto resolve;
-    }
-    
-    if (!memory || memory->firm != INIT_FIRM) return (ptr)offset;
-    
-    resolved = get_segment_pointer(memory, offset);
-    if (resolved == ERROR_POINTER) return (ptr)offset;
-    
-    resolve: {
-        if(WASM_DEBUG_m3_ResolvePointer) ESP_LOGI("WASM3", "m3_ResolvePointer: original: %p, resolved: %p", offset, resolved);
+    // Host pointers pass through untouched: no allocator lookup needed
+    if (!m3_IsGuestOffset(offset)) return (ptr)(uintptr_t)offset;
 
-        if (!is_ptr_valid((void*)resolved)) {
-            ESP_LOGW("WASM3", "m3_ResolvePointer: resolved pointer is not valid %p %p", offset, resolved);
-            //backtrace();
-            return (ptr)offset;
-        }    
+    // A guest offset that can't be resolved must not be used as a host address
+    if (!memory || memory->firm != INIT_FIRM) return (ptr)&ERROR_POINTER;
+
+    #if WASM_SEGMENTED_MEM_ENABLE_FLAT
+    if (m3_IsFlatMemory(memory) && offset < memory->total_size) {
+        return memory->flat_base + offset;
+    }
+    #endif
 
-        return resolved;
+    #if WASM_SEGMENTED_MEM_ENABLE_TLB
+    if (offset < memory->total_size) {
+        ptr hit = m3_TlbLookup(memory, offset);
+        if (hit != NULL) return hit;
     }
+    #endif
+
+    ptr resolved = get_segment_pointer(memory, offset);
+    if (resolved == ERROR_POINTER) return resolved;
+
+    if(WASM_DEBUG_m3_ResolvePointer) ESP_LOGI("WASM3", "m3_ResolvePointer: original: %u, resolved: %p", offset, resolved);
+    return resolved;
 }
 
 int find_segment_index(MemorySegment** segments, int num_segments, MemorySegment* segment) {
@@ -299,6 +434,17 @@ int find_segment_index(MemorySegment** segments, int num_segments, MemorySegment
     return -1;  // Se non viene trovato
 }
 
+// Helper function to free a chunk and its associated metadata
+static void free_chunk(MemoryChunk* chunk) {
+    if (!chunk) return;
+    if (chunk->segment_sizes) {
+        m3_Def_Free(chunk->segment_sizes);
+    }
+    m3_Def_Free(chunk);
+}
+
+static void pool_push(M3Memory* memory, MemorySegment* seg);
+
 // Memory initialization and growth
 DEBUG_TYPE WASM_DEBUG_INITSEGMENT = WASM_DEBUG_ALL || (WASM_DEBUG && false);
 MemorySegment* InitSegment(M3Memory* memory, MemorySegment* seg, bool initData) {
@@ -321,7 +467,8 @@ MemorySegment* InitSegment(M3Memory* memory, MemorySegment* seg, bool initData)
     seg->firm = INIT_FIRM;
 
     #if WASM_SEGMENTED_MEM_ENABLE_HE_PAGES
-    if(seg->segment_page == NULL) {
+    // Flat segments are views into one mapping and can't be paged out: they stay off the pager
+    if(seg->segment_page == NULL && !m3_IsFlatMemory(memory)) {
         esp_err_t res = paging_notify_segment_creation(memory->paging, &seg->segment_page);
         if(res != ESP_OK) {
             ESP_LOGE("WASM3", "Failed paging_notify_segment_creation: %d", res);
@@ -335,11 +482,32 @@ MemorySegment* InitSegment(M3Memory* memory, MemorySegment* seg, bool initData)
         }
 
         seg->segment_page->data = &seg->data;
+        #if WASM_SEGMENTED_MEM_BUILTIN_PAGER
+        seg->segment_page->owner = seg;
+        #endif
+    }
+
+    // Evicted by the pager: fault the content back in rather than handing out a blank segment
+    if (initData && !seg->data && seg->is_allocated) {
+        notify_memory_segment_access(memory, seg);
     }
     #endif 
     
     if (initData && !seg->data) {
         if(WASM_DEBUG_INITSEGMENT) ESP_LOGI("WASM", "InitSegment: allocating segment's data");
+
+        #if WASM_SEGMENTED_MEM_ENABLE_FLAT
+        if (m3_IsFlatMemory(memory)) {
+            // The segment is just a view into the reserved region (already committed by AddSegments)
+            seg->data = memory->flat_base + (size_t)seg->index * memory->segment_size;
+            seg->is_allocated = true;
+            seg->size = memory->segment_size;
+            memory->total_allocated_size += memory->segment_size;
+            if (seg->kind == c_m3SegKind_Pool) memory->collect_stats.empty_segments++;
+            return seg;
+        }
+        #endif
+
         seg->data = m3_Def_Malloc(memory->segment_size);
         if (seg->data == NULL) {
             ESP_LOGE("WASM", "InitSegment: segmente data allocate failed");
@@ -348,8 +516,10 @@ MemorySegment* InitSegment(M3Memory* memory, MemorySegment* seg, bool initData)
         
         seg->is_allocated = true;
         seg->size = memory->segment_size;
-        seg->first_chunk = NULL;
         memory->total_allocated_size += memory->segment_size;
+        if (seg->kind == c_m3SegKind_Pool) memory->collect_stats.empty_segments++;
+
+        m3_TlbInvalidateSegment(memory, seg->index);
         
         #if WASM_SEGMENTED_MEM_ENABLE_HE_PAGES
         paging_notify_segment_allocation(memory->paging, seg->segment_page, &seg->data);
@@ -374,6 +544,22 @@ M3Result AddSegments(IM3Memory memory, size_t additional_segments) {
         return NULL;
     }
 
+    // Offsets past the window would read as host pointers
+    if(new_num_segments > WASM_MAX_SEGMENTS) {
+        ESP_LOGE("WASM3", "AddSegments: %zu segments would leave the guest offset window", new_num_segments);
+        return m3Err_memoryLimit;
+    }
+
+    #if WASM_SEGMENTED_MEM_ENABLE_FLAT
+    if (m3_IsFlatMemory(memory)) {
+        M3Result result = flat_commit(memory, new_num_segments * memory->segment_size);
+        if (result) {
+            ESP_LOGE("WASM3", "AddSegments: flat region can't hold %zu segments", new_num_segments);
+            return result;
+        }
+    }
+    #endif
+
     size_t new_size = new_num_segments * sizeof(MemorySegment*);
     
     MemorySegment** new_segments = m3_Def_Realloc(memory->segments, new_size);
@@ -410,16 +596,25 @@ M3Result AddSegments(IM3Memory memory, size_t additional_segments) {
         }
     }
     
+    for (size_t i = memory->num_segments; i < new_num_segments; i++) {
+        m3_TlbInvalidateSegment(memory, i);
+    }
+
     memory->num_segments = new_num_segments;
     memory->total_size = memory->segment_size * new_num_segments;
     
     return m3Err_none;
 }
 
-const int WASM_M3_INIT_MEMORY_NUM_MALLOC_TESTS = 2;
 IM3Memory m3_InitMemory(IM3Memory memory) {
     if (memory == NULL) return NULL;
 
+    return m3_InitMemoryWithBackend(memory, memory->backend);
+}
+
+IM3Memory m3_InitMemoryWithBackend(IM3Memory memory, M3MemoryBackend backend) {
+    if (memory == NULL) return NULL;
+
     if(memory->firm == INIT_FIRM)
         return memory;
     
@@ -429,17 +624,73 @@ IM3Memory m3_InitMemory(IM3Memory memory) {
     memory->total_size = 0;
     memory->total_allocated_size = 0;
     memory->segment_size = WASM_SEGMENT_SIZE;
+    memory->numPages = 0;
     memory->maxPages = M3Memory_MaxPages;
     memory->pageSize = M3Memory_PageSize;
     memory->total_requested_size = 0;
+
+    #if WASM_SEGMENTED_MEM_ENABLE_TLB
+    memory->tlb_misses = 0;
+    #endif
+    m3_TlbFlush(memory);
+
+    memory->backend = c_m3MemoryBackend_Segmented;
+    #if WASM_SEGMENTED_MEM_ENABLE_FLAT
+    memory->flat_base = NULL;
+    if (backend == c_m3MemoryBackend_Flat) {
+        if (flat_reserve(memory) == m3Err_none) {
+            memory->backend = c_m3MemoryBackend_Flat;
+        } else {
+            ESP_LOGW("WASM3", "m3_InitMemory: flat backend unavailable, using segmented memory");
+        }
+    }
+    #else
+    if (backend == c_m3MemoryBackend_Flat) {
+        ESP_LOGW("WASM3", "m3_InitMemory: flat backend not supported on this platform, using segmented memory");
+    }
+    #endif
     
     // Initialize free chunks management
     memory->num_free_buckets = 32;
     memory->free_chunks = m3_Def_Malloc(memory->num_free_buckets * sizeof(MemoryChunk*));
-    if (!memory->free_chunks) return NULL;
+    if (!memory->free_chunks) {
+        FreeMemory(memory);
+        return NULL;
+    }
+
+    memset(memory->slab_partial, 0, sizeof(memory->slab_partial));
+    memset(memory->buddy_free, 0, sizeof(memory->buddy_free));
+    memset(&memory->alloc_stats, 0, sizeof(memory->alloc_stats));
+    memory->pool = NULL;
+    memory->pool_count = 0;
+    memory->pool_capacity = 0;
+    memory->alloc_stats.metadata_bytes = memory->num_free_buckets * sizeof(MemoryChunk*);
+
+    memory->collect_policy = (M3CollectPolicy){
+        .high_watermark = WASM_COLLECT_HIGH_WATERMARK,
+        .low_watermark = WASM_COLLECT_LOW_WATERMARK,
+        .max_per_call = WASM_COLLECT_MAX_PER_CALL,
+        .scan_limit = WASM_COLLECT_SCAN_LIMIT,
+        .min_free_heap = WASM_COLLECT_MIN_FREE_HEAP
+    };
+    memset(&memory->collect_stats, 0, sizeof(memory->collect_stats));
+    memory->collect_cursor = 1;
+
+    // Host pointers in this range would be taken for guest offsets
+    if (m3_IsGuestOffset(memory->free_chunks)) {
+        ESP_LOGE("WASM3", "m3_InitMemory: native heap (%p) overlaps the guest offset window (%u bytes)", memory->free_chunks, (unsigned)WASM_GUEST_OFFSET_WINDOW);
+        FreeMemory(memory);
+        return NULL;
+    }
         
     #if WASM_SEGMENTED_MEM_ENABLE_HE_PAGES
     segment_handlers_t handlers = {0};
+    #if WASM_SEGMENTED_MEM_BUILTIN_PAGER
+    handlers.on_evict = pager_on_evict;
+    handlers.on_load = pager_on_load;
+    handlers.on_age = pager_on_age;
+    handlers.user = memory;
+    #endif
     paging_init(&memory->paging, &handlers, memory->segment_size);
     if(WASM_DEBUG_M3_INIT_MEMORY) ESP_LOGI("WASM3", "m3_InitMemory: memory->paging: %p", memory->paging);
     #endif
@@ -448,30 +699,25 @@ IM3Memory m3_InitMemory(IM3Memory memory) {
     M3Result result = AddSegments(memory, WASM_INIT_SEGMENTS);
     if (result != m3Err_none) {
         ESP_LOGE("WASM3", "m3_InitMemory: AddSegments failed");
-        free(memory->free_chunks);
+        FreeMemory(memory);
         return NULL;
     }
 
-    if(WASM_M3_INIT_MEMORY_NUM_MALLOC_TESTS > 0){
-        for(int i = 0; i < WASM_M3_INIT_MEMORY_NUM_MALLOC_TESTS; i++){
-            if(WASM_DEBUG_M3_INIT_MEMORY) ESP_LOGI("WASM3", "m3_InitMemory: test m3_malloc num %d", i);
-            void* testPtr = m3_malloc(memory, 1);
-
-            if(i != 0 && testPtr == 0){
-                ESP_LOGE("WASM3", "m3_InitMemory: test m3_malloc failed (given %d)", testPtr);
-            }
-
-            if(WASM_DEBUG_M3_INIT_MEMORY) PRINT_PTR(testPtr);
-        }
+    // The initial segments seed m3_malloc's pool. Segment 0 stays out: offset 0 is NULL
+    for (size_t i = memory->num_segments - 1; i > 0; i--) {
+        pool_push(memory, memory->segments[i]);
     }
-    
+
     return memory;
 }
 
 IM3Memory m3_NewMemory(){
     IM3Memory memory = m3_Def_AllocStruct (M3Memory);
 
-    m3_InitMemory(memory);
+    if (memory && m3_InitMemory(memory) == NULL) {
+        m3_Def_Free(memory);
+        return NULL;
+    }
 
     return memory;
 }
@@ -493,9 +739,7 @@ void FreeMemory(IM3Memory memory) {
             MemoryChunk* chunk = memory->free_chunks[i];
             while (chunk) {
                 MemoryChunk* next = chunk->next;
-                if (chunk->segment_sizes) {
-                    m3_Def_Free(chunk->segment_sizes);
-                }
+                free_chunk(chunk);
                 chunk = next;
             }
         }
@@ -503,6 +747,10 @@ void FreeMemory(IM3Memory memory) {
         memory->free_chunks = NULL;
     }
 
+    m3_Def_Free(memory->pool);
+    memory->pool = NULL;
+    memory->pool_count = memory->pool_capacity = 0;
+
     if (is_ptr_valid(memory->segments)) {
         // Libera tutti i segmenti e le loro strutture
         for (size_t i = 0; i < memory->num_segments; i++) {
@@ -514,26 +762,21 @@ void FreeMemory(IM3Memory memory) {
                 continue;
             }
 
-            if (segment->data) {
-                // Libera segment_sizes di ogni chunk nel segmento
-                // ma solo per i chunk che iniziano in questo segmento
-                MemoryChunk* chunk = segment->first_chunk;
-                while (chunk) {
-                    if (chunk->start_segment == i && chunk->segment_sizes) {
-                        if (WASM_DEBUG_TOP_MEMORY) {
-                            ESP_LOGI("WASM3", "FreeMemory: freeing chunk segment_sizes at segment %zu", i);
-                        }
-                        m3_Def_Free(chunk->segment_sizes);
-                        chunk->segment_sizes = NULL;
-                    }
-                    chunk = chunk->next;
-                }
+            // Allocator bookkeeping: live runs hang off their first segment
+            if (segment->kind == c_m3SegKind_Run && segment->first_chunk) {
+                if (WASM_DEBUG_TOP_MEMORY) ESP_LOGI("WASM3", "FreeMemory: freeing run at segment %zu", i);
+                free_chunk(segment->first_chunk);
+                segment->first_chunk = NULL;
+            }
+            m3_Def_Free(segment->alloc);
+            segment->alloc = NULL;
 
+            if (segment->data) {
                 if (segment->is_allocated) {
                     if (WASM_DEBUG_TOP_MEMORY) {
                         ESP_LOGI("WASM3", "FreeMemory: freeing segment %zu data", i);
                     }
-                    m3_Def_Free(segment->data);
+                    if (!m3_IsFlatMemory(memory)) m3_Def_Free(segment->data);
                     segment->data = NULL;
                 }
             }
@@ -553,12 +796,19 @@ void FreeMemory(IM3Memory memory) {
     memory->total_size = 0;
     memory->total_allocated_size = 0;
     memory->total_requested_size = 0;
+    memory->numPages = 0;
     memory->maxPages = 0;
     memory->num_free_buckets = 0;
     memory->firm = 0;  // Invalida la struttura della memoria
+    m3_TlbFlush(memory);
+
+    #if WASM_SEGMENTED_MEM_ENABLE_FLAT
+    flat_release(memory);
+    #endif
 
     #if WASM_SEGMENTED_MEM_ENABLE_HE_PAGES
     paging_deinit(memory->paging);
+    memory->paging = NULL;
     #endif
 
     if (WASM_DEBUG_TOP_MEMORY) ESP_LOGI("WASM3", "FreeMemory completed");
@@ -573,12 +823,13 @@ M3Result GrowMemory(M3Memory* memory, size_t additional_size) {
     if (!memory) return m3Err_nullMemory;
     
     size_t new_total = memory->total_size + additional_size;
-    if (new_total > memory->maxPages * memory->segment_size) {
+    if (new_total > (size_t)memory->maxPages * memory->pageSize) {
         return m3Err_memoryLimit;
     }
     
-    size_t additional_segments = (additional_size +  memory->segment_size - 1) /  memory->segment_size;
-    return AddSegments(memory, additional_segments);
+    // AddSegments takes the new segment count, not the number to add
+    size_t new_num_segments = (new_total + memory->segment_size - 1) / memory->segment_size;
+    return AddSegments(memory, new_num_segments);
 }
 
 // Memory operations
@@ -610,34 +861,9 @@ bool IsValidMemoryAccess(IM3Memory memory, mos offset, size_t size) {
         MemorySegment* seg = memory->segments[i];
         if (!seg) goto isNotSegMem;
         
-        // Check for multi-segment chunks
-        if (seg->first_chunk) {
-            MemoryChunk* chunk = seg->first_chunk;
-            size_t chunk_segment_id = i;
-            while (chunk) {
-                if (chunk->num_segments > 1) {
-                    size_t chunk_start = chunk->start_segment * memory->segment_size;
-                    size_t chunk_end = chunk_start;
-                    for (size_t j = 0; j < chunk->num_segments; j++) {
-                        chunk_end += chunk->segment_sizes[j];
-                    }
-                    
-                    if (offset >= chunk_start && offset + size <= chunk_end) {
-                        MemorySegment* chunk_segment = memory->segments[chunk_segment_id];
-
-                        if(WASM_SEGMENTED_MEM_LAZY_ALLOC){
-                            if(!seg->is_allocated){
-                                InitSegment(memory, chunk_segment, true);
-                            }
-                        }
-
-                        //notify_memory_segment_access(memory, chunk_segment);
-                        return true;  // Access is within a valid multi-segment chunk
-                    }
-                }
-                chunk = chunk->next;
-                chunk_segment_id++;
-            }
+        // Segments covered by a multi-segment chunk are materialized on access
+        if (WASM_SEGMENTED_MEM_LAZY_ALLOC && seg->span_chunk && !seg->is_allocated) {
+            InitSegment(memory, seg, true);
         }
     }
     
@@ -645,14 +871,8 @@ bool IsValidMemoryAccess(IM3Memory memory, mos offset, size_t size) {
     return true;
 
     isNotSegMem: {    
-        mos* ptr = (mos*)offset;
-        if(!is_ptr_valid(ptr)){
-            //ESP_LOGW("WASM3", "IsValidMemoryAccess: is not segmented pointer, and both not valid pointer");
-            //backtrace();
-            return true;
-        }
-
-        return false;
+        // Out of range guest offsets are still guest offsets (the resolver will reject them)
+        return m3_IsGuestOffset(offset);
     }
 }
 
@@ -694,1012 +914,581 @@ static mos ptr_to_offset(M3Memory* memory, void* ptr) {
 ////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////
 
-#if m3_alloc_on_segment_data
-void* m3_malloc(M3Memory* memory, size_t size) {
-    if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-        ESP_LOGI("WASM3", "m3_malloc: entering with size=%zu", size);
-    }
 
-    if (!memory || memory->firm != INIT_FIRM || size == 0) {
-        ESP_LOGE("WASM3", "m3_malloc: invalid arguments - memory=%p, firm=%d, size=%zu", 
-                 memory, memory ? memory->firm : 0, size);
-        return NULL;
-    }
-    
-    size_t total_size = size + sizeof(MemoryChunk);
-    // Allinea la dimensione totale a WASM_CHUNK_SIZE
-    total_size = (total_size + (WASM_CHUNK_SIZE-1)) & ~(WASM_CHUNK_SIZE-1);
-    
-    size_t bucket = log2(total_size);
-    MemoryChunk* found_chunk = NULL;    
-    
-    if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-        ESP_LOGI("WASM3", "m3_malloc: calculated bucket=%zu for total_size=%zu (aligned from %zu)", 
-                 bucket, total_size, size);
-    }
-    
-    // 1. Prima cerca nei chunk liberi
-    if (bucket < memory->num_free_buckets) {
-        if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-            ESP_LOGI("WASM3", "m3_malloc: searching in free chunks bucket %zu", bucket);
-        }
-        
-        MemoryChunk** curr = &memory->free_chunks[bucket];
-        while (*curr) {
-            if ((*curr)->size >= total_size) {
-                found_chunk = *curr;
-                *curr = found_chunk->next;
-                if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-                    ESP_LOGI("WASM3", "m3_malloc: found free chunk of size=%zu at segment=%zu", 
-                             found_chunk->size, found_chunk->start_segment);
-                }
-                break;
-            }
-            curr = &(*curr)->next;
-        }
-    }
-    
-    // 2. Se non trova chunk liberi, cerca spazio alla fine dei segmenti esistenti
-    if (!found_chunk) {
-        if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-            ESP_LOGI("WASM3", "m3_malloc: no free chunks found, searching in existing segments");
-        }
-            
-        bool space_found = false;
-        
-        for (size_t i = 0; i < memory->num_segments && !space_found; i++) {
-            if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-                ESP_LOGI("WASM3", "m3_malloc: examining segment %zu (%p)", i, (void*)memory->segments[i]);
-            }
-                
-            MemorySegment* seg = memory->segments[i];
-            if (!seg || !seg->data) {
-                if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-                    ESP_LOGI("WASM3", "m3_malloc: initializing segment %zu", i);
-                }
-                if (InitSegment(memory, seg, true) == NULL) {
-                    ESP_LOGE("WASM3", "m3_malloc: failed to initialize segment %zu", i);
-                    continue;
-                }
-            }
-            
-            // Calcola spazio utilizzato nel segmento
-            size_t used_space = 0;
-            MemoryChunk* current = seg->first_chunk;
-            MemoryChunk* last_chunk = NULL;
-            
-            // Traccia tutti i chunk nel segmento
-            while (current) {
-                used_space += current->size;
-                last_chunk = current;
-                current = current->next;
-            }
-            
-            // Allinea used_space a WASM_CHUNK_SIZE
-            used_space = (used_space + (WASM_CHUNK_SIZE-1)) & ~(WASM_CHUNK_SIZE-1);
-            
-            if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-                ESP_LOGI("WASM3", "m3_malloc: segment %zu analysis - used_space=%zu, total_size=%zu, available=%zu", 
-                         i, used_space, seg->size, seg->size - used_space);
-            }
-            
-            // Se c'è spazio sufficiente dopo l'ultimo chunk
-            if (used_space + total_size <= seg->size) {
-                found_chunk = (MemoryChunk*)((char*)seg->data + used_space);
-                memset(found_chunk, 0, sizeof(MemoryChunk));  // Zero initialize
-                
-                found_chunk->size = total_size;
-                found_chunk->is_free = false;
-                found_chunk->next = NULL;
-                found_chunk->prev = last_chunk;
-                found_chunk->num_segments = 1;
-                found_chunk->start_segment = i;
-                found_chunk->segment_sizes = m3_Def_Malloc(sizeof(size_t));
-                
-                if (!found_chunk->segment_sizes) {
-                    ESP_LOGE("WASM3", "m3_malloc: failed to allocate segment_sizes array");
-                    return NULL;
-                }
-                
-                found_chunk->segment_sizes[0] = total_size;
-                
-                if (last_chunk) {
-                    last_chunk->next = found_chunk;
-                } else {
-                    seg->first_chunk = found_chunk;
-                }
-                
-                if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-                    ESP_LOGI("WASM3", "m3_malloc: allocated new chunk in segment %zu at offset %zu", 
-                             i, used_space);
-                }
-                
-                space_found = true;
-                break;
-            }
-        }
-    }
+
+// Helper function to create a new chunk metadata structure
+static MemoryChunk* create_chunk(size_t size, uint16_t start_segment, uint16_t num_segments) {
+    MemoryChunk* chunk = m3_Def_Malloc(sizeof(MemoryChunk));
+    if (!chunk) return NULL;
     
-    // 3. Se non trova spazio nei segmenti esistenti, alloca nuovi segmenti
-    if (!found_chunk) {
-        if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-            ESP_LOGI("WASM3", "m3_malloc: no space in existing segments, allocating new segments");
-        }
-        
-        // Calcola quanti segmenti servono
-        size_t segments_needed = (total_size + memory->segment_size - 1) / memory->segment_size;
-        if (segments_needed == 0) segments_needed = 1;
-        
-        if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-            ESP_LOGI("WASM3", "m3_malloc: need %zu new segments", segments_needed);
-        }
-        
-        // Aggiungi i segmenti necessari
-        M3Result result = AddSegments(memory, segments_needed);
-        if (result != NULL) {
-            ESP_LOGE("WASM3", "m3_malloc: failed to add %zu new segments", segments_needed);
-            return NULL;
-        }
-        
-        // Usa il primo nuovo segmento
-        size_t new_segment_index = memory->num_segments - segments_needed;
-        MemorySegment* new_seg = memory->segments[new_segment_index];
-        
-        if (!new_seg->data) {
-            if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-                ESP_LOGI("WASM3", "m3_malloc: initializing new segment %zu", new_segment_index);
-            }
-            if (InitSegment(memory, new_seg, !WASM_SEGMENTED_MEM_LAZY_ALLOC) != NULL) {
-                ESP_LOGE("WASM3", "m3_malloc: failed to initialize new segment %zu", new_segment_index);
-                return NULL;
-            }
-        }
-        
-        found_chunk = (MemoryChunk*)new_seg->data;
-        memset(found_chunk, 0, sizeof(MemoryChunk));  // Zero initialize
-        found_chunk->size = total_size;
-        found_chunk->is_free = false;
-        found_chunk->num_segments = segments_needed;
-        found_chunk->start_segment = new_segment_index;
-        found_chunk->segment_sizes = m3_Def_Malloc(sizeof(size_t) * segments_needed);
-        
-        if (!found_chunk->segment_sizes) {
-            ESP_LOGE("WASM3", "m3_malloc: failed to allocate segment_sizes array for %zu segments", 
-                     segments_needed);
-            return NULL;
-        }
-        
-        // Distribuisci la size tra i segmenti
-        size_t remaining_size = total_size;
-        for (size_t i = 0; i < segments_needed; i++) {
-            size_t available = memory->segment_size;
-            if (i == 0) available -= sizeof(MemoryChunk);
-            found_chunk->segment_sizes[i] = (remaining_size > available) ? available : remaining_size;
-            remaining_size -= found_chunk->segment_sizes[i];
-            
-            if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-                ESP_LOGI("WASM3", "m3_malloc: segment %zu allocated %zu bytes", 
-                         new_segment_index + i, found_chunk->segment_sizes[i]);
-            }
-        }
-        
-        new_seg->first_chunk = found_chunk;
-    }
+    chunk->size = size;
+    chunk->is_free = false;
+    chunk->next = NULL;
+    chunk->prev = NULL;
+    chunk->num_segments = num_segments;
+    chunk->start_segment = start_segment;
     
-    if (found_chunk) {
-        // Calcola l'offset relativo al primo segmento
-        mos base_offset = found_chunk->start_segment * memory->segment_size;
-        mos chunk_offset = (char*)found_chunk - (char*)memory->segments[found_chunk->start_segment]->data;
-        mos offset = base_offset + chunk_offset + sizeof(MemoryChunk);
-        
-        // Verifica che l'offset sia allineato
-        if (offset % WASM_CHUNK_SIZE != 0) {
-            offset = (offset + (WASM_CHUNK_SIZE-1)) & ~(WASM_CHUNK_SIZE-1);
-        }
-        
-        if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-            ESP_LOGI("WASM3", "m3_malloc: returning offset=%u (segment=%u, chunk_offset=%u)", 
-                     offset, found_chunk->start_segment, chunk_offset);
-        }
-        
-        memory->total_requested_size += size;
-        return (void*)offset;
+    // Allocate segment sizes array, followed by its prefix sums
+    chunk->segment_sizes = m3_Def_Malloc((2 * num_segments + 1) * sizeof(size_t));
+    if (!chunk->segment_sizes) {
+        m3_Def_Free(chunk);
+        return NULL;
     }
+    chunk->segment_offsets = chunk->segment_sizes + num_segments;
     
-    ESP_LOGE("WASM3", "m3_malloc: allocation failed for size %zu", size);
-    return NULL;
+    return chunk;
 }
 
-void m3_free(M3Memory* memory, void* offset_ptr) {
-    if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-        ESP_LOGI("WASM3", "m3_free: entering with ptr=%p", offset_ptr);
-    }
+// Total bytes covered by the chunk across all its segments
+static inline size_t chunk_span_size(MemoryChunk* chunk) {
+    if (chunk->segment_offsets) return chunk->segment_offsets[chunk->num_segments];
 
-    if (!memory || !offset_ptr) {
-        ESP_LOGE("WASM3", "m3_free: invalid arguments - memory=%p, ptr=%p", memory, offset_ptr);
-        return;
+    size_t total = 0;
+    for (size_t i = 0; i < chunk->num_segments; i++) {
+        total += chunk->segment_sizes[i];
     }
+    return total;
+}
 
-    if(!IsValidMemoryAccess(memory, offset_ptr, 1)) {
-        if(is_ptr_valid(offset_ptr)){
-            m3_Def_Free(offset_ptr);
-            return;
+// Points every covered segment back at its multi-segment chunk (or clears it)
+static void link_chunk_span(M3Memory* memory, MemoryChunk* chunk, bool link) {
+    if (chunk->num_segments <= 1) return;
+
+    for (size_t i = 0; i < chunk->num_segments; i++) {
+        size_t index = chunk->start_segment + i;
+        if (index >= memory->num_segments) break;
+
+        MemorySegment* seg = memory->segments[index];
+        if (!seg) continue;
+
+        if (link) {
+            seg->span_chunk = chunk;
+            seg->span_index = i;
+        } else if (seg->span_chunk == chunk) {
+            seg->span_chunk = NULL;
+            seg->span_index = 0;
         }
-        return;
-    }
-    
-    // Converti l'offset in puntatore al chunk
-    mos offset = (mos)offset_ptr;
-    if (offset < sizeof(MemoryChunk)) {
-        ESP_LOGE("WASM3", "m3_free: invalid offset %u (smaller than MemoryChunk)", offset);
-        return;
     }
+}
 
-    // Calcola indici di segmento
-    size_t segment_index = (offset - sizeof(MemoryChunk)) / memory->segment_size;
-    if (segment_index >= memory->num_segments) {
-        ESP_LOGE("WASM3", "m3_free: segment index %zu out of bounds (max %zu)", 
-                 segment_index, memory->num_segments - 1);
-        return;
-    }
-    
-    MemorySegment* seg = memory->segments[segment_index];
-    if (!seg || !seg->data) {
-        ESP_LOGE("WASM3", "m3_free: invalid segment at index %zu", segment_index);
-        return;
-    }
-    
-    size_t intra_segment_offset = (offset - sizeof(MemoryChunk)) % memory->segment_size;
-    MemoryChunk* chunk = (MemoryChunk*)((char*)seg->data + intra_segment_offset - sizeof(MemoryChunk));
-    
-    // Verifica validità del chunk
-    if (chunk->start_segment != segment_index || !chunk->segment_sizes) {
-        ESP_LOGE("WASM3", "m3_free: invalid chunk (start_segment=%zu, expected=%zu)", 
-                 chunk->start_segment, segment_index);
-        return;
-    }
+////////////////////////////////////////////////////////////////
+/// Sub-segment allocator
+///
+/// Requests are served by one of three tiers, all O(1) in the number of segments:
+///   <= WASM_SLAB_MAX_SIZE   size-classed slabs: a segment of equal slots, one bitmap bit each
+///   <= segment size         buddy blocks (512 B .. 4 KB) inside a segment; split and coalesce
+///                           are bit operations on the segment's unit mask
+///   larger                  runs of whole segments (MemoryChunk), reused by segment count
+/// The owning tier is recorded per segment, so m3_free never searches.
+/// Slab and buddy segments that empty out go back to a LIFO pool of segment indices.
+
+DEBUG_TYPE WASM_DEBUG_SUBSEGMENT_ALLOC = WASM_DEBUG_ALL || (WASM_DEBUG && false);
+
+#define SLAB_SLOT_SIZE(CLASS) ((size_t)1 << (WASM_SLAB_MIN_SHIFT + (CLASS)))
+#define SLAB_NUM_SLOTS(CLASS) (WASM_SEGMENT_SIZE >> (WASM_SLAB_MIN_SHIFT + (CLASS)))
+#define BUDDY_BLOCK_MASK(ORDER) ((1u << (1u << (ORDER))) - 1)
+
+static inline u32 floor_log2(size_t value) {
+    return (u32)(sizeof(unsigned long) * 8 - 1) - (u32)__builtin_clzl((unsigned long)value);
+}
 
-    if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-        ESP_LOGI("WASM3", "m3_free: freeing chunk at segment %zu with %zu segments, size=%zu", 
-                 segment_index, chunk->num_segments, chunk->size);
-    }
-    
-    // Gestione chunk multi-segmento
-    if (chunk->num_segments > 1) {
-        if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-            ESP_LOGI("WASM3", "m3_free: processing multi-segment chunk");
-        }
-        
-        // Rimuovi il chunk dalle liste di tutti i segmenti che occupa
-        for (size_t i = 0; i < chunk->num_segments; i++) {
-            size_t curr_segment_index = chunk->start_segment + i;
-            if (curr_segment_index >= memory->num_segments) {
-                ESP_LOGE("WASM3", "m3_free: segment index %zu out of bounds", curr_segment_index);
-                break;
-            }
-            
-            MemorySegment* curr_seg = memory->segments[curr_segment_index];
-            if (!curr_seg) continue;
-            
-            // Se questo è il primo chunk nel segmento, aggiorna first_chunk
-            if (curr_seg->first_chunk == chunk) {
-                if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-                    ESP_LOGI("WASM3", "m3_free: updating first_chunk for segment %zu", 
-                             curr_segment_index);
-                }
-                curr_seg->first_chunk = chunk->next;
-            }
-            
-            // Aggiorna i collegamenti per gli altri chunk nel segmento
-            if (i == 0) { // Solo nel primo segmento gestiamo i link prev/next
-                if (chunk->prev) chunk->prev->next = chunk->next;
-                if (chunk->next) chunk->next->prev = chunk->prev;
-            }
-        }
-    } else {
-        // Gestione chunk single-segment
-        if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-            ESP_LOGI("WASM3", "m3_free: processing single-segment chunk");
-        }
-        
-        if (chunk->prev) {
-            if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-                ESP_LOGI("WASM3", "m3_free: updating prev chunk link");
-            }
-            chunk->prev->next = chunk->next;
-        } else {
-            if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-                ESP_LOGI("WASM3", "m3_free: updating first_chunk for segment %zu", segment_index);
-            }
-            seg->first_chunk = chunk->next;
-        }
-        if (chunk->next) {
-            if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-                ESP_LOGI("WASM3", "m3_free: updating next chunk link");
-            }
-            chunk->next->prev = chunk->prev;
-        }
-    }
-    
-    // Gestisci la fusione con chunk adiacenti liberi
-    MemoryChunk* next = chunk->next;
-    MemoryChunk* prev = chunk->prev;
-    
-    if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-        ESP_LOGI("WASM3", "m3_free: checking for merge opportunities - next=%p, prev=%p", 
-                 (void*)next, (void*)prev);
-    }
-    
-    // Prova a fondere con il chunk successivo se libero e nello stesso segmento
-    if (next && next->is_free && 
-        next->start_segment == chunk->start_segment + chunk->num_segments - 1) {
-        if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-            ESP_LOGI("WASM3", "m3_free: merging with next chunk (size=%zu)", next->size);
-        }
-        
-        // Rimuovi next dalla free list
-        size_t next_bucket = log2(next->size);
-        if (next_bucket < memory->num_free_buckets) {
-            MemoryChunk** curr = &memory->free_chunks[next_bucket];
-            while (*curr && *curr != next) curr = &(*curr)->next;
-            if (*curr) *curr = (*curr)->next;
-            
-            if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-                ESP_LOGI("WASM3", "m3_free: removed next chunk from bucket %zu", next_bucket);
-            }
-        }
-        
-        // Aggiorna dimensioni e segmenti
-        chunk->size += next->size;
-        chunk->num_segments += next->num_segments;
-        
-        // Ridimensiona e aggiorna array segment_sizes
-        size_t* new_sizes = m3_Def_Realloc(chunk->segment_sizes, 
-                                          chunk->num_segments * sizeof(size_t));
-        if (new_sizes) {
-            memcpy(new_sizes + chunk->num_segments - next->num_segments,
-                  next->segment_sizes,
-                  next->num_segments * sizeof(size_t));
-            chunk->segment_sizes = new_sizes;
-            
-            if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-                ESP_LOGI("WASM3", "m3_free: updated segment_sizes array after next merge");
-            }
-        } else {
-            ESP_LOGE("WASM3", "m3_free: failed to reallocate segment_sizes array for next merge");
-        }
-        
-        chunk->next = next->next;
-        if (next->next) next->next->prev = chunk;
-        
-        m3_Def_Free(next->segment_sizes);
-    }
-    
-    // Prova a fondere con il chunk precedente se libero
-    if (prev && prev->is_free && 
-        prev->start_segment + prev->num_segments == chunk->start_segment) {
-        if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-            ESP_LOGI("WASM3", "m3_free: merging with previous chunk (size=%zu)", prev->size);
-        }
-        
-        // Rimuovi prev dalla free list
-        size_t prev_bucket = log2(prev->size);
-        if (prev_bucket < memory->num_free_buckets) {
-            MemoryChunk** curr = &memory->free_chunks[prev_bucket];
-            while (*curr && *curr != prev) curr = &(*curr)->next;
-            if (*curr) *curr = (*curr)->next;
-            
-            if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-                ESP_LOGI("WASM3", "m3_free: removed prev chunk from bucket %zu", prev_bucket);
-            }
-        }
-        
-        // Aggiorna dimensioni e segmenti
-        prev->size += chunk->size;
-        size_t old_num_segments = prev->num_segments;
-        prev->num_segments += chunk->num_segments;
-        
-        // Ridimensiona e aggiorna array segment_sizes
-        size_t* new_sizes = m3_Def_Realloc(prev->segment_sizes, 
-                                          prev->num_segments * sizeof(size_t));
-        if (new_sizes) {
-            memcpy(new_sizes + old_num_segments,
-                  chunk->segment_sizes,
-                  chunk->num_segments * sizeof(size_t));
-            prev->segment_sizes = new_sizes;
-            
-            if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-                ESP_LOGI("WASM3", "m3_free: updated segment_sizes array after prev merge");
-            }
-        } else {
-            ESP_LOGE("WASM3", "m3_free: failed to reallocate segment_sizes array for prev merge");
-        }
-        
-        prev->next = chunk->next;
-        if (chunk->next) chunk->next->prev = prev;
-        
-        // Usa prev come chunk principale
-        chunk = prev;
-        m3_Def_Free(chunk->segment_sizes);
-    }
-    
-    // Marca il chunk come libero e aggiungilo alla free list appropriata
-    chunk->is_free = true;
-    size_t bucket = log2(chunk->size);
-    if (bucket < memory->num_free_buckets) {
-        chunk->next = memory->free_chunks[bucket];
-        memory->free_chunks[bucket] = chunk;
-        
-        if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-            ESP_LOGI("WASM3", "m3_free: added chunk to free bucket %zu", bucket);
-        }
-    } else {
-        ESP_LOGE("WASM3", "m3_free: chunk size %zu too large for free buckets", chunk->size);
-    }
+static inline u32 ceil_log2(size_t value) {
+    return value <= 1 ? 0 : floor_log2(value - 1) + 1;
+}
 
-    // Free empty segments
-    if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-        ESP_LOGI("WASM3", "m3_free: collecting empty segments");
-    }
-    m3_collect_empty_segments(memory);
+static inline mos segment_base(MemorySegment* seg) {
+    return (mos)seg->index << WASM_SEGMENT_SIZE_SHIFT;
 }
 
-void* m3_realloc(M3Memory* memory, void* offset_ptr, size_t new_size) {
-    if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-        ESP_LOGI("WASM3", "m3_realloc: entering with ptr=%p, new_size=%zu", offset_ptr, new_size);
-    }
-    
-    if (!memory) {
-        ESP_LOGE("WASM3", "m3_realloc: invalid memory pointer");
-        return NULL;
-    }
-    
-    if (!offset_ptr) {
-        if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-            ESP_LOGI("WASM3", "m3_realloc: null ptr, forwarding to m3_malloc");
-        }
-        return m3_malloc(memory, new_size);
-    }
-    
-    if (new_size == 0) {
-        if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-            ESP_LOGI("WASM3", "m3_realloc: zero size, freeing memory");
+// Changes a segment's owner, keeping the collector's count of reclaimable segments in step
+static void segment_set_kind(M3Memory* memory, MemorySegment* seg, M3SegmentKind kind) {
+    bool was_empty = seg->kind == c_m3SegKind_Pool && seg->data;
+    bool is_empty = kind == c_m3SegKind_Pool && seg->data;
+
+    seg->kind = kind;
+    if (is_empty && !was_empty) memory->collect_stats.empty_segments++;
+    else if (was_empty && !is_empty) memory->collect_stats.empty_segments--;
+}
+
+static bool segment_is_pooled(M3Memory* memory, MemorySegment* seg) {
+    return seg->pool_slot < memory->pool_count && memory->pool[seg->pool_slot] == seg->index;
+}
+
+static void pool_add(M3Memory* memory, MemorySegment* seg) {
+    if (memory->pool_count == memory->pool_capacity) {
+        size_t capacity = memory->pool_capacity ? memory->pool_capacity * 2 : 32;
+        u32* pool = m3_Def_Realloc(memory->pool, capacity * sizeof(u32));
+        if (!pool || (void*)pool == ERROR_POINTER) {
+            // The segment stays out of the pool: its address range is simply not reused
+            ESP_LOGW("WASM3", "pool_add: can't grow segment pool");
+            segment_set_kind(memory, seg, c_m3SegKind_Guest);
+            return;
         }
-        m3_free(memory, offset_ptr);
-        return NULL;
+        memory->alloc_stats.metadata_bytes += (capacity - memory->pool_capacity) * sizeof(u32);
+        memory->pool = pool;
+        memory->pool_capacity = capacity;
     }
-    
-    // Get current chunk
-    mos offset = (mos)offset_ptr;
-    size_t segment_index = (offset - sizeof(MemoryChunk)) / memory->segment_size;
-    if (segment_index >= memory->num_segments) {
-        ESP_LOGE("WASM3", "m3_realloc: segment index %zu out of bounds", segment_index);
-        return NULL;
+
+    segment_set_kind(memory, seg, c_m3SegKind_Pool);
+    seg->pool_slot = memory->pool_count;
+    memory->pool[memory->pool_count++] = seg->index;
+    memory->alloc_stats.pooled_segments++;
+}
+
+static void pool_remove(M3Memory* memory, MemorySegment* seg) {
+    u32 last = memory->pool[--memory->pool_count];
+    memory->pool[seg->pool_slot] = last;
+    memory->segments[last]->pool_slot = seg->pool_slot;
+    memory->alloc_stats.pooled_segments--;
+}
+
+static inline size_t free_run_bucket(M3Memory* memory, size_t num_segments) {
+    return MIN(floor_log2(num_segments), memory->num_free_buckets - 1);
+}
+
+static void free_run_link(M3Memory* memory, MemoryChunk* run) {
+    size_t bucket = free_run_bucket(memory, run->num_segments);
+    run->is_free = true;
+    run->size = (size_t)run->num_segments << WASM_SEGMENT_SIZE_SHIFT;
+    run->prev = NULL;
+    run->next = memory->free_chunks[bucket];
+    if (run->next) run->next->prev = run;
+    memory->free_chunks[bucket] = run;
+
+    memory->segments[run->start_segment]->free_run = run;
+    memory->segments[run->start_segment + run->num_segments - 1]->free_run = run;
+}
+
+static void free_run_unlink(M3Memory* memory, MemoryChunk* run) {
+    if (run->prev) run->prev->next = run->next;
+    else memory->free_chunks[free_run_bucket(memory, run->num_segments)] = run->next;
+    if (run->next) run->next->prev = run->prev;
+    run->next = run->prev = NULL;
+
+    memory->segments[run->start_segment]->free_run = NULL;
+    memory->segments[run->start_segment + run->num_segments - 1]->free_run = NULL;
+}
+
+static void free_run_discard(M3Memory* memory, MemoryChunk* run) {
+    free_run_unlink(memory, run);
+    free_chunk(run);
+    memory->alloc_stats.metadata_bytes -= sizeof(MemoryChunk);
+}
+
+// Gives [start, start + count) back, merged with the free segments on either side
+static void segments_release(M3Memory* memory, size_t start, size_t count) {
+    for (size_t i = start; i < start + count; i++) {
+        segment_set_kind(memory, memory->segments[i], c_m3SegKind_Pool);
     }
-    
-    MemorySegment* seg = memory->segments[segment_index];
-    if (!seg || !seg->data) {
-        ESP_LOGE("WASM3", "m3_realloc: invalid segment at index %zu", segment_index);
-        return NULL;
+
+    MemorySegment* left = start > 0 ? memory->segments[start - 1] : NULL;
+    if (left && left->free_run) {
+        MemoryChunk* run = left->free_run;
+        start = run->start_segment;
+        count += run->num_segments;
+        free_run_discard(memory, run);
+    } else if (left && segment_is_pooled(memory, left)) {
+        pool_remove(memory, left);
+        start--;
+        count++;
     }
-    
-    size_t intra_segment_offset = (offset - sizeof(MemoryChunk)) % memory->segment_size;
-    MemoryChunk* old_chunk = (MemoryChunk*)((char*)seg->data + intra_segment_offset - sizeof(MemoryChunk));
-    
-    // Verifica validità del chunk
-    if (old_chunk->start_segment != segment_index || !old_chunk->segment_sizes) {
-        ESP_LOGE("WASM3", "m3_realloc: invalid chunk metadata");
-        return NULL;
+
+    MemorySegment* right = start + count < memory->num_segments ? memory->segments[start + count] : NULL;
+    if (right && right->free_run) {
+        MemoryChunk* run = right->free_run;
+        count += run->num_segments;
+        free_run_discard(memory, run);
+    } else if (right && segment_is_pooled(memory, right)) {
+        pool_remove(memory, right);
+        count++;
     }
-    
-    if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-        ESP_LOGI("WASM3", "m3_realloc: found chunk at segment %zu, current size=%zu", 
-                 segment_index, old_chunk->size);
+
+    if (count == 1) {
+        pool_add(memory, memory->segments[start]);
+        return;
     }
-    
-    // Calcola nuova dimensione totale allineata
-    size_t total_new_size = (new_size + sizeof(MemoryChunk) + (WASM_CHUNK_SIZE-1)) & 
-                           ~(WASM_CHUNK_SIZE-1);
-    
-    if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-        ESP_LOGI("WASM3", "m3_realloc: aligned total_new_size=%zu", total_new_size);
+
+    MemoryChunk* run = m3_Def_Malloc(sizeof(MemoryChunk));
+    if (!run || (void*)run == ERROR_POINTER) {
+        // Unmerged, but still reusable one by one
+        for (size_t i = start; i < start + count; i++) pool_add(memory, memory->segments[i]);
+        return;
     }
-    
-    // Se la nuova dimensione è minore o uguale, possiamo ridurre il chunk
-    if (total_new_size <= old_chunk->size) {
-        if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-            ESP_LOGI("WASM3", "m3_realloc: shrinking chunk");
-        }
-        
-        // Per chunk multi-segmento, potremmo dover rilasciare alcuni segmenti
-        if (old_chunk->num_segments > 1) {
-            size_t new_segments_needed = (total_new_size + memory->segment_size - 1) / memory->segment_size;
-            
-            if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-                ESP_LOGI("WASM3", "m3_realloc: multi-segment chunk needs %zu segments (current: %zu)", 
-                         new_segments_needed, old_chunk->num_segments);
-            }
-            
-            if (new_segments_needed < old_chunk->num_segments) {
-                // Rimuovi il chunk dalle liste dei segmenti non più necessari
-                for (size_t i = new_segments_needed; i < old_chunk->num_segments; i++) {
-                    size_t curr_segment_index = old_chunk->start_segment + i;
-                    if (curr_segment_index >= memory->num_segments) break;
-                    
-                    MemorySegment* curr_seg = memory->segments[curr_segment_index];
-                    if (!curr_seg) continue;
-                    
-                    if (curr_seg->first_chunk == old_chunk) {
-                        if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-                            ESP_LOGI("WASM3", "m3_realloc: removing chunk from segment %zu", 
-                                     curr_segment_index);
-                        }
-                        curr_seg->first_chunk = old_chunk->next;
-                    }
-                }
-                
-                // Aggiorna array segment_sizes
-                size_t* new_sizes = m3_Def_Realloc(old_chunk->segment_sizes, 
-                                                  new_segments_needed * sizeof(size_t));
-                if (new_sizes) {
-                    old_chunk->segment_sizes = new_sizes;
-                    old_chunk->num_segments = new_segments_needed;
-                    
-                    if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-                        ESP_LOGI("WASM3", "m3_realloc: updated segment_sizes array");
-                    }
-                } else {
-                    ESP_LOGE("WASM3", "m3_realloc: failed to reallocate segment_sizes array");
-                }
-            }
-        }
-        
-        old_chunk->size = total_new_size;
-        return offset_ptr;
+
+    memset(run, 0, sizeof(MemoryChunk));
+    run->start_segment = start;
+    run->num_segments = count;
+    free_run_link(memory, run);
+    memory->alloc_stats.metadata_bytes += sizeof(MemoryChunk);
+}
+
+static void pool_push(M3Memory* memory, MemorySegment* seg) {
+    segments_release(memory, seg->index, 1);
+}
+
+// Takes a pooled segment, else the last segment of the smallest free run, else appends one
+static MemorySegment* pool_pop(M3Memory* memory) {
+    if (memory->pool_count > 0) {
+        memory->alloc_stats.pooled_segments--;
+        return memory->segments[memory->pool[--memory->pool_count]];
     }
-    
-    // Prova a espandere in-place
-    bool can_expand = false;
-    
-    if (old_chunk->num_segments > 0) {
-        if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-            ESP_LOGI("WASM3", "m3_realloc: attempting in-place expansion");
-        }
-        
-        // Verifica se ci sono segmenti liberi adiacenti
-        size_t last_segment = old_chunk->start_segment + old_chunk->num_segments - 1;
-        size_t additional_segments_needed = (total_new_size - old_chunk->size + memory->segment_size - 1) 
-                                          / memory->segment_size;
-        
-        if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-            ESP_LOGI("WASM3", "m3_realloc: need %zu additional segments", additional_segments_needed);
-        }
-        
-        bool segments_available = true;
-        for (size_t i = 1; i <= additional_segments_needed; i++) {
-            size_t check_segment = last_segment + i;
-            if (check_segment >= memory->num_segments || 
-                (memory->segments[check_segment] && memory->segments[check_segment]->first_chunk)) {
-                segments_available = false;
-                if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-                    ESP_LOGI("WASM3", "m3_realloc: segment %zu not available", check_segment);
-                }
-                break;
-            }
-        }
-        
-        if (segments_available) {
-            if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-                ESP_LOGI("WASM3", "m3_realloc: adjacent segments are available for expansion");
-            }
-            
-            // Espandi il chunk nei segmenti adiacenti
-            size_t new_num_segments = old_chunk->num_segments + additional_segments_needed;
-            size_t* new_sizes = m3_Def_Realloc(old_chunk->segment_sizes, 
-                                              new_num_segments * sizeof(size_t));
-            if (new_sizes) {
-                old_chunk->segment_sizes = new_sizes;
-                
-                // Aggiorna le dimensioni dei segmenti
-                size_t remaining_size = total_new_size - old_chunk->size;
-                for (size_t i = old_chunk->num_segments; i < new_num_segments; i++) {
-                    size_t segment_size = MIN(remaining_size, memory->segment_size);
-                    old_chunk->segment_sizes[i] = segment_size;
-                    remaining_size -= segment_size;
-                    
-                    if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-                        ESP_LOGI("WASM3", "m3_realloc: allocated %zu bytes in new segment %zu", 
-                                segment_size, old_chunk->start_segment + i);
-                    }
-                    
-                    // Inizializza il nuovo segmento se necessario
-                    size_t curr_segment_index = old_chunk->start_segment + i;
-                    if (!memory->segments[curr_segment_index]->data) {
-                        if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-                            ESP_LOGI("WASM3", "m3_realloc: initializing new segment %zu", 
-                                    curr_segment_index);
-                        }
-                        if (InitSegment(memory, memory->segments[curr_segment_index], true) != NULL) {
-                            ESP_LOGE("WASM3", "m3_realloc: failed to initialize segment %zu", 
-                                    curr_segment_index);
-                            break;
-                        }
-                    }
-                    memory->segments[curr_segment_index]->first_chunk = old_chunk;
-                }
-                
-                old_chunk->num_segments = new_num_segments;
-                old_chunk->size = total_new_size;
-                can_expand = true;
-                
-                if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-                    ESP_LOGI("WASM3", "m3_realloc: in-place expansion successful");
-                }
-            } else {
-                ESP_LOGE("WASM3", "m3_realloc: failed to reallocate segment_sizes array");
-            }
+
+    for (size_t bucket = 0; bucket < memory->num_free_buckets; bucket++) {
+        MemoryChunk* run = memory->free_chunks[bucket];
+        if (!run) continue;
+
+        MemorySegment* seg = memory->segments[run->start_segment + run->num_segments - 1];
+        free_run_unlink(memory, run);
+        if (run->num_segments > 2) {
+            run->num_segments--;
+            free_run_link(memory, run);
         } else {
-            if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-                ESP_LOGI("WASM3", "m3_realloc: in-place expansion not possible");
-            }
+            MemorySegment* first = memory->segments[run->start_segment];
+            free_chunk(run);
+            memory->alloc_stats.metadata_bytes -= sizeof(MemoryChunk);
+            pool_add(memory, first);
         }
+        return seg;
     }
-    
-    if (can_expand) {
-        return offset_ptr;
-    }
-    
-    // Se non possiamo espandere in-place, alloca nuovo chunk e copia i dati
-    if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-        ESP_LOGI("WASM3", "m3_realloc: allocating new chunk and copying data");
-    }
-    
-    void* new_ptr = m3_malloc(memory, new_size);
-    if (!new_ptr) {
-        ESP_LOGE("WASM3", "m3_realloc: failed to allocate new chunk");
+
+    size_t index = memory->num_segments;
+    if (index + 1 > WASM_MAX_SEGMENTS || AddSegments(memory, index + 1) != m3Err_none) {
+        ESP_LOGE("WASM3", "pool_pop: failed to add a segment");
         return NULL;
     }
-    
-    // Copia i dati vecchi
-    size_t old_data_size = old_chunk->size - sizeof(MemoryChunk);
-    size_t copy_size = MIN(old_data_size, new_size);
-    
-    if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-        ESP_LOGI("WASM3", "m3_realloc: copying %zu bytes from old chunk to new location", copy_size);
-    }
-    
-    m3_memcpy(memory, new_ptr, offset_ptr, copy_size);
-    
-    // Libera il vecchio chunk
-    if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-        ESP_LOGI("WASM3", "m3_realloc: freeing old chunk");
-    }
-    m3_free(memory, offset_ptr);
-    
-    if(WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-        ESP_LOGI("WASM3", "m3_realloc: completed successfully");
-    }
-    return new_ptr;
+    return memory->segments[index];
 }
 
-ChunkInfo get_chunk_info(M3Memory* memory, void* ptr) {
-    ChunkInfo result = { NULL, 0 };
-    if (!memory || !ptr) return result;
-    
-    // Prima verifica se il puntatore è un offset
-    bool is_offset = ((uintptr_t)ptr < memory->total_size);
-    size_t segment_index;
-    size_t intra_offset;
-    
-    if (is_offset) {
-        // Calcola segmento e offset dall'offset fornito
-        segment_index = (uintptr_t)ptr / memory->segment_size;
-        intra_offset = (uintptr_t)ptr % memory->segment_size;
-    } else {
-        // Cerca in quale segmento si trova il puntatore diretto
-        bool found = false;
-        for (size_t i = 0; i < memory->num_segments; i++) {
-            MemorySegment* seg = memory->segments[i];
-            if (!seg || !seg->data) continue;
-            
-            if (ptr >= seg->data && ptr < (char*)seg->data + seg->size) {
-                segment_index = i;
-                intra_offset = (char*)ptr - (char*)seg->data;
-                found = true;
-                break;
-            }
-        }
-        if (!found) return result;
-    }
-    
-    // Verifica validità del segmento
-    if (segment_index >= memory->num_segments) return result;
-    MemorySegment* seg = memory->segments[segment_index];
-    if (!seg || !seg->data) return result;
-    
-    // Cerca il chunk che contiene questo puntatore
-    MemoryChunk* current = seg->first_chunk;
-    while (current) {
-        // Calcola l'area di memoria occupata da questo chunk
-        void* chunk_start = (void*)current;
-        void* chunk_end = (void*)((char*)chunk_start + current->size);
-        
-        // Per chunk multi-segmento
-        if (current->num_segments > 1) {
-            size_t total_size = 0;
-            for (size_t i = 0; i < current->num_segments; i++) {
-                total_size += current->segment_sizes[i];
-            }
-            chunk_end = (void*)((char*)chunk_start + total_size);
-        }
-        
-        // Verifica se il puntatore cade in questo chunk
-        if ((is_offset && intra_offset >= (uintptr_t)chunk_start - (uintptr_t)seg->data && 
-             intra_offset < (uintptr_t)chunk_end - (uintptr_t)seg->data) ||
-            (!is_offset && ptr >= chunk_start && ptr < chunk_end)) {
-            
-            result.chunk = current;
-            // Calcola l'offset base del chunk
-            result.base_offset = (current->start_segment * memory->segment_size) + 
-                               ((char*)current - (char*)memory->segments[current->start_segment]->data) +
-                               sizeof(MemoryChunk);
-            break;
-        }
-        
-        current = current->next;
-    }
-    
-    if (WASM_DEBUG_SEGMENTED_MEMORY_ALLOC && result.chunk) {
-        ESP_LOGI("WASM3", "Found chunk: segment=%d, size=%zu, base_offset=%u", 
-                 result.chunk->start_segment, result.chunk->size, result.base_offset);
+static M3SegmentAlloc* segment_alloc_attach(M3Memory* memory, MemorySegment* seg, M3SegmentKind kind) {
+    M3SegmentAlloc* meta = m3_Def_Malloc(sizeof(M3SegmentAlloc));
+    if (!meta || (void*)meta == ERROR_POINTER) {
+        pool_push(memory, seg);
+        return NULL;
     }
-    
-    return result;
+
+    memset(meta, 0, sizeof(M3SegmentAlloc));
+    segment_set_kind(memory, seg, kind);
+    seg->alloc = meta;
+    memory->alloc_stats.metadata_bytes += sizeof(M3SegmentAlloc);
+    return meta;
 }
 
+static void segment_alloc_detach(M3Memory* memory, MemorySegment* seg) {
+    m3_Def_Free(seg->alloc);
+    seg->alloc = NULL;
+    memory->alloc_stats.metadata_bytes -= sizeof(M3SegmentAlloc);
+    pool_push(memory, seg);
+}
+
+static void segment_list_push(MemorySegment** head, MemorySegment* seg) {
+    seg->alloc->prev = NULL;
+    seg->alloc->next = *head;
+    if (*head) (*head)->alloc->prev = seg;
+    *head = seg;
+}
+
+static void segment_list_remove(MemorySegment** head, MemorySegment* seg) {
+    M3SegmentAlloc* meta = seg->alloc;
+    if (meta->prev) meta->prev->alloc->next = meta->next;
+    else *head = meta->next;
+    if (meta->next) meta->next->alloc->prev = meta->prev;
+    meta->next = meta->prev = NULL;
+}
 
 ///
-///
+/// Slabs
 ///
 
-DEBUG_TYPE WASM_DEBUG_m3_memcpy = WASM_DEBUG_ALL || (WASM_DEBUG && false);
-M3Result m3_memcpy(M3Memory* memory, void* dest, const void* src, size_t n) {
-    if(WASM_DEBUG_m3_memcpy) {
-        ESP_LOGI("WASM3", "m3_memcpy called with dest=%p, src=%p, n=%zu", dest, src, n);
-    }
+static mos slab_alloc(M3Memory* memory, u32 size_class) {
+    MemorySegment* seg = memory->slab_partial[size_class];
+    if (!seg) {
+        seg = pool_pop(memory);
+        if (!seg) return 0;
 
-    if (dest == NULL || src == NULL || !n) {       
-        ESP_LOGE("WASM3", "m3_memcpy: invalid arguments - dest=%p, src=%p, n=%zu", dest, src, n);        
-        return m3Err_malformedData;
+        M3SegmentAlloc* meta = segment_alloc_attach(memory, seg, c_m3SegKind_Slab);
+        if (!meta) return 0;
+
+        meta->size_class = size_class;
+        meta->list = size_class;
+        segment_list_push(&memory->slab_partial[size_class], seg);
+        memory->alloc_stats.slab_segments++;
     }
 
-    // If memory is invalid, fall back to regular memcpy
-    if(!IsValidMemory(memory)) {
-        if(WASM_DEBUG_m3_memcpy) {
-            ESP_LOGI("WASM3", "m3_memcpy: using direct memcpy for invalid memory");
-            ESP_LOGW("WASM3", "m3_memcpy: dest=%p, src=%p", dest, src);
-        }        
+    // Slabs on the partial list always have a free slot below SLAB_NUM_SLOTS
+    M3SegmentAlloc* meta = seg->alloc;
+    size_t slot = 0;
+    for (size_t word = 0; word < WASM_SLAB_BITMAP_WORDS; word++) {
+        u32 free_bits = ~meta->slab.bitmap[word];
+        if (free_bits) {
+            slot = word * 32 + __builtin_ctz(free_bits);
+            break;
+        }
+    }
 
-        goto standardMemcpy;
+    meta->slab.bitmap[slot >> 5] |= 1u << (slot & 31);
+    if (++meta->slab.used == SLAB_NUM_SLOTS(size_class)) {
+        segment_list_remove(&memory->slab_partial[size_class], seg);
+        meta->list = WASM_ALLOC_NO_LIST;
     }
 
-    // Check if dest and src are M3Memory offsets or absolute pointers
-    bool dest_isSegmented = IsValidMemoryAccess(memory, (mos)dest, 1);
-    bool src_isSegmented = IsValidMemoryAccess(memory, (mos)src, 1);
+    return segment_base(seg) + (mos)(slot * SLAB_SLOT_SIZE(size_class));
+}
 
-    if(WASM_DEBUG_m3_memcpy) {
-        ESP_LOGI("WASM3", "m3_memcpy: dest_isSegmented=%d, src_isSegmented=%d", 
-                 dest_isSegmented, src_isSegmented);
-    }
+// Returns the released slot size, 0 if offset isn't a live slot
+static size_t slab_free(M3Memory* memory, MemorySegment* seg, mos offset) {
+    M3SegmentAlloc* meta = seg->alloc;
+    u32 size_class = meta->size_class;
+    size_t slot_size = SLAB_SLOT_SIZE(size_class);
+    size_t in_segment = offset & (WASM_SEGMENT_SIZE - 1);
 
-    // Only use direct memcpy if BOTH pointers are absolute
-    if (!dest_isSegmented && !src_isSegmented) {
-        if(WASM_DEBUG_m3_memcpy) {
-            ESP_LOGI("WASM3", "m3_memcpy: both pointers absolute, using direct memcpy");
-        }
-       
-       goto standardMemcpy;
-    }
-
-    // From here on, at least one pointer is segmented, so we need to handle segmented copy
-    size_t remaining = n;
-    size_t dest_offset = dest_isSegmented ? (mos)dest : 0;
-    size_t src_offset = src_isSegmented ? (mos)src : 0;
-    void* absolute_src = src_isSegmented ? NULL : src;
-    void* absolute_dest = dest_isSegmented ? NULL : dest;
-
-    while (remaining > 0) {
-        // Handle destination
-        size_t dest_segment = dest_isSegmented ? (dest_offset / memory->segment_size) : 0;
-        size_t dest_segment_offset = dest_isSegmented ? (dest_offset % memory->segment_size) : 0;
-        void* curr_dest = dest_isSegmented ? 
-            ((char*)memory->segments[dest_segment]->data + dest_segment_offset) : 
-            ((char*)absolute_dest + (n - remaining));
-
-        // Handle source
-        size_t src_segment = src_isSegmented ? (src_offset / memory->segment_size) : 0;
-        size_t src_segment_offset = src_isSegmented ? (src_offset % memory->segment_size) : 0;
-        void* curr_src = src_isSegmented ? 
-            ((char*)memory->segments[src_segment]->data + src_segment_offset) : 
-            ((char*)absolute_src + (n - remaining));
-
-        // Calculate copy size for this iteration
-        size_t dest_available = dest_isSegmented ? 
-            (memory->segment_size - dest_segment_offset) : remaining;
-        size_t src_available = src_isSegmented ? 
-            (memory->segment_size - src_segment_offset) : remaining;
-        size_t copy_size = MIN(MIN(dest_available, src_available), remaining);
-
-        if(WASM_DEBUG_m3_memcpy) {
-            ESP_LOGI("WASM3", "m3_memcpy: copying %zu bytes", copy_size);
-        }
+    if (in_segment & (slot_size - 1)) return 0;
 
-        memcpy(curr_dest, curr_src, copy_size);
+    size_t slot = in_segment >> (WASM_SLAB_MIN_SHIFT + size_class);
+    u32 bit = 1u << (slot & 31);
+    if (!(meta->slab.bitmap[slot >> 5] & bit)) return 0;
 
-        // Update counters
-        remaining -= copy_size;
-        if (dest_isSegmented) dest_offset += copy_size;
-        if (src_isSegmented) src_offset += copy_size;
+    meta->slab.bitmap[slot >> 5] &= ~bit;
+    meta->slab.used--;
+
+    if (meta->list == WASM_ALLOC_NO_LIST) {
+        segment_list_push(&memory->slab_partial[size_class], seg);
+        meta->list = size_class;
     }
 
-    if(WASM_DEBUG_m3_memcpy) {
-        ESP_LOGI("WASM3", "m3_memcpy: completed successfully");
+    // Keep the last partial slab of a class around, so alloc/free pairs don't bounce through the pool
+    if (meta->slab.used == 0 && (meta->next || meta->prev)) {
+        segment_list_remove(&memory->slab_partial[size_class], seg);
+        memory->alloc_stats.slab_segments--;
+        segment_alloc_detach(memory, seg);
     }
-    return NULL;
 
-    standardMemcpy: {
-        if(!is_ptr_valid(dest)){
-            ESP_LOGE("WASM3", "m3_memcpy: dest (%p) is invalid pointer", dest);
-            return m3Err_malformedData;
-        }
+    return slot_size;
+}
 
-        if(!is_ptr_valid(src)){
-            ESP_LOGE("WASM3", "m3_memcpy: src (%p) is invalid pointer", src);
-            return m3Err_malformedData;
-        }
+///
+/// Buddy blocks
+///
 
-        memcpy(dest, src, n);
-        return NULL;
+// Order of the largest free, aligned block left in the segment (WASM_ALLOC_NO_LIST if full)
+static u8 buddy_largest_free(u8 used_mask) {
+    for (int order = WASM_BUDDY_ORDERS - 1; order >= 0; order--) {
+        u32 units = 1u << order;
+        for (u32 unit = 0; unit < WASM_BUDDY_UNITS; unit += units) {
+            if (!(used_mask & (BUDDY_BLOCK_MASK(order) << unit))) return (u8)order;
+        }
     }
+    return WASM_ALLOC_NO_LIST;
 }
 
-////////////////////////////////////////////////////////////////
+static void buddy_relist(M3Memory* memory, MemorySegment* seg) {
+    M3SegmentAlloc* meta = seg->alloc;
+    u8 list = buddy_largest_free(meta->buddy.used_mask);
+    if (list == meta->list) return;
 
-//todo: implement overflow handling
-DEBUG_TYPE WASM_DEBUG_m3_memset = WASM_DEBUG_ALL || (WASM_DEBUG && false);
-M3Result m3_memset(M3Memory* memory, void* ptr, int value, size_t n) {
-    if(WASM_DEBUG_m3_memset) {
-        ESP_LOGI("WASM3", "m3_memset called with ptr=%p, value=%d, n=%zu", ptr, value, n);
-    }
+    if (meta->list != WASM_ALLOC_NO_LIST) segment_list_remove(&memory->buddy_free[meta->list], seg);
+    if (list != WASM_ALLOC_NO_LIST) segment_list_push(&memory->buddy_free[list], seg);
+    meta->list = list;
+}
 
-    if(!n){ // just ignore it (?)
-        return NULL;
+static mos buddy_alloc(M3Memory* memory, u32 order) {
+    // Smallest list that fits first: keeps the large blocks whole
+    MemorySegment* seg = NULL;
+    for (u32 list = order; list < WASM_BUDDY_ORDERS && !seg; list++) {
+        seg = memory->buddy_free[list];
     }
 
-    if (!ptr || !n) {
-        ESP_LOGE("WASM3", "m3_memset: invalid arguments - ptr=%p, n=%zu", ptr, n);
-        backtrace();
-        return m3Err_malformedData;
-    }
+    if (!seg) {
+        seg = pool_pop(memory);
+        if (!seg) return 0;
 
-    // If memory is invalid, fall back to regular memset
-    if(!IsValidMemory(memory)) {
-        if(WASM_DEBUG_m3_memset) {
-            ESP_LOGI("WASM3", "m3_memset: using direct memset for invalid memory");
-        }
-        memset(ptr, value, n);
-        return NULL;
+        M3SegmentAlloc* meta = segment_alloc_attach(memory, seg, c_m3SegKind_Buddy);
+        if (!meta) return 0;
+
+        memset(meta->buddy.head_order, WASM_ALLOC_NO_LIST, sizeof(meta->buddy.head_order));
+        meta->list = WASM_BUDDY_ORDERS - 1;
+        segment_list_push(&memory->buddy_free[meta->list], seg);
+        memory->alloc_stats.buddy_segments++;
     }
 
-    // Check if ptr is a M3Memory offset
-    bool is_segmented = IsValidMemoryAccess(memory, (mos)ptr, 0);
-    
-    if(WASM_DEBUG_m3_memset) {
-        ESP_LOGI("WASM3", "m3_memset: ptr is %s", is_segmented ? "segmented" : "absolute");
+    M3SegmentAlloc* meta = seg->alloc;
+    u32 units = 1u << order;
+    u32 unit = 0;
+    while (meta->buddy.used_mask & (BUDDY_BLOCK_MASK(order) << unit)) {
+        unit += units;
     }
 
-    // Get real pointer using m3_ResolvePointer
-    void* real_ptr = m3_ResolvePointer(memory, ptr);
-    
-    if (real_ptr == ERROR_POINTER) {
-        ESP_LOGE("WASM3", "m3_memset: failed to resolve pointer");
-        return m3Err_malformedData;
+    meta->buddy.used_mask |= BUDDY_BLOCK_MASK(order) << unit;
+    meta->buddy.head_order[unit] = order;
+    buddy_relist(memory, seg);
+
+    return segment_base(seg) + (mos)(unit << WASM_BUDDY_UNIT_SHIFT);
+}
+
+static size_t buddy_free(M3Memory* memory, MemorySegment* seg, mos offset) {
+    M3SegmentAlloc* meta = seg->alloc;
+    size_t in_segment = offset & (WASM_SEGMENT_SIZE - 1);
+
+    if (in_segment & ((1u << WASM_BUDDY_UNIT_SHIFT) - 1)) return 0;
+
+    u32 unit = in_segment >> WASM_BUDDY_UNIT_SHIFT;
+    u8 order = meta->buddy.head_order[unit];
+    if (order == WASM_ALLOC_NO_LIST) return 0;
+
+    // Freed units merge with free neighbours by construction
+    meta->buddy.used_mask &= ~(BUDDY_BLOCK_MASK(order) << unit);
+    meta->buddy.head_order[unit] = WASM_ALLOC_NO_LIST;
+    buddy_relist(memory, seg);
+
+    if (meta->buddy.used_mask == 0 && memory->alloc_stats.buddy_segments > 1) {
+        segment_list_remove(&memory->buddy_free[meta->list], seg);
+        memory->alloc_stats.buddy_segments--;
+        segment_alloc_detach(memory, seg);
     }
 
-    if (!is_segmented) {
-        // For absolute pointers, use direct memset
-        if(WASM_DEBUG_m3_memset) {
-            ESP_LOGI("WASM3", "m3_memset: using direct memset for absolute pointer");
-        }
-        memset(real_ptr, value, n);
-        return NULL;
+    return (size_t)1 << (WASM_BUDDY_UNIT_SHIFT + order);
+}
+
+///
+/// Segment runs
+///
+
+static void run_layout(MemoryChunk* chunk, size_t size) {
+    size_t remaining_size = size;
+    chunk->size = size;
+    chunk->segment_offsets[0] = 0;
+    for (size_t i = 0; i < chunk->num_segments; i++) {
+        size_t segment_size = MIN(remaining_size, WASM_SEGMENT_SIZE);
+        chunk->segment_sizes[i] = segment_size;
+        chunk->segment_offsets[i + 1] = chunk->segment_offsets[i] + segment_size;
+        remaining_size -= segment_size;
     }
+}
 
-    // Handle segmented memory
-    size_t remaining = n;
-    size_t current_offset = (mos)ptr;
+static inline size_t run_metadata_size(size_t num_segments) {
+    return sizeof(MemoryChunk) + (2 * num_segments + 1) * sizeof(size_t);
+}
 
-    while (remaining > 0) {
-        // Calculate current segment
-        size_t segment_index = current_offset / memory->segment_size;
-        
-        if (segment_index >= memory->num_segments) {
-            ESP_LOGE("WASM3", "m3_memset: segment index %zu out of bounds", segment_index);
-            return m3Err_malformedData;
+// Takes a free run of at least needed segments off its bucket: first fit among the runs of
+// about the same length, else the first run of a larger bucket (all of them fit)
+static MemoryChunk* run_take_free(M3Memory* memory, size_t needed) {
+    size_t bucket = free_run_bucket(memory, needed);
+    for (MemoryChunk* run = memory->free_chunks[bucket]; run; run = run->next) {
+        if (run->num_segments >= needed) {
+            free_run_unlink(memory, run);
+            return run;
         }
+    }
 
-        MemorySegment* segment = memory->segments[segment_index];
-        if (!segment || !segment->data) {
-            if(WASM_DEBUG_m3_memset) {
-                ESP_LOGI("WASM3", "m3_memset: initializing segment %zu", segment_index);
-            }
-            if (InitSegment(memory, segment, true) != NULL) {
-                ESP_LOGE("WASM3", "m3_memset: failed to initialize segment %zu", segment_index);
-                return m3Err_malformedData;
-            }
+    for (bucket++; bucket < memory->num_free_buckets; bucket++) {
+        MemoryChunk* run = memory->free_chunks[bucket];
+        if (run) {
+            free_run_unlink(memory, run);
+            return run;
         }
+    }
+
+    return NULL;
+}
+
+static mos run_alloc(M3Memory* memory, size_t size) {
+    size_t needed = (size + WASM_SEGMENT_SIZE - 1) >> WASM_SEGMENT_SIZE_SHIFT;
+    if (needed > WASM_MAX_SEGMENTS) return 0;
 
-        // Calculate how much we can set in this segment
-        size_t segment_offset = current_offset % memory->segment_size;
-        size_t available = memory->segment_size - segment_offset;
-        size_t to_set = MIN(remaining, available);
+    size_t start_segment;
+    MemoryChunk* free_run = run_take_free(memory, needed);
+    if (free_run) {
+        // The tail goes back as free segments
+        start_segment = free_run->start_segment;
+        size_t count = free_run->num_segments;
+        free_chunk(free_run);
+        memory->alloc_stats.metadata_bytes -= sizeof(MemoryChunk);
+        if (count > needed) segments_release(memory, start_segment + needed, count - needed);
+    }
+    else {
+        // Free segments at the end of memory start the run: only the rest is appended
+        MemorySegment* last = memory->segments[memory->num_segments - 1];
+        size_t reused = last->free_run ? last->free_run->num_segments : segment_is_pooled(memory, last) ? 1 : 0;
+        start_segment = memory->num_segments - reused;
 
-        if(WASM_DEBUG_m3_memset) {
-            ESP_LOGI("WASM3", "m3_memset: setting %zu bytes in segment %zu", 
-                     to_set, segment_index);
+        if (start_segment + needed > WASM_MAX_SEGMENTS) {
+            ESP_LOGE("WASM3", "run_alloc: %zu segments would leave the guest window", needed);
+            return 0;
         }
 
-        // Perform the memset for this segment
-        void* segment_ptr = (char*)segment->data + segment_offset;
-        memset(segment_ptr, value, to_set);
+        if (AddSegments(memory, start_segment + needed) != m3Err_none) {
+            ESP_LOGE("WASM3", "run_alloc: failed to add %zu segments", needed - reused);
+            return 0;
+        }
 
-        // Update counters
-        remaining -= to_set;
-        current_offset += to_set;
+        if (last->free_run) free_run_discard(memory, last->free_run);
+        else if (reused) pool_remove(memory, last);
+    }
 
-        if(WASM_DEBUG_m3_memset) {
-            ESP_LOGI("WASM3", "m3_memset: remaining=%zu bytes", remaining);
-        }
+    MemoryChunk* chunk = create_chunk(size, start_segment, needed);
+    if (!chunk) {
+        segments_release(memory, start_segment, needed);
+        return 0;
     }
+    memory->alloc_stats.metadata_bytes += run_metadata_size(needed);
 
-    if(WASM_DEBUG_m3_memset) {
-        ESP_LOGI("WASM3", "m3_memset: completed successfully");
+    // Segment data stays lazy: get_segment_pointer materializes it on first access
+    run_layout(chunk, size);
+    for (size_t i = 0; i < needed; i++) {
+        segment_set_kind(memory, memory->segments[start_segment + i], c_m3SegKind_Run);
     }
-    return NULL;
+    memory->segments[start_segment]->first_chunk = chunk;
+    link_chunk_span(memory, chunk, true);
+    memory->alloc_stats.run_segments += needed;
+
+    return (mos)start_segment << WASM_SEGMENT_SIZE_SHIFT;
 }
 
-#else
+static size_t run_free(M3Memory* memory, MemorySegment* seg, mos offset) {
+    MemoryChunk* chunk = seg->first_chunk;
+    if (!chunk || chunk->is_free || offset != segment_base(seg)) return 0;
 
+    link_chunk_span(memory, chunk, false);
+    seg->first_chunk = NULL;
 
-// Helper function to create a new chunk metadata structure
-static MemoryChunk* create_chunk(size_t size, uint16_t start_segment, uint16_t num_segments) {
-    MemoryChunk* chunk = m3_Def_Malloc(sizeof(MemoryChunk));
-    if (!chunk) return NULL;
-    
-    chunk->size = size;
-    chunk->is_free = false;
-    chunk->next = NULL;
-    chunk->prev = NULL;
-    chunk->num_segments = num_segments;
-    chunk->start_segment = start_segment;
-    
-    // Allocate segment sizes array
-    chunk->segment_sizes = m3_Def_Malloc(num_segments * sizeof(size_t));
-    if (!chunk->segment_sizes) {
-        m3_Def_Free(chunk);
-        return NULL;
-    }
-    
-    return chunk;
+    size_t start_segment = chunk->start_segment;
+    size_t num_segments = chunk->num_segments;
+    memory->alloc_stats.run_segments -= num_segments;
+    memory->alloc_stats.metadata_bytes -= run_metadata_size(num_segments);
+    free_chunk(chunk);
+
+    // The segments' data can be collected meanwhile
+    segments_release(memory, start_segment, num_segments);
+
+    return num_segments << WASM_SEGMENT_SIZE_SHIFT;
 }
 
-// Helper function to free a chunk and its associated metadata
-static void free_chunk(MemoryChunk* chunk) {
-    if (!chunk) return;
-    if (chunk->segment_sizes) {
-        m3_Def_Free(chunk->segment_sizes);
+///
+/// Entry points
+///
+
+// Linear-memory bytes reserved for the allocation starting at offset (0 if there is none)
+static size_t allocation_size(M3Memory* memory, mos offset) {
+    size_t index = offset >> WASM_SEGMENT_SIZE_SHIFT;
+    if (index >= memory->num_segments) return 0;
+
+    MemorySegment* seg = memory->segments[index];
+    size_t in_segment = offset & (WASM_SEGMENT_SIZE - 1);
+
+    switch (seg->kind) {
+        case c_m3SegKind_Slab: {
+            size_t slot = in_segment >> (WASM_SLAB_MIN_SHIFT + seg->alloc->size_class);
+            if (!(seg->alloc->slab.bitmap[slot >> 5] & (1u << (slot & 31)))) return 0;
+            return SLAB_SLOT_SIZE(seg->alloc->size_class);
+        }
+        case c_m3SegKind_Buddy: {
+            u8 order = seg->alloc->buddy.head_order[in_segment >> WASM_BUDDY_UNIT_SHIFT];
+            return order == WASM_ALLOC_NO_LIST ? 0 : (size_t)1 << (WASM_BUDDY_UNIT_SHIFT + order);
+        }
+        case c_m3SegKind_Run:
+            return seg->first_chunk ? (size_t)seg->first_chunk->num_segments << WASM_SEGMENT_SIZE_SHIFT : 0;
+        default:
+            return 0;
     }
-    m3_Def_Free(chunk);
 }
 
 ptr m3_malloc(M3Memory* memory, size_t size) {
@@ -1709,121 +1498,66 @@ ptr m3_malloc(M3Memory* memory, size_t size) {
 
     // Calculate total size needed with alignment
     size_t total_size = (size + (WASM_CHUNK_SIZE-1)) & ~(WASM_CHUNK_SIZE-1);
-    size_t bucket = log2(total_size);
-    
-    // First try to find a suitable free chunk
-    MemoryChunk* found_chunk = NULL;
-    if (bucket < memory->num_free_buckets) {
-        MemoryChunk** curr = &memory->free_chunks[bucket];
-        while (*curr) {
-            if ((*curr)->size >= total_size) {
-                found_chunk = *curr;
-                *curr = found_chunk->next;
-                found_chunk->is_free = false;
-                break;
-            }
-            curr = &(*curr)->next;
-        }
+    size_t reserved;
+    mos offset;
+
+    if (total_size <= WASM_SLAB_MAX_SIZE) {
+        u32 size_class = total_size <= SLAB_SLOT_SIZE(0) ? 0 : ceil_log2(total_size) - WASM_SLAB_MIN_SHIFT;
+        offset = slab_alloc(memory, size_class);
+        reserved = SLAB_SLOT_SIZE(size_class);
     }
-    
-    // If no free chunk found, create a new one
-    if (!found_chunk) {
-        // Calculate number of segments needed
-        size_t segments_needed = (total_size + memory->segment_size - 1) / memory->segment_size;
-        if (segments_needed == 0) segments_needed = 1;
-        
-        // Find or allocate required segments
-        size_t start_segment = memory->num_segments;
-        for (size_t i = 0; i < memory->num_segments; i++) {
-            if (!memory->segments[i]->data) {
-                start_segment = i;
-                break;
-            }
-        }
-        
-        // Add new segments if needed
-        if (start_segment + segments_needed > memory->num_segments) {
-            if (AddSegments(memory, start_segment + segments_needed) != m3Err_none) {
-                ESP_LOGE("WASM3", "m3_malloc: Failed to add segments");
-                return NULL;
-            }
-        }
-        
-        // Create new chunk metadata
-        found_chunk = create_chunk(total_size, start_segment, segments_needed);
-        if (!found_chunk) return NULL;
-        
-        // Initialize segments and set up chunk sizes
-        size_t remaining_size = total_size;
-        for (size_t i = 0; i < segments_needed; i++) {
-            MemorySegment* seg = memory->segments[start_segment + i];
-            
-            // Initialize segment if needed
-            if (!seg->data) {
-                if(seg->is_allocated){
-                    //notify_memory_segment_access(memory, seg); 
-                }
-                else {
-                    if (InitSegment(memory, seg, true) == NULL) {
-                        free_chunk(found_chunk);
-                        ESP_LOGE("WASM3", "m3_malloc: Failed to init segment");
-                        return NULL;
-                    }
-                }
-            }
-            
-            // Calculate size for this segment
-            size_t segment_size = MIN(remaining_size, memory->segment_size);
-            found_chunk->segment_sizes[i] = segment_size;
-            remaining_size -= segment_size;
-            
-            // Link chunk to segment
-            if (i == 0) {
-                found_chunk->next = seg->first_chunk;
-                if (seg->first_chunk) {
-                    seg->first_chunk->prev = found_chunk;
-                }
-                seg->first_chunk = found_chunk;
-            }
-        }
+    else if (total_size <= WASM_SEGMENT_SIZE) {
+        u32 order = ceil_log2(total_size) - WASM_BUDDY_UNIT_SHIFT;
+        offset = buddy_alloc(memory, order);
+        reserved = (size_t)1 << (WASM_BUDDY_UNIT_SHIFT + order);
     }
-    
-    // Calculate return offset
-    mos base_offset = found_chunk->start_segment * memory->segment_size;
+    else {
+        offset = run_alloc(memory, total_size);
+        reserved = (total_size + WASM_SEGMENT_SIZE - 1) & ~(size_t)(WASM_SEGMENT_SIZE - 1);
+    }
+
+    if (!offset) {
+        ESP_LOGE("WASM3", "m3_malloc: failed to allocate %zu bytes", size);
+        return NULL;
+    }
+
+    memory->alloc_stats.live_allocations++;
+    memory->alloc_stats.reserved_bytes += reserved;
     memory->total_requested_size += size;
-    
-    return (ptr)base_offset;
+
+    if (WASM_DEBUG_SUBSEGMENT_ALLOC) ESP_LOGI("WASM3", "m3_malloc: %zu bytes at %u (reserved %zu)", size, offset, reserved);
+
+    return (ptr)(uintptr_t)offset;
 }
 
 void m3_free(M3Memory* memory, ptr ptr) {
-    if (!memory || !ptr) return;
-    
-    // Get chunk info
-    ChunkInfo info = get_chunk_info(memory, ptr);
-    MemoryChunk* chunk = info.chunk;
-    if (!chunk) return;
-    
-    // Remove chunk from segment lists
-    MemorySegment* start_seg = memory->segments[chunk->start_segment];
-    if (start_seg->first_chunk == chunk) {
-        start_seg->first_chunk = chunk->next;
+    if (!memory || memory->firm != INIT_FIRM || !ptr) return;
+
+    mos offset = CAST_PTR ptr;
+    size_t index = offset >> WASM_SEGMENT_SIZE_SHIFT;
+    if (!m3_IsGuestOffset(ptr) || index >= memory->num_segments) {
+        ESP_LOGW("WASM3", "m3_free: %p is not an m3_malloc allocation", ptr);
+        return;
     }
-    
-    if (chunk->prev) chunk->prev->next = chunk->next;
-    if (chunk->next) chunk->next->prev = chunk->prev;
-    
-    // Add to appropriate free list
-    size_t bucket = log2(chunk->size);
-    if (bucket < memory->num_free_buckets) {
-        chunk->is_free = true;
-        chunk->next = memory->free_chunks[bucket];
-        memory->free_chunks[bucket] = chunk;
-    } else {
-        // Chunk too large for free lists, just delete it
-        free_chunk(chunk);
+
+    MemorySegment* seg = memory->segments[index];
+    size_t released = 0;
+    switch (seg->kind) {
+        case c_m3SegKind_Slab:  released = slab_free(memory, seg, offset); break;
+        case c_m3SegKind_Buddy: released = buddy_free(memory, seg, offset); break;
+        case c_m3SegKind_Run:   released = run_free(memory, seg, offset); break;
+        default: break;
     }
-    
-    // Try to collect empty segments
+
+    if (!released) {
+        ESP_LOGW("WASM3", "m3_free: invalid or double free of offset %u", offset);
+        return;
+    }
+
+    memory->alloc_stats.live_allocations--;
+    memory->alloc_stats.reserved_bytes -= released;
+
+    // Amortised: returns at the watermark check unless enough segments emptied out
     m3_collect_empty_segments(memory);
 }
 
@@ -1834,28 +1568,21 @@ ptr m3_realloc(M3Memory* memory, ptr offset, size_t new_size) {
         m3_free(memory, offset);
         return NULL;
     }
-    
-    // Get current chunk info
-    ChunkInfo info = get_chunk_info(memory, offset);
-    MemoryChunk* old_chunk = info.chunk;
-    if (!old_chunk) return NULL;
-    
-    // Calculate new total size needed
-    size_t total_new_size = (new_size + (WASM_CHUNK_SIZE-1)) & ~(WASM_CHUNK_SIZE-1);
-    
-    // If shrinking, just update the size
-    if (total_new_size <= old_chunk->size) {
-        old_chunk->size = total_new_size;
+
+    size_t old_size = allocation_size(memory, CAST_PTR offset);
+    if (!old_size) return NULL;
+
+    // Still fits, and isn't worth moving to a smaller slot
+    if (new_size <= old_size && (new_size > old_size / 4 || old_size <= WASM_SLAB_MAX_SIZE)) {
         return offset;
     }
-    
-    // Otherwise allocate new chunk and copy data
+
     ptr new_ptr = m3_malloc(memory, new_size);
     if (!new_ptr) return NULL;
-    
-    m3_memcpy(memory, new_ptr, offset, MIN(old_chunk->size, new_size));
+
+    m3_memcpy(memory, new_ptr, offset, MIN(old_size, new_size));
     m3_free(memory, offset);
-    
+
     return new_ptr;
 }
 
@@ -1863,38 +1590,63 @@ ptr m3_realloc(M3Memory* memory, ptr offset, size_t new_size) {
 ChunkInfo get_chunk_info(M3Memory* memory, void* ptr) {
     ChunkInfo result = { NULL, 0 };
     if (!memory || !ptr) return result;
-    
-    // Calculate segment index
-    mos offset = (mos)ptr;
-    size_t segment_index = offset / memory->segment_size;
+
+    mos offset = CAST_PTR ptr;
+    size_t segment_index = offset >> WASM_SEGMENT_SIZE_SHIFT;
     if (segment_index >= memory->num_segments) return result;
-    
+
     MemorySegment* seg = memory->segments[segment_index];
     if (!seg) return result;
-    
-    // Search for chunk that contains this address
-    MemoryChunk* current = seg->first_chunk;
-    while (current) {
-        mos chunk_start = current->start_segment * memory->segment_size;
-        mos chunk_end = chunk_start;
-        
-        // Calculate total size across segments
-        for (size_t i = 0; i < current->num_segments; i++) {
-            chunk_end += current->segment_sizes[i];
+
+    size_t in_segment = offset & (WASM_SEGMENT_SIZE - 1);
+    switch (seg->kind) {
+        case c_m3SegKind_Slab:
+            result.base_offset = offset - (in_segment & (SLAB_SLOT_SIZE(seg->alloc->size_class) - 1));
+            break;
+        case c_m3SegKind_Buddy: {
+            // Blocks are aligned to their size: look for the head of each order covering the unit
+            u32 unit = in_segment >> WASM_BUDDY_UNIT_SHIFT;
+            for (u32 order = 0; order < WASM_BUDDY_ORDERS; order++) {
+                u32 head = unit & ~((1u << order) - 1);
+                if (seg->alloc->buddy.head_order[head] == order) {
+                    result.base_offset = segment_base(seg) + (head << WASM_BUDDY_UNIT_SHIFT);
+                    break;
+                }
+            }
+            break;
         }
-        
-        if (offset >= chunk_start && offset < chunk_end) {
-            result.chunk = current;
-            result.base_offset = chunk_start;
+        case c_m3SegKind_Run: {
+            MemoryChunk* chunk = seg->first_chunk ? seg->first_chunk : seg->span_chunk;
+            if (chunk && !chunk->is_free) {
+                result.chunk = chunk;
+                result.base_offset = (mos)chunk->start_segment << WASM_SEGMENT_SIZE_SHIFT;
+            }
             break;
         }
-        
-        current = current->next;
+        default:
+            break;
     }
-    
+
     return result;
 }
 
+void m3_GetAllocatorStats(M3Memory* memory, M3AllocatorStats* o_stats) {
+    if (!memory || memory->firm != INIT_FIRM || !o_stats) return;
+    *o_stats = memory->alloc_stats;
+}
+
+void m3_PrintAllocatorStats(M3Memory* memory) {
+    if (!memory || memory->firm != INIT_FIRM) return;
+
+    M3AllocatorStats* stats = &memory->alloc_stats;
+    ESP_LOGI("WASM3", "m3_malloc: %zu live allocations, %zu bytes reserved (%zu requested in total)",
+             stats->live_allocations, stats->reserved_bytes, memory->total_requested_size);
+    ESP_LOGI("WASM3", "m3_malloc: segments: %zu slab, %zu buddy, %zu run, %zu pooled",
+             stats->slab_segments, stats->buddy_segments, stats->run_segments, stats->pooled_segments);
+    ESP_LOGI("WASM3", "m3_malloc: metadata %zu bytes (%zu per 1000 reserved)",
+             stats->metadata_bytes, stats->reserved_bytes ? stats->metadata_bytes * 1000 / stats->reserved_bytes : 0);
+}
+
 ///
 ///
 ///
@@ -1913,6 +1665,15 @@ M3Result m3_memcpy(M3Memory* memory, void* dest, const void* src, size_t n) {
         return m3Err_malformedData;
     }
 
+    #if WASM_SEGMENTED_MEM_ENABLE_FLAT
+    if (m3_IsFlatMemory(memory)) {
+        void* real_dest = ((uintptr_t)dest < memory->total_size) ? memory->flat_base + (uintptr_t)dest : dest;
+        const void* real_src = ((uintptr_t)src < memory->total_size) ? memory->flat_base + (uintptr_t)src : src;
+        memcpy(real_dest, real_src, n);
+        return NULL;
+    }
+    #endif
+
     // Check if pointers are segmented
     bool dest_is_segmented = IsValidMemoryAccess(memory, CAST_PTR dest, n);
     bool src_is_segmented = IsValidMemoryAccess(memory, CAST_PTR src, n);
@@ -1926,14 +1687,16 @@ M3Result m3_memcpy(M3Memory* memory, void* dest, const void* src, size_t n) {
     void* curr_dest = dest;
 
     while (bytes_remaining > 0) {
-        // Resolve pointers if they're segmented
+        // Resolve pointers if they're segmented. Faulting src in may evict, so dest stays pinned
         void* real_dest = dest_is_segmented ? m3_ResolvePointer(memory, CAST_PTR curr_dest) : curr_dest;
+        if (dest_is_segmented) m3_PinSegment(memory, CAST_PTR curr_dest);
         void* real_src = src_is_segmented ? m3_ResolvePointer(memory, CAST_PTR curr_src) : curr_src;
 
         if ((dest_is_segmented && real_dest == ERROR_POINTER) || 
             (src_is_segmented && real_src == ERROR_POINTER)) {
             ESP_LOGE("WASM3", "m3_memcpy: Failed to resolve pointer - src: %p, dest: %p", 
                      curr_src, curr_dest);
+            if (dest_is_segmented) m3_UnpinSegment(memory, CAST_PTR curr_dest);
             return m3Err_malformedData;
         }
 
@@ -1952,6 +1715,7 @@ M3Result m3_memcpy(M3Memory* memory, void* dest, const void* src, size_t n) {
 
         // Perform copy for current chunk        
         memcpy(real_dest, real_src, copy_size);
+        if (dest_is_segmented) m3_UnpinSegment(memory, CAST_PTR curr_dest);
 
         // Update pointers and remaining count
         curr_src = (const char*)curr_src + copy_size;
@@ -1976,6 +1740,14 @@ M3Result m3_memset(M3Memory* memory, void* ptr, int value, size_t n) {
         return m3Err_malformedData;
     }
 
+    #if WASM_SEGMENTED_MEM_ENABLE_FLAT
+    if (m3_IsFlatMemory(memory)) {
+        void* real_ptr = ((uintptr_t)ptr < memory->total_size) ? memory->flat_base + (uintptr_t)ptr : ptr;
+        memset(real_ptr, value, n);
+        return NULL;
+    }
+    #endif
+
     if(!IsValidMemoryAccess(memory, (mos)ptr, n)){
         memset(ptr, value, n);
         return NULL;
@@ -2007,14 +1779,10 @@ M3Result m3_memset(M3Memory* memory, void* ptr, int value, size_t n) {
     return NULL;
 }
 
-#endif
-
 ////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////
 
-void* m3SegmentedMemAccess(IM3Memory memory, m3stack_t offset, size_t size) {
-    return (void*)m3_ResolvePointer(memory, (mos)(uintptr_t)offset);
-}
+// m3SegmentedMemAccess: see m3_segmented_memory.h (inlined translation cache fast path)
 
 
 ////////////////////////////////////////////////////////////////////////
@@ -2032,59 +1800,71 @@ void m3_collect_empty_segments(M3Memory* memory) {
         return;
     }
 
+    M3CollectPolicy* policy = &memory->collect_policy;
+    M3CollectStats* stats = &memory->collect_stats;
+    stats->calls++;
+
+    // Mantieni almeno un segmento (il primo)
+    if (memory->num_segments <= 1 || stats->empty_segments == 0) return;
+
+    bool low_heap = policy->min_free_heap && heap_caps_get_free_size(MALLOC_CAP_8BIT) < policy->min_free_heap;
+    if (stats->empty_segments <= policy->high_watermark && !low_heap) return;
+
+    stats->collections++;
+    size_t target = low_heap ? 0 : policy->low_watermark;
+
     if (WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-        ESP_LOGI("WASM3", "Starting empty segments collection");
+        ESP_LOGI("WASM3", "Starting empty segments collection (%zu empty, target %zu)", stats->empty_segments, target);
     }
 
+    // Resume where the previous call stopped: every call does at most scan_limit steps
     size_t freed_segments = 0;
     size_t freed_bytes = 0;
+    size_t scanned = 0;
+    while (scanned < policy->scan_limit && freed_segments < policy->max_per_call && stats->empty_segments > target) {
+        if (memory->collect_cursor >= memory->num_segments) memory->collect_cursor = 1;
 
-    // Mantieni almeno un segmento (il primo)
-    for (size_t i = 1; i < memory->num_segments; i++) {
-        MemorySegment* segment = memory->segments[i];
-        
-        if (!segment || !segment->data) {
+        MemorySegment* segment = memory->segments[memory->collect_cursor++];
+        scanned++;
+
+        if (!segment || !segment->data || !is_segment_empty(memory, segment)) {
             continue;
         }
 
-        if (is_segment_empty(memory, segment) && segment->data) {
-            if (WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-                ESP_LOGI("WASM3", "Freeing empty segment %zu", i);
-            }
-
-            // Dealloca i dati del segmento
-            deallocate_segment_data(memory, segment);
-            freed_segments++;
-            freed_bytes += segment->size;
-            
-            // Reset dei campi del segmento ma mantieni la struttura
-            segment->data = NULL;
-            segment->is_allocated = false;
-            segment->size = 0;
-            segment->first_chunk = NULL;
+        if (WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
+            ESP_LOGI("WASM3", "Freeing empty segment %u", segment->index);
         }
+
+        freed_bytes += segment->size;
+        deallocate_segment_data(memory, segment);
+        freed_segments++;
     }
 
+    stats->scanned_segments += scanned;
+    stats->reclaimed_segments += freed_segments;
+    stats->reclaimed_bytes += freed_bytes;
+
     if (WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
-        ESP_LOGI("WASM3", "Garbage collection completed: freed %zu segments (%zu bytes)", 
-                 freed_segments, freed_bytes);
-        
-        // Log dello stato della memoria dopo la GC
-        size_t total_allocated = 0;
-        size_t empty_segments = 0;
-        for (size_t i = 0; i < memory->num_segments; i++) {
-            if (memory->segments[i] && memory->segments[i]->data) {
-                total_allocated += memory->segments[i]->size;
-            } else {
-                empty_segments++;
-            }
-        }
-        ESP_LOGI("WASM3", "Memory status after GC: %zu empty segments, %zu bytes still allocated",
-                 empty_segments, total_allocated);
+        ESP_LOGI("WASM3", "Garbage collection step: freed %zu segments (%zu bytes), %zu still empty",
+                 freed_segments, freed_bytes, stats->empty_segments);
+    }
+}
+
+void m3_SetCollectPolicy(M3Memory* memory, const M3CollectPolicy* policy) {
+    if (!memory || memory->firm != INIT_FIRM || !policy) return;
+
+    memory->collect_policy = *policy;
+    if (memory->collect_policy.low_watermark > memory->collect_policy.high_watermark) {
+        memory->collect_policy.low_watermark = memory->collect_policy.high_watermark;
+    }
+    if (memory->collect_policy.scan_limit == 0) {
+        memory->collect_policy.scan_limit = 1;
     }
+}
 
-    // Aggiorna il contatore della memoria totale allocata
-    memory->total_allocated_size -= freed_bytes;
+void m3_GetCollectStats(M3Memory* memory, M3CollectStats* o_stats) {
+    if (!memory || memory->firm != INIT_FIRM || !o_stats) return;
+    *o_stats = memory->collect_stats;
 }
 
 static bool is_segment_empty(IM3Memory memory, MemorySegment* segment) {
@@ -2092,38 +1872,8 @@ static bool is_segment_empty(IM3Memory memory, MemorySegment* segment) {
         return true;
     }
 
-    // Verifica se ci sono chunk attivi
-    MemoryChunk* current = segment->first_chunk;
-    while (current) {
-        if (!current->is_free) {
-            // Trovato un chunk attivo
-            return false;
-        }
-        current = current->next;
-    }
-
-    // Verifica che nessun chunk multi-segmento di altri segmenti si estenda in questo
-    MemoryChunk** free_chunks = memory->free_chunks;
-    size_t num_buckets = memory->num_free_buckets;
-
-    for (size_t i = 0; i < num_buckets; i++) {
-        MemoryChunk* chunk = free_chunks[i];
-        while (chunk) {
-            if (chunk->num_segments > 1) {
-                // Calcola il range di segmenti occupati da questo chunk
-                size_t end_segment = chunk->start_segment + chunk->num_segments - 1;
-                
-                // Se questo segmento cade nel range del chunk multi-segmento
-                if (segment->index >= chunk->start_segment && 
-                    segment->index <= end_segment) {
-                    return false;
-                }
-            }
-            chunk = chunk->next;
-        }
-    }
-
-    return true;
+    // Only what m3_free gave back (pooled segments, free runs): guest pages are never collected
+    return segment->kind == c_m3SegKind_Pool;
 }
 
 static void deallocate_segment_data(IM3Memory memory, MemorySegment* segment) {
@@ -2141,16 +1891,28 @@ static void deallocate_segment_data(IM3Memory memory, MemorySegment* segment) {
         current = current->next;
     }
 
+    if (segment->kind == c_m3SegKind_Pool) memory->collect_stats.empty_segments--;
+
     // Libera i dati del segmento
+    m3_TlbInvalidateSegment(memory, segment->index);
+    #if WASM_SEGMENTED_MEM_ENABLE_FLAT
+    if (m3_IsFlatMemory(memory)) {
+        // Keep the mapping, give the pages back: they read as zero on next touch
+        madvise(segment->data, segment->size, MADV_DONTNEED);
+    }
+    else
+    #endif
     m3_Def_Free(segment->data);
     segment->data = NULL;
     memory->total_allocated_size -= segment->size;
     segment->size = 0;
     segment->is_allocated = false;
     segment->first_chunk = NULL;
+    segment->span_chunk = NULL;
+    segment->span_index = 0;
 
     #if WASM_SEGMENTED_MEM_ENABLE_HE_PAGES
-    paging_notify_segment_deallocation(memory->paging, segment->segment_page->segment_id);
+    if (segment->segment_page) paging_notify_segment_deallocation(memory->paging, segment->segment_page->segment_id);
     #endif
 
     if (WASM_DEBUG_SEGMENTED_MEMORY_ALLOC) {
@@ -2158,27 +1920,6 @@ static void deallocate_segment_data(IM3Memory memory, MemorySegment* segment) {
     }
 }
 
-// Helper per verificare se un segmento è parte di un chunk multi-segmento attivo
-static bool is_part_of_active_multisegment(M3Memory* memory, size_t segment_index) {
-    for (size_t i = 0; i < memory->num_segments; i++) {
-        MemorySegment* seg = memory->segments[i];
-        if (!seg || !seg->data) continue;
-
-        MemoryChunk* chunk = seg->first_chunk;
-        while (chunk) {
-            if (!chunk->is_free && chunk->num_segments > 1) {
-                size_t end_segment = chunk->start_segment + chunk->num_segments - 1;
-                if (segment_index >= chunk->start_segment && 
-                    segment_index <= end_segment) {
-                    return true;
-                }
-            }
-            chunk = chunk->next;
-        }
-    }
-    return false;
-}
-
 ////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////
@@ -2189,7 +1930,122 @@ MemoryChunk* get_chunk(M3Memory* memory, void* ptr) {
     return get_chunk_info(memory, ptr).chunk;
 }
 
+size_t m3_GetContiguousSpan(M3Memory* memory, mos offset, size_t len, ptr* o_host) {
+    if (!IsValidMemory(memory) || len == 0 || (u64)offset + len > m3_LinearMemorySize(memory)) return 0;
+
+    #if WASM_SEGMENTED_MEM_ENABLE_FLAT
+    if (m3_IsFlatMemory(memory)) {
+        *o_host = memory->flat_base + offset;
+        return len;
+    }
+    #endif
+
+    size_t to_boundary = memory->segment_size - (offset & (memory->segment_size - 1));
+    size_t span = MIN(len, to_boundary);
+
+    // Materializes the segment if it's part of a multi-segment chunk
+    if (!IsValidMemoryAccess(memory, offset, span)) return 0;
+
+    ptr host = m3SegmentedMemAccess(memory, (m3stack_t)(uintptr_t)offset, span);
+    if (host == ERROR_POINTER || m3_IsGuestOffset(host)) return 0;
+
+    *o_host = host;
+    return span;
+}
+
+#if !defined(_WIN32)
+
+// Entries may be unaligned and straddle a segment boundary
+static M3Result read_iov_field(M3Memory* memory, u64 offset, u32* o_value) {
+    u8* value = (u8*)o_value;
+    size_t done = 0;
+    while (done < sizeof(u32)) {
+        ptr host = NULL;
+        size_t span = m3_GetContiguousSpan(memory, (mos)(offset + done), sizeof(u32) - done, &host);
+        if (span == 0) return m3Err_trapOutOfBoundsMemoryAccess;
+        memcpy(value + done, host, span);
+        done += span;
+    }
+    M3_BSWAP_u32(*o_value);
+    return m3Err_none;
+}
+
+M3Result m3_CheckIovecs(M3Memory* memory, mos iovs, u32 count) {
+    if (!IsValidMemory(memory)) return m3Err_trapOutOfBoundsMemoryAccess;
+    u64 size = m3_LinearMemorySize(memory);
+
+    for (u32 i = 0; i < count; ++i) {
+        u64 entry = (u64)iovs + (u64)i * 2 * sizeof(u32);
+        if (entry + 2 * sizeof(u32) > size) return m3Err_trapOutOfBoundsMemoryAccess;
+
+        u32 buf, len;
+        if (read_iov_field(memory, entry, &buf) || read_iov_field(memory, entry + sizeof(u32), &len))
+            return m3Err_trapOutOfBoundsMemoryAccess;
+        if ((u64)buf + len > size) return m3Err_trapOutOfBoundsMemoryAccess;
+    }
+
+    return m3Err_none;
+}
+
+M3Result m3_FillIovecs(M3Memory* memory, M3IovCursor* io_cursor, struct iovec* o_iovs, int* o_count, size_t* o_total) {
+    int n = 0;
+    size_t total = 0;
+    M3Result result = m3Err_none;
+
+    // One pin per span, and at least one span per host iovec
+    while (io_cursor->index < io_cursor->count && io_cursor->numPinned < M3_HOST_IOV_MAX) {
+        u64 entry = (u64)io_cursor->iovs + (u64)io_cursor->index * 2 * sizeof(u32);
+        u32 buf, len;
+        if (read_iov_field(memory, entry, &buf) || read_iov_field(memory, entry + sizeof(u32), &len)) {
+            result = m3Err_trapOutOfBoundsMemoryAccess;
+            break;
+        }
+
+        if (io_cursor->pos >= len) {
+            io_cursor->index++;
+            io_cursor->pos = 0;
+            continue;
+        }
+
+        mos at = buf + io_cursor->pos;
+        ptr host = NULL;
+        size_t span = m3_GetContiguousSpan(memory, at, len - io_cursor->pos, &host);
+        if (span == 0) {
+            result = m3Err_trapOutOfBoundsMemoryAccess;
+            break;
+        }
+
+        // Translating the next spans may fault segments in and evict others: keep this one
+        m3_PinSegment(memory, at);
+        io_cursor->pinned[io_cursor->numPinned++] = at;
+
+        if (n > 0 && (u8*)o_iovs[n-1].iov_base + o_iovs[n-1].iov_len == (u8*)host) {
+            o_iovs[n-1].iov_len += span;
+        } else {
+            o_iovs[n].iov_base = host;
+            o_iovs[n].iov_len = span;
+            n++;
+        }
+
+        io_cursor->pos += span;
+        total += span;
+    }
+
+    *o_count = n;
+    *o_total = total;
+    return result;
+}
+
+void m3_ReleaseIovecs(M3Memory* memory, M3IovCursor* io_cursor) {
+    for (int i = 0; i < io_cursor->numPinned; ++i)
+        m3_UnpinSegment(memory, io_cursor->pinned[i]);
+
+    io_cursor->numPinned = 0;
+}
+
+#endif
+
 // Funzione helper per ottenere solo l'offset base
 mos get_chunk_base_offset(M3Memory* memory, void* ptr) {
     return get_chunk_info(memory, ptr).base_offset;
-}
\ No newline at end of file
+}
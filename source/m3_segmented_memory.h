@@ -11,21 +11,69 @@
 
 
 #define WASM_SEGMENTED_MEM_ENABLE_HE_PAGES 1
-#define m3_alloc_on_segment_data 0
+
+// Built-in clock pager (m3_pager.c) instead of the external he_memory component
+#if !defined(ESP_PLATFORM)
+#define WASM_SEGMENTED_MEM_BUILTIN_PAGER 1
+#else
+#define WASM_SEGMENTED_MEM_BUILTIN_PAGER 0
+#endif
 
 #if WASM_SEGMENTED_MEM_ENABLE_HE_PAGES
+#if WASM_SEGMENTED_MEM_BUILTIN_PAGER
+#include "m3_pager.h"
+#else
 #include "he_memory.h" 
 #endif
+#endif
 
 #define WASM_ENABLE_SPI_MEM 0
 
 #define WASM_INIT_SEGMENTS 64/4 // 64 KB // this solves the unrecognized M3Memory pointers
 #define WASM_SEGMENT_SIZE 4096
+#define WASM_SEGMENT_SIZE_SHIFT 12 // log2(WASM_SEGMENT_SIZE)
 #define WASM_CHUNK_SIZE 8  // Dimensione minima di un chunk di memoria
 
+// m3_malloc tiers: size-classed slabs, then buddy blocks inside one segment, then whole-segment runs
+#define WASM_SLAB_MIN_SHIFT 4      // smallest slab slot: 16 bytes
+#define WASM_SLAB_NUM_CLASSES 5    // 16, 32, 64, 128, 256
+#define WASM_SLAB_MAX_SIZE (1 << (WASM_SLAB_MIN_SHIFT + WASM_SLAB_NUM_CLASSES - 1))
+#define WASM_SLAB_BITMAP_WORDS ((WASM_SEGMENT_SIZE >> WASM_SLAB_MIN_SHIFT) / 32)
+#define WASM_BUDDY_UNIT_SHIFT 9    // buddy blocks: 512 B .. one segment
+#define WASM_BUDDY_UNITS (WASM_SEGMENT_SIZE >> WASM_BUDDY_UNIT_SHIFT)
+#define WASM_BUDDY_ORDERS 4        // log2(WASM_BUDDY_UNITS) + 1
+
 #define M3Memory_MaxPages 1024
 #define M3Memory_PageSize 64*1024
 
+// Guest offsets and host pointers travel in the same mos/ptr values. They are told apart by
+// construction: a guest offset is always below the guest window (the largest possible linear
+// memory), and the native heap never maps there (checked once in m3_InitMemory).
+#define WASM_GUEST_OFFSET_WINDOW ((uintptr_t)M3Memory_MaxPages * M3Memory_PageSize)
+#define m3_IsGuestOffset(VALUE) ((uintptr_t)(VALUE) < WASM_GUEST_OFFSET_WINDOW)
+#define WASM_MAX_SEGMENTS (WASM_GUEST_OFFSET_WINDOW >> WASM_SEGMENT_SIZE_SHIFT)
+
+// Empty-segment collection (defaults, see m3_SetCollectPolicy)
+#define WASM_COLLECT_HIGH_WATERMARK 8      // reclaimable segments tolerated before collecting
+#define WASM_COLLECT_LOW_WATERMARK 2       // a collection stops here
+#define WASM_COLLECT_MAX_PER_CALL 4        // segments reclaimed by one m3_collect_empty_segments
+#define WASM_COLLECT_SCAN_LIMIT 64         // segments examined by one m3_collect_empty_segments
+#define WASM_COLLECT_MIN_FREE_HEAP (16*1024) // below this, collect down to zero regardless of watermarks
+
+// Direct-mapped translation cache (segment index -> host base pointer)
+#define WASM_SEGMENTED_MEM_ENABLE_TLB 1
+#define WASM_SEGMENTED_MEM_TLB_ENTRIES 64 // must be a power of 2
+#define WASM_SEGMENTED_MEM_TLB_INVALID ((u32)-1)
+
+// Flat linear-memory backend: one reserved virtual region, segments become views into it.
+// Needs mmap, so it's only available on hosted (non ESP-IDF) Linux/macOS builds.
+#if !defined(ESP_PLATFORM) && (defined(__linux__) || defined(__APPLE__))
+#define WASM_SEGMENTED_MEM_ENABLE_FLAT 1
+#else
+#define WASM_SEGMENTED_MEM_ENABLE_FLAT 0
+#endif
+#define WASM_FLAT_MEM_GUARD_SIZE (64*1024) // PROT_NONE tail after the reservation
+
 #define INIT_FIRM 19942003
 #define DUMMY_MEMORY_FIRM  6991 // Dummy M3Memory firm (to use when there is a placeholder memory)
 #define M3PTR_FIRM 20190394
@@ -39,6 +87,7 @@ typedef struct MemoryChunk {
     uint16_t num_segments;     // Number of segments this chunk spans
     uint16_t start_segment;    // Starting segment index
     size_t* segment_sizes;     // Array of sizes in each segment
+    size_t* segment_offsets;   // Prefix sums of segment_sizes (num_segments + 1 entries, same allocation)
 } MemoryChunk;
 
 typedef struct ChunkInfo {
@@ -46,6 +95,62 @@ typedef struct ChunkInfo {
     u32 base_offset;
 } ChunkInfo;
 
+// Who owns a segment's address range
+typedef enum M3SegmentKind {
+    c_m3SegKind_Guest = 0,  // not handed out by m3_malloc
+    c_m3SegKind_Pool,       // released by m3_malloc, data can be collected
+    c_m3SegKind_Slab,
+    c_m3SegKind_Buddy,
+    c_m3SegKind_Run
+} M3SegmentKind;
+
+// Native bookkeeping of a slab or buddy segment (never stored in linear memory)
+typedef struct M3SegmentAlloc {
+    struct MemorySegment* next;     // partial slab list / buddy free list
+    struct MemorySegment* prev;
+    u8 size_class;                  // slab only
+    u8 list;                        // list the segment is in, WASM_ALLOC_NO_LIST when full
+    union {
+        struct {
+            u16 used;
+            u32 bitmap[WASM_SLAB_BITMAP_WORDS];     // 1 = slot in use
+        } slab;
+        struct {
+            u8 used_mask;                           // one bit per 512 B unit
+            u8 head_order[WASM_BUDDY_UNITS];        // order of the block starting at unit
+        } buddy;
+    };
+} M3SegmentAlloc;
+
+#define WASM_ALLOC_NO_LIST 0xFF
+
+typedef struct M3AllocatorStats {
+    size_t live_allocations;
+    size_t reserved_bytes;      // linear memory handed out, rounded to slot/block/run size
+    size_t metadata_bytes;      // native heap spent on allocator bookkeeping
+    size_t slab_segments;
+    size_t buddy_segments;
+    size_t run_segments;
+    size_t pooled_segments;
+} M3AllocatorStats;
+
+typedef struct M3CollectPolicy {
+    u32 high_watermark;
+    u32 low_watermark;
+    u32 max_per_call;
+    u32 scan_limit;
+    size_t min_free_heap;       // 0 disables the heap check
+} M3CollectPolicy;
+
+typedef struct M3CollectStats {
+    size_t empty_segments;      // pooled segments still holding data
+    size_t calls;
+    size_t collections;         // calls that crossed a watermark
+    size_t scanned_segments;
+    size_t reclaimed_segments;
+    size_t reclaimed_bytes;
+} M3CollectStats;
+
 typedef struct MemorySegment {    
     int firm;
 
@@ -55,15 +160,32 @@ typedef struct MemorySegment {
     u32 index;  
     MemoryChunk* first_chunk;  // Primo chunk nel segmento
 
+    // Redirect table entry: multi-segment chunk covering this segment (NULL if none)
+    MemoryChunk* span_chunk;
+    uint16_t span_index;       // position of this segment inside span_chunk
+
+    u8 kind;                   // M3SegmentKind
+    M3SegmentAlloc* alloc;     // slab/buddy bookkeeping (NULL otherwise)
+    MemoryChunk* free_run;     // free run this segment begins or ends (NULL otherwise)
+    u32 pool_slot;             // position in M3Memory.pool while pooled
+
     #if WASM_SEGMENTED_MEM_ENABLE_HE_PAGES
     segment_info_t* segment_page;
     #endif
 } MemorySegment;
 
+#if WASM_SEGMENTED_MEM_ENABLE_TLB
+typedef struct M3MemoryTlbEntry {
+    u32 segment_index;      // WASM_SEGMENTED_MEM_TLB_INVALID if empty
+    u8* base;               // host address of the segment's offset 0
+} M3MemoryTlbEntry;
+#endif
+
 typedef struct M3Memory_t {  
     int firm;
 
     IM3Runtime runtime;
+    void* maxStack;             // end of the runtime value stack (checked in op_Entry)
     u32 numPages;
     u32 maxPages;
     u32 pageSize;
@@ -77,12 +199,36 @@ typedef struct M3Memory_t {
     size_t total_requested_size;
     
     // Cache per ottimizzare la ricerca di chunk liberi
-    MemoryChunk** free_chunks;  // Array di puntatori a chunk liberi per size
+    MemoryChunk** free_chunks;  // free runs of two or more segments, by floor(log2(num_segments))
     size_t num_free_buckets;    
 
+    // Sub-segment allocator
+    MemorySegment* slab_partial[WASM_SLAB_NUM_CLASSES];    // slabs with at least one free slot
+    MemorySegment* buddy_free[WASM_BUDDY_ORDERS];          // by largest free aligned block
+    u32* pool;                  // released single segments, no free neighbour (LIFO)
+    size_t pool_count;
+    size_t pool_capacity;
+    M3AllocatorStats alloc_stats;
+
+    M3CollectPolicy collect_policy;
+    M3CollectStats collect_stats;
+    size_t collect_cursor;      // next segment examined by the collector
+
     #if WASM_SEGMENTED_MEM_ENABLE_HE_PAGES
     paging_stats_t* paging;
     #endif
+
+    #if WASM_SEGMENTED_MEM_ENABLE_TLB
+    M3MemoryTlbEntry tlb[WASM_SEGMENTED_MEM_TLB_ENTRIES];
+    size_t tlb_misses;
+    #endif
+
+    M3MemoryBackend backend;
+    #if WASM_SEGMENTED_MEM_ENABLE_FLAT
+    u8* flat_base;              // reserved region (NULL with the segmented backend)
+    size_t flat_reserved;       // addressable bytes, guard excluded
+    size_t flat_committed;      // bytes currently PROT_READ|PROT_WRITE
+    #endif
 } M3Memory;
 
 typedef M3Memory *          IM3Memory;
@@ -99,6 +245,7 @@ typedef M3MemoryPoint *          IM3MemoryPoint;
 ////////////////////////////////
 IM3Memory m3_NewMemory();
 IM3Memory m3_InitMemory(IM3Memory memory);
+IM3Memory m3_InitMemoryWithBackend(IM3Memory memory, M3MemoryBackend backend);
 void FreeMemory(IM3Memory memory);
 bool IsValidMemory(IM3Memory memory);
 
@@ -116,9 +263,59 @@ M3Result GrowMemory(M3Memory* memory, size_t additional_size);
 bool IsValidMemoryAccess(IM3Memory memory, mos offset, size_t size);
 ptr get_segment_pointer(IM3Memory memory, mos offset);
 ptr m3_ResolvePointer(M3Memory* memory, mos offset);
-void* m3SegmentedMemAccess(IM3Memory mem, m3stack_t offset, size_t size);
 mos get_offset_pointer(IM3Memory memory, void* ptr);
 
+/// Translation cache
+/// Every path that changes a segment's host address (allocation, collection,
+/// pager eviction) must invalidate its entry.
+void m3_TlbFlush(IM3Memory memory);
+void m3_TlbInvalidateSegment(IM3Memory memory, size_t segment_index);
+
+#if WASM_SEGMENTED_MEM_ENABLE_FLAT
+#define m3_IsFlatMemory(memory) ((memory)->flat_base != NULL)
+#else
+#define m3_IsFlatMemory(memory) false
+#endif
+
+#if WASM_SEGMENTED_MEM_ENABLE_TLB
+static inline ptr m3_TlbLookup(IM3Memory memory, mos offset) {
+    u32 index = (u32)(offset >> WASM_SEGMENT_SIZE_SHIFT);
+    M3MemoryTlbEntry* entry = &memory->tlb[index & (WASM_SEGMENTED_MEM_TLB_ENTRIES - 1)];
+    if (M3_LIKELY(entry->segment_index == index)) {
+        return entry->base + (offset & (WASM_SEGMENT_SIZE - 1));
+    }
+    return NULL;
+}
+#endif
+
+static inline void* m3SegmentedMemAccess(IM3Memory memory, m3stack_t offset, size_t size) {
+    if (M3_UNLIKELY(memory == NULL)) return (void*)offset;
+
+    #if WASM_SEGMENTED_MEM_ENABLE_FLAT
+    if (m3_IsFlatMemory(memory) && (uintptr_t)offset < memory->total_size) {
+        return memory->flat_base + (uintptr_t)offset;
+    }
+    #endif
+
+    if (!m3_IsGuestOffset(offset)) return (void*)offset;
+
+    #if WASM_SEGMENTED_MEM_ENABLE_TLB
+    mos off = (mos)(uintptr_t)offset;
+    if (M3_LIKELY(off < memory->total_size)) {
+        ptr hit = m3_TlbLookup(memory, off);
+        if (M3_LIKELY(hit != NULL)) return hit;
+    }
+    #endif
+    return (void*)m3_ResolvePointer(memory, (mos)(uintptr_t)offset);
+}
+
+// Bytes the guest may address: memory.size pages. InitMemory and ResizeMemory create the segments
+// up to it (their data is allocated on first touch); total_size can be larger, since m3_malloc
+// appends segments of its own, so this is the bound for wasm accesses.
+static inline u64 m3_LinearMemorySize(IM3Memory memory) {
+    return (u64)memory->numPages * memory->pageSize;
+}
+
 /// Regions 
 ptr m3_malloc(M3Memory* memory, size_t size);
 void m3_free(M3Memory* memory, ptr ptr);
@@ -127,10 +324,57 @@ ptr m3_realloc(M3Memory* memory, ptr ptr, size_t new_size);
 M3Result m3_memset(M3Memory* memory, void* ptr, int value, size_t n);
 M3Result m3_memcpy(M3Memory* memory, void* dest, const void* src, size_t n);
 
+/// Pinning
+// Keeps the segment holding offset resident while a host pointer into it is in use, so
+// resolving other offsets can't evict it (builtin pager only). Pins nest; unpin each one.
+void m3_PinSegment(M3Memory* memory, mos offset);
+void m3_UnpinSegment(M3Memory* memory, mos offset);
+
+/// Scatter/gather
+// Host address of guest offset and how many of the next len bytes are contiguous there
+// (up to the end of its segment, or all of them with the flat backend). 0 if unmapped or if
+// the len bytes run past the end of memory.
+size_t m3_GetContiguousSpan(M3Memory* memory, mos offset, size_t len, ptr* o_host);
+
+// Guest iovec arrays (WASI layout: a u32 buf offset and a u32 buf_len per entry) translated into
+// host iovecs for readv/writev. Buffers are split at segment boundaries, so one that crosses a
+// segment never spills into unrelated host memory, and adjacent host runs are merged back
+// together (always the case with the flat backend).
+#define M3_HOST_IOV_MAX     64
+
+typedef struct M3IovCursor
+{
+    mos     iovs;                       // guest offset of the entry array
+    u32     count;
+    u32     index;                      // entry being translated
+    size_t  pos;                        // bytes of it already translated
+    int     numPinned;                  // segments pinned by the current batch until its I/O is done
+    mos     pinned [M3_HOST_IOV_MAX];
+}
+M3IovCursor;
+
+struct iovec;
+
+// Every entry and every buffer must lie inside linear memory (memory.size). Checked for the whole
+// array before the first batch, so a bad entry traps before anything reaches the fd.
+M3Result m3_CheckIovecs(M3Memory* memory, mos iovs, u32 count);
+// Next batch of at most M3_HOST_IOV_MAX host iovecs, their segments pinned; o_count is 0 once
+// every entry is done. Release the batch when its I/O is over, also after an error.
+M3Result m3_FillIovecs(M3Memory* memory, M3IovCursor* io_cursor, struct iovec* o_iovs, int* o_count, size_t* o_total);
+void m3_ReleaseIovecs(M3Memory* memory, M3IovCursor* io_cursor);
+
 /// Garbage collection
+// Incremental: reclaims a bounded number of empty segments, and only past the high watermark
+// (or when the free heap runs low). Called by m3_free.
 void m3_collect_empty_segments(M3Memory* memory);
+void m3_SetCollectPolicy(M3Memory* memory, const M3CollectPolicy* policy);
+void m3_GetCollectStats(M3Memory* memory, M3CollectStats* o_stats);
 
 /// Memory chunks
 ChunkInfo get_chunk_info(M3Memory* memory, void* ptr);
 
+/// Allocator statistics
+void m3_GetAllocatorStats(M3Memory* memory, M3AllocatorStats* o_stats);
+void m3_PrintAllocatorStats(M3Memory* memory);
+
 static u8 ERROR_POINTER[sizeof(u64)] __attribute__((aligned(8)));
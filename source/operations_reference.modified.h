@@ -19,8 +19,8 @@ const M3OpInfo c_operations [] =
     M3OP( "return", 10, 0,  any,    d_logOp (Return),                   Compile_Return ),       // 0x0a
     M3OP( "call", 11, 0,  any,    d_logOp (Call),                     Compile_Call ),         // 0x0b
     M3OP( "call_indirect", 12, 0,  any,    d_logOp (CallIndirect),             Compile_CallIndirect ), // 0x0c
-    M3OP( "return_call", 13, 0,  any,    d_emptyOpList,                      Compile_Call ),         // 0x0d
-    M3OP( "return_call_indirect", 14, 0,  any,    d_emptyOpList,                      Compile_CallIndirect ), // 0x0e
+    M3OP( "return_call", 13, 0,  any,    d_logOp (ReturnCall),               Compile_ReturnCall ),   // 0x0d
+    M3OP( "return_call_indirect", 14, 0,  any,    d_logOp (ReturnCallIndirect),       Compile_ReturnCall ),   // 0x0e
 
     M3OP_RESERVED,  M3OP_RESERVED,                                                                      // 0x14...
     M3OP_RESERVED,  M3OP_RESERVED, M3OP_RESERVED, M3OP_RESERVED,                                        // ...0x19
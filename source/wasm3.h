@@ -41,7 +41,8 @@
 ////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////
 
-#define M3Runtime_Stack_Segmented 1
+// Value stack on the native heap: slots are plain pointers, only guest memory goes through the resolver
+#define M3Runtime_Stack_Segmented 0
 
 #define M3CodePage_RemoveCodePageOfCapacity_FreePage 0
 
@@ -177,6 +178,13 @@ typedef enum M3ValueType
     c_m3Type_unknown
 } M3ValueType;
 
+typedef enum M3MemoryBackend
+{
+    c_m3MemoryBackend_Segmented = 0,    // 4 KB segments allocated on demand (default)
+    c_m3MemoryBackend_Flat      = 1     // single mmap'd region, hosted Linux/macOS only; never paged out
+
+} M3MemoryBackend;
+
 typedef struct M3TaggedValue
 {
     M3ValueType type;
@@ -216,7 +224,7 @@ M3ImportContext, * IM3ImportContext;
 #     define d_m3ErrorConst(LABEL, STRING)      const M3Result m3Err_##LABEL = { STRING };
 #   endif
 # else
-#   define d_m3ErrorConst(LABEL, STRING)        static const M3Result m3Err_##LABEL;
+#   define d_m3ErrorConst(LABEL, STRING)        extern const M3Result m3Err_##LABEL;
 # endif
 
 // -------------------------------------------------------------------------------------------------------------------------------
@@ -279,6 +287,19 @@ d_m3ErrorConst  (nullRuntime,                   "runtime is null")
 d_m3ErrorConst  (nullSegmentData,               "unable to allocate segment data")
 d_m3ErrorConst  (nullPointer,                   "null pointer")
 d_m3ErrorConst  (malformedData,                  "malformed data")
+d_m3ErrorConst  (codeCacheMiss,                 "no code cache for this module and build")
+d_m3ErrorConst  (codeCacheCorrupt,              "malformed code cache")
+d_m3ErrorConst  (codeCacheUnrelocatable,        "compiled code holds a pointer the code cache can't relocate")
+d_m3ErrorConst  (compileThreadFailed,           "unable to start a compile thread")
+d_m3ErrorConst  (noSuspendedCall,               "no suspended call to resume")
+d_m3ErrorConst  (callSuspended,                 "a suspended call must be resumed or cancelled first")
+d_m3ErrorConst  (suspendUnderHostCall,          "an import can't suspend a call made from a host function")
+d_m3ErrorConst  (runtimeScheduled,              "the runtime already has a scheduled call")
+d_m3ErrorConst  (executorThreadFailed,          "unable to start an executor thread")
+
+// not an error: an async import (d_m3EnableAsyncImports) or the end of the time slice (d_m3EnableTimeSlicing)
+// parked the call, m3_Resume continues it
+d_m3ErrorConst  (suspended,                     "[suspended] the call is parked until m3_Resume")
 
 // traps
 d_m3ErrorConst  (trapOutOfBoundsMemoryAccess,   "[trap] out of bounds memory access")
@@ -318,6 +339,13 @@ d_m3ErrorConst  (trapStackOverflow,             "[trap] stack overflow")
                                                      uint32_t               i_stackSizeInBytes,
                                                      void *                 i_userdata);
 
+    // Falls back to the segmented backend when the requested one isn't available on this host
+    IM3Runtime          m3_NewRuntimeWithMemoryBackend
+                                                    (IM3Environment         io_environment,
+                                                     uint32_t               i_stackSizeInBytes,
+                                                     void *                 i_userdata,
+                                                     M3MemoryBackend        i_memoryBackend);
+
     void                m3_FreeRuntime              (IM3Runtime             i_runtime);
 
     // Wasm currently only supports one memory region. i_memoryIndex should be zero.
@@ -342,6 +370,30 @@ d_m3ErrorConst  (trapStackOverflow,             "[trap] stack overflow")
                                                      uint32_t               i_numWasmBytes);*/
     M3Result  m3_ParseModule  (IM3Environment i_environment, IM3Module * o_module, cbytes_t i_bytes, u32 i_numBytes, IM3Runtime o_runtime);
 
+    // Streaming parse (d_m3EnableStreamingParse): the module is fed in pieces of any size as it arrives (network, flash pages)
+    // and only what must outlive the parse is copied: function bodies, globals, elements and data. The bytes passed to
+    // m3_ParseModuleFeed can be reused as soon as it returns. Memory is requested from i_runtime as with m3_ParseModule.
+    typedef struct M3ParseStream *  IM3ParseStream;
+
+    typedef struct M3ParseStats
+    {
+        uint32_t            peakBytes;                  // parser state and the largest section buffered, at once
+        uint32_t            keptBytes;                  // copied into the module: function bodies and the kept sections
+        uint32_t            numCompiled;                // functions compiled while the code section arrived
+    }
+    M3ParseStats;
+
+    // Optional: called once the imports are known, before the first function body. When it links them (m3_LinkRawFunction
+    // works on a module not loaded yet), each body is compiled as soon as it has arrived, while the rest is still on its way.
+    typedef M3Result (* M3LinkImports) (IM3Module io_module, void * i_userdata);
+
+    M3Result            m3_ParseModuleBegin         (IM3Environment i_environment, IM3Runtime i_runtime, M3LinkImports i_linkImports,
+                                                     void * i_userdata, IM3ParseStream * o_stream);
+    // After an error, the stream only waits for m3_ParseModuleFinish, which returns it again
+    M3Result            m3_ParseModuleFeed          (IM3ParseStream io_stream, cbytes_t i_bytes, u32 i_numBytes);
+    // Frees the stream. o_stats is optional
+    M3Result            m3_ParseModuleFinish        (IM3ParseStream i_stream, IM3Module * o_module, M3ParseStats * o_stats);
+
     // Only modules not loaded into a M3Runtime need to be freed. A module is considered unloaded if
     // a. m3_LoadModule has not yet been called on that module. Or,
     // b. m3_LoadModule returned a result.
@@ -353,6 +405,27 @@ d_m3ErrorConst  (trapStackOverflow,             "[trap] stack overflow")
     // Optional, compiles all functions in the module
     M3Result            m3_CompileModule            (IM3Module io_module);
 
+    // Compiled code cache (d_m3EnableCodeCache): <directory>/<hash of the wasm bytes>.m3cc, valid only for the configuration and d_m3CodeCacheBuildTag that wrote it.
+    // Load after m3_LoadModule and after linking the imports; on m3Err_codeCacheMiss compile as usual, then save.
+    M3Result            m3_LoadCodeCache            (IM3Module io_module, const char * i_directory);
+    // Saves the functions compiled so far: call m3_CompileModule first for a complete cache
+    M3Result            m3_SaveCodeCache            (IM3Module i_module, const char * i_directory);
+
+    // Background compilation (d_m3EnableParallelCompile): compiles the functions on i_numThreads worker threads (0 for the
+    // default) while the caller goes on, e.g. with m3_RunStart. i_hotOnly limits it to the start function and the exports.
+    // Call after m3_LoadModule and after linking the imports. Without d_m3EnableParallelCompile the caller compiles.
+    M3Result            m3_CompileModuleInBackground    (IM3Module io_module, uint32_t i_numThreads, bool i_hotOnly);
+    // Joins the workers; returns the first error of a background compile (that function is compiled again when called)
+    M3Result            m3_WaitForBackgroundCompile     (IM3Runtime i_runtime);
+
+    // Code release (d_m3EnableCodePageRefCounting). Call between calls, with no wasm function on the stack; with a
+    // parked call (d_m3EnableAsyncImports) both return m3Err_callSuspended until it is resumed or cancelled.
+    // Unloads and frees a loaded module, with the code pages only its functions used. Nothing may call into it anymore
+    M3Result            m3_UnloadModule             (IM3Module i_module);
+    // Above i_maxCodePages, releases the code of the functions not entered since the previous call (they compile again
+    // when called) and frees the pages left empty. o_numPagesFreed is optional
+    M3Result            m3_ReleaseColdCode          (IM3Runtime io_runtime, uint32_t i_maxCodePages, uint32_t * o_numPagesFreed);
+
     // Calling m3_RunStart is optional
     M3Result            m3_RunStart                 (IM3Module i_module);
 
@@ -419,6 +492,61 @@ d_m3ErrorConst  (trapStackOverflow,             "[trap] stack overflow")
     M3Result            m3_GetResultsVL             (IM3Function i_function, va_list o_rets);
     M3Result            m3_GetResults               (IM3Function i_function, uint32_t i_retc, const void * o_retptrs[]);
 
+    // Async imports (d_m3EnableAsyncImports): a raw import that can't answer yet (a read on a socket or a UART) returns
+    // m3ApiSuspend (). The call then returns m3Err_suspended with the guest parked in the runtime, holding no native stack;
+    // no other call can start on that runtime until it's resumed or cancelled. Only calls made by the embedder can park.
+    // So can the start function, which m3_Call may run first: the function called has then not begun once it's resumed.
+    // The import that parked the call, NULL if none (or if the call ran out of its time slice)
+    IM3Function         m3_GetSuspendedImport       (IM3Runtime i_runtime);
+    // Stores the import's results (as m3_Call takes arguments; none after a time slice) and runs the guest on. Returns as
+    // the call would have, m3Err_suspended included; m3_GetResults then reads the results of the function the embedder called
+    M3Result            m3_Resume                   (IM3Runtime io_runtime, uint32_t i_retc, const void * i_retptrs[]);
+    // Drops the parked call: the guest doesn't finish
+    void                m3_CancelSuspended          (IM3Runtime io_runtime);
+
+    // Time slicing (d_m3EnableTimeSlicing, implies the above): each function entry, tail call and loop iteration spends
+    // one unit of the runtime's slice. When it's spent the call is parked as by an async import, and m3_Resume (no results)
+    // gives it a new slice. 0 (the default) is no limit. Calls made by host functions back into wasm run to their end.
+    void                m3_SetTimeSlice             (IM3Runtime io_runtime, uint32_t i_budget);
+
+    // Scheduler: interleaves calls on many runtimes, one call per runtime, from a single thread. The highest priority call
+    // ready to run gets the next slice; calls of equal priority take turns. A call parked by an async import waits until
+    // m3_WakeScheduledCall hands it the import's results. Without d_m3EnableTimeSlicing a slice lasts until the call ends or waits.
+    typedef struct M3Scheduler *    IM3Scheduler;
+
+    // Called once the call has returned, trapped or failed to start; m3_GetResults reads its results from here
+    typedef void (* M3ScheduledCallEnded) (IM3Function i_function, M3Result i_result, void * i_userdata);
+
+    IM3Scheduler        m3_NewScheduler             (void);
+    // Cancels the calls still scheduled, without calling their M3ScheduledCallEnded
+    void                m3_FreeScheduler            (IM3Scheduler i_scheduler);
+    // The arguments are copied. i_timeSlice as with m3_SetTimeSlice, which the runtime keeps. i_ended is optional
+    M3Result            m3_ScheduleCall             (IM3Scheduler io_scheduler, IM3Function i_function, uint32_t i_priority,
+                                                     uint32_t i_timeSlice, uint32_t i_argc, const void * i_argptrs[],
+                                                     M3ScheduledCallEnded i_ended, void * i_userdata);
+    // The call on i_runtime waits for an import: these are its results (copied), it runs again in a later slice
+    M3Result            m3_WakeScheduledCall        (IM3Scheduler io_scheduler, IM3Runtime i_runtime,
+                                                     uint32_t i_retc, const void * i_retptrs[]);
+    // Runs up to i_maxSlices slices (0: until no call is ready). Returns the number of calls left, ready or waiting
+    uint32_t            m3_RunScheduler             (IM3Scheduler io_scheduler, uint32_t i_maxSlices);
+
+    // Executor (d_m3EnableExecutor): runs jobs on a thread per runtime. The runtimes are prepared by the host (same modules
+    // loaded and linked, typically) and are only used by their thread until m3_FreeExecutor; the host still frees them after.
+    // A job goes to any idle thread and gets that thread's runtime: it finds its function there and calls it. Jobs submitted
+    // by a job stay with its thread (last in, first out) unless an idle thread steals them, oldest first.
+    // Without d_m3EnableExecutor there is no thread: m3_SubmitJob runs the job at once on the first runtime.
+    typedef struct M3Executor *     IM3Executor;
+
+    typedef void (* M3ExecutorJob) (IM3Runtime i_runtime, void * i_userdata);
+
+    M3Result            m3_NewExecutor              (IM3Executor * o_executor, IM3Runtime * i_runtimes, uint32_t i_numRuntimes);
+    // Waits for the jobs submitted, then joins the threads
+    void                m3_FreeExecutor             (IM3Executor i_executor);
+    // Thread safe: any thread, a job's included, can submit
+    M3Result            m3_SubmitJob                (IM3Executor io_executor, M3ExecutorJob i_job, void * i_userdata);
+    // Returns once every job submitted so far has run; not from a job
+    void                m3_WaitForJobs              (IM3Executor io_executor);
+
 
     void                m3_GetErrorInfo             (IM3Runtime i_runtime, M3ErrorInfo* o_info);
     void                m3_ResetErrorInfo           (IM3Runtime i_runtime);
@@ -433,6 +561,8 @@ d_m3ErrorConst  (trapStackOverflow,             "[trap] stack overflow")
     void                m3_PrintRuntimeInfo         (IM3Runtime i_runtime);
     void                m3_PrintM3Info              (void);
     void                m3_PrintProfilerInfo        (void);
+    // Writes the op n-gram counts of d_m3EnableOpProfiling (input of scripts/generate_wasm_ops.py --ngrams)
+    M3Result            m3_WriteProfilerInfo        (const char * i_path);
 
     // The runtime owns the backtrace, do not free the backtrace you obtain. Returns NULL if there's no backtrace.
     IM3BacktraceInfo    m3_GetBacktrace             (IM3Runtime i_runtime);
@@ -462,10 +592,16 @@ typedef void* ptr; //todo: check it
 #define m3ApiOffsetToPtr(offset)              m3_ResolvePointer(_mem, offset)
 #define m3ApiPtrToOffset(ptr)                 get_offset_pointer(_mem, ptr)
 
-#define m3ApiReturnType(TYPE)                 TYPE* raw_return = ((TYPE*) (m3ApiOffsetToPtr((mos)(uintptr_t)_sp++)));
-#define m3ApiMultiValueReturnType(TYPE, NAME) TYPE* NAME = ((TYPE*) (m3ApiOffsetToPtr((mos)(uintptr_t)_sp++)));
-#define m3ApiGetArg(TYPE, NAME)               TYPE NAME = *((TYPE *) (m3ApiOffsetToPtr((mos)(uintptr_t)_sp++)));
-#define m3ApiGetBaseArg(TYPE, NAME)           TYPE NAME = (TYPE)(*(void**)(m3ApiOffsetToPtr((mos)(uintptr_t)_sp++)));
+#if M3Runtime_Stack_Segmented
+#define m3ApiStackPtr(SP)                     m3ApiOffsetToPtr((mos)(uintptr_t)(SP))
+#else
+#define m3ApiStackPtr(SP)                     ((void*)(SP))
+#endif
+
+#define m3ApiReturnType(TYPE)                 TYPE* raw_return = ((TYPE*) (m3ApiStackPtr(_sp++)));
+#define m3ApiMultiValueReturnType(TYPE, NAME) TYPE* NAME = ((TYPE*) (m3ApiStackPtr(_sp++)));
+#define m3ApiGetArg(TYPE, NAME)               TYPE NAME = *((TYPE *) (m3ApiStackPtr(_sp++)));
+#define m3ApiGetBaseArg(TYPE, NAME)           TYPE NAME = (TYPE)(*(void**)(m3ApiStackPtr(_sp++)));
 
 #define _m3ApiReturnType(TYPE)                 TYPE* raw_return = ((TYPE*) (_sp++));
 #define _m3ApiMultiValueReturnType(TYPE, NAME) TYPE* NAME = ((TYPE*) (_sp++));
@@ -473,13 +609,17 @@ typedef void* ptr; //todo: check it
 #define _m3ApiGetBaseArg(TYPE, NAME)           TYPE NAME = (TYPE)(*(ptr*)(_sp++));
 
 //#define m3ApiGetArgMem(TYPE, NAME)            TYPE NAME = (TYPE)m3ApiOffsetToPtr((uintptr_t)(* ((uint32_t *) (_sp++)))); 
+#if M3Runtime_Stack_Segmented
 #define m3ApiGetArgMem(TYPE, NAME)            TYPE NAME = ((TYPE) m3ApiOffsetToPtr(_sp++));
 #define m3ApiGetArgArgs(TYPE, NAME, PTR)            TYPE NAME = ((TYPE) m3ApiOffsetToPtr(PTR++));
-
-#define m3ApiTrap(VALUE)                      return VALUE
+#else
+// the slot holds a guest offset: only that goes through the resolver
+#define m3ApiGetArgMem(TYPE, NAME)            TYPE NAME = ((TYPE) m3ApiOffsetToPtr(* ((uint32_t *) (_sp++))));
+#define m3ApiGetArgArgs(TYPE, NAME, PTR)            TYPE NAME = ((TYPE) m3ApiOffsetToPtr(* ((uint32_t *) (PTR++))));
+#endif
 
 // Native functions arguments access design
-#define m3_GetArgs()            uint64_t* args = (uint64_t*) m3ApiOffsetToPtr(CAST_PTR _sp++); int narg = 0
+#define m3_GetArgs()            uint64_t* args = (uint64_t*) m3ApiStackPtr(_sp++); int narg = 0
 #define m3_GetReturn(TYPE)      TYPE* raw_return = ((TYPE*) &args[narg++])
 #define m3_GetArg(TYPE, NAME)   TYPE NAME = (TYPE) args[narg++]
 
@@ -495,6 +635,7 @@ typedef void* ptr; //todo: check it
 # define m3ApiMultiValueReturn(NAME, VALUE)   { *NAME = (VALUE); }
 # define m3ApiTrap(VALUE)                     { return VALUE; }
 # define m3ApiSuccess()                       { return m3Err_none; }
+# define m3ApiSuspend()                       { return m3Err_suspended; }   // results come with m3_Resume
 
 # if defined(M3_BIG_ENDIAN)
 #  define m3ApiReadMem8(ptr)         (* (uint8_t *)(ptr))
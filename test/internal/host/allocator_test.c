@@ -0,0 +1,180 @@
+//
+//  allocator_test.c
+//
+//  m3_malloc/m3_free: released segments merge with their free neighbours and are
+//  reused (by every tier) before new segments are appended, so a long random mix
+//  of sizes stays close to its live footprint and inside the guest window, which
+//  neither the allocator nor memory growth may cross.
+//
+
+#include "m3_host_test.h"
+#include "m3_segmented_memory.h"
+
+#define c_numSlots      512
+#define c_liveLimit     (1536 * 1024)
+#define c_numOps        20000
+
+typedef struct Allocation
+{
+    ptr     offset;
+    size_t  size;
+    u8      tag;
+}
+Allocation;
+
+static u32 s_random = 0x12345678;
+
+static u32 Random (void)
+{
+    s_random ^= s_random << 13;
+    s_random ^= s_random >> 17;
+    s_random ^= s_random << 5;
+    return s_random;
+}
+
+static size_t RandomSize (void)
+{
+    u32 kind = Random () % 10;
+    if (kind < 5) return 1 + Random () % 256;               // slabs
+    if (kind < 8) return 257 + Random () % 3840;            // buddy blocks
+    return 4097 + Random () % (60 * 1024);                  // runs
+}
+
+// first, middle and last byte still carry the allocation's tag
+static bool CheckTag (IM3Memory memory, Allocation * a)
+{
+    size_t at [3] = { 0, a->size / 2, a->size - 1 };
+    for (int i = 0; i < 3; i++)
+    {
+        u8 byte = 0;
+        m3_memcpy (memory, & byte, (u8 *) a->offset + at [i], 1);
+        if (byte != a->tag) return false;
+    }
+    return true;
+}
+
+
+int  main  (int argc, const char  * argv [])
+{
+    Test (allocator.stress)
+    {
+        IM3Memory memory = m3_NewMemory ();
+        static Allocation slots [c_numSlots];
+        memset (slots, 0, sizeof (slots));
+
+        size_t live = 0, peak = 0;
+        int outside = 0, corrupted = 0, failed = 0;
+
+        for (int op = 0; op < c_numOps; op++)
+        {
+            Allocation * a = & slots [Random () % c_numSlots];
+            if (a->offset)
+            {
+                if (not CheckTag (memory, a)) corrupted++;
+                m3_free (memory, a->offset);
+                live -= a->size;
+                a->offset = NULL;
+            }
+            else
+            {
+                size_t size = RandomSize ();
+                if (live + size > c_liveLimit) continue;
+
+                a->offset = m3_malloc (memory, size);
+                if (not a->offset) { failed++; continue; }
+
+                if (not m3_IsGuestOffset ((u8 *) a->offset + size)) outside++;
+                a->size = size;
+                a->tag = (u8) (op | 1);
+                m3_memset (memory, a->offset, a->tag, size);
+                live += size;
+                peak = M3_MAX (peak, live);
+            }
+        }
+                                                                        expect (failed == 0)
+                                                                        expect (outside == 0)
+                                                                        expect (corrupted == 0)
+        // slack for slab/buddy rounding and partly used segments, not for leaked ones
+        size_t linear = memory->num_segments * memory->segment_size;
+                                                                        expect (linear < 2 * peak + 256 * 1024)
+        printf ("peak live %zu KB, %zu segments (%zu KB)\n", peak / 1024, memory->num_segments, linear / 1024);
+
+        for (int i = 0; i < c_numSlots; i++)
+            if (slots [i].offset) m3_free (memory, slots [i].offset);
+
+        M3AllocatorStats stats;
+        m3_GetAllocatorStats (memory, & stats);
+                                                                        expect (stats.live_allocations == 0)
+                                                                        expect (stats.run_segments == 0)
+        FreeMemory (memory);
+        m3_Def_Free (memory);
+    }
+
+    Test (allocator.merge)
+    {
+        IM3Memory memory = m3_NewMemory ();
+        const size_t S = memory->segment_size;
+
+        ptr a = m3_malloc (memory, 20 * S);
+        ptr b = m3_malloc (memory, 20 * S);
+        ptr c = m3_malloc (memory, 20 * S);
+        ptr guard = m3_malloc (memory, 20 * S);
+        size_t segments = memory->num_segments;
+                                                                        expect ((u8 *) b == (u8 *) a + 20 * S and (u8 *) c == (u8 *) b + 20 * S)
+        m3_free (memory, a);
+        m3_free (memory, c);
+        m3_free (memory, b);
+
+        // a, b and c are one free run again: a run as long as the three fits in it
+        ptr abc = m3_malloc (memory, 60 * S);
+                                                                        expect (abc == a)
+                                                                        expect (memory->num_segments == segments)
+        m3_free (memory, abc);
+        m3_free (memory, guard);
+        FreeMemory (memory);
+        m3_Def_Free (memory);
+    }
+
+    Test (allocator.pooled)
+    {
+        IM3Memory memory = m3_NewMemory ();
+        const size_t S = memory->segment_size;
+        size_t segments = memory->num_segments;
+
+        // whole-segment buddy blocks come out of the initial free segments and go back to them
+        ptr blocks [10];
+        for (int i = 0; i < 10; i++) blocks [i] = m3_malloc (memory, 4000);
+        for (int i = 0; i < 10; i++) m3_free (memory, blocks [i]);
+
+        // the last buddy segment is kept, 14 of the 15 are free: a 9-segment run needs no new ones
+        ptr run = m3_malloc (memory, 9 * S);
+                                                                        expect (run != NULL)
+                                                                        expect (memory->num_segments == segments)
+        m3_free (memory, run);
+        FreeMemory (memory);
+        m3_Def_Free (memory);
+    }
+
+    Test (allocator.window)
+    {
+        IM3Memory memory = m3_NewMemory ();
+        const size_t S = memory->segment_size;
+        u8 byte = 0;
+
+        // the last segment of the window can be created and used, one more can't
+                                                                        expect (AddSegments (memory, WASM_MAX_SEGMENTS) == m3Err_none)
+                                                                        expect (m3_memset (memory, (u8 *) WASM_GUEST_OFFSET_WINDOW - 4, 0x5a, 4) == m3Err_none)
+                                                                        expect (m3_memcpy (memory, & byte, (u8 *) WASM_GUEST_OFFSET_WINDOW - 1, 1) == m3Err_none and byte == 0x5a)
+                                                                        expect (AddSegments (memory, WASM_MAX_SEGMENTS + 1) == m3Err_memoryLimit)
+                                                                        expect (GrowMemory (memory, S) == m3Err_memoryLimit)
+                                                                        expect (memory->num_segments == WASM_MAX_SEGMENTS)
+
+        // a run longer than the free segments would need new ones
+                                                                        expect (m3_malloc (memory, 16 * S) == NULL)
+                                                                        expect (m3_malloc (memory, 2 * S) != NULL)
+        FreeMemory (memory);
+        m3_Def_Free (memory);
+    }
+
+    return TestResult ();
+}
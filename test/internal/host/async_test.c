@@ -0,0 +1,145 @@
+//
+//  async_test.c
+//
+//  Async imports (d_m3EnableAsyncImports): a raw import parks the call, m3_Resume
+//  hands it the import's result and runs the guest on; nothing else may use the
+//  runtime, or free code under it, while the call is parked.
+//
+
+#include "m3_host_test.h"
+
+#if d_m3EnableAsyncImports
+
+//  0  env.aread (i32) -> i32             import
+//  1  helper (x)                         aread (x) + 1
+//  2  main (n)                           sum of helper (i) for i in [0, n)
+//  with aread (x) = 2x, main (n) = n * n
+static const u8 c_asyncWasm [] =
+{
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x06, 0x01, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x02, 0x0d, 0x01, 0x03, 0x65, 0x6e, 0x76, 0x05,
+    0x61, 0x72, 0x65, 0x61, 0x64, 0x00, 0x00, 0x03, 0x03, 0x02, 0x00, 0x00,
+    0x0a, 0x32, 0x02, 0x09, 0x00, 0x20, 0x00, 0x10, 0x00, 0x41, 0x01, 0x6a,
+    0x0b, 0x26, 0x01, 0x02, 0x7f, 0x03, 0x40, 0x20, 0x01, 0x20, 0x00, 0x46,
+    0x04, 0x40, 0x20, 0x02, 0x0f, 0x0b, 0x20, 0x02, 0x20, 0x01, 0x10, 0x01,
+    0x6a, 0x21, 0x02, 0x20, 0x01, 0x41, 0x01, 0x6a, 0x21, 0x01, 0x0c, 0x00,
+    0x0b, 0x20, 0x02, 0x0b,
+};
+
+static bool g_parkReads = false;
+static i32 g_pending = 0;
+static u32 g_numSuspended = 0;
+
+m3ApiRawFunction (aread)
+{
+    m3ApiReturnType (i32)
+    m3ApiGetArg     (i32, x)
+
+    if (not g_parkReads)
+        m3ApiReturn (x * 2);
+
+    g_pending = x;
+    g_numSuspended++;
+    m3ApiSuspend ();
+}
+
+static u32 Results (IM3Function i_function)
+{
+    u32 value = 0;
+    m3_GetResultsV (i_function, & value);
+    return value;
+}
+
+// resumes with 2x until the call is done; o_result gets the call's own result
+static M3Result ResumeAll (IM3Runtime io_runtime, M3Result i_result)
+{
+    while (i_result == m3Err_suspended)
+    {
+        i32 value = g_pending * 2;
+        const void * results [] = { & value };
+        i_result = m3_Resume (io_runtime, 1, results);
+    }
+    return i_result;
+}
+
+
+int  main  (int argc, const char  * argv [])
+{
+    IM3Environment env = m3_NewEnvironment ();
+    IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+    IM3Module module = ParseTestModule (runtime, c_asyncWasm, sizeof (c_asyncWasm));
+    if (not module)
+        return TestResult ();
+
+    // the import names don't survive parsing on a 64-bit host
+    module->functions [0].import.moduleUtf8 = strdup ("env");
+    module->functions [0].import.fieldUtf8 = strdup ("aread");
+
+    M3Result result = m3_LinkRawFunction (module, "env", "aread", "i(i)", & aread);
+                                                                        expect (result == m3Err_none)
+    result = m3_CompileModule (module);                                 expect (result == m3Err_none)
+
+    IM3Function run = & module->functions [2];
+
+    Test (async.sync)
+    {
+        g_parkReads = false;
+        result = m3_CallV (run, 5);                                     expect (result == m3Err_none)
+                                                                        expect (Results (run) == 25)
+    }
+
+    Test (async.resume)
+    {
+        g_parkReads = true;
+        g_numSuspended = 0;
+        result = m3_CallV (run, 7);                                     expect (result == m3Err_suspended)
+                                                                        expect (m3_GetSuspendedImport (runtime) == & module->functions [0])
+        result = ResumeAll (runtime, result);                           expect (result == m3Err_none)
+                                                                        expect (g_numSuspended == 7)
+                                                                        expect (Results (run) == 49)
+                                                                        expect (m3_GetSuspendedImport (runtime) == NULL)
+    }
+
+    Test (async.parked)
+    {
+        g_parkReads = true;
+        result = m3_CallV (run, 3);                                     expect (result == m3Err_suspended)
+
+        // the runtime's stack holds the parked frames
+        result = m3_CallV (run, 1);                                     expect (result == m3Err_callSuspended)
+#   if d_m3EnableCodePageRefCounting
+        // and they return into code that must stay
+        u32 numFreed = 1;
+        result = m3_ReleaseColdCode (runtime, 0, & numFreed);          expect (result == m3Err_callSuspended)
+        result = m3_UnloadModule (module);                              expect (result == m3Err_callSuspended)
+#   endif
+        result = ResumeAll (runtime, m3Err_suspended);                  expect (result == m3Err_none)
+                                                                        expect (Results (run) == 9)
+    }
+
+    Test (async.cancel)
+    {
+        g_parkReads = true;
+        result = m3_CallV (run, 4);                                     expect (result == m3Err_suspended)
+        m3_CancelSuspended (runtime);                                   expect (m3_GetSuspendedImport (runtime) == NULL)
+        result = m3_Resume (runtime, 0, NULL);                          expect (result == m3Err_noSuspendedCall)
+
+        g_parkReads = false;
+        result = m3_CallV (run, 4);                                     expect (result == m3Err_none)
+                                                                        expect (Results (run) == 16)
+    }
+
+    m3_FreeRuntime (runtime);
+    m3_FreeEnvironment (env);
+    return TestResult ();
+}
+
+#else
+
+int  main  (int argc, const char  * argv [])
+{
+    printf ("skipped: build with -Dd_m3EnableAsyncImports=1\n");
+    return 0;
+}
+
+#endif // d_m3EnableAsyncImports
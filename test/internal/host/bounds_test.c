@@ -0,0 +1,102 @@
+//
+//  bounds_test.c
+//
+//  Load/store bounds follow memory.size (pages), not total_size (the segments
+//  materialized so far, which ResizeMemory over-allocates), and move with memory.grow.
+//  Every in-bounds address has a segment behind it, from the first access on.
+//
+
+#include "m3_host_test.h"
+
+static const u8 c_boundsWasm [] =
+{
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00,
+    0x01, 0x0a, 0x02,                                   // types
+        0x60, 0x01, 0x7f, 0x01, 0x7f,                   //   0: (i32) -> i32
+        0x60, 0x00, 0x01, 0x7f,                         //   1: () -> i32
+    0x03, 0x05, 0x04, 0x00, 0x00, 0x00, 0x01,           // functions: load, store, grow, size
+    0x05, 0x03, 0x01, 0x00, 0x01,                       // memory: min 1 page (c_boundsMinPagesAt)
+    0x0a, 0x22, 0x04,                                   // code
+        0x07, 0x00, 0x20, 0x00, 0x28, 0x02, 0x00, 0x0b,                         // i32.load (local 0)
+        0x0c, 0x00, 0x20, 0x00, 0x41, 0xb4, 0x24, 0x36, 0x02, 0x00, 0x41, 0x01, 0x0b, // i32.store (local 0) 0x1234
+        0x06, 0x00, 0x20, 0x00, 0x40, 0x00, 0x0b,                               // memory.grow (local 0)
+        0x04, 0x00, 0x3f, 0x00, 0x0b,                                           // memory.size
+};
+
+static const u32 c_boundsMinPagesAt = 31;
+
+static M3Result Call (IM3Function i_function, i32 i_arg, i32 * o_result)
+{
+    M3Result result = i_function->funcType->numArgs ? m3_CallV (i_function, i_arg) : m3_CallV (i_function);
+    if (not result)
+        result = m3_GetResultsV (i_function, o_result);
+    return result;
+}
+
+
+int  main  (int argc, const char  * argv [])
+{
+    IM3Environment env = m3_NewEnvironment ();
+    IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+    IM3Module module = LoadTestModule (runtime, c_boundsWasm, sizeof (c_boundsWasm));
+    if (not module)
+        return TestResult ();
+
+    IM3Function load  = & module->functions [0];
+    IM3Function store = & module->functions [1];
+    IM3Function grow  = & module->functions [2];
+    IM3Function size  = & module->functions [3];
+    i32 value = 0;
+
+    Test (bounds.initial)
+    {
+        M3Result result;
+        result = Call (size, 0, & value);                             expect (result == m3Err_none and value == 1)
+        result = Call (load, 65532, & value);                           expect (result == m3Err_none)
+        result = Call (load, 65533, & value);                           expect (result == m3Err_trapOutOfBoundsMemoryAccess)
+        result = Call (store, 65536, & value);                          expect (result == m3Err_trapOutOfBoundsMemoryAccess)
+    }
+
+    Test (bounds.store)
+    {
+        M3Result result;
+        result = Call (store, 60000, & value);                          expect (result == m3Err_none)
+        result = Call (load, 60000, & value);                           expect (result == m3Err_none and value == 0x1234)
+    }
+
+    Test (bounds.grow)
+    {
+        M3Result result;
+        result = Call (grow, 1, & value);                               expect (result == m3Err_none and value == 1)
+        result = Call (size, 0, & value);                               expect (result == m3Err_none and value == 2)
+        result = Call (store, 65536 + 4000, & value);                   expect (result == m3Err_none)
+        result = Call (load, 65536 + 4000, & value);                    expect (result == m3Err_none and value == 0x1234)
+        result = Call (load, 2 * 65536 - 4, & value);                   expect (result == m3Err_none)
+        result = Call (load, 2 * 65536 - 3, & value);                   expect (result == m3Err_trapOutOfBoundsMemoryAccess)
+    }
+
+    Test (bounds.multipage)
+    {
+        u8 bytes [sizeof (c_boundsWasm)];
+        memcpy (bytes, c_boundsWasm, sizeof (bytes));
+        bytes [c_boundsMinPagesAt] = 4;
+
+        IM3Runtime runtime4 = m3_NewRuntime (env, 64 * 1024, NULL);
+        IM3Module module4 = LoadTestModule (runtime4, bytes, sizeof (bytes));
+        if (module4)
+        {
+            M3Result result;
+            result = Call (& module4->functions [3], 0, & value);         expect (result == m3Err_none and value == 4)
+            result = Call (& module4->functions [1], 200000, & value);    expect (result == m3Err_none)
+            result = Call (& module4->functions [0], 200000, & value);    expect (result == m3Err_none and value == 0x1234)
+            result = Call (& module4->functions [1], 4 * 65536 - 4, & value);   expect (result == m3Err_none)
+            result = Call (& module4->functions [0], 4 * 65536 - 4, & value);   expect (result == m3Err_none and value == 0x1234)
+            result = Call (& module4->functions [0], 4 * 65536 - 3, & value);   expect (result == m3Err_trapOutOfBoundsMemoryAccess)
+        }
+        m3_FreeRuntime (runtime4);
+    }
+
+    m3_FreeRuntime (runtime);
+    m3_FreeEnvironment (env);
+    return TestResult ();
+}
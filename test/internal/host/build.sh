@@ -0,0 +1,75 @@
+#!/bin/bash
+#
+# Builds the runtime for the host (Linux/macOS) against the ESP-IDF stand-ins in
+# this directory and runs every *_test.c next to it. This is not the firmware
+# build: the pager, segment resolver, compiler and interpreter are the same code,
+# but the timings and stack numbers are the host's, not the ESP32's.
+#
+#   ./build.sh                  build and run every test
+#   ./build.sh pager            build and run pager_test.c only
+#   DEFS="-Dd_m3EnableStacklessCalls=1" ./build.sh
+#                               same tests, other configuration. Tests of features
+#                               that are off by default skip themselves (on Linux
+#                               the code cache is on, as in the CMake build); all on:
+#   DEFS="-Dd_m3EnableTimeSlicing=1 -Dd_m3EnableCodePageRefCounting=1 \
+#         -Dd_m3EnableParallelCompile=1 -Dd_m3EnableTieredCompile=1" ./build.sh
+#   DEFS="-Dd_m3EnableOpProfiling=1" ./build.sh profile
+#                               the profiler's counts and n-gram file
+#   CFLAGS="-O2" ./build.sh fib_bench 30
+#                               build a benchmark (NAME.c) and run it with the
+#                               remaining arguments
+#
+set -e
+cd "$(dirname "$0")"
+
+SRC=${SRC:-../../../source}
+OUT=build
+CC=${CC:-cc}
+# -O2: the interpreter's op chain relies on the sibling calls GCC only makes from -O2 on
+CFLAGS=${CFLAGS:-"-std=gnu11 -g -O2 -fsanitize=address -fno-omit-frame-pointer"}
+DEFS=${DEFS:-}
+# unless DEFS sets it either way: a second -D of the same macro is a redefinition warning
+if [ "$(uname)" = Linux ]; then
+    case "$DEFS" in
+        *-Dd_m3EnableCodeCache*) ;;
+        *) DEFS="-Dd_m3EnableCodeCache=1 $DEFS" ;;
+    esac
+fi
+
+# -Wall -Wextra, less the warnings the baseline sources already raise: anything else is new
+WARN="-Wall -Wextra -Wno-unused-parameter -Wno-unused-variable -Wno-unused-but-set-variable \
+      -Wno-unused-const-variable -Wno-unused-function -Wno-unused-label -Wno-sign-compare \
+      -Wno-type-limits -Wno-missing-field-initializers -Wno-format -Wno-int-conversion \
+      -Wno-int-to-pointer-cast -Wno-pointer-to-int-cast -Wno-incompatible-pointer-types \
+      -Wno-implicit-function-declaration -Wno-return-type"
+if $CC --version 2>/dev/null | grep -q clang; then
+    WARN="$WARN -Wno-incompatible-pointer-types-discards-qualifiers"
+else
+    WARN="$WARN -Wno-discarded-qualifiers"
+fi
+
+mkdir -p $OUT/lib
+for f in $SRC/m3_*.c host_stubs.c; do
+    o=$OUT/lib/$(basename ${f%.c}).o
+    $CC $CFLAGS $DEFS $WARN -I. -I$SRC -c $f -o $o
+done
+
+# m3_FreeRuntime leaves the runtime struct behind (pre-existing); keep LSan quiet about it
+export ASAN_OPTIONS=${ASAN_OPTIONS:-detect_leaks=0}
+
+if [ -n "$1" ] && [ -f "$1.c" ]; then
+    bin=$OUT/$1
+    $CC $CFLAGS $DEFS $WARN -I. -I$SRC $1.c $OUT/lib/*.o -lm -lpthread -o $bin
+    shift
+    exec ./$bin "$@"
+fi
+
+tests=${1:+$1_test.c}
+status=0
+for t in ${tests:-*_test.c}; do
+    bin=$OUT/${t%.c}
+    $CC $CFLAGS $DEFS $WARN -I. -I$SRC $t $OUT/lib/*.o -lm -lpthread -o $bin
+    echo "==== ${t%.c}"
+    ./$bin || status=1
+done
+exit $status
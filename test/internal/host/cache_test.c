@@ -0,0 +1,135 @@
+//
+//  cache_test.c
+//
+//  m3_SaveCodeCache / m3_LoadCodeCache round trip: code saved by one runtime runs
+//  in another without compiling, and a miss or a damaged file leaves the module to
+//  compile as usual.
+//
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "m3_host_test.h"
+#include "extra/fib32.wasm.h"
+
+#if d_m3EnableCodeCache
+
+static const u8 c_otherWasm [] =
+{
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00,
+    0x01, 0x05, 0x01, 0x60, 0x00, 0x01, 0x7f,           // () -> i32
+    0x03, 0x02, 0x01, 0x00,
+    0x0a, 0x06, 0x01, 0x04, 0x00, 0x41, 0x2a, 0x0b,     // i32.const 42
+};
+
+// the single .m3cc file the directory holds
+static bool GetCacheFile (char * o_path, size_t i_size, const char * i_directory)
+{
+    bool found = false;
+    DIR * dir = opendir (i_directory);
+    struct dirent * entry;
+
+    while (dir and (entry = readdir (dir)))
+    {
+        if (strstr (entry->d_name, ".m3cc"))
+        {
+            snprintf (o_path, i_size, "%s/%s", i_directory, entry->d_name);
+            found = true;
+        }
+    }
+    if (dir)
+        closedir (dir);
+
+    return found;
+}
+
+static u32 CallFib (IM3Function i_fib, u32 i_n)
+{
+    u32 value = 0;
+    M3Result result = m3_CallV (i_fib, i_n);
+    if (not result)
+        m3_GetResultsV (i_fib, & value);
+    return result ? 0 : value;
+}
+
+
+int  main  (int argc, const char  * argv [])
+{
+    char directory [] = "/tmp/m3cc.XXXXXX";
+    if (not mkdtemp (directory))
+        return 1;
+
+    char path [512] = "";
+    IM3Environment env = m3_NewEnvironment ();
+
+    {
+        IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+        IM3Module module = LoadTestModule (runtime, fib32_wasm, fib32_wasm_len);
+        M3Result result = module ? m3_SaveCodeCache (module, directory) : "no module";
+                                                                        expect (result == m3Err_none)
+                                                                        expect (GetCacheFile (path, sizeof (path), directory))
+        m3_FreeRuntime (runtime);
+    }
+
+    Test (cache.roundtrip)
+    {
+        IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+        IM3Module module = ParseTestModule (runtime, fib32_wasm, fib32_wasm_len);
+        IM3Function fib = & module->functions [0];
+                                                                        expect (fib->compiled == NULL)
+        M3Result result = m3_LoadCodeCache (module, directory);         expect (result == m3Err_none)
+                                                                        expect (fib->compiled != NULL)
+                                                                        expect (CallFib (fib, 20) == 6765)
+                                                                        expect (CallFib (fib, 24) == 46368)
+        m3_FreeRuntime (runtime);
+    }
+
+    Test (cache.miss)
+    {
+        IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+        IM3Module module = ParseTestModule (runtime, c_otherWasm, sizeof (c_otherWasm));
+        M3Result result = m3_LoadCodeCache (module, directory);         expect (result == m3Err_codeCacheMiss)
+                                                                        expect (module->functions [0].compiled == NULL)
+        i32 value = 0;
+        result = m3_CompileModule (module);                             expect (result == m3Err_none)
+        result = m3_CallV (& module->functions [0]);                    expect (result == m3Err_none)
+        m3_GetResultsV (& module->functions [0], & value);              expect (value == 42)
+        m3_FreeRuntime (runtime);
+    }
+
+    Test (cache.truncated)
+    {
+        // header intact, function records cut short
+        FILE * file = fopen (path, "r+b");
+        fseek (file, 0, SEEK_END);
+        long size = ftell (file);
+        fclose (file);
+                                                                        expect (truncate (path, size / 2) == 0)
+
+        IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+        IM3Module module = ParseTestModule (runtime, fib32_wasm, fib32_wasm_len);
+        IM3Function fib = & module->functions [0];
+        M3Result result = m3_LoadCodeCache (module, directory);         expect (result == m3Err_codeCacheCorrupt)
+                                                                        expect (fib->compiled == NULL)
+        result = m3_CompileModule (module);                             expect (result == m3Err_none)
+                                                                        expect (CallFib (fib, 20) == 6765)
+        m3_FreeRuntime (runtime);
+    }
+
+    unlink (path);
+    rmdir (directory);
+
+    m3_FreeEnvironment (env);
+    return TestResult ();
+}
+
+#else
+
+int  main  (void)
+{
+    printf ("skipped: build with -Dd_m3EnableCodeCache=1\n");
+    return 0;
+}
+
+#endif // d_m3EnableCodeCache
@@ -0,0 +1,163 @@
+//
+//  collect_test.c
+//
+//  m3_collect_empty_segments: nothing is collected up to the high watermark,
+//  past it every call reclaims at most max_per_call segments and examines at
+//  most scan_limit, and a low free heap drains the reclaimable segments to zero.
+//
+
+#include "m3_host_test.h"
+#include "m3_segmented_memory.h"
+
+#define c_numBlocks     20
+#define c_runSegments   40
+
+static IM3Memory NewMemory (const M3CollectPolicy * i_policy)
+{
+    IM3Memory memory = m3_NewMemory ();
+#   if WASM_SEGMENTED_MEM_ENABLE_HE_PAGES && WASM_SEGMENTED_MEM_BUILTIN_PAGER
+    // every segment stays resident: the counts below are the collector's, not the pager's
+    paging_set_resident_budget (memory->paging, WASM_MAX_SEGMENTS);
+#   endif
+    m3_SetCollectPolicy (memory, i_policy);
+    return memory;
+}
+
+static void FreeTestMemory (IM3Memory memory)
+{
+    FreeMemory (memory);
+    m3_Def_Free (memory);
+}
+
+static size_t EmptySegments (IM3Memory memory)
+{
+    M3CollectStats stats;
+    m3_GetCollectStats (memory, & stats);
+    return stats.empty_segments;
+}
+
+
+int  main  (int argc, const char  * argv [])
+{
+    Test (collect.watermarks)
+    {
+        M3CollectPolicy policy = { .high_watermark = 8, .low_watermark = 2, .max_per_call = 4, .scan_limit = 64 };
+        IM3Memory memory = NewMemory (& policy);
+
+        // whole-segment blocks, touched so that each one holds data once it's back in the pool
+        ptr blocks [c_numBlocks];
+        for (int i = 0; i < c_numBlocks; i++)
+        {
+            blocks [i] = m3_malloc (memory, memory->segment_size - 96);
+            m3_memset (memory, blocks [i], 0x77, memory->segment_size - 96);
+        }
+
+        M3CollectStats stats;
+        size_t peak = 0, quiet = 0;
+        for (int i = 0; i < c_numBlocks; i++)
+        {
+            m3_free (memory, blocks [i]);
+            m3_GetCollectStats (memory, & stats);
+            peak = M3_MAX (peak, stats.empty_segments);
+            if (stats.empty_segments <= policy.high_watermark and stats.collections == 0) quiet++;
+        }
+        // one free adds one empty segment: the collector runs as the count passes the watermark
+                                                                        expect (peak <= policy.high_watermark + 1)
+                                                                        expect (quiet >= policy.high_watermark - 1)
+                                                                        expect (stats.collections > 0)
+                                                                        expect (stats.reclaimed_segments <= stats.collections * policy.max_per_call)
+                                                                        expect (stats.reclaimed_segments >= stats.collections)
+                                                                        expect (stats.scanned_segments <= stats.collections * policy.scan_limit)
+                                                                        expect (stats.reclaimed_bytes == stats.reclaimed_segments * memory->segment_size)
+                                                                        expect (stats.calls == c_numBlocks)
+        FreeTestMemory (memory);
+    }
+
+    Test (collect.incremental)
+    {
+        M3CollectPolicy policy = { .high_watermark = 8, .low_watermark = 2, .max_per_call = 4, .scan_limit = 64 };
+        IM3Memory memory = NewMemory (& policy);
+        const size_t S = memory->segment_size;
+
+        ptr run = m3_malloc (memory, c_runSegments * S);
+        ptr guard = m3_malloc (memory, 2 * S);
+        m3_memset (memory, run, 0x55, c_runSegments * S);
+        size_t before = EmptySegments (memory);
+
+        // the whole run empties at once, the collector takes max_per_call of it per call
+        m3_free (memory, run);
+        M3CollectStats stats;
+        m3_GetCollectStats (memory, & stats);
+                                                                        expect (stats.reclaimed_segments == policy.max_per_call)
+                                                                        expect (stats.empty_segments == before + c_runSegments - policy.max_per_call)
+        int steps = 1, overrun = 0;
+        while (EmptySegments (memory) > policy.high_watermark and steps < 100)
+        {
+            size_t empty = EmptySegments (memory);
+            m3_collect_empty_segments (memory);
+            if (empty - EmptySegments (memory) > policy.max_per_call) overrun++;
+            steps++;
+        }
+        // down to the high watermark, not the low one: below it, calls are free
+        m3_GetCollectStats (memory, & stats);
+                                                                        expect (overrun == 0)
+                                                                        expect (stats.empty_segments <= policy.high_watermark)
+                                                                        expect (stats.empty_segments > policy.low_watermark)
+                                                                        expect (steps >= (c_runSegments - policy.high_watermark) / policy.max_per_call)
+        size_t collections = stats.collections;
+        m3_collect_empty_segments (memory);
+        m3_GetCollectStats (memory, & stats);
+                                                                        expect (stats.collections == collections)
+
+        // what was reclaimed is the run's data, given back to the heap
+        size_t released = 0;
+        for (size_t i = 0; i < c_runSegments; i++)
+            if (not memory->segments [((mos) (uintptr_t) run / S) + i]->data) released++;
+                                                                        expect (released == stats.reclaimed_segments)
+        m3_free (memory, guard);
+        FreeTestMemory (memory);
+    }
+
+    Test (collect.scan_limit)
+    {
+        M3CollectPolicy policy = { .high_watermark = 0, .low_watermark = 0, .max_per_call = 1000, .scan_limit = 3 };
+        IM3Memory memory = NewMemory (& policy);
+        const size_t S = memory->segment_size;
+
+        ptr run = m3_malloc (memory, c_runSegments * S);
+        ptr guard = m3_malloc (memory, 2 * S);
+        m3_memset (memory, run, 0x55, c_runSegments * S);
+
+        M3CollectStats before, after;
+        m3_GetCollectStats (memory, & before);
+        m3_free (memory, run);
+        m3_GetCollectStats (memory, & after);
+                                                                        expect (after.scanned_segments - before.scanned_segments <= policy.scan_limit)
+                                                                        expect (after.reclaimed_segments - before.reclaimed_segments <= policy.scan_limit)
+        // the cursor moves on: calls keep making progress until every segment is reclaimed
+        for (int i = 0; i < 1000 and EmptySegments (memory) > 0; i++)
+            m3_collect_empty_segments (memory);
+                                                                        expect (EmptySegments (memory) == 0)
+        m3_free (memory, guard);
+        FreeTestMemory (memory);
+    }
+
+    Test (collect.low_heap)
+    {
+        // the host stub reports 1 GB free: ask for more, and the collector drains to zero in one call
+        M3CollectPolicy policy = { .high_watermark = 1000, .low_watermark = 500, .max_per_call = 1000, .scan_limit = 1000,
+                                   .min_free_heap = (size_t) 1 << 31 };
+        IM3Memory memory = NewMemory (& policy);
+        const size_t S = memory->segment_size;
+
+        ptr run = m3_malloc (memory, c_runSegments * S);
+        ptr guard = m3_malloc (memory, 2 * S);
+        m3_memset (memory, run, 0x55, c_runSegments * S);
+        m3_free (memory, run);
+                                                                        expect (EmptySegments (memory) == 0)
+        m3_free (memory, guard);
+        FreeTestMemory (memory);
+    }
+
+    return TestResult ();
+}
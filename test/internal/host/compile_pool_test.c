@@ -0,0 +1,213 @@
+//
+//  compile_pool_test.c
+//
+//  m3_CompileModuleInBackground: every queued function is compiled once and
+//  published by the workers, a call that races them takes its functions off the
+//  queue (or waits for the worker compiling them), hot-only stops at the exports,
+//  and a worker's compile error comes back from m3_WaitForBackgroundCompile.
+//
+
+#include "m3_host_test.h"
+#include "m3_compile.h"
+#include "m3_compile_pool.h"
+
+#if d_m3EnableParallelCompile
+
+#define c_numChain      100
+
+static u8 * EmitULEB (u8 * o_bytes, u32 i_value)
+{
+    do
+    {
+        u8 byte = i_value & 0x7f;
+        i_value >>= 7;
+        * o_bytes++ = byte | (i_value ? 0x80 : 0);
+    }
+    while (i_value);
+
+    return o_bytes;
+}
+
+static u8 * EmitSection (u8 * o_bytes, u8 i_id, const u8 * i_content, u32 i_size)
+{
+    * o_bytes++ = i_id;
+    o_bytes = EmitULEB (o_bytes, i_size);
+    memcpy (o_bytes, i_content, i_size);
+    return o_bytes + i_size;
+}
+
+// c_numChain (i32) -> i32 functions: 0 returns n, k returns f [k - 1] (n) + 1; the last is exported as "top".
+// i_broken appends one more that leaves nothing on the stack, which fails to compile
+static u32 BuildChainModule (u8 * o_bytes, bool i_broken)
+{
+    static u8 content [4096];
+    u32 numFunctions = c_numChain + (i_broken ? 1 : 0);
+    u8 * bytes = o_bytes, * at;
+
+    static const u8 header [] = { 0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00 };
+    memcpy (bytes, header, sizeof (header));
+    bytes += sizeof (header);
+
+    static const u8 types [] = { 0x01, 0x60, 0x01, 0x7f, 0x01, 0x7f };
+    bytes = EmitSection (bytes, 1, types, sizeof (types));
+
+    at = EmitULEB (content, numFunctions);
+    for (u32 i = 0; i < numFunctions; i++)
+        * at++ = 0x00;
+    bytes = EmitSection (bytes, 3, content, (u32) (at - content));
+
+    at = EmitULEB (content, 1);
+    * at++ = 3; memcpy (at, "top", 3); at += 3;
+    * at++ = 0x00;
+    at = EmitULEB (at, c_numChain - 1);
+    bytes = EmitSection (bytes, 7, content, (u32) (at - content));
+
+    at = EmitULEB (content, numFunctions);
+    for (u32 i = 0; i < numFunctions; i++)
+    {
+        u8 body [16], * b = body;
+        * b++ = 0x00;                                                   // no locals
+        if (i == c_numChain)
+            ;                                                           // the broken one: no result
+        else if (i == 0)
+        {
+            * b++ = 0x20; * b++ = 0x00;
+        }
+        else
+        {
+            * b++ = 0x20; * b++ = 0x00;
+            * b++ = 0x10; b = EmitULEB (b, i - 1);
+            * b++ = 0x41; * b++ = 0x01; * b++ = 0x6a;
+        }
+        * b++ = 0x0b;
+
+        at = EmitULEB (at, (u32) (b - body));
+        memcpy (at, body, b - body);
+        at += b - body;
+    }
+    bytes = EmitSection (bytes, 10, content, (u32) (at - content));
+
+    return (u32) (bytes - o_bytes);
+}
+
+static u32 CountCompiled (IM3Module i_module)
+{
+    u32 compiled = 0;
+    for (u32 i = 0; i < i_module->numFunctions; i++)
+        if (i_module->functions [i].compiled) compiled++;
+    return compiled;
+}
+
+static u32 CountBusy (IM3Module i_module)
+{
+    u32 busy = 0;
+    for (u32 i = 0; i < i_module->numFunctions; i++)
+        if (i_module->functions [i].compileState != c_m3CompileIdle) busy++;
+    return busy;
+}
+
+// the entry compiles as m3_FindFunction does it (by index: see ParseTestModule), the callees through op_Compile
+static i32 CallTop (IM3Module i_module, i32 i_arg)
+{
+    IM3Function top = & i_module->functions [c_numChain - 1];
+    i32 value = -1;
+    if ((not GetFunctionCompiled (top) and CompileFunction (top)) or m3_CallV (top, i_arg) or m3_GetResultsV (top, & value))
+        return -1;
+    return value;
+}
+
+
+int  main  (int argc, const char  * argv [])
+{
+    IM3Environment env = m3_NewEnvironment ();
+    static u8 chain [8192], broken [8192];
+    u32 chainSize = BuildChainModule (chain, false);
+    u32 brokenSize = BuildChainModule (broken, true);
+
+    Test (pool.all)
+    {
+        IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+        IM3Module module = ParseTestModule (runtime, chain, chainSize);
+        if (not module)
+            return TestResult ();
+                                                                        expect (m3_CompileModuleInBackground (module, 4, false) == m3Err_none)
+                                                                        expect (m3_WaitForBackgroundCompile (runtime) == m3Err_none)
+                                                                        expect (CountCompiled (module) == c_numChain)
+                                                                        expect (CountBusy (module) == 0)
+        // published code runs, and isn't compiled again
+        pc_t compiled = module->functions [0].compiled;
+                                                                        expect (CallTop (module, 5) == 5 + c_numChain - 1)
+                                                                        expect (module->functions [0].compiled == compiled)
+        m3_FreeRuntime (runtime);
+    }
+
+    Test (pool.race)
+    {
+        // one worker from index 0 up, the call from the top down: they meet somewhere
+        for (int round = 0; round < 20; round++)
+        {
+            IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+            IM3Module module = ParseTestModule (runtime, chain, chainSize);
+            if (not module)
+                return TestResult ();
+
+            M3Result result = m3_CompileModuleInBackground (module, 1 + round % 2, false);
+            i32 value = CallTop (module, round);
+            M3Result waited = m3_WaitForBackgroundCompile (runtime);
+
+            if (result or waited or value != round + c_numChain - 1 or CountCompiled (module) != c_numChain or CountBusy (module))
+            {
+                printf ("round %d: %s %s %d, %u compiled\n", round, result ? result : "-", waited ? waited : "-", value, CountCompiled (module));
+                ++g_failures;
+            }
+            m3_FreeRuntime (runtime);
+        }
+    }
+
+    Test (pool.hot_only)
+    {
+        IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+        IM3Module module = ParseTestModule (runtime, chain, chainSize);
+        if (not module)
+            return TestResult ();
+                                                                        expect (m3_CompileModuleInBackground (module, 2, true) == m3Err_none)
+                                                                        expect (m3_WaitForBackgroundCompile (runtime) == m3Err_none)
+        // only the export; the rest compile when they're first called
+                                                                        expect (CountCompiled (module) == 1 and module->functions [c_numChain - 1].compiled)
+                                                                        expect (CallTop (module, 1) == c_numChain)
+                                                                        expect (CountCompiled (module) == c_numChain)
+        m3_FreeRuntime (runtime);
+    }
+
+    Test (pool.error)
+    {
+        IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+        IM3Module module = ParseTestModule (runtime, broken, brokenSize);
+        if (not module)
+            return TestResult ();
+
+        IM3Function bad = & module->functions [c_numChain];
+                                                                        expect (m3_CompileModuleInBackground (module, 2, false) == m3Err_none)
+                                                                        expect (m3_WaitForBackgroundCompile (runtime) != m3Err_none)
+        // reported once; the broken function is left to fail again when it's called
+                                                                        expect (m3_WaitForBackgroundCompile (runtime) == m3Err_none)
+                                                                        expect (bad->compiled == NULL)
+                                                                        expect (CountCompiled (module) == c_numChain)
+                                                                        expect (m3_CallV (bad, 1) != m3Err_none)
+                                                                        expect (CallTop (module, 2) == 1 + c_numChain)
+        m3_FreeRuntime (runtime);
+    }
+
+    m3_FreeEnvironment (env);
+    return TestResult ();
+}
+
+#else
+
+int  main  (void)
+{
+    printf ("skipped: build with -Dd_m3EnableParallelCompile=1\n");
+    return 0;
+}
+
+#endif // d_m3EnableParallelCompile
@@ -0,0 +1,162 @@
+//
+//  compress_test.c
+//
+//  The pager's compressed RAM store, driven directly: uniform segments are kept as
+//  their fill word, the rest go through the LZ codec (long literal and match runs
+//  included) and come back byte for byte on fault-in, and random segments are
+//  refused and stay resident.
+//
+
+#include "m3_host_test.h"
+#include "m3_pager.h"
+
+#define c_segmentSize   4096
+#define c_perKind       4
+
+typedef enum
+{
+    c_kindZero,
+    c_kindFill,
+    c_kindMixed,
+    c_kindLongRuns,
+    c_kindAlmostFill,
+    c_kindRandom,
+    c_numKinds
+}
+Kind;
+
+static u32 s_random = 0x2545f491;
+
+static u32 Random (void)
+{
+    s_random ^= s_random << 13;
+    s_random ^= s_random >> 17;
+    s_random ^= s_random << 5;
+    return s_random;
+}
+
+static void RandomBytes (u8 * o_bytes, size_t i_size)
+{
+    for (size_t i = 0; i < i_size; i++)
+        o_bytes [i] = (u8) Random ();
+}
+
+static void FillSegment (u8 * o_bytes, Kind i_kind)
+{
+    switch (i_kind)
+    {
+        case c_kindZero:
+            memset (o_bytes, 0, c_segmentSize);
+            break;
+
+        case c_kindFill:
+        {
+            u32 word = 0xdeadbeef ^ Random ();
+            for (size_t i = 0; i < c_segmentSize; i += sizeof (word))
+                memcpy (o_bytes + i, & word, sizeof (word));
+            break;
+        }
+
+        // a phrase repeated, with a few random bytes every 256
+        case c_kindMixed:
+        {
+            static const char phrase [] = "segment 0042: offset, length, flags; ";
+            for (size_t i = 0; i < c_segmentSize; i++)
+                o_bytes [i] = (u8) phrase [i % (sizeof (phrase) - 1)];
+            for (size_t i = 0; i < c_segmentSize; i += 256)
+                RandomBytes (o_bytes + i, 16);
+            break;
+        }
+
+        // literal and match lengths past 15 + 255: both need extension bytes, one of them 255
+        case c_kindLongRuns:
+            RandomBytes (o_bytes, 300);
+            for (size_t i = 300; i < c_segmentSize - 400; i++)
+                o_bytes [i] = o_bytes [i % 300];
+            RandomBytes (o_bytes + c_segmentSize - 400, 400);
+            break;
+
+        // uniform but for the last byte: not a fill segment, one long match
+        case c_kindAlmostFill:
+            memset (o_bytes, 0xa5, c_segmentSize);
+            o_bytes [c_segmentSize - 1] = 0x5a;
+            break;
+
+        default:
+            RandomBytes (o_bytes, c_segmentSize);
+            break;
+    }
+}
+
+
+int  main  (int argc, const char  * argv [])
+{
+    Test (compress.round_trip)
+    {
+        const u32 numSegments = c_numKinds * c_perKind;
+        paging_stats_t * paging = NULL;
+                                                                        expect (paging_init (& paging, NULL, c_segmentSize) == ESP_OK)
+        if (not paging)
+            return TestResult ();
+                                                                        expect (paging->store_kind == c_pagerStore_Compressed)
+        static void * data [c_numKinds * c_perKind];
+        static u8 expected [c_numKinds * c_perKind][c_segmentSize];
+
+        for (u32 i = 0; i < numSegments; i++)
+        {
+            segment_info_t * page = NULL;
+            paging_notify_segment_creation (paging, & page);
+            data [i] = m3_Def_Malloc (c_segmentSize);
+            FillSegment ((u8 *) data [i], (Kind) (i % c_numKinds));
+            memcpy (expected [i], data [i], c_segmentSize);
+            paging_notify_segment_allocation (paging, page, & data [i]);
+        }
+
+        // everything but the minimum resident set goes to the store; random segments can't
+        paging_set_resident_budget (paging, 0);
+                                                                        expect (paging->evictions > 0)
+                                                                        expect (paging->fill_pages > 0 and paging->lz_pages > 0)
+                                                                        expect (paging->incompressible > 0)
+                                                                        expect (paging->compressed_bytes * 4 < paging->raw_bytes)
+        int stillRandom = 0;
+        for (u32 i = 0; i < numSegments; i++)
+        {
+            segment_info_t * page = paging->pages [i];
+            if (page->state != c_pagerState_Evicted)
+                continue;
+            u32 kind = i % c_numKinds;
+            if (kind == c_kindRandom) stillRandom++;
+            bool fill = kind == c_kindZero or kind == c_kindFill;
+                                                                        expect (page->encoding == (fill ? c_pagerEncoding_Fill : c_pagerEncoding_LZ))
+                                                                        expect (fill ? page->blob_size == 4 : page->blob_size < c_segmentSize / 2)
+        }
+                                                                        expect (stillRandom == 0)
+
+        // fault every segment in, twice round, so that the first round's survivors are evicted too
+        // (and the clock has tried every random one)
+        u32 restored [c_numKinds] = { 0 };
+        int wrong = 0;
+        for (u32 round = 0; round < 2; round++)
+        {
+            for (u32 i = 0; i < numSegments; i++)
+            {
+                if (paging->pages [i]->state == c_pagerState_Evicted) restored [i % c_numKinds]++;
+                paging_notify_segment_access (paging, i);
+                if (not data [i] or memcmp (data [i], expected [i], c_segmentSize) != 0) wrong++;
+            }
+        }
+                                                                        expect (wrong == 0)
+                                                                        expect (paging->incompressible >= c_perKind)
+        for (u32 k = 0; k < c_numKinds; k++)
+        {
+                                                                        expect (k == c_kindRandom ? restored [k] == 0 : restored [k] >= c_perKind)
+        }
+                                                                        expect (paging->decompressions == paging->faults)
+                                                                        expect (paging->decompress_max_ns >= 0)
+        for (u32 i = 0; i < numSegments; i++)
+            m3_Def_Free (data [i]);
+        paging_deinit (paging);
+    }
+
+    return TestResult ();
+}
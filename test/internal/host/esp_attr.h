@@ -0,0 +1,2 @@
+#pragma once
+// Host stand-in for esp_attr.h.
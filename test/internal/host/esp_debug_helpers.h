@@ -0,0 +1,8 @@
+#pragma once
+// Host stand-in for esp_debug_helpers.h: backtraces are empty.
+#include <stdint.h>
+#include <stdbool.h>
+typedef struct { uint32_t pc, sp, next_pc; } esp_backtrace_frame_t;
+void esp_backtrace_print(int depth);
+void esp_backtrace_get_start(uint32_t *pc, uint32_t *sp, uint32_t *next_pc);
+bool esp_backtrace_get_next_frame(esp_backtrace_frame_t *frame);
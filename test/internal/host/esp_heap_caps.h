@@ -0,0 +1,19 @@
+#pragma once
+// Host stand-in for heap_caps: everything is one malloc heap.
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+typedef struct { size_t total_free_bytes, total_allocated_bytes, largest_free_block, minimum_free_bytes; } multi_heap_info_t;
+#define MALLOC_CAP_8BIT 4
+#define MALLOC_CAP_DEFAULT 4096
+#define MALLOC_CAP_EXEC 1
+#define MALLOC_CAP_SPIRAM 1024
+#define MALLOC_CAP_INTERNAL 2048
+bool heap_caps_check_integrity_addr(intptr_t addr, bool print_errors);
+void heap_caps_get_info(multi_heap_info_t *info, uint32_t caps);
+void heap_caps_free(void *ptr);
+void *heap_caps_malloc(size_t size, uint32_t caps);
+size_t heap_caps_get_free_size(uint32_t caps);
+void *heap_caps_realloc(void *ptr, size_t size, uint32_t caps);
+size_t heap_caps_get_allocated_size(void *ptr);
+size_t heap_caps_get_largest_free_block(uint32_t caps);
@@ -0,0 +1,8 @@
+#pragma once
+// Host stand-in for the ESP-IDF logger: every level goes to stdout.
+#include <stdio.h>
+#define ESP_LOGI(tag, fmt, ...) printf(fmt "\n", ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) printf(fmt "\n", ##__VA_ARGS__)
+#define ESP_LOGE(tag, fmt, ...) printf(fmt "\n", ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) do { } while (0)
+#define ESP_LOGV(tag, fmt, ...) do { } while (0)
@@ -0,0 +1,4 @@
+#pragma once
+// Host stand-in for esp_memory_utils.h.
+#include <stdbool.h>
+bool esp_ptr_in_dram(const void*);
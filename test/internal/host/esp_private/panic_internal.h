@@ -0,0 +1,3 @@
+#pragma once
+// Host stand-in for esp_private/panic_internal.h.
+typedef struct { int dummy; } panic_info_t;
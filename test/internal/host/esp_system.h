@@ -0,0 +1,5 @@
+#pragma once
+// Host stand-in for esp_system.h.
+#include <stdint.h>
+uint32_t esp_get_free_heap_size(void);
+uint32_t esp_get_minimum_free_heap_size(void);
@@ -0,0 +1,3 @@
+#pragma once
+// Host stand-in for esp_task_wdt.h.
+void esp_task_wdt_reset(void);
@@ -0,0 +1,4 @@
+#pragma once
+// Host stand-in for esp_timer.h.
+#include <stdint.h>
+int64_t esp_timer_get_time(void);
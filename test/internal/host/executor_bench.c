@@ -0,0 +1,107 @@
+//
+//  executor_bench.c
+//
+//  Throughput of m3_SubmitJob at 1, 2, 4, 8 and 16 threads: many short calls of fib (test/lang/fib32.wasm),
+//  each job on whichever runtime its thread owns. Build and run it from here with the executor on:
+//
+//      CFLAGS="-O2" DEFS="-Dd_m3EnableExecutor=1" ./build.sh executor_bench 20 20000
+//
+//  The speedup can't exceed the number of cores the machine gives the process.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "m3_host_test.h"
+#include "extra/fib32.wasm.h"
+
+#define MAX_THREADS     16
+
+static uint32_t         s_argument  = 20;
+static uint32_t         s_failures;
+
+// resolved once per runtime, before any job runs; each runtime's user data points at its entry
+static IM3Function      s_functions [MAX_THREADS];
+
+
+static double  Now  (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, & ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void  CallJob  (IM3Runtime i_runtime, void * i_userdata)
+{
+    IM3Function function = * (IM3Function *) m3_GetUserData (i_runtime);
+
+    M3Result result = m3_CallV (function, s_argument);
+    if (result)
+        __atomic_add_fetch (& s_failures, 1, __ATOMIC_RELAXED);
+}
+
+
+int  main  (int argc, const char * argv [])
+{
+    if (argc > 1) s_argument = atoi (argv [1]);
+    uint32_t numJobs = argc > 2 ? atoi (argv [2]) : 20000;
+
+    // the runtimes share one environment, as an embedder's usually do
+    IM3Environment env = m3_NewEnvironment ();
+    IM3Runtime runtimes [MAX_THREADS];
+
+    for (int i = 0; i < MAX_THREADS; ++i)
+    {
+        runtimes [i] = m3_NewRuntime (env, 64*1024, & s_functions [i]);
+
+        IM3Module module = LoadTestModule (runtimes [i], fib32_wasm, fib32_wasm_len);
+        if (not module)
+            return 1;
+
+        s_functions [i] = & module->functions [0];      // by index: names don't survive parsing on a 64-bit host
+    }
+
+    printf ("%u calls of fib(%u)\n\n", numJobs, s_argument);
+    printf ("threads        calls/s    speedup\n");
+
+    double single = 0;
+
+    for (uint32_t numThreads = 1; numThreads <= MAX_THREADS; numThreads *= 2)
+    {
+        IM3Executor executor;
+        M3Result result = m3_NewExecutor (& executor, runtimes, numThreads);
+        if (result)
+        {
+            printf ("m3_NewExecutor: %s\n", result);
+            return 1;
+        }
+
+        double start = Now ();
+
+        for (uint32_t i = 0; i < numJobs; ++i)
+            m3_SubmitJob (executor, CallJob, NULL);
+
+        m3_WaitForJobs (executor);
+
+        double rate = numJobs / (Now () - start);
+        if (numThreads == 1)
+            single = rate;
+
+        printf ("%7u  %13.0f  %8.2fx\n", numThreads, rate, rate / single);
+
+        m3_FreeExecutor (executor);
+    }
+
+    if (s_failures)
+        printf ("\n%u calls failed\n", s_failures);
+
+    for (int i = 0; i < MAX_THREADS; ++i)
+        m3_FreeRuntime (runtimes [i]);
+
+    m3_FreeEnvironment (env);
+
+    return s_failures ? 1 : 0;
+}
@@ -0,0 +1,140 @@
+//
+//  executor_test.c
+//
+//  m3_SubmitJob / m3_WaitForJobs: every job runs once, on a runtime of the pool,
+//  and gets the right answer; jobs submitted by jobs are waited for too. Without
+//  d_m3EnableExecutor the jobs run inline on the first runtime.
+//
+
+#include "m3_host_test.h"
+#include "extra/fib32.wasm.h"
+
+#define c_numRuntimes   4
+#define c_numJobs       400
+#define c_numChildren   8
+
+typedef struct FibJob
+{
+    u32             n;
+    u32             value;
+    u32             runs;
+    IM3Runtime      runtime;
+}
+FibJob;
+
+static IM3Function  s_functions [c_numRuntimes];    // runtime user data points here
+static IM3Executor  s_executor;
+static FibJob       s_jobs [c_numJobs];
+static FibJob       s_children [c_numJobs] [c_numChildren];
+
+static u32  Fib  (u32 n)
+{
+    u32 a = 0, b = 1;
+    while (n--) { u32 t = a + b; a = b; b = t; }
+    return a;
+}
+
+static void  RunFib  (IM3Runtime i_runtime, void * i_userdata)
+{
+    FibJob * job = (FibJob *) i_userdata;
+    IM3Function function = * (IM3Function *) m3_GetUserData (i_runtime);
+
+    if (not m3_CallV (function, job->n))
+        m3_GetResultsV (function, & job->value);
+
+    job->runtime = i_runtime;
+    __atomic_add_fetch (& job->runs, 1, __ATOMIC_RELAXED);
+}
+
+// runs like RunFib, then submits its row of s_children
+static void  RunParent  (IM3Runtime i_runtime, void * i_userdata)
+{
+    FibJob * job = (FibJob *) i_userdata;
+    RunFib (i_runtime, job);
+
+    FibJob * children = s_children [job - s_jobs];
+    for (u32 i = 0; i < c_numChildren; ++i)
+        m3_SubmitJob (s_executor, RunFib, & children [i]);
+}
+
+
+int  main  (int argc, const char  * argv [])
+{
+    IM3Environment env = m3_NewEnvironment ();
+    IM3Runtime runtimes [c_numRuntimes];
+
+    for (int i = 0; i < c_numRuntimes; ++i)
+    {
+        runtimes [i] = m3_NewRuntime (env, 64 * 1024, & s_functions [i]);
+        IM3Module module = LoadTestModule (runtimes [i], fib32_wasm, fib32_wasm_len);
+        if (not module)
+            return TestResult ();
+        s_functions [i] = & module->functions [0];
+    }
+
+    M3Result result = m3_NewExecutor (& s_executor, runtimes, c_numRuntimes);
+                                                                        expect (result == m3Err_none)
+
+    Test (executor.jobs)
+    {
+        memset (s_jobs, 0, sizeof (s_jobs));
+        for (u32 i = 0; i < c_numJobs; ++i)
+        {
+            s_jobs [i].n = i % 20;
+            result = m3_SubmitJob (s_executor, RunFib, & s_jobs [i]);
+            if (result) break;
+        }
+                                                                        expect (result == m3Err_none)
+        m3_WaitForJobs (s_executor);
+
+        u32 bad = 0, foreign = 0, first = 0;
+        for (u32 i = 0; i < c_numJobs; ++i)
+        {
+            if (s_jobs [i].runs != 1 or s_jobs [i].value != Fib (s_jobs [i].n)) bad++;
+
+            bool pooled = false;
+            for (int r = 0; r < c_numRuntimes; ++r)
+                pooled = pooled or s_jobs [i].runtime == runtimes [r];
+            if (not pooled) foreign++;
+            if (s_jobs [i].runtime == runtimes [0]) first++;
+        }
+                                                                        expect (bad == 0)
+                                                                        expect (foreign == 0)
+#   if ! d_m3EnableExecutor
+                                                                        expect (first == c_numJobs)
+#   endif
+    }
+
+    Test (executor.nested)
+    {
+        // m3_WaitForJobs covers the jobs the jobs submit
+        memset (s_jobs, 0, sizeof (s_jobs));
+        memset (s_children, 0, sizeof (s_children));
+        for (u32 i = 0; i < c_numJobs; ++i)
+        {
+            s_jobs [i].n = i % 20;
+            for (u32 c = 0; c < c_numChildren; ++c)
+                s_children [i] [c].n = (i + c) % 24;
+        }
+
+        for (u32 i = 0; i < c_numJobs; ++i)
+            m3_SubmitJob (s_executor, RunParent, & s_jobs [i]);
+        m3_WaitForJobs (s_executor);
+
+        u32 bad = 0;
+        for (u32 i = 0; i < c_numJobs; ++i)
+        {
+            if (s_jobs [i].runs != 1) bad++;
+            for (u32 c = 0; c < c_numChildren; ++c)
+                if (s_children [i] [c].runs != 1 or s_children [i] [c].value != Fib (s_children [i] [c].n)) bad++;
+        }
+                                                                        expect (bad == 0)
+    }
+
+    m3_FreeExecutor (s_executor);
+
+    for (int i = 0; i < c_numRuntimes; ++i)
+        m3_FreeRuntime (runtimes [i]);
+    m3_FreeEnvironment (env);
+    return TestResult ();
+}
@@ -0,0 +1,52 @@
+//
+//  fib_bench.c
+//
+//  fib(n) from test/lang/fib32.wasm, timed. Used for the dispatch backend numbers
+//  in docs/Performance.md; build it without ASAN:
+//
+//    CFLAGS="-O2" ./build.sh fib_bench 30
+//    CFLAGS="-O2" DEFS="-Dd_m3ThreadedDispatch=1" ./build.sh fib_bench 30
+//
+//  Add -Dd_m3LogNativeStack=1 to DEFS to print the native stack the call used.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "m3_host_test.h"
+#include "extra/fib32.wasm.h"
+
+
+int  main  (int argc, const char  * argv [])
+{
+    u32 n = (argc > 1) ? (u32) atoi (argv [1]) : 24;
+
+    IM3Environment env = m3_NewEnvironment ();
+    IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+    IM3Module module = LoadTestModule (runtime, fib32_wasm, fib32_wasm_len);
+    if (not module)
+        return 1;
+
+    IM3Function fib = & module->functions [0];
+
+    struct timespec t0, t1;
+    clock_gettime (CLOCK_MONOTONIC, & t0);
+
+    u32 value = 0;
+    M3Result result = m3_CallV (fib, n);
+    if (not result)
+        result = m3_GetResultsV (fib, & value);
+
+    clock_gettime (CLOCK_MONOTONIC, & t1);
+    double ms = (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+
+    if (result)
+        printf ("fib(%u): %s\n", n, result);
+    else
+        printf ("fib(%u) = %u in %.1f ms\n", n, value, ms);
+
+    m3_FreeRuntime (runtime);
+    m3_FreeEnvironment (env);
+    return result ? 1 : 0;
+}
@@ -0,0 +1,133 @@
+//
+//  flat_test.c
+//
+//  c_m3MemoryBackend_Flat: a runtime created with it runs the same module to the
+//  same results as a segmented one, its linear memory is one region that growth
+//  commits in place (flat_base doesn't move, earlier bytes stay put), and guest
+//  offsets, m3_malloc'd ones included, resolve to flat_base + offset.
+//
+
+#include "m3_host_test.h"
+#include "m3_segmented_memory.h"
+#include "sum_loop.wasm.h"
+
+#if WASM_SEGMENTED_MEM_ENABLE_FLAT
+
+static i32 Call1 (IM3Function i_function, i32 i_arg)
+{
+    i32 value = -1;
+    if (m3_CallV (i_function, i_arg) or m3_GetResultsV (i_function, & value))
+        return -1;
+    return value;
+}
+
+
+int  main  (int argc, const char  * argv [])
+{
+    IM3Environment env = m3_NewEnvironment ();
+
+    Test (flat.backend)
+    {
+        static const u32 sizes [] = { 0, 1, 3, 1000 };
+        IM3Runtime flat = m3_NewRuntimeWithMemoryBackend (env, 64 * 1024, NULL, c_m3MemoryBackend_Flat);
+        IM3Runtime segmented = m3_NewRuntime (env, 64 * 1024, NULL);
+        IM3Memory memory = & flat->memory;
+                                                                        expect (memory->backend == c_m3MemoryBackend_Flat and m3_IsFlatMemory (memory))
+                                                                        expect (not m3_IsFlatMemory (& segmented->memory))
+
+        IM3Module onFlat = LoadTestModule (flat, c_sumLoopWasm, sizeof (c_sumLoopWasm));
+        IM3Module onSegmented = LoadTestModule (segmented, c_sumLoopWasm, sizeof (c_sumLoopWasm));
+        if (onFlat and onSegmented)
+        {
+            for (u32 i = 0; i < sizeof (sizes) / sizeof (sizes [0]); i++)
+            {
+                i32 expected = (i32) SumLoopExpected (sizes [i]);
+                                                                        expect (Call1 (& onFlat->functions [0], sizes [i]) == expected)
+                                                                        expect (Call1 (& onSegmented->functions [0], sizes [i]) == expected)
+            }
+
+            // the data segment is in the region itself, and the embedder gets the region, not a copy
+            u32 size = 0;
+                                                                        expect (m3_GetMemory (flat, & size, 0) == memory->flat_base)
+                                                                        expect (size == memory->total_size and memory->flat_committed >= size)
+                                                                        expect (memory->flat_base [8] == 0x01 and memory->flat_base [12] == 0x02)
+        }
+        m3_FreeRuntime (segmented);
+        m3_FreeRuntime (flat);
+    }
+
+    Test (flat.grow)
+    {
+        IM3Runtime runtime = m3_NewRuntimeWithMemoryBackend (env, 64 * 1024, NULL, c_m3MemoryBackend_Flat);
+        IM3Module module = ParseTestModule (runtime, c_sumLoopWasm, sizeof (c_sumLoopWasm));
+        if (not module)
+            return TestResult ();
+
+        IM3Memory memory = & runtime->memory;
+        const size_t S = memory->segment_size;
+        u8 * base = memory->flat_base;
+        size_t before = memory->total_size;
+
+        base [before - 1] = 0x5a;
+                                                                        expect (ResizeMemory (runtime, 4) == m3Err_none)
+                                                                        expect (memory->flat_base == base)
+                                                                        expect (memory->total_size >= 4 * memory->pageSize)
+                                                                        expect (memory->flat_committed >= memory->total_size)
+                                                                        expect (base [before - 1] == 0x5a)
+        // every segment is its slice of the region, so a span never stops at a segment boundary
+        size_t misplaced = 0;
+        for (size_t i = 0; i < memory->num_segments; i++)
+        {
+            MemorySegment * segment = memory->segments [i];
+            if (segment->data and segment->data != base + i * S) misplaced++;
+        }
+                                                                        expect (misplaced == 0)
+        ptr host = NULL;
+                                                                        expect (m3_GetContiguousSpan (memory, before - 10, 3 * S, & host) == 3 * S)
+                                                                        expect (host == base + before - 10)
+        // the new pages are writable and read back through the offset paths
+        u8 byte = 0;
+                                                                        expect (m3_memset (memory, (u8 *) (uintptr_t) (before + S), 0x33, 1) == m3Err_none)
+                                                                        expect (m3_memcpy (memory, & byte, (u8 *) (uintptr_t) (before + S), 1) == m3Err_none)
+                                                                        expect (byte == 0x33 and base [before + S] == 0x33)
+                                                                        expect (ResizeMemory (runtime, 1u << 20) != m3Err_none)
+                                                                        expect (memory->flat_base == base)
+        m3_FreeRuntime (runtime);
+    }
+
+    Test (flat.malloc)
+    {
+        IM3Runtime runtime = m3_NewRuntimeWithMemoryBackend (env, 64 * 1024, NULL, c_m3MemoryBackend_Flat);
+        IM3Memory memory = & runtime->memory;
+
+        // a run, a buddy block and a slab: each one an offset into the region
+        static const size_t sizes [] = { 3 * 4096 + 100, 1000, 24 };
+        for (int i = 0; i < 3; i++)
+        {
+            ptr offset = m3_malloc (memory, sizes [i]);
+                                                                        expect (offset != NULL and m3_IsGuestOffset (offset))
+            if (not offset)
+                continue;
+
+            u8 * host = (u8 *) m3_ResolvePointer (memory, (mos) (uintptr_t) offset);
+                                                                        expect (host == memory->flat_base + (uintptr_t) offset)
+                                                                        expect (m3_memset (memory, offset, 0x40 + i, sizes [i]) == m3Err_none)
+                                                                        expect (host [0] == 0x40 + i and host [sizes [i] - 1] == 0x40 + i)
+            m3_free (memory, offset);
+        }
+        m3_FreeRuntime (runtime);
+    }
+
+    m3_FreeEnvironment (env);
+    return TestResult ();
+}
+
+#else
+
+int  main  (void)
+{
+    printf ("skipped: the flat backend needs a hosted Linux/macOS build\n");
+    return 0;
+}
+
+#endif // WASM_SEGMENTED_MEM_ENABLE_FLAT
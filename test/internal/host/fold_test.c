@@ -0,0 +1,296 @@
+//
+//  fold_test.c
+//
+//  Constant folding and the peephole: an operator on constants gives what the same
+//  operator gives at run time, traps included (a trapping one is left to trap);
+//  a constant br_if to a loop still hands the loop its params; copies are only
+//  dropped when nothing can read them.
+//
+
+#include "m3_host_test.h"
+
+typedef struct BinaryCase
+{
+    u8          opcode;
+    bool        is64;
+    u64         a, b;
+    u8          trap;                   // c_noTrap, c_overflow or c_divisionByZero
+    u64         value;
+}
+BinaryCase;
+
+enum { c_noTrap, c_overflow, c_divisionByZero };
+
+#define I32(X)      ((u64) (u32) (X))
+#define I64(X)      ((u64) (X))
+
+static const BinaryCase c_binaryCases [] =
+{
+    { 0x6d, false, I32 (INT32_MIN), I32 (-1),   c_overflow, 0 },         // i32.div_s
+    { 0x6d, false, I32 (-7),        I32 (2),    c_noTrap, I32 (-3) },
+    { 0x6d, false, I32 (7),         0,          c_divisionByZero, 0 },
+    { 0x6e, false, I32 (7),         0,          c_divisionByZero, 0 },          // i32.div_u
+    { 0x6f, false, I32 (INT32_MIN), I32 (-1),   c_noTrap, 0 },                              // i32.rem_s
+    { 0x6f, false, I32 (-7),        I32 (2),    c_noTrap, I32 (-1) },
+    { 0x6f, false, I32 (7),         0,          c_divisionByZero, 0 },
+    { 0x70, false, I32 (7),         0,          c_divisionByZero, 0 },          // i32.rem_u
+    { 0x74, false, 1,               33,         c_noTrap, 2 },                              // i32.shl
+    { 0x75, false, I32 (INT32_MIN), 63,         c_noTrap, I32 (-1) },                       // i32.shr_s
+    { 0x76, false, I32 (INT32_MIN), 32,         c_noTrap, I32 (INT32_MIN) },                // i32.shr_u
+    { 0x77, false, 0x12345678,      0,          c_noTrap, 0x12345678 },                     // i32.rotl
+    { 0x77, false, 0x12345678,      32,         c_noTrap, 0x12345678 },
+    { 0x78, false, 0x12345678,      0,          c_noTrap, 0x12345678 },                     // i32.rotr
+    { 0x78, false, 0x80000001,      33,         c_noTrap, 0xc0000000 },
+
+    { 0x7f, true,  I64 (INT64_MIN), I64 (-1),   c_overflow, 0 },         // i64.div_s
+    { 0x7f, true,  7,               0,          c_divisionByZero, 0 },
+    { 0x80, true,  7,               0,          c_divisionByZero, 0 },          // i64.div_u
+    { 0x81, true,  I64 (INT64_MIN), I64 (-1),   c_noTrap, 0 },                              // i64.rem_s
+    { 0x81, true,  7,               0,          c_divisionByZero, 0 },
+    { 0x82, true,  7,               0,          c_divisionByZero, 0 },          // i64.rem_u
+    { 0x86, true,  1,               65,         c_noTrap, 2 },                              // i64.shl
+    { 0x87, true,  I64 (INT64_MIN), 127,        c_noTrap, I64 (-1) },                       // i64.shr_s
+    { 0x88, true,  I64 (INT64_MIN), 64,         c_noTrap, I64 (INT64_MIN) },                // i64.shr_u
+    { 0x89, true,  0x123456789abcdef0, 0,       c_noTrap, 0x123456789abcdef0 },             // i64.rotl
+    { 0x89, true,  0x123456789abcdef0, 64,      c_noTrap, 0x123456789abcdef0 },
+    { 0x8a, true,  0x123456789abcdef0, 0,       c_noTrap, 0x123456789abcdef0 },             // i64.rotr
+};
+
+static u8 * EmitSLEB (u8 * o_bytes, i64 i_value)
+{
+    bool more = true;
+    while (more)
+    {
+        u8 byte = i_value & 0x7f;
+        i_value >>= 7;
+        more = not ((i_value == 0 and not (byte & 0x40)) or (i_value == -1 and (byte & 0x40)));
+        * o_bytes++ = more ? byte | 0x80 : byte;
+    }
+    return o_bytes;
+}
+
+// function 0: () -> T, the operator on two constants; function 1: (T, T) -> T, the same on its params
+static u32 BuildBinaryModule (u8 * o_bytes, const BinaryCase * i_case)
+{
+    u8 type = i_case->is64 ? 0x7e : 0x7f;
+    u8 constOp = i_case->is64 ? 0x42 : 0x41;
+    i64 a = i_case->is64 ? (i64) i_case->a : (i32) i_case->a;
+    i64 b = i_case->is64 ? (i64) i_case->b : (i32) i_case->b;
+
+    u8 folded [32], * f = folded;
+    * f++ = 0x00;                                       // no locals
+    * f++ = constOp;    f = EmitSLEB (f, a);
+    * f++ = constOp;    f = EmitSLEB (f, b);
+    * f++ = i_case->opcode;
+    * f++ = 0x0b;
+
+    const u8 header [] =
+    {
+        0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00,
+        0x01, 0x0b, 0x02,                               // types
+            0x60, 0x00, 0x01, type,                     //   0: () -> T
+            0x60, 0x02, type, type, 0x01, type,         //   1: (T, T) -> T
+        0x03, 0x03, 0x02, 0x00, 0x01,                   // functions
+    };
+    const u8 runtime [] = { 0x00, 0x20, 0x00, 0x20, 0x01, i_case->opcode, 0x0b };
+    u32 foldedSize = (u32) (f - folded);
+
+    u8 * out = o_bytes;
+    memcpy (out, header, sizeof (header));              out += sizeof (header);
+    * out++ = 0x0a;                                     // code
+    * out++ = (u8) (1 + 1 + foldedSize + 1 + sizeof (runtime));
+    * out++ = 0x02;
+    * out++ = (u8) foldedSize;                          memcpy (out, folded, foldedSize);           out += foldedSize;
+    * out++ = (u8) sizeof (runtime);                    memcpy (out, runtime, sizeof (runtime));    out += sizeof (runtime);
+
+    return (u32) (out - o_bytes);
+}
+
+static M3Result CallBinary (IM3Function i_function, const BinaryCase * i_case, u64 * o_value)
+{
+    M3Result result;
+    if (i_function->funcType->numArgs == 0)
+        result = m3_CallV (i_function);
+    else if (i_case->is64)
+        result = m3_CallV (i_function, i_case->a, i_case->b);
+    else
+        result = m3_CallV (i_function, (u32) i_case->a, (u32) i_case->b);
+
+    * o_value = 0;
+    if (not result)
+    {
+        if (i_case->is64)
+            result = m3_GetResultsV (i_function, o_value);
+        else
+        {
+            u32 value = 0;
+            result = m3_GetResultsV (i_function, & value);
+            * o_value = value;
+        }
+    }
+    return result;
+}
+
+// function 0: loop (param i32) (result i32) continued by `i32.const 1; br_if 0` with its param + 1 (still in a
+// register), until a local counts down from 3: 13. function 1: the same with `i32.const 0`, so the loop runs
+// once. function 2: a plain br, which must hand over the param just the same
+static const u8 c_branchLoopWasm [] =
+{
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00,
+    0x01, 0x0a, 0x02,                                   // types
+        0x60, 0x00, 0x01, 0x7f,                         //   0: () -> i32
+        0x60, 0x01, 0x7f, 0x01, 0x7f,                   //   1: (i32) -> i32, the loop's
+    0x03, 0x04, 0x03, 0x00, 0x00, 0x00,                 // functions
+    0x0a, 0x6d, 0x03,                                   // code
+        0x23, 0x01, 0x01, 0x7f,                         //   local i32 (counter)
+            0x41, 0x03, 0x21, 0x00,                     //   counter = 3
+            0x02, 0x7f,                                 //   block (result i32)
+            0x41, 0x0a,                                 //     10
+            0x03, 0x01,                                 //     loop (param i32) (result i32)
+            0x20, 0x00, 0x45, 0x0d, 0x01,               //       br_if 1 (counter == 0)
+            0x20, 0x00, 0x41, 0x01, 0x6b, 0x21, 0x00,   //       counter -= 1
+            0x41, 0x01, 0x6a,                           //       + 1, in a register
+            0x41, 0x01, 0x0d, 0x00,                     //       br_if 0 (1)
+            0x0b, 0x0b, 0x0b,
+        0x23, 0x01, 0x01, 0x7f,
+            0x41, 0x03, 0x21, 0x00,
+            0x02, 0x7f,
+            0x41, 0x0a,
+            0x03, 0x01,
+            0x20, 0x00, 0x45, 0x0d, 0x01,
+            0x20, 0x00, 0x41, 0x01, 0x6b, 0x21, 0x00,
+            0x41, 0x01, 0x6a,
+            0x41, 0x00, 0x0d, 0x00,                     //       br_if 0 (0)
+            0x0b, 0x0b, 0x0b,
+        0x23, 0x01, 0x01, 0x7f,
+            0x41, 0x03, 0x21, 0x00,
+            0x02, 0x7f,
+            0x41, 0x0a,
+            0x03, 0x01,
+            0x20, 0x00, 0x45, 0x0d, 0x01,
+            0x20, 0x00, 0x41, 0x01, 0x6b, 0x21, 0x00,
+            0x41, 0x01, 0x6a,
+            0x01, 0x01, 0x0c, 0x00,                     //       br 0
+            0x0b, 0x0b, 0x0b,
+};
+
+// all (i32) -> i32, with one i32 local
+static const u8 c_copiesWasm [] =
+{
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00,
+    0x01, 0x06, 0x01, 0x60, 0x01, 0x7f, 0x01, 0x7f,     // types
+    0x03, 0x05, 0x04, 0x00, 0x00, 0x00, 0x00,           // functions
+    0x0a, 0x4e, 0x04,                                   // code
+        // 0: a copy at the end of a block that a br_if skips: p ? 7 : 9
+        0x15, 0x01, 0x01, 0x7f,
+            0x02, 0x40,
+            0x41, 0x07, 0x21, 0x01,                     //   local1 = 7
+            0x20, 0x00, 0x0d, 0x00,                     //   br_if 0 (p)
+            0x41, 0x09, 0x21, 0x01,                     //   local1 = 9
+            0x0b,
+            0x20, 0x01, 0x0b,
+        // 1: a dead copy at the end of a block, overwritten after it: 3 + p
+        0x14, 0x01, 0x01, 0x7f,
+            0x02, 0x40,
+            0x20, 0x00, 0x21, 0x01,                     //   local1 = p
+            0x0b,
+            0x41, 0x03, 0x21, 0x01,                     //   local1 = 3
+            0x20, 0x01, 0x20, 0x00, 0x6a, 0x0b,
+        // 2: a copy read by local.get before it's overwritten: p - 100
+        0x12, 0x01, 0x01, 0x7f,
+            0x20, 0x00, 0x21, 0x01,                     //   local1 = p
+            0x20, 0x01,                                 //   push local1
+            0x41, 0xe4, 0x00, 0x21, 0x01,               //   local1 = 100
+            0x20, 0x01, 0x6b, 0x0b,
+        // 3: a copy overwritten by the next one, which nothing read: 5
+        0x0e, 0x01, 0x01, 0x7f,
+            0x20, 0x00, 0x21, 0x01,                     //   local1 = p
+            0x41, 0x05, 0x21, 0x01,                     //   local1 = 5
+            0x20, 0x01, 0x0b,
+};
+
+static i32 Call1 (IM3Function i_function, i32 i_arg)
+{
+    i32 value = -1;
+    M3Result result = i_function->funcType->numArgs ? m3_CallV (i_function, i_arg) : m3_CallV (i_function);
+    if (result or m3_GetResultsV (i_function, & value))
+        return -1;
+    return value;
+}
+
+
+int  main  (int argc, const char  * argv [])
+{
+    IM3Environment env = m3_NewEnvironment ();
+
+    Test (fold.binary)
+    {
+        u32 numCases = sizeof (c_binaryCases) / sizeof (c_binaryCases [0]);
+        for (u32 i = 0; i < numCases; i++)
+        {
+            const BinaryCase * c = & c_binaryCases [i];
+            IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+            u8 bytes [128];
+            IM3Module module = LoadTestModule (runtime, bytes, BuildBinaryModule (bytes, c));
+            if (not module)
+                break;
+
+            u64 folded, computed;
+            M3Result foldedResult = CallBinary (& module->functions [0], c, & folded);
+            M3Result computedResult = CallBinary (& module->functions [1], c, & computed);
+
+            M3Result trap = (c->trap == c_overflow) ? m3Err_trapIntegerOverflow :
+                            (c->trap == c_divisionByZero) ? m3Err_trapDivisionByZero : m3Err_none;
+            bool ok = (foldedResult == trap and computedResult == trap);
+            if (not c->trap)
+                ok = ok and folded == c->value and computed == c->value;
+#           if d_m3EnableConstantFolding and not d_m3EnableTieredCompile     // the baseline tier doesn't fold
+            // a trapping operator is left to trap at run time
+            ok = ok and module->numFoldedOps == (c->trap ? 0 : 1);
+#           endif
+            if (not ok)
+                printf ("case %u: op 0x%02x: %s %s 0x%" PRIx64 " 0x%" PRIx64 "\n", i, c->opcode,
+                        foldedResult ? foldedResult : "-", computedResult ? computedResult : "-", folded, computed);
+                                                                        expect (ok)
+            m3_FreeRuntime (runtime);
+        }
+    }
+
+    Test (fold.branch_loop)
+    {
+        IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+        IM3Module module = LoadTestModule (runtime, c_branchLoopWasm, sizeof (c_branchLoopWasm));
+        if (module)
+        {
+                                                                        expect (Call1 (& module->functions [0], 0) == 13)
+                                                                        expect (Call1 (& module->functions [1], 0) == 11)
+                                                                        expect (Call1 (& module->functions [2], 0) == 13)
+#           if d_m3EnableConstantFolding and not d_m3EnableTieredCompile
+                                                                        expect (module->numRemovedOps == 2)
+#           endif
+        }
+        m3_FreeRuntime (runtime);
+    }
+
+    Test (fold.copies)
+    {
+        IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+        IM3Module module = LoadTestModule (runtime, c_copiesWasm, sizeof (c_copiesWasm));
+        if (module)
+        {
+            IM3Function f = module->functions;
+                                                                        expect (Call1 (& f [0], 0) == 9 and Call1 (& f [0], 1) == 7)
+                                                                        expect (Call1 (& f [1], 4) == 7)
+                                                                        expect (Call1 (& f [2], 142) == 42)
+                                                                        expect (Call1 (& f [3], 8) == 5)
+#           if d_m3EnableConstantFolding and not d_m3EnableTieredCompile
+            // only the copy in function 3
+                                                                        expect (module->numRemovedOps == 1)
+#           endif
+        }
+        m3_FreeRuntime (runtime);
+    }
+
+    m3_FreeEnvironment (env);
+    return TestResult ();
+}
@@ -0,0 +1,66 @@
+//
+//  fusion_bench.c
+//
+//  sum_loop.wasm.h timed with and without superinstructions (the runtime's
+//  disableFusion), for the numbers in docs/Performance.md. Build it without ASAN:
+//
+//    CFLAGS="-O2" ./build.sh fusion_bench 30000 2000
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "m3_host_test.h"
+#include "sum_loop.wasm.h"
+
+static double Now (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, & ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+int  main  (int argc, const char  * argv [])
+{
+    u32 n = (argc > 1) ? (u32) atoi (argv [1]) : 30000;                 // the loads stay inside the page up to 32000
+    u32 repeats = (argc > 2) ? (u32) atoi (argv [2]) : 1000;
+
+    IM3Environment env = m3_NewEnvironment ();
+
+    for (int disabled = 0; disabled < 2; disabled++)
+    {
+        IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+        runtime->disableFusion = disabled;
+
+        IM3Module module = LoadTestModule (runtime, c_sumLoopWasm, sizeof (c_sumLoopWasm));
+        if (not module)
+            return 1;
+
+        IM3Function sum = & module->functions [0];
+        u32 value = 0;
+        M3Result result = m3Err_none;
+
+        double start = Now ();
+        for (u32 i = 0; i < repeats and not result; i++)
+        {
+            result = m3_CallV (sum, n);
+            if (not result)
+                result = m3_GetResultsV (sum, & value);
+        }
+        double ns = (Now () - start) / ((double) repeats * n);
+
+        if (result or value != SumLoopExpected (n))
+        {
+            printf ("sum_loop(%u): %s\n", n, result ? result : "wrong result");
+            return 1;
+        }
+        printf ("%-8s %u fused ops: %.2f ns per iteration\n", disabled ? "unfused" : "fused", runtime->numFusedOps, ns);
+
+        m3_FreeRuntime (runtime);
+    }
+
+    m3_FreeEnvironment (env);
+    return 0;
+}
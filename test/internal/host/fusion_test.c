@@ -0,0 +1,70 @@
+//
+//  fusion_test.c
+//
+//  Superinstructions: the same module compiled with and without them (the runtime's
+//  disableFusion) gives the same results, and every fusion family in sum_loop.wasm.h
+//  is taken when they're on. fusion_bench.c times the difference.
+//
+
+#include "m3_host_test.h"
+#include "sum_loop.wasm.h"
+#include "extra/fib32.wasm.h"
+
+#if d_m3EnableSuperInstructions
+
+static i32 Call1 (IM3Function i_function, i32 i_arg)
+{
+    i32 value = -1;
+    if (m3_CallV (i_function, i_arg) or m3_GetResultsV (i_function, & value))
+        return -1;
+    return value;
+}
+
+
+int  main  (int argc, const char  * argv [])
+{
+    IM3Environment env = m3_NewEnvironment ();
+
+    Test (fusion.on_off)
+    {
+        static const u32 sizes [] = { 0, 1, 2, 3, 1000 };
+        u32 numFused [2] = { 0, 0 };
+
+        for (int disabled = 0; disabled < 2; disabled++)
+        {
+            IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+            runtime->disableFusion = disabled;
+
+            IM3Module loop = LoadTestModule (runtime, c_sumLoopWasm, sizeof (c_sumLoopWasm));
+            IM3Module fib = LoadTestModule (runtime, fib32_wasm, fib32_wasm_len);
+            if (not loop or not fib)
+                break;
+
+            for (u32 i = 0; i < sizeof (sizes) / sizeof (sizes [0]); i++)
+            {
+                                                                        expect ((u32) Call1 (& loop->functions [0], sizes [i]) == SumLoopExpected (sizes [i]))
+            }
+                                                                        expect (Call1 (& fib->functions [0], 20) == 6765)
+            numFused [disabled] = runtime->numFusedOps;
+            m3_FreeRuntime (runtime);
+        }
+                                                                        expect (numFused [1] == 0)
+#       if not d_m3EnableTieredCompile
+        // compare ; br_if, two binop ; local.set and add ; load; fib has none of them
+                                                                        expect (numFused [0] == 4)
+#       endif
+    }
+
+    m3_FreeEnvironment (env);
+    return TestResult ();
+}
+
+#else
+
+int  main  (void)
+{
+    printf ("skipped: build with -Dd_m3EnableSuperInstructions=1\n");
+    return 0;
+}
+
+#endif // d_m3EnableSuperInstructions
@@ -0,0 +1,2 @@
+#pragma once
+// Host stand-in for he_cmd.h.
@@ -0,0 +1,8 @@
+#pragma once
+// Host stand-in for he_defines.h (HelloESP shell types and helpers).
+#include <stdio.h>
+#include "esp_err.h"
+void waitForIt();
+#define vTaskDelay(x)
+#define pdMS_TO_TICKS(x) (x)
+typedef struct shell_t shell_t;
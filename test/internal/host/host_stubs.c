@@ -0,0 +1,48 @@
+//
+//  host_stubs.c
+//
+//  ESP-IDF and HelloESP symbols the runtime links against, implemented on top
+//  of libc so the segmented-memory runtime can be built and tested on a host.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <time.h>
+
+#include "esp_heap_caps.h"
+#include "esp_debug_helpers.h"
+#include "esp_err.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_memory_utils.h"
+#include "esp_task_wdt.h"
+
+void *heap_caps_malloc(size_t size, uint32_t caps)                 { return malloc(size); }
+void *heap_caps_realloc(void *ptr, size_t size, uint32_t caps)     { return realloc(ptr, size); }
+void  heap_caps_free(void *ptr)                                    { free(ptr); }
+size_t heap_caps_get_allocated_size(void *ptr)                     { return malloc_usable_size(ptr); }
+size_t heap_caps_get_free_size(uint32_t caps)                      { return 1u << 30; }
+size_t heap_caps_get_largest_free_block(uint32_t caps)             { return 1u << 30; }
+void  heap_caps_get_info(multi_heap_info_t *info, uint32_t caps)   { memset(info, 0, sizeof *info); }
+bool  heap_caps_check_integrity_addr(intptr_t addr, bool print)    { return true; }
+
+const char *esp_err_to_name(esp_err_t code)                        { return code == ESP_OK ? "ESP_OK" : "ESP_FAIL"; }
+uint32_t esp_get_free_heap_size(void)                              { return 1u << 30; }
+uint32_t esp_get_minimum_free_heap_size(void)                      { return 1u << 30; }
+bool  esp_ptr_in_dram(const void *ptr)                             { return ptr != NULL; }
+void  esp_task_wdt_reset(void)                                     { }
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void esp_backtrace_print(int depth)                                { }
+void esp_backtrace_get_start(uint32_t *pc, uint32_t *sp, uint32_t *next_pc) { *pc = *sp = *next_pc = 0; }
+bool esp_backtrace_get_next_frame(esp_backtrace_frame_t *frame)    { return false; }
+
+// HelloESP hook for on-demand segment allocation; the host always allocates eagerly.
+bool allocate_segment(void *memory, size_t index)                  { return false; }
@@ -0,0 +1,124 @@
+//
+//  iovec_test.c
+//
+//  m3_CheckIovecs/m3_FillIovecs: guest iovecs are split where a buffer crosses a
+//  segment, with every span pinned until the batch is released, and entries or
+//  buffers past memory.size are refused before any host iovec is handed out.
+//
+
+#include "m3_host_test.h"
+#include "m3_segmented_memory.h"
+
+#include <sys/uio.h>
+
+static const u8 c_memoryWasm [] =
+{
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00,
+    0x05, 0x03, 0x01, 0x00, 0x01,                       // memory: min 1 page
+};
+
+static void Poke (IM3Memory memory, mos i_offset, const void * i_bytes, size_t i_size)
+{
+    for (size_t done = 0; done < i_size; )
+    {
+        ptr host = NULL;
+        size_t span = m3_GetContiguousSpan (memory, i_offset + done, i_size - done, & host);
+        if (span == 0) { printf ("poke outside memory: %u\n", i_offset); ++g_failures; return; }
+        memcpy (host, (const u8 *) i_bytes + done, span);
+        done += span;
+    }
+}
+
+static void PokeIovec (IM3Memory memory, mos i_at, u32 i_buf, u32 i_len)
+{
+    u32 entry [2] = { i_buf, i_len };
+    Poke (memory, i_at, entry, sizeof (entry));
+}
+
+
+int  main  (int argc, const char  * argv [])
+{
+    IM3Environment env = m3_NewEnvironment ();
+    IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+    IM3Module module = ParseTestModule (runtime, c_memoryWasm, sizeof (c_memoryWasm));
+    if (not module)
+        return TestResult ();
+
+    IM3Memory memory = & runtime->memory;
+    const u32 S = memory->segment_size;
+    const u32 size = (u32) m3_LinearMemorySize (memory);
+
+    Test (iovec.split)
+    {
+        u8 pattern [25];
+        for (int i = 0; i < 25; i++) pattern [i] = (u8) (i + 1);
+
+        // the array itself straddles a segment (mid-field), the first buffer does too
+        mos iovs = 2 * S - 2;
+        PokeIovec (memory, iovs, S - 10, 20);
+        PokeIovec (memory, iovs + 8, 3 * S, 5);
+        Poke (memory, S - 10, pattern, 20);
+        Poke (memory, 3 * S, pattern + 20, 5);
+                                                                        expect (m3_CheckIovecs (memory, iovs, 2) == m3Err_none)
+        M3IovCursor cursor = { .iovs = iovs, .count = 2 };
+        struct iovec host [M3_HOST_IOV_MAX];
+        int count = 0; size_t total = 0;
+
+        M3Result result = m3_FillIovecs (memory, & cursor, host, & count, & total);
+                                                                        expect (result == m3Err_none)
+                                                                        expect (total == 25)
+        // one pin per span; the two halves of the first buffer are only merged if the host ones touch
+                                                                        expect (cursor.numPinned == 3)
+                                                                        expect (count >= 2 and count <= 3)
+        if (not m3_IsFlatMemory (memory) and count == 3)
+                                                                        expect (host [0].iov_len == 10 and host [1].iov_len == 10)
+        u8 gathered [25], * at = gathered;
+        for (int i = 0; i < count and at + host [i].iov_len <= gathered + 25; i++)
+        {
+            memcpy (at, host [i].iov_base, host [i].iov_len);
+            at += host [i].iov_len;
+        }
+                                                                        expect (at == gathered + 25 and memcmp (gathered, pattern, 25) == 0)
+        m3_ReleaseIovecs (memory, & cursor);
+                                                                        expect (cursor.numPinned == 0)
+        result = m3_FillIovecs (memory, & cursor, host, & count, & total);
+                                                                        expect (result == m3Err_none and count == 0 and total == 0)
+    }
+
+    Test (iovec.rejected)
+    {
+        mos iovs = 256;
+        // segments past memory.size, as the runtime's own allocations append them
+                                                                        expect (AddSegments (memory, memory->num_segments + 2) == m3Err_none)
+                                                                        expect (memory->total_size > size)
+        PokeIovec (memory, iovs, size - 6, 6);
+                                                                        expect (m3_CheckIovecs (memory, iovs, 1) == m3Err_none)
+        // a buffer past memory.size, though inside total_size
+        PokeIovec (memory, iovs, size - 6, 7);
+                                                                        expect (m3_CheckIovecs (memory, iovs, 1) == m3Err_trapOutOfBoundsMemoryAccess)
+        // one whose end wraps around 32 bits
+        PokeIovec (memory, iovs, 0xfffffff0, 0x20);
+                                                                        expect (m3_CheckIovecs (memory, iovs, 1) == m3Err_trapOutOfBoundsMemoryAccess)
+        // an array whose last entry runs off the end
+                                                                        expect (m3_CheckIovecs (memory, size - 8, 1) == m3Err_none)
+                                                                        expect (m3_CheckIovecs (memory, size - 4, 1) == m3Err_trapOutOfBoundsMemoryAccess)
+                                                                        expect (m3_CheckIovecs (memory, size - 8, 2) == m3Err_trapOutOfBoundsMemoryAccess)
+
+        // unchecked, the fill stops at the bad span without handing out a host iovec for it
+        PokeIovec (memory, iovs, 16, 4);
+        PokeIovec (memory, iovs + 8, size - 2, 4);
+        M3IovCursor cursor = { .iovs = iovs, .count = 2 };
+        struct iovec host [M3_HOST_IOV_MAX];
+        int count = 0; size_t total = 0;
+
+        M3Result result = m3_FillIovecs (memory, & cursor, host, & count, & total);
+                                                                        expect (result == m3Err_trapOutOfBoundsMemoryAccess)
+                                                                        expect (count == 1 and total == 4)
+        m3_ReleaseIovecs (memory, & cursor);
+                                                                        expect (cursor.numPinned == 0)
+    }
+
+    m3_FreeRuntime (runtime);
+    m3_FreeEnvironment (env);
+    return TestResult ();
+}
@@ -0,0 +1,77 @@
+//
+//  m3_host_test.h
+//
+//  Test/expect harness for the host tests in this directory, same shape as
+//  test/internal/m3_test.c; expect() also counts failures so main can return them.
+//
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wasm3.h"
+#include "m3_env.h"
+
+static int g_failures = 0;
+
+#define Test(NAME) if (RunTest (argc, argv, #NAME) != 0)
+#define DisabledTest(NAME) printf ("\ndisabled: %s\n", #NAME); if (false)
+#define expect(TEST) if (not (TEST)) { printf ("failed: (%s) on line: %d\n", #TEST, __LINE__); ++g_failures; }
+
+
+static bool RunTest (int i_argc, const char * i_argv [], cstr_t i_name)
+{
+    cstr_t option = (i_argc == 2) ? i_argv [1] : NULL;
+
+    bool runningTest = option ? strcmp (option, i_name) == 0 : true;
+
+    if (runningTest)
+        printf ("\n    test: %s\n", i_name);
+
+    return runningTest;
+}
+
+static int TestResult (void)
+{
+    printf ("\n%s: %d failure(s)\n", g_failures ? "FAILED" : "ok", g_failures);
+    return g_failures ? 1 : 0;
+}
+
+// Parses and loads a module built inline by the test; the bytes are copied since the
+// module keeps pointing into them. Names don't survive parsing on a 64-bit host (mos
+// is 32 bits), so tests pick functions by index rather than m3_FindFunction.
+static IM3Module ParseTestModule (IM3Runtime runtime, const u8 * i_bytes, u32 i_size)
+{
+    u8 * bytes = (u8 *) calloc (1, i_size + 16);    // the LEB readers fetch a word at a time
+    memcpy (bytes, i_bytes, i_size);
+
+    IM3Module module = NULL;
+    M3Result result = m3_ParseModule (runtime->environment, & module, bytes, i_size, runtime);
+    if (not result)
+        result = m3_LoadModule (runtime, module);
+
+    if (result)
+    {
+        printf ("failed to load test module: %s\n", result);
+        ++g_failures;
+        return NULL;
+    }
+    return module;
+}
+
+// ParseTestModule, then compiles every function up front
+static IM3Module LoadTestModule (IM3Runtime runtime, const u8 * i_bytes, u32 i_size)
+{
+    IM3Module module = ParseTestModule (runtime, i_bytes, i_size);
+
+    M3Result result = module ? m3_CompileModule (module) : m3Err_none;
+    if (result)
+    {
+        printf ("failed to compile test module: %s\n", result);
+        ++g_failures;
+        return NULL;
+    }
+    return module;
+}
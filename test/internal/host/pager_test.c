@@ -0,0 +1,112 @@
+//
+//  pager_test.c
+//
+//  Built-in pager under a small resident budget: host pointers held across a
+//  resolve (m3_memcpy, pinned spans) must stay valid while other segments fault in.
+//
+
+#include "m3_host_test.h"
+#include "m3_segmented_memory.h"
+#include "m3_pager.h"
+
+#define c_numSegments   40
+#define c_budget        8
+
+static IM3Runtime NewPagedRuntime (IM3Environment env)
+{
+    IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+    IM3Memory memory = & runtime->memory;
+
+    AddSegments (memory, c_numSegments);
+    for (size_t i = 1; i < c_numSegments; i++)
+        m3_memset (memory, (void *)(uintptr_t)(i * memory->segment_size), (int) i, memory->segment_size);
+
+    paging_set_resident_budget (memory->paging, c_budget);
+    return runtime;
+}
+
+
+int  main  (int argc, const char  * argv [])
+{
+    IM3Environment env = m3_NewEnvironment ();
+
+    Test (pager.memcpy)
+    {
+        IM3Runtime runtime = NewPagedRuntime (env);
+        IM3Memory memory = & runtime->memory;
+        const size_t S = memory->segment_size;
+
+        // every copy resolves src after dest; with 8 resident pages the dest page
+        // is routinely the clock's next victim
+        int bad = 0;
+        for (size_t d = 1; d < c_numSegments; d++)
+        {
+            for (size_t s = 1; s < c_numSegments; s += 3)
+            {
+                if (s == d) continue;
+                m3_memcpy (memory, (void *)(uintptr_t)(d * S + 100), (void *)(uintptr_t)(s * S + 200), 50);
+
+                u8 * p = (u8 *) m3_ResolvePointer (memory, d * S + 100);
+                for (int k = 0; k < 50; k++)
+                    if (p [k] != (u8) s) { bad++; break; }
+
+                m3_memset (memory, (void *)(uintptr_t)(d * S + 100), (int) d, 50);
+            }
+        }
+                                                                        expect (bad == 0)
+                                                                        expect (memory->paging->evictions > 0)
+                                                                        expect (memory->paging->resident <= c_budget)
+        m3_FreeRuntime (runtime);
+    }
+
+    Test (pager.pin)
+    {
+        IM3Runtime runtime = NewPagedRuntime (env);
+        IM3Memory memory = & runtime->memory;
+        const size_t S = memory->segment_size;
+
+        const mos pinned = 5 * S;
+        m3_PinSegment (memory, pinned);
+        u8 * host = (u8 *) m3_ResolvePointer (memory, pinned);
+        segment_info_t * page = memory->segments [5]->segment_page;
+
+        for (size_t i = 10; i < c_numSegments; i++)
+        {
+            u8 * p = (u8 *) m3SegmentedMemAccess (memory, (m3stack_t)(uintptr_t)(i * S), 1);
+                                                                        expect (* p == (u8) i)
+        }
+                                                                        expect (page->state == c_pagerState_Resident)
+                                                                        expect (host [0] == 5 and host [S - 1] == 5)
+                                                                        expect ((u8 *) m3_ResolvePointer (memory, pinned) == host)
+        m3_UnpinSegment (memory, pinned);
+                                                                        expect (page->pins == 0)
+                                                                        expect (memory->paging->resident <= c_budget)
+        m3_FreeRuntime (runtime);
+    }
+
+    Test (pager.churn)
+    {
+        IM3Runtime runtime = NewPagedRuntime (env);
+        IM3Memory memory = & runtime->memory;
+        const size_t S = memory->segment_size;
+
+        // one hot segment between a sweep of cold ones: whatever gets evicted,
+        // every read must come back with the segment's fill byte
+        int bad = 0;
+        for (int round = 0; round < 2000; round++)
+        {
+            u8 * h = (u8 *) m3SegmentedMemAccess (memory, (m3stack_t)(uintptr_t)(3 * S + 8), 1);
+            if (* h != 3) bad++;
+
+            size_t cold = 10 + round % 30;
+            u8 * c = (u8 *) m3SegmentedMemAccess (memory, (m3stack_t)(uintptr_t)(cold * S + 8), 1);
+            if (* c != (u8) cold) bad++;
+        }
+                                                                        expect (bad == 0)
+                                                                        expect (memory->paging->faults > 0)
+        m3_FreeRuntime (runtime);
+    }
+
+    m3_FreeEnvironment (env);
+    return TestResult ();
+}
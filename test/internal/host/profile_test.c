@@ -0,0 +1,136 @@
+//
+//  profile_test.c
+//
+//  d_m3EnableOpProfiling: every dispatch is counted against the op that runs, fused
+//  ops save the dispatches they should, and m3_WriteProfilerInfo writes the n-gram
+//  file generate_wasm_ops.py reads: sorted, well formed, with the loop's sequences in it.
+//
+
+#include "m3_host_test.h"
+#include "m3_info.h"
+#include "sum_loop.wasm.h"
+
+#if d_m3EnableOpProfiling
+
+#define c_profilePath   "build/profile_test.ngrams"
+#define c_iterations    1000
+
+static u64 RunSumLoop (IM3Environment env, bool i_disableFusion)
+{
+    IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+#   if d_m3EnableSuperInstructions
+    runtime->disableFusion = i_disableFusion;
+#   endif
+
+    u64 dispatches = 0;
+    IM3Module module = LoadTestModule (runtime, c_sumLoopWasm, sizeof (c_sumLoopWasm));
+    if (module)
+    {
+        u32 value = 0;
+        u64 before = GetProfiledDispatches ();
+        M3Result result = m3_CallV (& module->functions [0], c_iterations);
+        dispatches = GetProfiledDispatches () - before;
+
+        if (not result)
+            result = m3_GetResultsV (& module->functions [0], & value);
+                                                                        expect (result == m3Err_none and value == SumLoopExpected (c_iterations))
+    }
+
+    m3_FreeRuntime (runtime);
+    return dispatches;
+}
+
+
+static void CheckProfile (FILE * file)
+{
+    char line [512];
+    u64 dropped = ~0ull;
+    bool header = fgets (line, sizeof (line), file) and strncmp (line, "# wasm3 op n-grams:", 19) == 0;
+                                                                        expect (header)
+                                                                        expect (fgets (line, sizeof (line), file) and sscanf (line, "# dropped %" SCNu64, & dropped) == 1)
+                                                                        expect (dropped == 0)
+
+    u32 numLines = 0, malformed = 0, unsorted = 0;
+    u64 previous = ~0ull, addLoadHits = 0;
+    while (fgets (line, sizeof (line), file))
+    {
+        numLines++;
+        u64 hits; u32 length; int consumed;
+        if (sscanf (line, "%" SCNu64 " %" SCNu32 "%n", & hits, & length, & consumed) != 2 or
+            length < 2 or length > d_m3ProfilerNGramMax or not strstr (line, "  #"))
+        {
+            malformed++;
+            continue;
+        }
+        if (hits > previous) unsorted++;
+        previous = hits;
+
+        // one "<index>:<variant>" or "?" per op before the names
+        u32 numOps = 0;
+        int indexes [d_m3ProfilerNGramMax];
+        char * ops = line + consumed;
+        * strstr (ops, "  #") = 0;
+        for (char * op = strtok (ops, " "); op; op = strtok (NULL, " "))
+        {
+            int index = -1, variant, end = 0;
+            if (strcmp (op, "?") != 0 and (sscanf (op, "%d:%d%n", & index, & variant, & end) != 2 or op [end]))
+                malformed++;
+            if (numOps < d_m3ProfilerNGramMax)
+                indexes [numOps] = index;
+            numOps++;
+        }
+        if (numOps != length) malformed++;
+
+        // the unfused loop's i32.add ; i32.load
+        if (length == 2 and numOps == 2 and indexes [0] == GetOpInfo (0x6a)->idx and indexes [1] == GetOpInfo (0x28)->idx)
+            addLoadHits += hits;
+    }
+                                                                        expect (numLines > 0)
+                                                                        expect (malformed == 0)
+                                                                        expect (unsorted == 0)
+                                                                        expect (addLoadHits >= c_iterations)
+}
+
+
+int  main  (int argc, const char  * argv [])
+{
+    IM3Environment env = m3_NewEnvironment ();
+
+    Test (profile.dispatches)
+    {
+        u64 unfused = RunSumLoop (env, true);
+        u64 fused = RunSumLoop (env, false);
+        printf ("sum_loop (%d): %" PRIu64 " dispatches unfused, %" PRIu64 " fused\n", c_iterations, unfused, fused);
+                                                                        expect (unfused >= 8 * c_iterations)
+#       if d_m3EnableSuperInstructions and not d_m3EnableTieredCompile
+        // each of the four fused ops replaces at least two
+                                                                        expect (unfused - fused >= 4 * c_iterations)
+#       endif
+    }
+
+    Test (profile.ngrams)
+    {
+        RunSumLoop (env, true);
+                                                                        expect (m3_WriteProfilerInfo (c_profilePath) == m3Err_none)
+        FILE * file = fopen (c_profilePath, "r");
+                                                                        expect (file != NULL)
+        if (file)
+        {
+            CheckProfile (file);
+            fclose (file);
+        }
+    }
+
+    m3_FreeEnvironment (env);
+    return TestResult ();
+}
+
+#else
+
+int  main  (void)
+{
+    printf ("skipped: build with -Dd_m3EnableOpProfiling=1\n");
+    return 0;
+}
+
+#endif // d_m3EnableOpProfiling
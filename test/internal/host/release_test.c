@@ -0,0 +1,123 @@
+//
+//  release_test.c
+//
+//  Code page reference counting: each page counts the functions with code in it,
+//  m3_UnloadModule frees the pages only the module used, and m3_ReleaseColdCode
+//  gives a function one pass to be called again before its code goes; released
+//  code compiles again on the next call.
+//
+
+#include "m3_host_test.h"
+#include "sum_loop.wasm.h"
+#include "extra/fib32.wasm.h"
+
+#if d_m3EnableCodePageRefCounting
+
+static u32 CountPageUses (IM3Runtime i_runtime)
+{
+    u32 uses = 0;
+    IM3CodePage lists [] = { i_runtime->pagesOpen, i_runtime->pagesFull };
+
+    for (u32 i = 0; i < 2; i++)
+        for (IM3CodePage page = lists [i]; page; page = page->info.next)
+            uses += page->info.usageCount;
+
+    return uses;
+}
+
+static u32 CountFunctionRefs (IM3Runtime i_runtime)
+{
+    u32 refs = 0;
+    for (IM3Module module = i_runtime->modules; module; module = module->next)
+        for (u32 i = 0; i < module->numFunctions; i++)
+            refs += module->functions [i].numCodePageRefs;
+
+    return refs;
+}
+
+static i32 Call1 (IM3Function i_function, i32 i_arg)
+{
+    i32 value = -1;
+    if (m3_CallV (i_function, i_arg) or m3_GetResultsV (i_function, & value))
+        return -1;
+    return value;
+}
+
+
+int  main  (int argc, const char  * argv [])
+{
+    IM3Environment env = m3_NewEnvironment ();
+
+    Test (release.unload)
+    {
+        IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+        IM3Module fib = LoadTestModule (runtime, fib32_wasm, fib32_wasm_len);
+        IM3Module loop = LoadTestModule (runtime, c_sumLoopWasm, sizeof (c_sumLoopWasm));
+        if (not fib or not loop)
+            return TestResult ();
+
+        u32 pages = runtime->numCodePages;
+                                                                        expect (pages > 0)
+                                                                        expect (fib->functions [0].numCodePageRefs > 0)
+                                                                        expect (CountPageUses (runtime) == CountFunctionRefs (runtime))
+
+        // a page fib shares with the loop stays
+                                                                        expect (m3_UnloadModule (fib) == m3Err_none)
+                                                                        expect (runtime->numCodePages <= pages)
+                                                                        expect (CountPageUses (runtime) == CountFunctionRefs (runtime))
+                                                                        expect ((u32) Call1 (& loop->functions [0], 100) == SumLoopExpected (100))
+
+                                                                        expect (m3_UnloadModule (loop) == m3Err_none)
+                                                                        expect (runtime->modules == NULL)
+                                                                        expect (runtime->numCodePages == 0)
+        m3_FreeRuntime (runtime);
+    }
+
+    Test (release.cold)
+    {
+        IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+        IM3Module fib = LoadTestModule (runtime, fib32_wasm, fib32_wasm_len);
+        IM3Module loop = LoadTestModule (runtime, c_sumLoopWasm, sizeof (c_sumLoopWasm));
+        if (not fib or not loop)
+            return TestResult ();
+
+        IM3Function fibFunction = & fib->functions [0];
+        IM3Function loopFunction = & loop->functions [0];
+        u32 freed = ~0u;
+                                                                        expect ((u32) Call1 (loopFunction, 10) == SumLoopExpected (10))
+        // within the budget nothing goes, and the calls still count for the next pass
+                                                                        expect (m3_ReleaseColdCode (runtime, runtime->numCodePages, & freed) == m3Err_none)
+                                                                        expect (freed == 0 and fibFunction->compiled and loopFunction->compiled)
+
+        // fib was never called; the loop was, so it's kept this time
+                                                                        expect (m3_ReleaseColdCode (runtime, 0, & freed) == m3Err_none)
+                                                                        expect (fibFunction->compiled == NULL and fibFunction->numCodePageRefs == 0)
+                                                                        expect (loopFunction->compiled != NULL)
+                                                                        expect (CountPageUses (runtime) == CountFunctionRefs (runtime))
+
+        // and goes on the next one, with every page
+                                                                        expect (m3_ReleaseColdCode (runtime, 0, & freed) == m3Err_none)
+                                                                        expect (loopFunction->compiled == NULL)
+                                                                        expect (runtime->numCodePages == 0)
+
+        // released code compiles again when called
+                                                                        expect (Call1 (fibFunction, 20) == 6765)
+                                                                        expect ((u32) Call1 (loopFunction, 1000) == SumLoopExpected (1000))
+                                                                        expect (runtime->numCodePages > 0)
+                                                                        expect (CountPageUses (runtime) == CountFunctionRefs (runtime))
+        m3_FreeRuntime (runtime);
+    }
+
+    m3_FreeEnvironment (env);
+    return TestResult ();
+}
+
+#else
+
+int  main  (void)
+{
+    printf ("skipped: build with -Dd_m3EnableCodePageRefCounting=1\n");
+    return 0;
+}
+
+#endif // d_m3EnableCodePageRefCounting
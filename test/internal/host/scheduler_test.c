@@ -0,0 +1,211 @@
+//
+//  scheduler_test.c
+//
+//  m3_RunScheduler ordering: equal priorities take turns slice by slice, a higher
+//  priority call runs first, and a call waiting for an import doesn't hold up the
+//  others. Four runtimes run the same module; its import logs which one is running.
+//
+
+#include "m3_host_test.h"
+
+#if d_m3EnableTimeSlicing
+
+//  0  env.aread (i32) -> i32             import
+//  1  helper (x)                         aread (x) + 1
+//  2  main (n)                           sum of helper (i) for i in [0, n)
+//  with aread (x) = 2x, main (n) = n * n
+static const u8 c_asyncWasm [] =
+{
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x06, 0x01, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x02, 0x0d, 0x01, 0x03, 0x65, 0x6e, 0x76, 0x05,
+    0x61, 0x72, 0x65, 0x61, 0x64, 0x00, 0x00, 0x03, 0x03, 0x02, 0x00, 0x00,
+    0x0a, 0x32, 0x02, 0x09, 0x00, 0x20, 0x00, 0x10, 0x00, 0x41, 0x01, 0x6a,
+    0x0b, 0x26, 0x01, 0x02, 0x7f, 0x03, 0x40, 0x20, 0x01, 0x20, 0x00, 0x46,
+    0x04, 0x40, 0x20, 0x02, 0x0f, 0x0b, 0x20, 0x02, 0x20, 0x01, 0x10, 0x01,
+    0x6a, 0x21, 0x02, 0x20, 0x01, 0x41, 0x01, 0x6a, 0x21, 0x01, 0x0c, 0x00,
+    0x0b, 0x20, 0x02, 0x0b,
+};
+
+#define c_numRuntimes   4
+#define c_n             20
+
+static int          g_ids       [c_numRuntimes];
+static IM3Runtime   g_runtimes  [c_numRuntimes];
+static IM3Function  g_main      [c_numRuntimes];
+
+static int g_parking = -1;                      // runtime whose reads wait
+static i32 g_pending;
+static bool g_waiting;
+
+static char g_trace [4096];                     // runtime id, once per change of runtime
+static int g_traceLength;
+
+static int g_ended [c_numRuntimes];
+static int g_numEnded;
+static u32 g_results [c_numRuntimes];
+
+m3ApiRawFunction (aread)
+{
+    m3ApiReturnType (i32)
+    m3ApiGetArg     (i32, x)
+
+    int id = * (int *) m3_GetUserData (runtime);
+    if ((g_traceLength == 0 or g_trace [g_traceLength - 1] != '0' + id) and g_traceLength < (int) sizeof (g_trace) - 1)
+        g_trace [g_traceLength++] = '0' + id;
+
+    if (id == g_parking)
+    {
+        g_pending = x;
+        g_waiting = true;
+        m3ApiSuspend ();
+    }
+    m3ApiReturn (x * 2);
+}
+
+static void Ended (IM3Function i_function, M3Result i_result, void * i_userdata)
+{
+    int id = (int) (intptr_t) i_userdata;
+    u32 value = 0;
+    if (not i_result)
+        m3_GetResultsV (i_function, & value);
+
+    g_results [id] = value;
+    g_ended [g_numEnded++] = id;
+}
+
+static IM3Scheduler ScheduleAll (u32 i_slice, int i_urgent)
+{
+    memset (g_trace, 0, sizeof (g_trace));
+    g_traceLength = g_numEnded = 0;
+    memset (g_results, 0, sizeof (g_results));
+
+    IM3Scheduler scheduler = m3_NewScheduler ();
+    i32 n = c_n;
+    const void * args [] = { & n };
+
+    for (int i = 0; i < c_numRuntimes; ++i)
+    {
+        M3Result result = m3_ScheduleCall (scheduler, g_main [i], i == i_urgent ? 2 : 1, i_slice, 1, args, Ended, (void *) (intptr_t) i);
+        if (result)
+            printf ("m3_ScheduleCall: %s\n", result);
+    }
+    return scheduler;
+}
+
+static bool AllEnded (void)
+{
+    bool ok = g_numEnded == c_numRuntimes;
+    for (int i = 0; i < c_numRuntimes; ++i)
+        ok = ok and g_results [i] == c_n * c_n;
+    return ok;
+}
+
+
+int  main  (int argc, const char  * argv [])
+{
+    IM3Environment env = m3_NewEnvironment ();
+
+    for (int i = 0; i < c_numRuntimes; ++i)
+    {
+        g_ids [i] = i;
+        g_runtimes [i] = m3_NewRuntime (env, 64 * 1024, & g_ids [i]);
+
+        IM3Module module = ParseTestModule (g_runtimes [i], c_asyncWasm, sizeof (c_asyncWasm));
+        if (not module)
+            return TestResult ();
+
+        module->functions [0].import.moduleUtf8 = strdup ("env");      // lost in parsing on a 64-bit host
+        module->functions [0].import.fieldUtf8 = strdup ("aread");
+
+        M3Result result = m3_LinkRawFunction (module, "env", "aread", "i(i)", & aread);
+        if (not result)
+            result = m3_CompileModule (module);
+                                                                        expect (result == m3Err_none)
+        g_main [i] = & module->functions [2];
+    }
+
+    Test (scheduler.whole)
+    {
+        // no slice: each call runs to its end, in the order scheduled
+        IM3Scheduler scheduler = ScheduleAll (0, -1);
+        u32 left = m3_RunScheduler (scheduler, 0);                     expect (left == 0)
+                                                                        expect (AllEnded ())
+                                                                        expect (strcmp (g_trace, "0123") == 0)
+                                                                        expect (g_ended [0] == 0 and g_ended [3] == 3)
+        m3_FreeScheduler (scheduler);
+    }
+
+    Test (scheduler.turns)
+    {
+        IM3Scheduler scheduler = ScheduleAll (10, -1);
+        u32 left = m3_RunScheduler (scheduler, 4);                     expect (left == 4)
+                                                                        expect (strcmp (g_trace, "0123") == 0)
+        left = m3_RunScheduler (scheduler, 0);                          expect (left == 0)
+                                                                        expect (AllEnded ())
+                                                                        expect (strncmp (g_trace, "01230123", 8) == 0)
+        m3_FreeScheduler (scheduler);
+    }
+
+    Test (scheduler.priority)
+    {
+        // runtime 2 outranks the rest: it runs every slice until it's done
+        IM3Scheduler scheduler = ScheduleAll (10, 2);
+        u32 left = m3_RunScheduler (scheduler, 0);                     expect (left == 0)
+                                                                        expect (AllEnded ())
+                                                                        expect (g_ended [0] == 2)
+                                                                        expect (strncmp (g_trace, "2013013", 7) == 0)
+        m3_FreeScheduler (scheduler);
+    }
+
+    Test (scheduler.waiting)
+    {
+        // runtime 1 waits on its first read; the others finish meanwhile
+        g_parking = 1;
+        g_waiting = false;
+        IM3Scheduler scheduler = ScheduleAll (10, -1);
+        u32 left = m3_RunScheduler (scheduler, 0);                     expect (left == 1)
+                                                                        expect (g_numEnded == 3 and g_waiting)
+                                                                        expect (strchr (g_trace, '1') == strrchr (g_trace, '1'))
+        g_parking = -1;
+        i32 value = g_pending * 2;
+        const void * results [] = { & value };
+        M3Result result = m3_WakeScheduledCall (scheduler, g_runtimes [1], 1, results);
+                                                                        expect (result == m3Err_none)
+        left = m3_RunScheduler (scheduler, 0);                          expect (left == 0)
+                                                                        expect (AllEnded ())
+                                                                        expect (g_ended [3] == 1)
+        m3_FreeScheduler (scheduler);
+    }
+
+    Test (scheduler.one_call_per_runtime)
+    {
+        IM3Scheduler scheduler = ScheduleAll (10, -1);
+        i32 n = 1;
+        const void * args [] = { & n };
+        M3Result result = m3_ScheduleCall (scheduler, g_main [0], 1, 10, 1, args, NULL, NULL);
+                                                                        expect (result == m3Err_runtimeScheduled)
+        // freed with the calls in flight: they are cancelled and the runtimes usable again
+        m3_RunScheduler (scheduler, 3);
+        m3_FreeScheduler (scheduler);                                   expect (g_numEnded == 0)
+
+        m3_SetTimeSlice (g_runtimes [0], 0);
+        result = m3_CallV (g_main [0], 5);                              expect (result == m3Err_none)
+        u32 value = 0;
+        m3_GetResultsV (g_main [0], & value);                           expect (value == 25)
+    }
+
+    for (int i = 0; i < c_numRuntimes; ++i)
+        m3_FreeRuntime (g_runtimes [i]);
+    m3_FreeEnvironment (env);
+    return TestResult ();
+}
+
+#else
+
+int  main  (int argc, const char  * argv [])
+{
+    printf ("skipped: build with -Dd_m3EnableTimeSlicing=1\n");
+    return 0;
+}
+
+#endif // d_m3EnableTimeSlicing
@@ -0,0 +1,106 @@
+//
+//  segment_bench.c
+//
+//  Cost of resolving a guest offset as the number of live multi-segment chunks grows.
+//  get_segment_pointer is the uncached path (the per-segment redirect, no TLB);
+//  m3SegmentedMemAccess goes through the TLB first, as the interpreter does. Both
+//  should stay flat. Build it without ASAN:
+//
+//    CFLAGS="-O2" ./build.sh segment_bench 1000000
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "m3_host_test.h"
+#include "m3_segmented_memory.h"
+
+#define c_maxChunks     256
+
+typedef struct Chunk
+{
+    mos     offset;
+    u32     size;
+}
+Chunk;
+
+static u32 s_random = 2463534242u;
+
+static u32 Random (void)
+{
+    s_random ^= s_random << 13;                                         // xorshift32
+    s_random ^= s_random >> 17;
+    s_random ^= s_random << 5;
+    return s_random;
+}
+
+static double Now (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, & ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+int  main  (int argc, const char  * argv [])
+{
+    u32 iterations = (argc > 1) ? (u32) atoi (argv [1]) : 1000000;
+    static const u32 chunkCounts [] = { 1, 4, 16, 64, 128, c_maxChunks };
+    static Chunk chunks [c_maxChunks];
+
+    printf ("%8s %10s %16s %16s\n", "chunks", "segments", "uncached ns", "tlb ns");
+
+    for (u32 c = 0; c < sizeof (chunkCounts) / sizeof (chunkCounts [0]); c++)
+    {
+        IM3Memory memory = m3_NewMemory ();
+        if (not memory)
+            return 1;
+
+#   if WASM_SEGMENTED_MEM_ENABLE_HE_PAGES && WASM_SEGMENTED_MEM_BUILTIN_PAGER
+        // every segment stays resident: this times the translation, not the pager's faults
+        paging_set_resident_budget (memory->paging, WASM_MAX_SEGMENTS);
+#   endif
+
+        // 2 to 4 segments each, not a multiple of the segment size
+        u32 numChunks = 0;
+        for (u32 i = 0; i < chunkCounts [c]; i++)
+        {
+            u32 size = (2 + i % 3) * memory->segment_size - 100;
+            ptr chunk = m3_malloc (memory, size);
+            if (not chunk)
+                break;
+            chunks [numChunks++] = (Chunk) { (mos) (uintptr_t) chunk, size };
+        }
+
+        // the same offsets for both paths: each in a random chunk, at a random place in it
+        mos * offsets = (mos *) malloc (iterations * sizeof (mos));
+        for (u32 i = 0; i < iterations; i++)
+        {
+            Chunk * chunk = & chunks [Random () % numChunks];
+            offsets [i] = chunk->offset + Random () % chunk->size;
+        }
+
+        volatile uintptr_t sink = 0;
+
+        double start = Now ();
+        for (u32 i = 0; i < iterations; i++)
+            sink += (uintptr_t) get_segment_pointer (memory, offsets [i]);
+        double uncached = (Now () - start) / iterations;
+
+        start = Now ();
+        for (u32 i = 0; i < iterations; i++)
+            sink += (uintptr_t) m3SegmentedMemAccess (memory, (m3stack_t) (uintptr_t) offsets [i], 1);
+        double cached = (Now () - start) / iterations;
+
+        printf ("%8u %10zu %16.1f %16.1f\n", numChunks, memory->num_segments, uncached, cached);
+
+        free (offsets);
+        for (u32 i = 0; i < numChunks; i++)
+            m3_free (memory, (ptr) (uintptr_t) chunks [i].offset);
+        FreeMemory (memory);
+        m3_Def_Free (memory);
+    }
+
+    return 0;
+}
@@ -0,0 +1,167 @@
+//
+//  slot_test.c
+//
+//  Stack slots and code-page immediates are plain native loads: op_Entry checks a
+//  function's whole frame against M3Memory.maxStack once, traps when it doesn't
+//  fit, and otherwise clears the locals and copies the constant table in place.
+//  Constants past the table are Const64 immediates read straight from the code page.
+//
+
+#include "m3_host_test.h"
+
+#define c_numConstants  150             // past d_m3MaxConstantTableSize: the rest are immediates
+#define c_numBigLocals  1500
+
+static u8 * EmitULEB (u8 * o_bytes, u32 i_value)
+{
+    do
+    {
+        u8 byte = i_value & 0x7f;
+        i_value >>= 7;
+        * o_bytes++ = byte | (i_value ? 0x80 : 0);
+    }
+    while (i_value);
+
+    return o_bytes;
+}
+
+static u8 * EmitSLEB (u8 * o_bytes, i64 i_value)
+{
+    bool more = true;
+    while (more)
+    {
+        u8 byte = i_value & 0x7f;
+        i_value >>= 7;
+        more = not ((i_value == 0 and not (byte & 0x40)) or (i_value == -1 and (byte & 0x40)));
+        * o_bytes++ = byte | (more ? 0x80 : 0);
+    }
+
+    return o_bytes;
+}
+
+static u8 * EmitSection (u8 * o_bytes, u8 i_id, const u8 * i_content, u32 i_size)
+{
+    * o_bytes++ = i_id;
+    o_bytes = EmitULEB (o_bytes, i_size);
+    memcpy (o_bytes, i_content, i_size);
+    return o_bytes + i_size;
+}
+
+static i64 Constant (u32 i_index)
+{
+    return (i64) (((u64) (i_index + 1) << 33) | ((i_index + 1) * 0x9e37u));
+}
+
+// both (i32) -> i64. 0: its i64, i32 and f64 locals plus the param plus every Constant (),
+// then it dirties the locals before returning. 1: returns the last of c_numBigLocals i64 locals
+static u32 BuildSlotModule (u8 * o_bytes)
+{
+    static u8 content [4096];
+    u8 * bytes = o_bytes, * at, * b;
+
+    static const u8 header [] = { 0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00 };
+    memcpy (bytes, header, sizeof (header));
+    bytes += sizeof (header);
+
+    static const u8 types [] = { 0x01, 0x60, 0x01, 0x7f, 0x01, 0x7e };
+    bytes = EmitSection (bytes, 1, types, sizeof (types));
+
+    static const u8 functions [] = { 0x02, 0x00, 0x00 };
+    bytes = EmitSection (bytes, 3, functions, sizeof (functions));
+
+    static u8 body [4096];
+    at = EmitULEB (content, 2);
+
+    b = body;
+    * b++ = 0x03; * b++ = 0x01; * b++ = 0x7e; * b++ = 0x01; * b++ = 0x7f; * b++ = 0x01; * b++ = 0x7c;
+    * b++ = 0x20; * b++ = 0x01;                                         // local 1
+    * b++ = 0x20; * b++ = 0x02; * b++ = 0xad; * b++ = 0x7c;             // + local 2, extended
+    * b++ = 0x20; * b++ = 0x03; * b++ = 0xb0; * b++ = 0x7c;             // + local 3, truncated
+    * b++ = 0x20; * b++ = 0x00; * b++ = 0xad; * b++ = 0x7c;             // + the param, extended
+    for (u32 i = 0; i < c_numConstants; i++)
+    {
+        * b++ = 0x42; b = EmitSLEB (b, Constant (i)); * b++ = 0x7c;
+    }
+    * b++ = 0x42; * b++ = 0x7f; * b++ = 0x21; * b++ = 0x01;             // local 1 = -1
+    * b++ = 0x41; * b++ = 0x7f; * b++ = 0x21; * b++ = 0x02;             // local 2 = -1
+    static const u8 dirtyF64 [] = { 0x44, 0, 0, 0, 0, 0x65, 0xcd, 0xcd, 0x41, 0x21, 0x03 };   // local 3 = 1e9
+    memcpy (b, dirtyF64, sizeof (dirtyF64)); b += sizeof (dirtyF64);
+    * b++ = 0x0b;
+    at = EmitULEB (at, (u32) (b - body));
+    memcpy (at, body, b - body); at += b - body;
+
+    b = body;
+    * b++ = 0x01; b = EmitULEB (b, c_numBigLocals); * b++ = 0x7e;
+    * b++ = 0x20; b = EmitULEB (b, c_numBigLocals);
+    * b++ = 0x0b;
+    at = EmitULEB (at, (u32) (b - body));
+    memcpy (at, body, b - body); at += b - body;
+
+    bytes = EmitSection (bytes, 10, content, (u32) (at - content));
+    return (u32) (bytes - o_bytes);
+}
+
+static i64 Expected (u32 i_param)
+{
+    u64 sum = i_param;
+    for (u32 i = 0; i < c_numConstants; i++)
+        sum += (u64) Constant (i);
+    return (i64) sum;
+}
+
+static M3Result Call1 (IM3Function i_function, i32 i_arg, i64 * o_value)
+{
+    M3Result result = m3_CallV (i_function, i_arg);
+    return result ? result : m3_GetResultsV (i_function, o_value);
+}
+
+
+int  main  (int argc, const char  * argv [])
+{
+    static u8 wasm [8192];
+    u32 size = BuildSlotModule (wasm);
+    IM3Environment env = m3_NewEnvironment ();
+
+    Test (slot.frame)
+    {
+        IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+        IM3Module module = LoadTestModule (runtime, wasm, size);
+        if (not module)
+            return TestResult ();
+
+        IM3Function sum = & module->functions [0];
+        static const u32 params [] = { 0, 5, 5, 0xffffffff };
+        int wrong = 0;
+
+        // each call starts from the locals the previous one dirtied
+        for (u32 i = 0; i < sizeof (params) / sizeof (params [0]); i++)
+        {
+            i64 value = 0;
+            if (Call1 (sum, params [i], & value) or value != Expected (params [i])) wrong++;
+        }
+                                                                        expect (wrong == 0)
+        i64 value = -1;
+                                                                        expect (Call1 (& module->functions [1], 3, & value) == m3Err_none and value == 0)
+        m3_FreeRuntime (runtime);
+    }
+
+    Test (slot.overflow)
+    {
+        // room for the constants' frame, not for c_numBigLocals locals
+        IM3Runtime runtime = m3_NewRuntime (env, 8 * 1024, NULL);
+        IM3Module module = LoadTestModule (runtime, wasm, size);
+        if (not module)
+            return TestResult ();
+
+        IM3Function sum = & module->functions [0], big = & module->functions [1];
+                                                                        expect (sum->maxStackSlots < runtime->numStackSlots)
+                                                                        expect (big->maxStackSlots > runtime->numStackSlots)
+        i64 value = -1;
+                                                                        expect (Call1 (big, 3, & value) == m3Err_trapStackOverflow)
+                                                                        expect (Call1 (sum, 7, & value) == m3Err_none and value == Expected (7))
+        m3_FreeRuntime (runtime);
+    }
+
+    m3_FreeEnvironment (env);
+    return TestResult ();
+}
@@ -0,0 +1,116 @@
+//
+//  stackless_test.c
+//
+//  d_m3EnableStacklessCalls: wasm recursion keeps its return frames in the runtime,
+//  not on the C stack, so a call d_m3MaxCallDepth deep runs on a thread with a small
+//  native stack; one deeper traps with a stack overflow, and the runtime is usable after.
+//
+
+#include <pthread.h>
+
+#include "m3_host_test.h"
+
+#if d_m3EnableStacklessCalls
+
+#define c_nativeStackSize   (256 * 1024)
+
+//  0  down (n)     n == 0 ? 0 : down (n - 1) + 1, not a tail call
+static const u8 c_downWasm [] =
+{
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00,
+    0x01, 0x06, 0x01, 0x60, 0x01, 0x7f, 0x01, 0x7f,     // types: (i32) -> i32
+    0x03, 0x02, 0x01, 0x00,                             // functions
+    0x0a, 0x17, 0x01,                                   // code
+        0x15, 0x00,
+            0x20, 0x00, 0x45, 0x04, 0x40,               //   if (n == 0)
+            0x41, 0x00, 0x0f, 0x0b,                     //     return 0
+            0x20, 0x00, 0x41, 0x01, 0x6b, 0x10, 0x00,   //   down (n - 1)
+            0x41, 0x01, 0x6a, 0x0b,                     //   + 1
+};
+
+typedef struct DownCall
+{
+    IM3Function     function;
+    u32             depth;
+    u32             value;
+    M3Result        result;
+}
+DownCall;
+
+static void * CallDown (void * io_call)
+{
+    DownCall * call = (DownCall *) io_call;
+
+    call->value = 0;
+    call->result = m3_CallV (call->function, call->depth);
+    if (not call->result)
+        call->result = m3_GetResultsV (call->function, & call->value);
+
+    return NULL;
+}
+
+// on a thread whose native stack a few thousand nested interpreter calls would overflow
+static void RunOnSmallStack (DownCall * io_call)
+{
+    pthread_attr_t attributes;
+    pthread_attr_init (& attributes);
+    pthread_attr_setstacksize (& attributes, c_nativeStackSize);
+
+    pthread_t thread;
+    if (pthread_create (& thread, & attributes, CallDown, io_call) == 0)
+        pthread_join (thread, NULL);
+    else
+        io_call->result = "pthread_create failed";
+
+    pthread_attr_destroy (& attributes);
+}
+
+
+int  main  (int argc, const char  * argv [])
+{
+    IM3Environment env = m3_NewEnvironment ();
+    // wasm stack for every frame down to the limit, so the return frames are what runs out
+    IM3Runtime runtime = m3_NewRuntime (env, 128 * d_m3MaxCallDepth, NULL);
+    IM3Module module = LoadTestModule (runtime, c_downWasm, sizeof (c_downWasm));
+    if (not module)
+        return TestResult ();
+
+    DownCall call = { & module->functions [0] };
+
+    Test (stackless.deep)
+    {
+        call.depth = d_m3MaxCallDepth - 2;
+        RunOnSmallStack (& call);
+                                                                        expect (call.result == m3Err_none and call.value == call.depth)
+                                                                        expect (runtime->numCallFrames == 0)
+                                                                        expect (runtime->maxCallFrames <= d_m3MaxCallDepth)
+    }
+
+    Test (stackless.overflow)
+    {
+        call.depth = d_m3MaxCallDepth + 2;
+        RunOnSmallStack (& call);
+                                                                        expect (call.result == m3Err_trapStackOverflow)
+                                                                        expect (runtime->maxCallFrames == d_m3MaxCallDepth)
+                                                                        expect (runtime->numCallFrames == 0)
+
+        // the trap leaves nothing behind
+        call.depth = 1000;
+        RunOnSmallStack (& call);
+                                                                        expect (call.result == m3Err_none and call.value == 1000)
+    }
+
+    m3_FreeRuntime (runtime);
+    m3_FreeEnvironment (env);
+    return TestResult ();
+}
+
+#else
+
+int  main  (void)
+{
+    printf ("skipped: build with -Dd_m3EnableStacklessCalls=1\n");
+    return 0;
+}
+
+#endif // d_m3EnableStacklessCalls
@@ -0,0 +1,176 @@
+//
+//  stream_test.c
+//
+//  m3_ParseModuleBegin/Feed/Finish: the same module whatever the chunking, the
+//  same verdict as m3_ParseModule on every truncation, sizes from the module
+//  refused before they are allocated, and bodies compiled as they arrive.
+//
+
+#include "m3_host_test.h"
+#include "extra/fib32.wasm.h"
+
+#if d_m3EnableStreamingParse
+
+static M3Result Stream (IM3Runtime runtime, const u8 * i_bytes, u32 i_size, u32 i_chunk, M3LinkImports i_link,
+                        IM3Module * o_module, M3ParseStats * o_stats)
+{
+    IM3ParseStream stream;
+    M3Result result = m3_ParseModuleBegin (runtime->environment, runtime, i_link, NULL, & stream);
+    if (result)
+        return result;
+
+    // each chunk is a copy that's gone once Feed returns, as a network buffer would be
+    for (u32 at = 0; at < i_size and not result; at += i_chunk)
+    {
+        u32 size = M3_MIN (i_chunk, i_size - at);
+        u8 * chunk = (u8 *) malloc (size);
+        memcpy (chunk, i_bytes + at, size);
+        result = m3_ParseModuleFeed (stream, chunk, size);
+        free (chunk);
+    }
+
+    M3Result finished = m3_ParseModuleFinish (stream, o_module, o_stats);
+    return result ? result : finished;
+}
+
+static i32 CallFib (IM3Runtime runtime, IM3Module module, i32 n)
+{
+    i32 value = -1;
+    if (m3_LoadModule (runtime, module))
+        return -1;
+
+    IM3Function fib = & module->functions [0];     // by index: names don't survive parsing on a 64-bit host
+    if (m3_CompileModule (module) or m3_CallV (fib, n) or m3_GetResultsV (fib, & value))
+        return -1;
+    return value;
+}
+
+static M3Result LinkNothing (IM3Module io_module, void * i_userdata)
+{
+    return m3Err_none;
+}
+
+// header, the fib32 type, function and export sections, then a code section announcing huge sizes
+static const u8 c_hugeBody [] =
+{
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00,
+    0x01, 0x06, 0x01, 0x60, 0x01, 0x7f, 0x01, 0x7f,
+    0x03, 0x02, 0x01, 0x00,
+    0x0a, 0xf0, 0xff, 0xff, 0xff, 0x07,                 // code: 0x7ffffff0 bytes
+        0x01,                                           //   one body
+        0x80, 0xff, 0xff, 0xff, 0x07,                   //   of 0x7fffff80 bytes
+};
+
+static const u8 c_hugeData [] =
+{
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00,
+    0x0b, 0xf0, 0xff, 0xff, 0xff, 0x0f,                 // data: 0xfffffff0 bytes
+};
+
+static const u8 c_hugeTypes [] =
+{
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00,
+    0x01, 0x80, 0x80, 0x80, 0x40,                       // types: 128 MB, into the transient buffer
+};
+
+
+int  main  (int argc, const char  * argv [])
+{
+    IM3Environment env = m3_NewEnvironment ();
+
+    Test (stream.chunks)
+    {
+        u32 chunks [] = { 1, 7, fib32_wasm_len };
+        for (int i = 0; i < 3; i++)
+        {
+            IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+            IM3Module module = NULL;
+            M3ParseStats stats;
+
+            M3Result result = Stream (runtime, fib32_wasm, fib32_wasm_len, chunks [i], NULL, & module, & stats);
+                                                                        expect (result == m3Err_none and module)
+                                                                        expect (stats.keptBytes == 30)   // the body and its size
+                                                                        expect (stats.numCompiled == 0)
+                                                                        expect (module and CallFib (runtime, module, 20) == 6765)
+            m3_FreeRuntime (runtime);
+        }
+    }
+
+    Test (stream.truncated)
+    {
+        IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+        int disagree = 0, accepted = 0;
+
+        for (u32 size = 0; size < fib32_wasm_len; size++)
+        {
+            IM3Module streamed = NULL, parsed = NULL;
+            M3Result streamResult = Stream (runtime, fib32_wasm, size, 3, NULL, & streamed, NULL);
+
+            u8 * bytes = (u8 *) calloc (1, size + 16);
+            memcpy (bytes, fib32_wasm, size);
+            M3Result parseResult = m3_ParseModule (env, & parsed, bytes, size, runtime);
+
+            if ((streamResult == m3Err_none) != (parseResult == m3Err_none)) disagree++;
+            if (streamResult == m3Err_none) accepted++;
+            if (streamResult) expect (streamed == NULL)
+
+            m3_FreeModule (streamed);
+            m3_FreeModule (parsed);
+            free (bytes);
+        }
+                                                                        expect (disagree == 0)
+        // only the cuts between sections can be complete modules
+                                                                        expect (accepted <= 4)
+        m3_FreeRuntime (runtime);
+    }
+
+    Test (stream.oversized)
+    {
+        IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+        struct { const u8 * bytes; u32 size; } cases [] =
+        {
+            { c_hugeBody,  sizeof (c_hugeBody) },
+            { c_hugeData,  sizeof (c_hugeData) },
+            { c_hugeTypes, sizeof (c_hugeTypes) },
+        };
+
+        for (int i = 0; i < 3; i++)
+        {
+            IM3Module module = NULL;
+            M3ParseStats stats;
+
+            M3Result result = Stream (runtime, cases [i].bytes, cases [i].size, 1, NULL, & module, & stats);
+                                                                        expect (result != m3Err_none and module == NULL)
+                                                                        expect (stats.peakBytes < 4096)
+        }
+        m3_FreeRuntime (runtime);
+    }
+
+    Test (stream.compile)
+    {
+        IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+        IM3Module module = NULL;
+        M3ParseStats stats;
+
+        // with the imports linked (fib has none), the body is compiled before Finish
+        M3Result result = Stream (runtime, fib32_wasm, fib32_wasm_len, 5, LinkNothing, & module, & stats);
+                                                                        expect (result == m3Err_none and module)
+                                                                        expect (stats.numCompiled == 1)
+                                                                        expect (module and module->functions [0].compiled != NULL)
+                                                                        expect (module and CallFib (runtime, module, 10) == 55)
+        m3_FreeRuntime (runtime);
+    }
+
+    m3_FreeEnvironment (env);
+    return TestResult ();
+}
+
+#else
+
+int  main  (void)
+{
+    printf ("skipped: build with -Dd_m3EnableStreamingParse=1\n");
+    return 0;
+}
+
+#endif
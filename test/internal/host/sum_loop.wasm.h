@@ -0,0 +1,40 @@
+//
+//  sum_loop.wasm.h
+//
+//  (func (param $n i32) (result i32)): the sum of i and of the word at 2 * i, for i below $n.
+//  Written so that each fusion family has a site in the loop: i >= n ; br_if, sum + i ; local.set,
+//  i + i ; i32.load and i + 1 ; local.set. Memory starts 01 00 00 00 02 00 00 00, so the loads
+//  add 1 + 0x20000 + 2 once $n is past 2.
+//
+
+#pragma once
+
+static const u8 c_sumLoopWasm [] =
+{
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00,
+    0x01, 0x06, 0x01, 0x60, 0x01, 0x7f, 0x01, 0x7f,     // types: (i32) -> i32
+    0x03, 0x02, 0x01, 0x00,                             // functions
+    0x05, 0x03, 0x01, 0x00, 0x01,                       // memory: min 1 page
+    0x0a, 0x32, 0x01,                                   // code
+        0x30, 0x01, 0x02, 0x7f,                         //   locals i, sum
+            0x02, 0x40, 0x03, 0x40,                     //   block loop
+            0x20, 0x01, 0x20, 0x00, 0x4f, 0x0d, 0x01,   //     br_if 1 (i >= n)
+            0x20, 0x02, 0x20, 0x01, 0x6a, 0x21, 0x02,   //     sum = sum + i
+            0x20, 0x01, 0x20, 0x01, 0x6a,               //     i + i
+            0x28, 0x02, 0x08,                           //     i32.load offset=8
+            0x20, 0x02, 0x6a, 0x21, 0x02,               //     sum = that + sum
+            0x20, 0x01, 0x41, 0x01, 0x6a, 0x21, 0x01,   //     i = i + 1
+            0x0c, 0x00, 0x0b, 0x0b,                     //   br 0
+            0x20, 0x02, 0x0b,
+    0x0b, 0x0e, 0x01, 0x00, 0x41, 0x08, 0x0b, 0x08,     // data at 8
+        0x01, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00,
+};
+
+static u32 SumLoopExpected (u32 i_n)
+{
+    u32 sum = i_n * (i_n - 1) / 2;
+    if (i_n > 0) sum += 1;
+    if (i_n > 1) sum += 0x20000;
+    if (i_n > 2) sum += 2;
+    return sum;
+}
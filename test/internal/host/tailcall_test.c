@@ -0,0 +1,81 @@
+//
+//  tailcall_test.c
+//
+//  return_call / return_call_indirect reuse the caller's frame: a million deep
+//  tail recursion runs in the stack a single call needs.
+//
+
+#include "m3_host_test.h"
+
+//  0  even (n)           n == 0 ? 1 : return_call even→odd (n - 1)
+//  1  odd (n)            n == 0 ? 0 : return_call_indirect table[0] = even (n - 1)
+//  2  acc (n, a:i64, c)  n == 0 ? wrap(a) + c : return_call acc (n - 1, a + n, c)
+//  3  sum (n)            return_call acc (n, 0, 7)
+//  4  main (n)           even (n) + sum (n)
+static const u8 c_tailWasm [] =
+{
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x0d, 0x02, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x60, 0x03, 0x7f, 0x7e, 0x7f, 0x01, 0x7f, 0x03,
+    0x06, 0x05, 0x00, 0x00, 0x01, 0x00, 0x00, 0x04, 0x04, 0x01, 0x70, 0x00,
+    0x01, 0x07, 0x08, 0x01, 0x04, 0x6d, 0x61, 0x69, 0x6e, 0x00, 0x04, 0x09,
+    0x07, 0x01, 0x00, 0x41, 0x00, 0x0b, 0x01, 0x00, 0x0a, 0x60, 0x05, 0x12,
+    0x00, 0x20, 0x00, 0x45, 0x04, 0x7f, 0x41, 0x01, 0x05, 0x20, 0x00, 0x41,
+    0x01, 0x6b, 0x12, 0x01, 0x0b, 0x0b, 0x15, 0x00, 0x20, 0x00, 0x45, 0x04,
+    0x7f, 0x41, 0x00, 0x05, 0x20, 0x00, 0x41, 0x01, 0x6b, 0x41, 0x00, 0x13,
+    0x00, 0x00, 0x0b, 0x0b, 0x1e, 0x00, 0x20, 0x00, 0x45, 0x04, 0x7f, 0x20,
+    0x01, 0xa7, 0x20, 0x02, 0x6a, 0x05, 0x20, 0x00, 0x41, 0x01, 0x6b, 0x20,
+    0x01, 0x20, 0x00, 0xad, 0x7c, 0x20, 0x02, 0x12, 0x02, 0x0b, 0x0b, 0x0a,
+    0x00, 0x20, 0x00, 0x42, 0x00, 0x41, 0x07, 0x12, 0x02, 0x0b, 0x0b, 0x00,
+    0x20, 0x00, 0x10, 0x00, 0x20, 0x00, 0x10, 0x03, 0x6a, 0x0b,
+};
+
+static M3Result Call (IM3Function i_function, u32 i_arg, u32 * o_result)
+{
+    * o_result = 0;
+    M3Result result = m3_CallV (i_function, i_arg);
+    if (not result)
+        result = m3_GetResultsV (i_function, o_result);
+    return result;
+}
+
+
+int  main  (int argc, const char  * argv [])
+{
+    IM3Environment env = m3_NewEnvironment ();
+    IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+    IM3Module module = LoadTestModule (runtime, c_tailWasm, sizeof (c_tailWasm));
+    if (not module)
+        return TestResult ();
+
+    IM3Function even = & module->functions [0];
+    IM3Function odd  = & module->functions [1];
+    IM3Function sum  = & module->functions [3];
+    IM3Function run  = & module->functions [4];
+    u32 value;
+
+    Test (tailcall.small)
+    {
+        M3Result result;
+        result = Call (run, 3, & value);                                expect (result == m3Err_none and value == 13)
+        result = Call (even, 10, & value);                              expect (result == m3Err_none and value == 1)
+        result = Call (odd, 7, & value);                                expect (result == m3Err_none and value == 1)
+        result = Call (sum, 0, & value);                                expect (result == m3Err_none and value == 7)
+    }
+
+    Test (tailcall.deep)
+    {
+        // 64 KiB of wasm stack holds a few thousand frames, not a million
+        const u32 n = 1000000;
+        const u32 expected = (u32) ((u64) n * (n + 1) / 2 + 7);
+
+        M3Result result;
+        result = Call (even, n, & value);                               expect (result == m3Err_none and value == 1)
+        result = Call (odd, n + 1, & value);                            expect (result == m3Err_none and value == 1)
+        result = Call (sum, n, & value);                                expect (result == m3Err_none and value == expected)
+        result = Call (run, n, & value);                                expect (result == m3Err_none and value == expected + 1)
+    }
+
+    m3_FreeRuntime (runtime);
+    m3_FreeEnvironment (env);
+    return TestResult ();
+}
@@ -0,0 +1,98 @@
+//
+//  tier_test.c
+//
+//  d_m3EnableTieredCompile: a function is recompiled when its calls or loop iterations
+//  reach the thresholds, in the middle of the run that got it there. The frames running
+//  the baseline code finish in it, callers still holding its entry are sent on to the
+//  new code, and the results don't change.
+//
+
+#include "m3_host_test.h"
+#include "sum_loop.wasm.h"
+#include "extra/fib32.wasm.h"
+
+#if d_m3EnableTieredCompile
+
+static u32 Fib (u32 n)
+{
+    return n < 2 ? n : Fib (n - 1) + Fib (n - 2);
+}
+
+static i32 Call1 (IM3Function i_function, i32 i_arg)
+{
+    i32 value = -1;
+    if (m3_CallV (i_function, i_arg) or m3_GetResultsV (i_function, & value))
+        return -1;
+    return value;
+}
+
+
+int  main  (int argc, const char  * argv [])
+{
+    IM3Environment env = m3_NewEnvironment ();
+
+    Test (tier.calls)
+    {
+        IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+        IM3Module module = LoadTestModule (runtime, fib32_wasm, fib32_wasm_len);
+        if (not module)
+            return TestResult ();
+
+        IM3Function fib = & module->functions [0];
+        pc_t baseline = fib->compiled;
+
+        // fib (10) is 177 calls: it stays
+                                                                        expect (Call1 (fib, 10) == 55)
+                                                                        expect (fib->tier == c_m3TierBaseline and fib->compiled == baseline)
+
+        // fib (20) passes d_m3TierUpCalls deep in its recursion: the frames above go on in the baseline
+        // code, and its op_Calls, which still hold the baseline entry, are sent on to the new code
+                                                                        expect (Call1 (fib, 20) == 6765)
+                                                                        expect (fib->tier == c_m3TierOptimized)
+                                                                        expect (fib->compiled != baseline and fib->baselineCompiled == baseline)
+                                                                        expect (runtime->numTierUps == 1)
+
+        for (u32 n = 0; n < 24; n++)
+            if (Call1 (fib, n) != (i32) Fib (n)) { printf ("fib (%u) after tier-up\n", n); ++g_failures; }
+                                                                        expect (runtime->numTierUps == 1)
+        m3_FreeRuntime (runtime);
+    }
+
+    Test (tier.back_edges)
+    {
+        IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+        IM3Module module = LoadTestModule (runtime, c_sumLoopWasm, sizeof (c_sumLoopWasm));
+        if (not module)
+            return TestResult ();
+
+        IM3Function loop = & module->functions [0];
+        pc_t baseline = loop->compiled;
+        const u32 n = d_m3TierUpBackEdges + d_m3TierUpBackEdges / 2;
+
+        // one call, recompiled halfway through its loop; no on-stack replacement, it ends in the baseline code
+                                                                        expect ((u32) Call1 (loop, n) == SumLoopExpected (n))
+                                                                        expect (loop->tier == c_m3TierOptimized and loop->compiled != baseline)
+                                                                        expect (loop->baselineCompiled == baseline)
+#       if d_m3EnableSuperInstructions
+        // the baseline tier doesn't fuse, the optimised one does
+                                                                        expect (runtime->numFusedOps == 4)
+#       endif
+                                                                        expect ((u32) Call1 (loop, n) == SumLoopExpected (n))
+                                                                        expect ((u32) Call1 (loop, 3) == SumLoopExpected (3))
+                                                                        expect (runtime->numTierUps == 1)
+        m3_FreeRuntime (runtime);
+    }
+
+    m3_FreeEnvironment (env);
+    return TestResult ();
+}
+
+#else
+
+int  main  (void)
+{
+    printf ("skipped: build with -Dd_m3EnableTieredCompile=1\n");
+    return 0;
+}
+
+#endif // d_m3EnableTieredCompile